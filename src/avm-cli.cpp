@@ -4,11 +4,104 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <tinyformat.h>
+#include <util/system.h>
+
+#ifndef WIN32
+#include <executionserver.h>
+
+#include <csignal>
+#endif
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+
+const std::function<std::string(const char *)> G_TRANSLATION_FUN = nullptr;
+
+#ifndef WIN32
+static ExecutionServer *g_execution_server = nullptr;
+
+static void HandleSIGTERM(int) {
+    if (g_execution_server) {
+        g_execution_server->Interrupt();
+    }
+}
+
+static int Serve(const ArgsManager &args) {
+    if (!args.IsArgSet("-socket")) {
+        tfm::format(std::cerr, "Error: serve needs -socket\n");
+        return EXIT_FAILURE;
+    }
+    ExecutionServer server(args.GetArg("-socket", ""), args.GetArg("-queue", DEFAULT_EXECUTION_QUEUE),
+                           args.GetArg("-threads", 0));
+    std::string error;
+    if (!server.Listen(error)) {
+        tfm::format(std::cerr, "Error: %s\n", error);
+        return EXIT_FAILURE;
+    }
+
+    // Writes to clients that went away fail rather than raise SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    g_execution_server = &server;
+    struct sigaction sa;
+    sa.sa_handler = HandleSIGTERM;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+
+    server.Run();
+    g_execution_server = nullptr;
+    return EXIT_SUCCESS;
+}
+#endif
+
+static void SetupCliArgs(ArgsManager &argsman) {
+    SetupHelpOptions(argsman);
+    argsman.AddArg("-socket=<path>", "Unix domain socket to serve calls on", ArgsManager::ALLOW_STRING,
+                   OptionsCategory::OPTIONS);
+    argsman.AddArg("-threads=<n>",
+                   "Number of threads running calls, 0 for one per hardware thread (default: 0)",
+                   ArgsManager::ALLOW_INT, OptionsCategory::OPTIONS);
+    argsman.AddArg("-queue=<n>",
+                   strprintf("Number of calls queued for the threads at once (default: %u)", DEFAULT_EXECUTION_QUEUE),
+                   ArgsManager::ALLOW_INT, OptionsCategory::OPTIONS);
+    argsman.AddArg("serve",
+                   "Run contract calls for local clients on -socket, until interrupted. Requests and responses "
+                   "are framed as described in executionserver.h",
+                   ArgsManager::ALLOW_ANY, OptionsCategory::COMMANDS);
+}
+
 int main(int argc, char *argv[]) {
 #ifdef WIN32
     util::WinCmdLineArgs winArgs;
     std::tie(argc, argv) = winArgs.get();
 #endif
-    int ret = 0;
-    return ret;
+    SetupCliArgs(gArgs);
+    std::string error;
+    if (!gArgs.ParseParameters(argc, argv, error)) {
+        tfm::format(std::cerr, "Error parsing command line arguments: %s\n", error);
+        return EXIT_FAILURE;
+    }
+
+    // The command is the first argument that is not an option
+    int command = 1;
+    while (command < argc && IsSwitchChar(argv[command][0])) {
+        command++;
+    }
+    if (HelpRequested(gArgs) || command == argc) {
+        tfm::format(std::cout, "Usage: avm-cli [options] <command>\n\n%s", gArgs.GetHelpMessage());
+        return HelpRequested(gArgs) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (strcmp(argv[command], "serve") == 0) {
+#ifndef WIN32
+        return Serve(gArgs);
+#else
+        tfm::format(std::cerr, "Error: serve needs Unix domain sockets\n");
+        return EXIT_FAILURE;
+#endif
+    }
+    tfm::format(std::cerr, "Error: unknown command %s\n", argv[command]);
+    return EXIT_FAILURE;
 }
@@ -6,5 +6,21 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <string>
 
-void EaglesongHash( unsigned char * output, const unsigned char * input, unsigned int input_length );
\ No newline at end of file
+void EaglesongHash( unsigned char * output, const unsigned char * input, unsigned int input_length );
+
+namespace eaglesong_ref {
+/**
+ * The reference implementation of EaglesongHash by Alan Szepieniec: slow,
+ * but written as the specification reads, so that the fast one is checked
+ * against it.
+ */
+void Hash(unsigned char *output, const unsigned char *input, unsigned int input_length);
+} // namespace eaglesong_ref
+
+/**
+ * Autodetect the best available Eaglesong implementation.
+ * Returns the name of the implementation.
+ */
+std::string EaglesongAutoDetect();
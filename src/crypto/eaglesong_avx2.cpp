@@ -0,0 +1,203 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// The Eaglesong permutation on two vectors, one holding the even state words
+// and one the odd, so that each addition / rotation / addition pair lines up
+// lane for lane.
+
+#ifdef ENABLE_AVX2
+
+#include <cstdint>
+#include <immintrin.h>
+
+namespace eaglesong_avx2 {
+namespace {
+
+    constexpr int NUM_ROUNDS = 43;
+
+    // Injection constants of each round, the even words followed by the odd.
+    alignas(32) const uint32_t INJECTION_CONSTANTS[NUM_ROUNDS * 16] = {
+        0x6e9e40ae, 0x9a13d3b1, 0x3d8951cf, 0xb806b54c, 0xd3622b3b, 0x9edcf1c0, 0x7f91e46c, 0x265d9241,
+        0x71927c02, 0xdaec32ad, 0xe1c9fe9a, 0xacbbf417, 0xa082762a, 0xa9bada77, 0xcb0f6e4f, 0xb7bdeab0,
+        0x6260c9e6, 0x9036aa71, 0xd1307cdf, 0xf83133e2, 0x94871b01, 0x583a3264, 0x4cbda964, 0xf4a3033e,
+        0xff50dd2a, 0xce161879, 0x89e456df, 0x65f55c3d, 0xb5d204cd, 0x5e165957, 0x675fca47, 0x2a417322,
+        0x3b61432f, 0xb609973b, 0x31b477c9, 0x78969712, 0x7e11d22d, 0xeed07eb8, 0xe7cb6bcf, 0x4d05653a,
+        0x7f5532f2, 0x1a795239, 0xd2949d28, 0x0eb87b6e, 0xccee88bd, 0xe5563a81, 0x25de953e, 0x0b831557,
+        0x94b9cd77, 0x794b4a4a, 0xc456d8d4, 0x668456d7, 0x38b3a828, 0x438d681e, 0x97ee19a8, 0x2c76c47b,
+        0x13f01579, 0x67e7c7dc, 0x59689c9b, 0x22d2a2e1, 0x0315ac3c, 0xab7109c5, 0xde062b2e, 0x0084456f,
+        0x908f0fd3, 0x3e826725, 0x9f01c2b0, 0x92ea1df8, 0x7c2ea356, 0x46926893, 0xb501cc75, 0x685250f4,
+        0xa646551f, 0xd521788e, 0x93180cdc, 0x431a9aae, 0xda33ad03, 0x66bde7d7, 0x1f6e8a41, 0x3bb1f318,
+        0xaf238c04, 0x5b159e49, 0x12085626, 0x6bd20c48, 0x18ab1068, 0x2c8c11c0, 0x0ff675c3, 0x74bbbb24,
+        0x974ed2ec, 0xd526f8bf, 0x3e2432a9, 0x1f1d59da, 0x80f83cf8, 0x7d548035, 0xfed160bf, 0xd98e006b,
+        0xdeaa47eb, 0x437b0b71, 0x00a99d3b, 0x72686f8e, 0xdedc0787, 0x7012fe76, 0x9a7b2eda, 0x4da0d4ad,
+        0x05f2179e, 0xa7c95f8f, 0x3fc3c444, 0x00fd01a9, 0xc6af7626, 0xf2a5f7ce, 0x5e57fcf2, 0x5c63b155,
+        0x34117375, 0x2ea77435, 0xab522c4c, 0xc94a09e4, 0x91ecb65e, 0x8703bb52, 0x30a0538a, 0x157f6329,
+        0xd4134c11, 0x5278b6de, 0xbc8fc702, 0xebb93a9e, 0x4c52ecc6, 0xcb2d60aa, 0x1514f10b, 0x3429dc3d,
+        0x5db73eb2, 0x7286bd24, 0x3785ba5f, 0x02758170, 0x99d95191, 0x58a7fb22, 0x4f0c33f6, 0xe0904821,
+        0xa7a1a969, 0x0df6881e, 0xcd04623a, 0xd827f556, 0x84457eb1, 0xd2967c5f, 0x4a02099a, 0x94124036,
+        0x496a031b, 0xcf1a4927, 0xcdfaf4f8, 0x27c96a84, 0x7f8cf847, 0xc88905e6, 0x7172875a, 0x010aa53c,
+        0x780b69c4, 0x87a119b8, 0x4cf9cd0f, 0x6d11117e, 0x74ceede5, 0x60215841, 0x736e993a, 0x43d53c2b,
+        0xf0d91a93, 0xf816663c, 0x0a61737c, 0x83a5ac2f, 0x7b01aeb5, 0xb7678f7b, 0x068018f2, 0x29188aa8,
+        0x0d983b56, 0xe5d13363, 0x09d51150, 0x3e884905, 0x600a6ea7, 0x72b38977, 0xce6ae45b, 0xe5a0b1e9,
+        0xc04c2b86, 0x648781f3, 0xddcdd8ae, 0x446baaba, 0x17be4f90, 0x676f9c95, 0x6fd4c867, 0x19dde49d,
+        0x8bd14d75, 0xdbae1e0a, 0xab4d81a3, 0x1cc0c19d, 0x82c0e65d, 0x5c708db2, 0xa5106ef0, 0x78182f95,
+        0xd089cd81, 0xbe306c82, 0x037f1bde, 0xeddc1e22, 0x8a2f571b, 0x021b7477, 0xc95dbccc, 0x944e46bc,
+        0xa32e98fe, 0x6cd83d8c, 0x0b15722d, 0x93c76559, 0x92cc81b4, 0x67523904, 0xac17ee9d, 0x0781867e,
+        0xc854dd9d, 0x858c0416, 0xebe29c58, 0xd496b4ab, 0x10d24706, 0x96f523cb, 0x78c36564, 0x4729d97a,
+        0x26e2c30c, 0x6d397708, 0xc80ced86, 0xbe45e6f5, 0xacf8187a, 0x2227e143, 0x4643adc2, 0xcff93e0d,
+        0x25484bbd, 0x95f773f4, 0x2eda57ba, 0xeeaa4466, 0xa8af0c9b, 0x0cc2b7bd, 0x4f41071d, 0x49a6eff8,
+        0x91c6798e, 0x44204675, 0x06d313ef, 0x2dfa7530, 0x39f1535e, 0x38a76c0e, 0xcdaf2475, 0x01621748,
+        0x36ebacab, 0x44d1cd65, 0x55fa5a1a, 0xae559b45, 0x637d60ad, 0x97491cbb, 0xffe7f997, 0xe61320e9,
+        0xbd6d9a29, 0x40815dfd, 0x87cce9e9, 0xd76b4c26, 0xde29f5f9, 0xfb350040, 0x201c9dcd, 0xa90987a3,
+        0xe24afa83, 0xcc87ff62, 0x4fd04546, 0x46e456b9, 0xf627e68c, 0xc705bbfd, 0x892dae62, 0xea1d5c94,
+        0x61c1e6fc, 0xf1c9d8fa, 0x90ecc76e, 0x305dceb8, 0x2d286815, 0x101b6df3, 0xd5b7fb44, 0x5332e3cb,
+        0xf856f88a, 0x28408d9d, 0xeb9af9bc, 0x67985a91, 0x7c4d697d, 0x6ff5cebb, 0x674ceac0, 0x0de94784,
+        0xb341b0e9, 0x5421bc17, 0x602371c5, 0xd774907f, 0x9370b0b8, 0x7d465744, 0xea9102fc, 0xc793de69,
+        0xfe599bb1, 0x6d6ca9c3, 0xf9022f05, 0xe5e98cd3, 0x6df3bcdb, 0x17f5d010, 0x6eac77fe, 0x88d90cbb,
+        0xc6ad952f, 0x928c3f91, 0x24a164dc, 0x7649efdb, 0x5d1e9ff1, 0xe2686ea1, 0x7bb5c585, 0x18689163,
+        0x67c9efa5, 0x960efbab, 0x70f4c474, 0xd1541d15, 0xe3f02b3e, 0x53a077ba, 0xa50a6c1d, 0x52ba335b,
+        0xc0b76d9b, 0xbd872807, 0x56c29d20, 0x88137033, 0xb6d9b28d, 0xeedcd29e, 0x12c2801e, 0x35984614,
+        0xe2599aa8, 0xd90d4767, 0x77bec4f4, 0xfc5c8b76, 0xda366dc6, 0x1b36f7fc, 0x6fe7e724, 0xc4227404,
+        0xaf94ed1d, 0x202c7d07, 0xfa71bc80, 0x8d0fbbfc, 0x8b32a0c7, 0x6642dcbc, 0x8b5fa782, 0x3a7d1da7,
+        0x517ed658, 0x3e5c9b23, 0x1470601d, 0x676b065d, 0xea6f1a9c, 0x608785f0, 0x69d26699, 0x77f9986a,
+        0x8a18df6d, 0x1fbd51ef, 0x3400389c, 0x8864ad80, 0x2db484e1, 0x8dd384af, 0x409c4e16, 0x7f491266,
+        0x883ea6cf, 0xfa2e5db5, 0x9156bb89, 0xac3989c7, 0x581f3560, 0x7e5ad9cd, 0x43e5998e, 0xf038f8e1,
+        0xeaa06072, 0x352594b4, 0xa2fbbbfb, 0x6e2422b1, 0x1009a9b5, 0xa9fc0a6e, 0x7f8778f9, 0x5415c2e8,
+        0x6499b731, 0x05d4d819, 0xf1735aa0, 0x47ec952c, 0xb3cb2cb6, 0x271ac51b, 0xf76a0469, 0x4f5c90d6,
+        0xb82389ae, 0x0f06440e, 0x986430ee, 0xbf149cc5, 0x3f41e8c2, 0x48ac5ded, 0x717bba4d, 0x3b74f756,
+        0x1824110a, 0x1eb0507c, 0x157c59a7, 0xd66031a0, 0xe533fa43, 0xd7953a71, 0x58f0fa07, 0x057e990d,
+        0xa4fd43e3, 0xa9375c08, 0x0cad8f51, 0xabb5343f, 0x1996e2bb, 0xd2529b94, 0x4c9b1877, 0x8bfe19c4,
+        0xa8e2c0c9, 0x69d2aaca, 0xf4d22307, 0x1366aa07, 0xce1066bf, 0x9930b52a, 0x31ff7eb4, 0x150ac49c,
+        0x99fcaada, 0xdc1c4642, 0x7fe27e8c, 0x1594e637, 0xdb922552, 0xaeaa9a3e, 0x5e1f945a, 0x0ccdac2d,
+        0xd8a8a217, 0xd6a74659, 0x836eef4a, 0x7fa3ea4b, 0xbf069f55, 0xd6ebdb23, 0x19a7110d, 0xfb633868,
+        0xb82ea6e5, 0x67b7e3e6, 0xb6f90074, 0xcb038123, 0x1fa83fc4, 0x16f0a137, 0x5ff3b55f, 0xb466f845,
+        0xbce0c198, 0xddbdd88b, 0x63a553f8, 0x378a2bce, 0xefb77e7d, 0x32515c15, 0xe8405976, 0xd4eed4d9,
+        0x88404296, 0x7fc52546, 0xa728405a, 0x6862e570, 0xc611625e, 0x6984b765, 0x9ba386fd, 0xf8fe0309,
+        0x0ce54601, 0xd8524057, 0x72c0a3a9, 0x82f33a45, 0x29c7e182, 0x5a6f245b, 0xcb701d9c, 0x0841f145,
+        0xbaf879c2, 0x1d8c1d7a, 0x5a1ffbde, 0x5143f446, 0xe536c32f, 0x44272adb, 0xf76137ec, 0xe7042ecc,
+        0xf1277dd7, 0xa8fe65fe, 0x54c513ef, 0xb66336b0, 0xbcd75753, 0x56a6f0be, 0x5ea31f3d, 0xf76de3de,
+        0x745cf92c, 0xd3e2d7cf, 0x6079bc2d, 0x101e383b, 0x25be238a, 0xeeffcc17, 0x0ae772f5, 0x1bbecdad,
+        0xc9107d43, 0x618358cd, 0xf6975906, 0x67d314dc, 0x56ce5888, 0xbff6b1bf, 0xf1709c1e, 0x902402b9,
+        0xf7e38dce, 0x5c833f04, 0xde4177e5, 0xb4760f3e, 0x0e8345a8, 0x78dfb112, 0x7bb8ed8b, 0xdaa64ae0,
+        0x46b71d89, 0xbe376509, 0x0863ea1f, 0x79bdecc5, 0x5f2e4bae, 0x72f8ce7b, 0x14525535, 0x9094ccfd,
+        0x7eee035f, 0x99648f3a, 0x49ad8887, 0x3c10b568, 0x04ef20ab, 0x521e1ebe, 0x2e8af95b, 0xbcf36713,
+        0xc73953ef, 0x6554ec2d, 0x03dc73b7, 0xcbbef182, 0x632a32bd, 0x1ae5533d, 0x4cc5a004, 0x62cbd38d,
+        0xd4b91474, 0xe3885c96, 0x931688a9, 0x2b77cfc9, 0xd2115dcc, 0x32684e13, 0x13321bde, 0x78383a3b,
+        0xd00686f1, 0x7eaf23de, 0x9c351209, 0x6d566eac, 0x32e9fac5, 0x09f84725, 0x72291f02, 0x3dbfcbb8,
+        0x9f601ee7, 0x3110c492, 0x7eb89d52, 0xc2efd226, 0x52227274, 0xb8d0b605, 0x71b5c34b, 0x04a02263,
+        0x55ba597f, 0xc813e1be, 0xc3c058f3, 0x1dfcf55f, 0xa9c01a74, 0xe57e1428, 0x836b956d, 0x5835d541,
+        0xd4e4037d, 0xffddeefa, 0x87010f2e, 0xc694eeeb, 0x98c2fc6b, 0xdd265a71, 0x7e46ab1a, 0x50b32505,
+        0xe640913c, 0xfe496263, 0x93cd6620, 0x2d657b40, 0x57710c69, 0xb5f8728a, 0xca28b751, 0x5ab12c3c,
+        0xbb486079, 0x113c5b69, 0x5efe823b, 0xb46dfc6c, 0xfe9fadeb, 0xe3224170, 0xfdabae56, 0xa697c457,
+        0xd28fa2b7, 0x9fd9d810, 0xd88d89ab, 0x6d47abd0, 0x6f83ebaf, 0xfceb9ee2, 0xce9856df, 0x2772c854,
+        0x056579f2, 0xe3557478, 0xa72a9422, 0x405bcbd9, 0x13caec76, 0x2e922df7, 0xc05e9322, 0xb67f2a32,
+        0x6d1af28d, 0xdff411e4, 0xed8b842e, 0x6e857085, 0xee37f6bc, 0x5e9ec45a, 0xa5573db7, 0x486b4768,
+        0x3a78cf77, 0x61c74ca9, 0x72880845, 0xc6404932, 0x27116f48, 0x8ea2a51f, 0xa746d036, 0x5b438f3b,
+        0x18c54a5c, 0xe993cdc1, 0x9de07de7, 0x87423c5e, 0x962eb75b, 0xdcdb5363, 0x83d9cc88, 0xc71121bb,
+        0x64fcf08e, 0x35c1ead3, 0x321b841c, 0x071aa0f6, 0xbb06bdd2, 0x389752f2, 0xd014adc6, 0x2372f938,
+        0xcaff2650, 0x56dccaff, 0x09712e95, 0x1b085744, 0x5c9a812e, 0x85e46044, 0x5a4c903f, 0x7d1d601b,
+        0x62be8951, 0xac4084c0, 0x1d3c288f, 0xe1d3cfef, 0x6611fd59, 0x1981d885, 0x43f30d4b, 0xdd3c3391,
+        0x030ec65e, 0x72e795fe, 0x1ec085db, 0x93e8dd1e, 0x73563144, 0x5fd5aefe, 0x75ced665, 0x4e83bba7,
+        0xc12878cd, 0xd0c76abd, 0x7cbb61fa, 0x8582eb06, 0x049d4e7e, 0x7b842a00, 0xbb32d458, 0x8f15151f,
+        0x7795a125, 0x499af99d, 0xa3b1278d, 0x96ca058e, 0xa6fb8cae, 0x17504923, 0xaea886c2, 0xebd5ea6b,
+        0xf0842455, 0x565cc7fa, 0x3f27ce74, 0x8a497443, 0xc115aa21, 0xe4932402, 0x8eb79af5, 0xc7980d3b,
+        0x71369315, 0x3a7ec708, 0xe02b74e7, 0x6c8c1f54, 0x59aee281, 0xe01f5605, 0xc9a1a3b4, 0xc935c39c,
+        0x796e6a66, 0xb05175c8, 0xeb377ad3, 0xb980c374, 0x449cb799, 0xed0e085e, 0xaac481b1, 0xb7d8ce7f};
+
+    constexpr uint32_t M = 0xffffffff;
+
+    // Row k selects the even, then the odd, words of the bit matrix product
+    // that state word k is added into.
+    alignas(32) const uint32_t BIT_MATRIX[16][16] = {
+        {M, M, 0, 0, M, M, 0, 0, M, M, M, M, M, M, 0, M},
+        {0, M, M, M, M, M, M, 0, M, M, 0, 0, M, M, 0, M},
+        {0, M, M, 0, 0, M, M, 0, 0, M, M, M, M, M, M, M},
+        {0, 0, M, M, M, M, M, M, 0, M, M, 0, 0, M, M, M},
+        {M, M, M, M, M, M, M, M, M, M, 0, 0, 0, 0, M, 0},
+        {M, 0, M, 0, M, M, 0, M, 0, 0, 0, 0, 0, 0, M, M},
+        {M, M, 0, 0, M, M, 0, M, 0, M, 0, M, 0, 0, 0, 0},
+        {M, M, M, 0, 0, M, 0, 0, 0, 0, M, M, 0, 0, 0, M},
+        {0, 0, 0, M, M, 0, 0, 0, M, M, M, 0, 0, M, 0, M},
+        {0, M, M, M, 0, 0, M, 0, 0, 0, 0, M, M, 0, 0, M},
+        {0, 0, 0, 0, M, M, 0, 0, 0, M, M, M, 0, 0, M, M},
+        {0, 0, M, M, M, 0, 0, M, 0, 0, 0, 0, M, M, 0, M},
+        {M, M, 0, 0, M, 0, M, 0, M, M, 0, 0, 0, M, 0, 0},
+        {0, M, M, 0, 0, 0, M, 0, M, M, 0, 0, M, 0, M, 0},
+        {0, M, M, 0, 0, M, 0, M, 0, M, M, 0, 0, 0, M, 0},
+        {M, M, M, M, M, M, 0, M, M, 0, 0, M, M, 0, 0, M}};
+
+    __m256i inline Load(const uint32_t *p) {
+        return _mm256_load_si256((const __m256i *)p);
+    }
+
+    __m256i inline Xor(__m256i a, __m256i b, __m256i c, __m256i d) {
+        return _mm256_xor_si256(_mm256_xor_si256(a, b), _mm256_xor_si256(c, d));
+    }
+
+    /**
+     * The part of the bit matrix product contributed by state word k to the
+     * even (half 0) or odd (half 1) output words.
+     */
+    __m256i inline Term(__m256i even, __m256i odd, int k, int half) {
+        const __m256i word = _mm256_permutevar8x32_epi32(k % 2 ? odd : even, _mm256_set1_epi32(k / 2));
+        return _mm256_and_si256(word, Load(BIT_MATRIX[k] + 8 * half));
+    }
+
+    __m256i inline Rotl(__m256i x, __m256i n) {
+        return _mm256_or_si256(_mm256_sllv_epi32(x, n), _mm256_srlv_epi32(x, _mm256_sub_epi32(_mm256_set1_epi32(32), n)));
+    }
+
+    /** x ^ (x <<< n1) ^ (x <<< n2), lane by lane. */
+    __m256i inline Circulant(__m256i x, __m256i n1, __m256i n2) {
+        return _mm256_xor_si256(x, _mm256_xor_si256(Rotl(x, n1), Rotl(x, n2)));
+    }
+
+} // namespace
+
+void Permutation(uint32_t *s) {
+    const __m256i deinterleave = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m256i interleave = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const __m256i rotl8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                           3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    const __m256i rotl24 = _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+                                            1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    const __m256i even1 = _mm256_setr_epi32(2, 4, 27, 17, 18, 4, 12, 7);
+    const __m256i even2 = _mm256_setr_epi32(4, 19, 31, 26, 22, 7, 27, 8);
+    const __m256i odd1 = _mm256_setr_epi32(13, 3, 3, 3, 12, 4, 7, 1);
+    const __m256i odd2 = _mm256_setr_epi32(22, 14, 8, 12, 18, 31, 17, 13);
+
+    __m256i lo = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)s), deinterleave);
+    __m256i hi = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)(s + 8)), deinterleave);
+    __m256i even = _mm256_permute2x128_si256(lo, hi, 0x20);
+    __m256i odd = _mm256_permute2x128_si256(lo, hi, 0x31);
+
+    for (int i = 0; i < NUM_ROUNDS; ++i) {
+        // bit matrix, as a tree of sums to keep the dependency chains short
+        const __m256i e = even, o = odd;
+        even = Xor(Xor(Term(e, o, 0, 0), Term(e, o, 1, 0), Term(e, o, 2, 0), Term(e, o, 3, 0)),
+                   Xor(Term(e, o, 4, 0), Term(e, o, 5, 0), Term(e, o, 6, 0), Term(e, o, 7, 0)),
+                   Xor(Term(e, o, 8, 0), Term(e, o, 9, 0), Term(e, o, 10, 0), Term(e, o, 11, 0)),
+                   Xor(Term(e, o, 12, 0), Term(e, o, 13, 0), Term(e, o, 14, 0), Term(e, o, 15, 0)));
+        odd = Xor(Xor(Term(e, o, 0, 1), Term(e, o, 1, 1), Term(e, o, 2, 1), Term(e, o, 3, 1)),
+                  Xor(Term(e, o, 4, 1), Term(e, o, 5, 1), Term(e, o, 6, 1), Term(e, o, 7, 1)),
+                  Xor(Term(e, o, 8, 1), Term(e, o, 9, 1), Term(e, o, 10, 1), Term(e, o, 11, 1)),
+                  Xor(Term(e, o, 12, 1), Term(e, o, 13, 1), Term(e, o, 14, 1), Term(e, o, 15, 1)));
+
+        // circulant multiplication, constants injection
+        even = _mm256_xor_si256(Circulant(even, even1, even2), Load(INJECTION_CONSTANTS + 16 * i));
+        odd = _mm256_xor_si256(Circulant(odd, odd1, odd2), Load(INJECTION_CONSTANTS + 16 * i + 8));
+
+        // addition / rotation / addition
+        even = _mm256_shuffle_epi8(_mm256_add_epi32(even, odd), rotl8);
+        odd = _mm256_add_epi32(_mm256_shuffle_epi8(odd, rotl24), even);
+    }
+
+    lo = _mm256_permutevar8x32_epi32(_mm256_permute2x128_si256(even, odd, 0x20), interleave);
+    hi = _mm256_permutevar8x32_epi32(_mm256_permute2x128_si256(even, odd, 0x31), interleave);
+    _mm256_storeu_si256((__m256i *)s, lo);
+    _mm256_storeu_si256((__m256i *)(s + 8), hi);
+}
+} // namespace eaglesong_avx2
+
+#endif
@@ -7,9 +7,11 @@
 #include <compat/cpuid.h>
 #include <crypto/common.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstring>
+#include <vector>
 
 #if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
 #if defined(USE_ASM)
@@ -23,10 +25,18 @@ namespace sha256d64_sse41 {
 void Transform_4way(uint8_t *out, const uint8_t *in);
 }
 
+namespace sha256_sse41 {
+void Transform_4way(uint32_t *s, const uint8_t *const *chunks);
+}
+
 namespace sha256d64_avx2 {
 void Transform_8way(uint8_t *out, const uint8_t *in);
 }
 
+namespace sha256_avx2 {
+void Transform_8way(uint32_t *s, const uint8_t *const *chunks);
+}
+
 namespace sha256d64_shani {
 void Transform_2way(uint8_t *out, const uint8_t *in);
 }
@@ -579,6 +589,7 @@ namespace sha256 {
 
 typedef void (*TransformType)(uint32_t *, const uint8_t *, size_t);
 typedef void (*TransformD64Type)(uint8_t *, const uint8_t *);
+typedef void (*TransformMultiType)(uint32_t *, const uint8_t *const *);
 
 template <TransformType tr>
 void TransformD64Wrapper(uint8_t *out, const uint8_t *in) {
@@ -619,6 +630,26 @@ TransformD64Type TransformD64 = sha256::TransformD64;
 TransformD64Type TransformD64_2way = nullptr;
 TransformD64Type TransformD64_4way = nullptr;
 TransformD64Type TransformD64_8way = nullptr;
+TransformMultiType TransformMulti_4way = nullptr;
+TransformMultiType TransformMulti_8way = nullptr;
+
+// Run one multi-lane transform taking lane i from result[i] to result[i + 1]
+// over the i-th 64 byte block of the input data.
+bool SelfTestMulti(TransformMultiType tr, size_t lanes, const uint32_t (*result)[8], const uint8_t *data) {
+    uint32_t state[8 * 8];
+    const uint8_t *chunks[8];
+    for (size_t i = 0; i < lanes; ++i) {
+        std::copy(result[i], result[i] + 8, state + 8 * i);
+        chunks[i] = data + 64 * i;
+    }
+    tr(state, chunks);
+    for (size_t i = 0; i < lanes; ++i) {
+        if (!std::equal(state + 8 * i, state + 8 * i + 8, result[i + 1])) {
+            return false;
+        }
+    }
+    return true;
+}
 
 bool SelfTest() {
     // Input state (equal to the initial SHA256 state)
@@ -730,6 +761,16 @@ bool SelfTest() {
         }
     }
 
+    // Test TransformMulti_4way, if available.
+    if (TransformMulti_4way && !SelfTestMulti(TransformMulti_4way, 4, result, data + 1)) {
+        return false;
+    }
+
+    // Test TransformMulti_8way, if available.
+    if (TransformMulti_8way && !SelfTestMulti(TransformMulti_8way, 8, result, data + 1)) {
+        return false;
+    }
+
     return true;
 }
 
@@ -795,6 +836,7 @@ std::string SHA256AutoDetect() {
 #endif
 #if defined(ENABLE_SSE41) && !defined(BUILD_AVM_INTERNAL)
         TransformD64_4way = sha256d64_sse41::Transform_4way;
+        TransformMulti_4way = sha256_sse41::Transform_4way;
         ret += ",sse41(4way)";
 #endif
     }
@@ -802,6 +844,7 @@ std::string SHA256AutoDetect() {
 #if defined(ENABLE_AVX2) && !defined(BUILD_AVM_INTERNAL)
     if (have_avx2 && have_avx && enabled_avx) {
         TransformD64_8way = sha256d64_avx2::Transform_8way;
+        TransformMulti_8way = sha256_avx2::Transform_8way;
         ret += ",avx2(8way)";
     }
 #endif
@@ -896,3 +939,162 @@ void SHA256D64(uint8_t *out, const uint8_t *in, size_t blocks) {
         --blocks;
     }
 }
+
+////// Multi-buffer SHA-256
+
+namespace {
+/** A message being hashed in one lane of SHA256Multi. */
+struct MultiLane {
+    SHA256MultiSource *source = nullptr;
+    uint8_t *output = nullptr;
+    uint64_t bytes = 0;
+    // 0 while reading data, 1 when only the length block is left, 2 once
+    // the last block has been handed out.
+    int stage = 0;
+};
+
+/** Fill block with the next padded block of the lane's message. */
+void NextBlock(MultiLane &lane, uint8_t *block) {
+    size_t n = 0;
+    if (lane.stage == 0) {
+        n = lane.source->Read(block, 64);
+        lane.bytes += n;
+        if (n == 64) {
+            return;
+        }
+        block[n++] = 0x80;
+        if (n > 56) {
+            memset(block + n, 0, 64 - n);
+            lane.stage = 1;
+            return;
+        }
+    }
+    memset(block + n, 0, 56 - n);
+    WriteBE64(block + 56, lane.bytes << 3);
+    lane.stage = 2;
+}
+
+void FinishLane(const MultiLane &lane, const uint32_t *s) {
+    for (int i = 0; i < 8; ++i) {
+        WriteBE32(lane.output + 4 * i, s[i]);
+    }
+}
+
+void HashLane(MultiLane &lane, uint32_t *s) {
+    uint8_t block[64];
+    while (lane.stage != 2) {
+        NextBlock(lane, block);
+        Transform(s, block, 1);
+    }
+    FinishLane(lane, s);
+}
+
+/** Hash a whole message on its own, reading it in larger pieces. */
+void HashSource(SHA256MultiSource *source, uint8_t *output) {
+    uint8_t buf[1024];
+    CSHA256 hasher;
+    size_t n;
+    do {
+        n = source->Read(buf, sizeof(buf));
+        hasher.Write(buf, n);
+    } while (n == sizeof(buf));
+    hasher.Finalize(output);
+}
+
+/** SHA256MultiSource over a buffer in memory. */
+class BufferSource final : public SHA256MultiSource {
+    const uint8_t *data;
+    size_t remaining;
+
+public:
+    BufferSource(const uint8_t *dataIn, size_t len) : data(dataIn), remaining(len) {}
+
+    size_t Read(uint8_t *buf, size_t len) override {
+        size_t n = std::min(len, remaining);
+        memcpy(buf, data, n);
+        data += n;
+        remaining -= n;
+        return n;
+    }
+};
+} // namespace
+
+void SHA256Multi(SHA256MultiSource *const *sources, uint8_t *outputs, size_t count) {
+    static const uint8_t unused[64] = {0};
+    const struct {
+        TransformMultiType transform;
+        size_t width;
+    } kernels[] = {{TransformMulti_8way, 8}, {TransformMulti_4way, 4}};
+
+    // Busy lanes are kept in slots [0, busy), with their state at 8 * slot.
+    MultiLane lanes[8];
+    uint32_t states[8 * 8] = {0};
+    uint8_t blocks[8][64];
+    const uint8_t *chunks[8];
+    size_t busy = 0;
+    size_t next = 0;
+    for (const auto &kernel : kernels) {
+        if (!kernel.transform) {
+            continue;
+        }
+        while (true) {
+            while (busy < kernel.width && next < count) {
+                lanes[busy] = MultiLane();
+                lanes[busy].source = sources[next];
+                lanes[busy].output = outputs + 32 * next;
+                sha256::Initialize(states + 8 * busy);
+                ++busy;
+                ++next;
+            }
+            // Below half occupancy a narrower kernel, or the single lane
+            // transform, does the same work for less.
+            if (busy * 2 < kernel.width) {
+                break;
+            }
+            for (size_t slot = 0; slot < kernel.width; ++slot) {
+                if (slot < busy) {
+                    NextBlock(lanes[slot], blocks[slot]);
+                    chunks[slot] = blocks[slot];
+                } else {
+                    chunks[slot] = unused;
+                }
+            }
+            kernel.transform(states, chunks);
+            for (size_t slot = 0; slot < busy;) {
+                if (lanes[slot].stage != 2) {
+                    ++slot;
+                    continue;
+                }
+                FinishLane(lanes[slot], states + 8 * slot);
+                --busy;
+                lanes[slot] = lanes[busy];
+                std::copy(states + 8 * busy, states + 8 * busy + 8, states + 8 * slot);
+            }
+        }
+    }
+
+    for (size_t slot = 0; slot < busy; ++slot) {
+        HashLane(lanes[slot], states + 8 * slot);
+    }
+    for (; next < count; ++next) {
+        HashSource(sources[next], outputs + 32 * next);
+    }
+}
+
+void SHA256Multi(const uint8_t *const *inputs, const size_t *lengths, uint8_t *outputs, size_t count) {
+    if (!TransformMulti_4way && !TransformMulti_8way) {
+        for (size_t i = 0; i < count; ++i) {
+            CSHA256().Write(inputs[i], lengths[i]).Finalize(outputs + 32 * i);
+        }
+        return;
+    }
+    std::vector<BufferSource> buffers;
+    std::vector<SHA256MultiSource *> sources;
+    buffers.reserve(count);
+    sources.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        buffers.emplace_back(inputs[i], lengths[i]);
+        sources.push_back(&buffers.back());
+    }
+    SHA256Multi(sources.data(), outputs, count);
+}
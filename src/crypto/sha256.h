@@ -37,3 +37,23 @@ std::string SHA256AutoDetect();
  * blocks:  the number of hashes to compute.
  */
 void SHA256D64(uint8_t *output, const uint8_t *input, size_t blocks);
+
+/** A message hashed by SHA256Multi, read in order as it is needed. */
+class SHA256MultiSource {
+public:
+    virtual ~SHA256MultiSource() = default;
+    /**
+     * Copy up to len of the next bytes of the message into buf. Returns the
+     * number copied, which is less than len only at the end of the message.
+     */
+    virtual size_t Read(uint8_t *buf, size_t len) = 0;
+};
+
+/**
+ * Compute the SHA256's of count independent messages of any length, running
+ * them side by side in the lanes of the multi-buffer transforms when
+ * SHA256AutoDetect found any.
+ * output:  pointer to a count*32 byte output buffer
+ */
+void SHA256Multi(SHA256MultiSource *const *sources, uint8_t *output, size_t count);
+void SHA256Multi(const uint8_t *const *inputs, const size_t *lengths, uint8_t *output, size_t count);
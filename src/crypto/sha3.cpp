@@ -5,8 +5,10 @@
 // Based on https://github.com/mjosaarinen/tiny_sha3/blob/master/sha3.c
 // by Markku-Juhani O. Saarinen <mjos@iki.fi>
 
-#include <crypto/common.h>
 #include <crypto/sha3.h>
+
+#include <compat/cpuid.h>
+#include <crypto/common.h>
 #include <span.h>
 
 #include <algorithm>
@@ -14,13 +16,19 @@
 #include <cassert>
 #include <cstdint>
 
+#if defined(ENABLE_BMI2)
+namespace sha3_bmi2 {
+void KeccakF(uint64_t (&st)[25]);
+}
+#endif
+
 // Internal implementation code.
 namespace {
 uint64_t Rotl(uint64_t x, int n) {
     return (x << n) | (x >> (64 - n));
 }
-} // namespace
 
+namespace sha3 {
 void KeccakF(uint64_t (&st)[25]) {
     static constexpr uint64_t RNDC[24] = {
         0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000, 0x000000000000808b,
@@ -196,6 +204,62 @@ void KeccakF(uint64_t (&st)[25]) {
         st[24] = bc4 ^ (~bc0 & bc1);
     }
 }
+} // namespace sha3
+
+typedef void (*KeccakFType)(uint64_t (&)[25]);
+
+KeccakFType KeccakFImpl = sha3::KeccakF;
+
+bool SelfTest() {
+    // The permutation of lanes 0x0123456789abcdef * (i + 1).
+    static constexpr uint64_t result[25] = {
+        0x417587a73ff14736, 0x873bba4514a8a528, 0x05a18dbc335777ec, 0xa41cc61ddf026a5b, 0xb0e172792d3cc4e5,
+        0x472c635570b62583, 0xe2d65383463f6f17, 0x60baa6f9379c7ba9, 0xa2c422cb35ddc877, 0x510ce38feb44910d,
+        0x924c9ef2011ff0bc, 0x0df1614c89e62a0d, 0xc149908c2f31b8b7, 0xe4d870b996ed8882, 0xbcc0333872cefebe,
+        0x62a75a1066987052, 0xbb6ffc6b1724ac28, 0xd67dd7b4b493a612, 0x9e15e34a81636c19, 0xbb0f092ae5a26d76,
+        0x1b27912af146fc4a, 0xc55c3e7de26f2fec, 0x704808fc5a6582dd, 0x3788b80ba50a9fda, 0x5e9f70e888a1388f};
+
+    uint64_t st[25];
+    for (int i = 0; i < 25; ++i) {
+        st[i] = 0x0123456789abcdef * uint64_t(i + 1);
+    }
+    KeccakFImpl(st);
+    return std::equal(std::begin(st), std::end(st), std::begin(result));
+}
+} // namespace
+
+std::string SHA3AutoDetect() {
+    std::string ret = "standard";
+#if defined(USE_ASM) && defined(HAVE_GETCPUID)
+    bool have_bmi1 = false;
+    bool have_bmi2 = false;
+
+    (void)have_bmi1;
+    (void)have_bmi2;
+
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(0, 0, eax, ebx, ecx, edx);
+    if (eax >= 7) {
+        GetCPUID(7, 0, eax, ebx, ecx, edx);
+        have_bmi1 = (ebx >> 3) & 1;
+        have_bmi2 = (ebx >> 8) & 1;
+    }
+
+#if defined(ENABLE_BMI2) && !defined(BUILD_AVM_INTERNAL)
+    if (have_bmi1 && have_bmi2) {
+        KeccakFImpl = sha3_bmi2::KeccakF;
+        ret = "bmi2";
+    }
+#endif
+#endif
+
+    assert(SelfTest());
+    return ret;
+}
+
+void KeccakF(uint64_t (&st)[25]) {
+    KeccakFImpl(st);
+}
 
 SHA3_256 &SHA3_256::Write(Span<const uint8_t> data) {
     if (m_bufsize && m_bufsize + data.size() >= sizeof(m_buffer)) {
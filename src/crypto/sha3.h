@@ -7,6 +7,13 @@
 #include <span.h>
 
 #include <cstdint>
+#include <string>
+
+/**
+ * Autodetect the best available Keccak-f[1600] implementation.
+ * Returns the name of the implementation.
+ */
+std::string SHA3AutoDetect();
 
 //! The Keccak-f[1600] transform.
 void KeccakF(uint64_t (&st)[25]);
@@ -0,0 +1,214 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Keccak-f[1600] with the state held in 25 locals and the round fully
+// unrolled, two rounds per loop iteration so the lanes swap between the A and
+// E sets instead of being copied back. Built with BMI1/BMI2 so the compiler
+// emits ANDN for chi and RORX for the rotations, which do not clobber their
+// sources. Lane names follow the Keccak reference code: the first letter of
+// the suffix is the row (b, g, k, m, s) and the second the column (a, e, i, o,
+// u).
+
+#ifdef ENABLE_BMI2
+
+#include <cstdint>
+
+namespace sha3_bmi2 {
+namespace {
+
+    constexpr uint64_t RNDC[24] = {
+        0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000, 0x000000000000808b,
+        0x0000000080000001, 0x8000000080008081, 0x8000000000008009, 0x000000000000008a, 0x0000000000000088,
+        0x0000000080008009, 0x000000008000000a, 0x000000008000808b, 0x800000000000008b, 0x8000000000008089,
+        0x8000000000008003, 0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
+        0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008};
+    constexpr int ROUNDS = 24;
+
+    inline uint64_t Rotl(uint64_t x, int n) {
+        return (x << n) | (x >> (64 - n));
+    }
+
+} // namespace
+
+void KeccakF(uint64_t (&st)[25]) {
+    uint64_t Aba, Abe, Abi, Abo, Abu, Aga, Age, Agi, Ago, Agu, Aka, Ake, Aki, Ako, Aku, Ama, Ame, Ami, Amo, Amu, Asa, Ase, Asi, Aso, Asu;
+    uint64_t Eba, Ebe, Ebi, Ebo, Ebu, Ega, Ege, Egi, Ego, Egu, Eka, Eke, Eki, Eko, Eku, Ema, Eme, Emi, Emo, Emu, Esa, Ese, Esi, Eso, Esu;
+    uint64_t ca, ce, ci, co, cu, da, de, di, do_, du, ba, be, bi, bo, bu;
+    Aba = st[0];
+    Abe = st[1];
+    Abi = st[2];
+    Abo = st[3];
+    Abu = st[4];
+    Aga = st[5];
+    Age = st[6];
+    Agi = st[7];
+    Ago = st[8];
+    Agu = st[9];
+    Aka = st[10];
+    Ake = st[11];
+    Aki = st[12];
+    Ako = st[13];
+    Aku = st[14];
+    Ama = st[15];
+    Ame = st[16];
+    Ami = st[17];
+    Amo = st[18];
+    Amu = st[19];
+    Asa = st[20];
+    Ase = st[21];
+    Asi = st[22];
+    Aso = st[23];
+    Asu = st[24];
+    for (int round = 0; round < ROUNDS; round += 2) {
+        ca = Aba ^ Aga ^ Aka ^ Ama ^ Asa;
+        ce = Abe ^ Age ^ Ake ^ Ame ^ Ase;
+        ci = Abi ^ Agi ^ Aki ^ Ami ^ Asi;
+        co = Abo ^ Ago ^ Ako ^ Amo ^ Aso;
+        cu = Abu ^ Agu ^ Aku ^ Amu ^ Asu;
+        da = cu ^ Rotl(ce, 1);
+        de = ca ^ Rotl(ci, 1);
+        di = ce ^ Rotl(co, 1);
+        do_ = ci ^ Rotl(cu, 1);
+        du = co ^ Rotl(ca, 1);
+        ba = Aba ^ da;
+        be = Rotl(Age ^ de, 44);
+        bi = Rotl(Aki ^ di, 43);
+        bo = Rotl(Amo ^ do_, 21);
+        bu = Rotl(Asu ^ du, 14);
+        Eba = ba ^ (~be & bi) ^ RNDC[round];
+        Ebe = be ^ (~bi & bo);
+        Ebi = bi ^ (~bo & bu);
+        Ebo = bo ^ (~bu & ba);
+        Ebu = bu ^ (~ba & be);
+        ba = Rotl(Abo ^ do_, 28);
+        be = Rotl(Agu ^ du, 20);
+        bi = Rotl(Aka ^ da, 3);
+        bo = Rotl(Ame ^ de, 45);
+        bu = Rotl(Asi ^ di, 61);
+        Ega = ba ^ (~be & bi);
+        Ege = be ^ (~bi & bo);
+        Egi = bi ^ (~bo & bu);
+        Ego = bo ^ (~bu & ba);
+        Egu = bu ^ (~ba & be);
+        ba = Rotl(Abe ^ de, 1);
+        be = Rotl(Agi ^ di, 6);
+        bi = Rotl(Ako ^ do_, 25);
+        bo = Rotl(Amu ^ du, 8);
+        bu = Rotl(Asa ^ da, 18);
+        Eka = ba ^ (~be & bi);
+        Eke = be ^ (~bi & bo);
+        Eki = bi ^ (~bo & bu);
+        Eko = bo ^ (~bu & ba);
+        Eku = bu ^ (~ba & be);
+        ba = Rotl(Abu ^ du, 27);
+        be = Rotl(Aga ^ da, 36);
+        bi = Rotl(Ake ^ de, 10);
+        bo = Rotl(Ami ^ di, 15);
+        bu = Rotl(Aso ^ do_, 56);
+        Ema = ba ^ (~be & bi);
+        Eme = be ^ (~bi & bo);
+        Emi = bi ^ (~bo & bu);
+        Emo = bo ^ (~bu & ba);
+        Emu = bu ^ (~ba & be);
+        ba = Rotl(Abi ^ di, 62);
+        be = Rotl(Ago ^ do_, 55);
+        bi = Rotl(Aku ^ du, 39);
+        bo = Rotl(Ama ^ da, 41);
+        bu = Rotl(Ase ^ de, 2);
+        Esa = ba ^ (~be & bi);
+        Ese = be ^ (~bi & bo);
+        Esi = bi ^ (~bo & bu);
+        Eso = bo ^ (~bu & ba);
+        Esu = bu ^ (~ba & be);
+        ca = Eba ^ Ega ^ Eka ^ Ema ^ Esa;
+        ce = Ebe ^ Ege ^ Eke ^ Eme ^ Ese;
+        ci = Ebi ^ Egi ^ Eki ^ Emi ^ Esi;
+        co = Ebo ^ Ego ^ Eko ^ Emo ^ Eso;
+        cu = Ebu ^ Egu ^ Eku ^ Emu ^ Esu;
+        da = cu ^ Rotl(ce, 1);
+        de = ca ^ Rotl(ci, 1);
+        di = ce ^ Rotl(co, 1);
+        do_ = ci ^ Rotl(cu, 1);
+        du = co ^ Rotl(ca, 1);
+        ba = Eba ^ da;
+        be = Rotl(Ege ^ de, 44);
+        bi = Rotl(Eki ^ di, 43);
+        bo = Rotl(Emo ^ do_, 21);
+        bu = Rotl(Esu ^ du, 14);
+        Aba = ba ^ (~be & bi) ^ RNDC[round + 1];
+        Abe = be ^ (~bi & bo);
+        Abi = bi ^ (~bo & bu);
+        Abo = bo ^ (~bu & ba);
+        Abu = bu ^ (~ba & be);
+        ba = Rotl(Ebo ^ do_, 28);
+        be = Rotl(Egu ^ du, 20);
+        bi = Rotl(Eka ^ da, 3);
+        bo = Rotl(Eme ^ de, 45);
+        bu = Rotl(Esi ^ di, 61);
+        Aga = ba ^ (~be & bi);
+        Age = be ^ (~bi & bo);
+        Agi = bi ^ (~bo & bu);
+        Ago = bo ^ (~bu & ba);
+        Agu = bu ^ (~ba & be);
+        ba = Rotl(Ebe ^ de, 1);
+        be = Rotl(Egi ^ di, 6);
+        bi = Rotl(Eko ^ do_, 25);
+        bo = Rotl(Emu ^ du, 8);
+        bu = Rotl(Esa ^ da, 18);
+        Aka = ba ^ (~be & bi);
+        Ake = be ^ (~bi & bo);
+        Aki = bi ^ (~bo & bu);
+        Ako = bo ^ (~bu & ba);
+        Aku = bu ^ (~ba & be);
+        ba = Rotl(Ebu ^ du, 27);
+        be = Rotl(Ega ^ da, 36);
+        bi = Rotl(Eke ^ de, 10);
+        bo = Rotl(Emi ^ di, 15);
+        bu = Rotl(Eso ^ do_, 56);
+        Ama = ba ^ (~be & bi);
+        Ame = be ^ (~bi & bo);
+        Ami = bi ^ (~bo & bu);
+        Amo = bo ^ (~bu & ba);
+        Amu = bu ^ (~ba & be);
+        ba = Rotl(Ebi ^ di, 62);
+        be = Rotl(Ego ^ do_, 55);
+        bi = Rotl(Eku ^ du, 39);
+        bo = Rotl(Ema ^ da, 41);
+        bu = Rotl(Ese ^ de, 2);
+        Asa = ba ^ (~be & bi);
+        Ase = be ^ (~bi & bo);
+        Asi = bi ^ (~bo & bu);
+        Aso = bo ^ (~bu & ba);
+        Asu = bu ^ (~ba & be);
+    }
+    st[0] = Aba;
+    st[1] = Abe;
+    st[2] = Abi;
+    st[3] = Abo;
+    st[4] = Abu;
+    st[5] = Aga;
+    st[6] = Age;
+    st[7] = Agi;
+    st[8] = Ago;
+    st[9] = Agu;
+    st[10] = Aka;
+    st[11] = Ake;
+    st[12] = Aki;
+    st[13] = Ako;
+    st[14] = Aku;
+    st[15] = Ama;
+    st[16] = Ame;
+    st[17] = Ami;
+    st[18] = Amo;
+    st[19] = Amu;
+    st[20] = Asa;
+    st[21] = Ase;
+    st[22] = Asi;
+    st[23] = Aso;
+    st[24] = Asu;
+}
+
+} // namespace sha3_bmi2
+
+#endif
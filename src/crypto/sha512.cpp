@@ -4,10 +4,27 @@
 
 #include <crypto/sha512.h>
 
+#include <compat/cpuid.h>
 #include <crypto/common.h>
 
+#include <algorithm>
+#include <cassert>
 #include <cstring>
 
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#if defined(ENABLE_BMI2)
+namespace sha512_bmi2 {
+void Transform(uint64_t *s, const uint8_t *chunk, size_t blocks);
+}
+#endif
+
+#if defined(ENABLE_AVX2)
+namespace sha512_avx2 {
+void Transform_4way(uint64_t *s, const uint8_t *const *chunks);
+}
+#endif
+#endif
+
 // Internal implementation code.
 namespace {
 /// Internal SHA-512 implementation.
@@ -53,192 +70,312 @@ namespace sha512 {
         s[7] = 0x5be0cd19137e2179ull;
     }
 
-    /** Perform one SHA-512 transformation, processing a 128-byte chunk. */
-    void Transform(uint64_t *s, const uint8_t *chunk) {
-        uint64_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5],
-                 g = s[6], h = s[7];
-        uint64_t w0, w1, w2, w3, w4, w5, w6, w7, w8, w9, w10, w11, w12, w13,
-            w14, w15;
-
-        Round(a, b, c, d, e, f, g, h, 0x428a2f98d728ae22ull,
-              w0 = ReadBE64(chunk + 0));
-        Round(h, a, b, c, d, e, f, g, 0x7137449123ef65cdull,
-              w1 = ReadBE64(chunk + 8));
-        Round(g, h, a, b, c, d, e, f, 0xb5c0fbcfec4d3b2full,
-              w2 = ReadBE64(chunk + 16));
-        Round(f, g, h, a, b, c, d, e, 0xe9b5dba58189dbbcull,
-              w3 = ReadBE64(chunk + 24));
-        Round(e, f, g, h, a, b, c, d, 0x3956c25bf348b538ull,
-              w4 = ReadBE64(chunk + 32));
-        Round(d, e, f, g, h, a, b, c, 0x59f111f1b605d019ull,
-              w5 = ReadBE64(chunk + 40));
-        Round(c, d, e, f, g, h, a, b, 0x923f82a4af194f9bull,
-              w6 = ReadBE64(chunk + 48));
-        Round(b, c, d, e, f, g, h, a, 0xab1c5ed5da6d8118ull,
-              w7 = ReadBE64(chunk + 56));
-        Round(a, b, c, d, e, f, g, h, 0xd807aa98a3030242ull,
-              w8 = ReadBE64(chunk + 64));
-        Round(h, a, b, c, d, e, f, g, 0x12835b0145706fbeull,
-              w9 = ReadBE64(chunk + 72));
-        Round(g, h, a, b, c, d, e, f, 0x243185be4ee4b28cull,
-              w10 = ReadBE64(chunk + 80));
-        Round(f, g, h, a, b, c, d, e, 0x550c7dc3d5ffb4e2ull,
-              w11 = ReadBE64(chunk + 88));
-        Round(e, f, g, h, a, b, c, d, 0x72be5d74f27b896full,
-              w12 = ReadBE64(chunk + 96));
-        Round(d, e, f, g, h, a, b, c, 0x80deb1fe3b1696b1ull,
-              w13 = ReadBE64(chunk + 104));
-        Round(c, d, e, f, g, h, a, b, 0x9bdc06a725c71235ull,
-              w14 = ReadBE64(chunk + 112));
-        Round(b, c, d, e, f, g, h, a, 0xc19bf174cf692694ull,
-              w15 = ReadBE64(chunk + 120));
-
-        Round(a, b, c, d, e, f, g, h, 0xe49b69c19ef14ad2ull,
-              w0 += sigma1(w14) + w9 + sigma0(w1));
-        Round(h, a, b, c, d, e, f, g, 0xefbe4786384f25e3ull,
-              w1 += sigma1(w15) + w10 + sigma0(w2));
-        Round(g, h, a, b, c, d, e, f, 0x0fc19dc68b8cd5b5ull,
-              w2 += sigma1(w0) + w11 + sigma0(w3));
-        Round(f, g, h, a, b, c, d, e, 0x240ca1cc77ac9c65ull,
-              w3 += sigma1(w1) + w12 + sigma0(w4));
-        Round(e, f, g, h, a, b, c, d, 0x2de92c6f592b0275ull,
-              w4 += sigma1(w2) + w13 + sigma0(w5));
-        Round(d, e, f, g, h, a, b, c, 0x4a7484aa6ea6e483ull,
-              w5 += sigma1(w3) + w14 + sigma0(w6));
-        Round(c, d, e, f, g, h, a, b, 0x5cb0a9dcbd41fbd4ull,
-              w6 += sigma1(w4) + w15 + sigma0(w7));
-        Round(b, c, d, e, f, g, h, a, 0x76f988da831153b5ull,
-              w7 += sigma1(w5) + w0 + sigma0(w8));
-        Round(a, b, c, d, e, f, g, h, 0x983e5152ee66dfabull,
-              w8 += sigma1(w6) + w1 + sigma0(w9));
-        Round(h, a, b, c, d, e, f, g, 0xa831c66d2db43210ull,
-              w9 += sigma1(w7) + w2 + sigma0(w10));
-        Round(g, h, a, b, c, d, e, f, 0xb00327c898fb213full,
-              w10 += sigma1(w8) + w3 + sigma0(w11));
-        Round(f, g, h, a, b, c, d, e, 0xbf597fc7beef0ee4ull,
-              w11 += sigma1(w9) + w4 + sigma0(w12));
-        Round(e, f, g, h, a, b, c, d, 0xc6e00bf33da88fc2ull,
-              w12 += sigma1(w10) + w5 + sigma0(w13));
-        Round(d, e, f, g, h, a, b, c, 0xd5a79147930aa725ull,
-              w13 += sigma1(w11) + w6 + sigma0(w14));
-        Round(c, d, e, f, g, h, a, b, 0x06ca6351e003826full,
-              w14 += sigma1(w12) + w7 + sigma0(w15));
-        Round(b, c, d, e, f, g, h, a, 0x142929670a0e6e70ull,
-              w15 += sigma1(w13) + w8 + sigma0(w0));
-
-        Round(a, b, c, d, e, f, g, h, 0x27b70a8546d22ffcull,
-              w0 += sigma1(w14) + w9 + sigma0(w1));
-        Round(h, a, b, c, d, e, f, g, 0x2e1b21385c26c926ull,
-              w1 += sigma1(w15) + w10 + sigma0(w2));
-        Round(g, h, a, b, c, d, e, f, 0x4d2c6dfc5ac42aedull,
-              w2 += sigma1(w0) + w11 + sigma0(w3));
-        Round(f, g, h, a, b, c, d, e, 0x53380d139d95b3dfull,
-              w3 += sigma1(w1) + w12 + sigma0(w4));
-        Round(e, f, g, h, a, b, c, d, 0x650a73548baf63deull,
-              w4 += sigma1(w2) + w13 + sigma0(w5));
-        Round(d, e, f, g, h, a, b, c, 0x766a0abb3c77b2a8ull,
-              w5 += sigma1(w3) + w14 + sigma0(w6));
-        Round(c, d, e, f, g, h, a, b, 0x81c2c92e47edaee6ull,
-              w6 += sigma1(w4) + w15 + sigma0(w7));
-        Round(b, c, d, e, f, g, h, a, 0x92722c851482353bull,
-              w7 += sigma1(w5) + w0 + sigma0(w8));
-        Round(a, b, c, d, e, f, g, h, 0xa2bfe8a14cf10364ull,
-              w8 += sigma1(w6) + w1 + sigma0(w9));
-        Round(h, a, b, c, d, e, f, g, 0xa81a664bbc423001ull,
-              w9 += sigma1(w7) + w2 + sigma0(w10));
-        Round(g, h, a, b, c, d, e, f, 0xc24b8b70d0f89791ull,
-              w10 += sigma1(w8) + w3 + sigma0(w11));
-        Round(f, g, h, a, b, c, d, e, 0xc76c51a30654be30ull,
-              w11 += sigma1(w9) + w4 + sigma0(w12));
-        Round(e, f, g, h, a, b, c, d, 0xd192e819d6ef5218ull,
-              w12 += sigma1(w10) + w5 + sigma0(w13));
-        Round(d, e, f, g, h, a, b, c, 0xd69906245565a910ull,
-              w13 += sigma1(w11) + w6 + sigma0(w14));
-        Round(c, d, e, f, g, h, a, b, 0xf40e35855771202aull,
-              w14 += sigma1(w12) + w7 + sigma0(w15));
-        Round(b, c, d, e, f, g, h, a, 0x106aa07032bbd1b8ull,
-              w15 += sigma1(w13) + w8 + sigma0(w0));
-
-        Round(a, b, c, d, e, f, g, h, 0x19a4c116b8d2d0c8ull,
-              w0 += sigma1(w14) + w9 + sigma0(w1));
-        Round(h, a, b, c, d, e, f, g, 0x1e376c085141ab53ull,
-              w1 += sigma1(w15) + w10 + sigma0(w2));
-        Round(g, h, a, b, c, d, e, f, 0x2748774cdf8eeb99ull,
-              w2 += sigma1(w0) + w11 + sigma0(w3));
-        Round(f, g, h, a, b, c, d, e, 0x34b0bcb5e19b48a8ull,
-              w3 += sigma1(w1) + w12 + sigma0(w4));
-        Round(e, f, g, h, a, b, c, d, 0x391c0cb3c5c95a63ull,
-              w4 += sigma1(w2) + w13 + sigma0(w5));
-        Round(d, e, f, g, h, a, b, c, 0x4ed8aa4ae3418acbull,
-              w5 += sigma1(w3) + w14 + sigma0(w6));
-        Round(c, d, e, f, g, h, a, b, 0x5b9cca4f7763e373ull,
-              w6 += sigma1(w4) + w15 + sigma0(w7));
-        Round(b, c, d, e, f, g, h, a, 0x682e6ff3d6b2b8a3ull,
-              w7 += sigma1(w5) + w0 + sigma0(w8));
-        Round(a, b, c, d, e, f, g, h, 0x748f82ee5defb2fcull,
-              w8 += sigma1(w6) + w1 + sigma0(w9));
-        Round(h, a, b, c, d, e, f, g, 0x78a5636f43172f60ull,
-              w9 += sigma1(w7) + w2 + sigma0(w10));
-        Round(g, h, a, b, c, d, e, f, 0x84c87814a1f0ab72ull,
-              w10 += sigma1(w8) + w3 + sigma0(w11));
-        Round(f, g, h, a, b, c, d, e, 0x8cc702081a6439ecull,
-              w11 += sigma1(w9) + w4 + sigma0(w12));
-        Round(e, f, g, h, a, b, c, d, 0x90befffa23631e28ull,
-              w12 += sigma1(w10) + w5 + sigma0(w13));
-        Round(d, e, f, g, h, a, b, c, 0xa4506cebde82bde9ull,
-              w13 += sigma1(w11) + w6 + sigma0(w14));
-        Round(c, d, e, f, g, h, a, b, 0xbef9a3f7b2c67915ull,
-              w14 += sigma1(w12) + w7 + sigma0(w15));
-        Round(b, c, d, e, f, g, h, a, 0xc67178f2e372532bull,
-              w15 += sigma1(w13) + w8 + sigma0(w0));
-
-        Round(a, b, c, d, e, f, g, h, 0xca273eceea26619cull,
-              w0 += sigma1(w14) + w9 + sigma0(w1));
-        Round(h, a, b, c, d, e, f, g, 0xd186b8c721c0c207ull,
-              w1 += sigma1(w15) + w10 + sigma0(w2));
-        Round(g, h, a, b, c, d, e, f, 0xeada7dd6cde0eb1eull,
-              w2 += sigma1(w0) + w11 + sigma0(w3));
-        Round(f, g, h, a, b, c, d, e, 0xf57d4f7fee6ed178ull,
-              w3 += sigma1(w1) + w12 + sigma0(w4));
-        Round(e, f, g, h, a, b, c, d, 0x06f067aa72176fbaull,
-              w4 += sigma1(w2) + w13 + sigma0(w5));
-        Round(d, e, f, g, h, a, b, c, 0x0a637dc5a2c898a6ull,
-              w5 += sigma1(w3) + w14 + sigma0(w6));
-        Round(c, d, e, f, g, h, a, b, 0x113f9804bef90daeull,
-              w6 += sigma1(w4) + w15 + sigma0(w7));
-        Round(b, c, d, e, f, g, h, a, 0x1b710b35131c471bull,
-              w7 += sigma1(w5) + w0 + sigma0(w8));
-        Round(a, b, c, d, e, f, g, h, 0x28db77f523047d84ull,
-              w8 += sigma1(w6) + w1 + sigma0(w9));
-        Round(h, a, b, c, d, e, f, g, 0x32caab7b40c72493ull,
-              w9 += sigma1(w7) + w2 + sigma0(w10));
-        Round(g, h, a, b, c, d, e, f, 0x3c9ebe0a15c9bebcull,
-              w10 += sigma1(w8) + w3 + sigma0(w11));
-        Round(f, g, h, a, b, c, d, e, 0x431d67c49c100d4cull,
-              w11 += sigma1(w9) + w4 + sigma0(w12));
-        Round(e, f, g, h, a, b, c, d, 0x4cc5d4becb3e42b6ull,
-              w12 += sigma1(w10) + w5 + sigma0(w13));
-        Round(d, e, f, g, h, a, b, c, 0x597f299cfc657e2aull,
-              w13 += sigma1(w11) + w6 + sigma0(w14));
-        Round(c, d, e, f, g, h, a, b, 0x5fcb6fab3ad6faecull,
-              w14 + sigma1(w12) + w7 + sigma0(w15));
-        Round(b, c, d, e, f, g, h, a, 0x6c44198c4a475817ull,
-              w15 + sigma1(w13) + w8 + sigma0(w0));
-
-        s[0] += a;
-        s[1] += b;
-        s[2] += c;
-        s[3] += d;
-        s[4] += e;
-        s[5] += f;
-        s[6] += g;
-        s[7] += h;
+    /** Perform a number of SHA-512 transformations, processing 128-byte chunks. */
+    void Transform(uint64_t *s, const uint8_t *chunk, size_t blocks) {
+        while (blocks--) {
+            uint64_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5],
+                     g = s[6], h = s[7];
+            uint64_t w0, w1, w2, w3, w4, w5, w6, w7, w8, w9, w10, w11, w12, w13,
+                w14, w15;
+
+            Round(a, b, c, d, e, f, g, h, 0x428a2f98d728ae22ull,
+                  w0 = ReadBE64(chunk + 0));
+            Round(h, a, b, c, d, e, f, g, 0x7137449123ef65cdull,
+                  w1 = ReadBE64(chunk + 8));
+            Round(g, h, a, b, c, d, e, f, 0xb5c0fbcfec4d3b2full,
+                  w2 = ReadBE64(chunk + 16));
+            Round(f, g, h, a, b, c, d, e, 0xe9b5dba58189dbbcull,
+                  w3 = ReadBE64(chunk + 24));
+            Round(e, f, g, h, a, b, c, d, 0x3956c25bf348b538ull,
+                  w4 = ReadBE64(chunk + 32));
+            Round(d, e, f, g, h, a, b, c, 0x59f111f1b605d019ull,
+                  w5 = ReadBE64(chunk + 40));
+            Round(c, d, e, f, g, h, a, b, 0x923f82a4af194f9bull,
+                  w6 = ReadBE64(chunk + 48));
+            Round(b, c, d, e, f, g, h, a, 0xab1c5ed5da6d8118ull,
+                  w7 = ReadBE64(chunk + 56));
+            Round(a, b, c, d, e, f, g, h, 0xd807aa98a3030242ull,
+                  w8 = ReadBE64(chunk + 64));
+            Round(h, a, b, c, d, e, f, g, 0x12835b0145706fbeull,
+                  w9 = ReadBE64(chunk + 72));
+            Round(g, h, a, b, c, d, e, f, 0x243185be4ee4b28cull,
+                  w10 = ReadBE64(chunk + 80));
+            Round(f, g, h, a, b, c, d, e, 0x550c7dc3d5ffb4e2ull,
+                  w11 = ReadBE64(chunk + 88));
+            Round(e, f, g, h, a, b, c, d, 0x72be5d74f27b896full,
+                  w12 = ReadBE64(chunk + 96));
+            Round(d, e, f, g, h, a, b, c, 0x80deb1fe3b1696b1ull,
+                  w13 = ReadBE64(chunk + 104));
+            Round(c, d, e, f, g, h, a, b, 0x9bdc06a725c71235ull,
+                  w14 = ReadBE64(chunk + 112));
+            Round(b, c, d, e, f, g, h, a, 0xc19bf174cf692694ull,
+                  w15 = ReadBE64(chunk + 120));
+
+            Round(a, b, c, d, e, f, g, h, 0xe49b69c19ef14ad2ull,
+                  w0 += sigma1(w14) + w9 + sigma0(w1));
+            Round(h, a, b, c, d, e, f, g, 0xefbe4786384f25e3ull,
+                  w1 += sigma1(w15) + w10 + sigma0(w2));
+            Round(g, h, a, b, c, d, e, f, 0x0fc19dc68b8cd5b5ull,
+                  w2 += sigma1(w0) + w11 + sigma0(w3));
+            Round(f, g, h, a, b, c, d, e, 0x240ca1cc77ac9c65ull,
+                  w3 += sigma1(w1) + w12 + sigma0(w4));
+            Round(e, f, g, h, a, b, c, d, 0x2de92c6f592b0275ull,
+                  w4 += sigma1(w2) + w13 + sigma0(w5));
+            Round(d, e, f, g, h, a, b, c, 0x4a7484aa6ea6e483ull,
+                  w5 += sigma1(w3) + w14 + sigma0(w6));
+            Round(c, d, e, f, g, h, a, b, 0x5cb0a9dcbd41fbd4ull,
+                  w6 += sigma1(w4) + w15 + sigma0(w7));
+            Round(b, c, d, e, f, g, h, a, 0x76f988da831153b5ull,
+                  w7 += sigma1(w5) + w0 + sigma0(w8));
+            Round(a, b, c, d, e, f, g, h, 0x983e5152ee66dfabull,
+                  w8 += sigma1(w6) + w1 + sigma0(w9));
+            Round(h, a, b, c, d, e, f, g, 0xa831c66d2db43210ull,
+                  w9 += sigma1(w7) + w2 + sigma0(w10));
+            Round(g, h, a, b, c, d, e, f, 0xb00327c898fb213full,
+                  w10 += sigma1(w8) + w3 + sigma0(w11));
+            Round(f, g, h, a, b, c, d, e, 0xbf597fc7beef0ee4ull,
+                  w11 += sigma1(w9) + w4 + sigma0(w12));
+            Round(e, f, g, h, a, b, c, d, 0xc6e00bf33da88fc2ull,
+                  w12 += sigma1(w10) + w5 + sigma0(w13));
+            Round(d, e, f, g, h, a, b, c, 0xd5a79147930aa725ull,
+                  w13 += sigma1(w11) + w6 + sigma0(w14));
+            Round(c, d, e, f, g, h, a, b, 0x06ca6351e003826full,
+                  w14 += sigma1(w12) + w7 + sigma0(w15));
+            Round(b, c, d, e, f, g, h, a, 0x142929670a0e6e70ull,
+                  w15 += sigma1(w13) + w8 + sigma0(w0));
+
+            Round(a, b, c, d, e, f, g, h, 0x27b70a8546d22ffcull,
+                  w0 += sigma1(w14) + w9 + sigma0(w1));
+            Round(h, a, b, c, d, e, f, g, 0x2e1b21385c26c926ull,
+                  w1 += sigma1(w15) + w10 + sigma0(w2));
+            Round(g, h, a, b, c, d, e, f, 0x4d2c6dfc5ac42aedull,
+                  w2 += sigma1(w0) + w11 + sigma0(w3));
+            Round(f, g, h, a, b, c, d, e, 0x53380d139d95b3dfull,
+                  w3 += sigma1(w1) + w12 + sigma0(w4));
+            Round(e, f, g, h, a, b, c, d, 0x650a73548baf63deull,
+                  w4 += sigma1(w2) + w13 + sigma0(w5));
+            Round(d, e, f, g, h, a, b, c, 0x766a0abb3c77b2a8ull,
+                  w5 += sigma1(w3) + w14 + sigma0(w6));
+            Round(c, d, e, f, g, h, a, b, 0x81c2c92e47edaee6ull,
+                  w6 += sigma1(w4) + w15 + sigma0(w7));
+            Round(b, c, d, e, f, g, h, a, 0x92722c851482353bull,
+                  w7 += sigma1(w5) + w0 + sigma0(w8));
+            Round(a, b, c, d, e, f, g, h, 0xa2bfe8a14cf10364ull,
+                  w8 += sigma1(w6) + w1 + sigma0(w9));
+            Round(h, a, b, c, d, e, f, g, 0xa81a664bbc423001ull,
+                  w9 += sigma1(w7) + w2 + sigma0(w10));
+            Round(g, h, a, b, c, d, e, f, 0xc24b8b70d0f89791ull,
+                  w10 += sigma1(w8) + w3 + sigma0(w11));
+            Round(f, g, h, a, b, c, d, e, 0xc76c51a30654be30ull,
+                  w11 += sigma1(w9) + w4 + sigma0(w12));
+            Round(e, f, g, h, a, b, c, d, 0xd192e819d6ef5218ull,
+                  w12 += sigma1(w10) + w5 + sigma0(w13));
+            Round(d, e, f, g, h, a, b, c, 0xd69906245565a910ull,
+                  w13 += sigma1(w11) + w6 + sigma0(w14));
+            Round(c, d, e, f, g, h, a, b, 0xf40e35855771202aull,
+                  w14 += sigma1(w12) + w7 + sigma0(w15));
+            Round(b, c, d, e, f, g, h, a, 0x106aa07032bbd1b8ull,
+                  w15 += sigma1(w13) + w8 + sigma0(w0));
+
+            Round(a, b, c, d, e, f, g, h, 0x19a4c116b8d2d0c8ull,
+                  w0 += sigma1(w14) + w9 + sigma0(w1));
+            Round(h, a, b, c, d, e, f, g, 0x1e376c085141ab53ull,
+                  w1 += sigma1(w15) + w10 + sigma0(w2));
+            Round(g, h, a, b, c, d, e, f, 0x2748774cdf8eeb99ull,
+                  w2 += sigma1(w0) + w11 + sigma0(w3));
+            Round(f, g, h, a, b, c, d, e, 0x34b0bcb5e19b48a8ull,
+                  w3 += sigma1(w1) + w12 + sigma0(w4));
+            Round(e, f, g, h, a, b, c, d, 0x391c0cb3c5c95a63ull,
+                  w4 += sigma1(w2) + w13 + sigma0(w5));
+            Round(d, e, f, g, h, a, b, c, 0x4ed8aa4ae3418acbull,
+                  w5 += sigma1(w3) + w14 + sigma0(w6));
+            Round(c, d, e, f, g, h, a, b, 0x5b9cca4f7763e373ull,
+                  w6 += sigma1(w4) + w15 + sigma0(w7));
+            Round(b, c, d, e, f, g, h, a, 0x682e6ff3d6b2b8a3ull,
+                  w7 += sigma1(w5) + w0 + sigma0(w8));
+            Round(a, b, c, d, e, f, g, h, 0x748f82ee5defb2fcull,
+                  w8 += sigma1(w6) + w1 + sigma0(w9));
+            Round(h, a, b, c, d, e, f, g, 0x78a5636f43172f60ull,
+                  w9 += sigma1(w7) + w2 + sigma0(w10));
+            Round(g, h, a, b, c, d, e, f, 0x84c87814a1f0ab72ull,
+                  w10 += sigma1(w8) + w3 + sigma0(w11));
+            Round(f, g, h, a, b, c, d, e, 0x8cc702081a6439ecull,
+                  w11 += sigma1(w9) + w4 + sigma0(w12));
+            Round(e, f, g, h, a, b, c, d, 0x90befffa23631e28ull,
+                  w12 += sigma1(w10) + w5 + sigma0(w13));
+            Round(d, e, f, g, h, a, b, c, 0xa4506cebde82bde9ull,
+                  w13 += sigma1(w11) + w6 + sigma0(w14));
+            Round(c, d, e, f, g, h, a, b, 0xbef9a3f7b2c67915ull,
+                  w14 += sigma1(w12) + w7 + sigma0(w15));
+            Round(b, c, d, e, f, g, h, a, 0xc67178f2e372532bull,
+                  w15 += sigma1(w13) + w8 + sigma0(w0));
+
+            Round(a, b, c, d, e, f, g, h, 0xca273eceea26619cull,
+                  w0 += sigma1(w14) + w9 + sigma0(w1));
+            Round(h, a, b, c, d, e, f, g, 0xd186b8c721c0c207ull,
+                  w1 += sigma1(w15) + w10 + sigma0(w2));
+            Round(g, h, a, b, c, d, e, f, 0xeada7dd6cde0eb1eull,
+                  w2 += sigma1(w0) + w11 + sigma0(w3));
+            Round(f, g, h, a, b, c, d, e, 0xf57d4f7fee6ed178ull,
+                  w3 += sigma1(w1) + w12 + sigma0(w4));
+            Round(e, f, g, h, a, b, c, d, 0x06f067aa72176fbaull,
+                  w4 += sigma1(w2) + w13 + sigma0(w5));
+            Round(d, e, f, g, h, a, b, c, 0x0a637dc5a2c898a6ull,
+                  w5 += sigma1(w3) + w14 + sigma0(w6));
+            Round(c, d, e, f, g, h, a, b, 0x113f9804bef90daeull,
+                  w6 += sigma1(w4) + w15 + sigma0(w7));
+            Round(b, c, d, e, f, g, h, a, 0x1b710b35131c471bull,
+                  w7 += sigma1(w5) + w0 + sigma0(w8));
+            Round(a, b, c, d, e, f, g, h, 0x28db77f523047d84ull,
+                  w8 += sigma1(w6) + w1 + sigma0(w9));
+            Round(h, a, b, c, d, e, f, g, 0x32caab7b40c72493ull,
+                  w9 += sigma1(w7) + w2 + sigma0(w10));
+            Round(g, h, a, b, c, d, e, f, 0x3c9ebe0a15c9bebcull,
+                  w10 += sigma1(w8) + w3 + sigma0(w11));
+            Round(f, g, h, a, b, c, d, e, 0x431d67c49c100d4cull,
+                  w11 += sigma1(w9) + w4 + sigma0(w12));
+            Round(e, f, g, h, a, b, c, d, 0x4cc5d4becb3e42b6ull,
+                  w12 += sigma1(w10) + w5 + sigma0(w13));
+            Round(d, e, f, g, h, a, b, c, 0x597f299cfc657e2aull,
+                  w13 += sigma1(w11) + w6 + sigma0(w14));
+            Round(c, d, e, f, g, h, a, b, 0x5fcb6fab3ad6faecull,
+                  w14 + sigma1(w12) + w7 + sigma0(w15));
+            Round(b, c, d, e, f, g, h, a, 0x6c44198c4a475817ull,
+                  w15 + sigma1(w13) + w8 + sigma0(w0));
+
+            s[0] += a;
+            s[1] += b;
+            s[2] += c;
+            s[3] += d;
+            s[4] += e;
+            s[5] += f;
+            s[6] += g;
+            s[7] += h;
+            chunk += 128;
+        }
     }
 
 } // namespace sha512
 
+typedef void (*TransformType)(uint64_t *, const uint8_t *, size_t);
+typedef void (*TransformMultiType)(uint64_t *, const uint8_t *const *);
+
+TransformType Transform = sha512::Transform;
+TransformMultiType TransformMulti_4way = nullptr;
+
+bool SelfTest() {
+    // Input state (equal to the initial SHA512 state), followed by the state
+    // after each of the four blocks of data.
+    static const uint64_t result[5][8] = {
+        {0x6a09e667f3bcc908ull, 0xbb67ae8584caa73bull, 0x3c6ef372fe94f82bull, 0xa54ff53a5f1d36f1ull, 0x510e527fade682d1ull, 0x9b05688c2b3e6c1full, 0x1f83d9abfb41bd6bull, 0x5be0cd19137e2179ull},
+        {0x671082c8e7685d01ull, 0x6b92f0fe98b2e13aull, 0x533263155a57f8e6ull, 0x97e63edeba494df4ull, 0x2412d1d36ba348c8ull, 0x70618e0840f3cb67ull, 0x2db8f477243531fdull, 0x19fdc842336a72eeull},
+        {0x37002192093d5c50ull, 0xe7a9da3690f2fbdbull, 0xfc560541055d9d9eull, 0xd91b7a5463d082dfull, 0x9b284f5c05245b09ull, 0x5bb0630fb47a2cceull, 0x6cd83b17cc74f304ull, 0xf5a8b9455c3e2962ull},
+        {0xbfeb3e1b17e460e3ull, 0xbbc00e6ddfd7266dull, 0x0a9f458094a1993cull, 0x00dc89c49d96e31dull, 0xfb3598b84baaf24full, 0x57c4db8d82fd7530ull, 0x058548d2b9a160a4ull, 0xd3841548334dfa36ull},
+        {0x37fe66a080d69989ull, 0xeb8b75de6847b75full, 0x670101ed9a8c4a2aull, 0x91ae36413d6c02e6ull, 0xc89318bddbf5e9ffull, 0x5cd3f3a292ebc568ull, 0x58a52f006f022e58ull, 0x4f502b30eab6c4b3ull}};
+
+    uint8_t data[4 * 128];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = uint8_t(i * 181 + 43);
+    }
+
+    // Test Transform() for 0 through 4 blocks.
+    for (size_t i = 0; i <= 4; ++i) {
+        uint64_t state[8];
+        std::copy(result[0], result[0] + 8, state);
+        Transform(state, data, i);
+        if (!std::equal(state, state + 8, result[i])) {
+            return false;
+        }
+    }
+
+    // Test TransformMulti_4way, if available, taking lane i from result[i]
+    // to result[i + 1] over the i-th block.
+    if (TransformMulti_4way) {
+        uint64_t state[4 * 8];
+        const uint8_t *chunks[4];
+        for (size_t i = 0; i < 4; ++i) {
+            std::copy(result[i], result[i] + 8, state + 8 * i);
+            chunks[i] = data + 128 * i;
+        }
+        TransformMulti_4way(state, chunks);
+        for (size_t i = 0; i < 4; ++i) {
+            if (!std::equal(state + 8 * i, state + 8 * i + 8, result[i + 1])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+#if defined(USE_ASM) &&                                                        \
+    (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+/** Check whether the OS has enabled AVX registers. */
+bool AVXEnabled() {
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
 } // namespace
 
+std::string SHA512AutoDetect() {
+    std::string ret = "standard";
+#if defined(USE_ASM) && defined(HAVE_GETCPUID)
+    bool have_xsave = false;
+    bool have_avx = false;
+    bool have_avx2 = false;
+    bool have_bmi1 = false;
+    bool have_bmi2 = false;
+    bool enabled_avx = false;
+
+    (void)AVXEnabled;
+    (void)have_avx;
+    (void)have_xsave;
+    (void)have_avx2;
+    (void)have_bmi1;
+    (void)have_bmi2;
+    (void)enabled_avx;
+
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(0, 0, eax, ebx, ecx, edx);
+    const uint32_t max_leaf = eax;
+    GetCPUID(1, 0, eax, ebx, ecx, edx);
+    have_xsave = (ecx >> 27) & 1;
+    have_avx = (ecx >> 28) & 1;
+    if (have_xsave && have_avx) {
+        enabled_avx = AVXEnabled();
+    }
+    if (max_leaf >= 7) {
+        GetCPUID(7, 0, eax, ebx, ecx, edx);
+        have_bmi1 = (ebx >> 3) & 1;
+        have_avx2 = (ebx >> 5) & 1;
+        have_bmi2 = (ebx >> 8) & 1;
+    }
+
+#if defined(ENABLE_BMI2) && !defined(BUILD_AVM_INTERNAL)
+    if (have_bmi1 && have_bmi2) {
+        Transform = sha512_bmi2::Transform;
+        ret = "bmi2(1way)";
+    }
+#endif
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_AVM_INTERNAL)
+    if (have_avx2 && have_avx && enabled_avx) {
+        TransformMulti_4way = sha512_avx2::Transform_4way;
+        ret += ",avx2(4way)";
+    }
+#endif
+#endif
+
+    assert(SelfTest());
+    return ret;
+}
+
+void SHA512Transform(uint64_t *s, const uint8_t *chunk, size_t blocks) {
+    Transform(s, chunk, blocks);
+}
+
 ////// SHA-512
 
 CSHA512::CSHA512() : bytes(0) {
@@ -253,14 +390,15 @@ CSHA512 &CSHA512::Write(const uint8_t *data, size_t len) {
         memcpy(buf + bufsize, data, 128 - bufsize);
         bytes += 128 - bufsize;
         data += 128 - bufsize;
-        sha512::Transform(s, buf);
+        Transform(s, buf, 1);
         bufsize = 0;
     }
-    while (end - data >= 128) {
+    if (end - data >= 128) {
+        size_t blocks = (end - data) / 128;
         // Process full chunks directly from the source.
-        sha512::Transform(s, data);
-        data += 128;
-        bytes += 128;
+        Transform(s, data, blocks);
+        data += 128 * blocks;
+        bytes += 128 * blocks;
     }
     if (end > data) {
         // Fill the buffer with what remains.
@@ -291,3 +429,128 @@ CSHA512 &CSHA512::Reset() {
     sha512::Initialize(s);
     return *this;
 }
+
+////// Multi-buffer SHA-512
+
+namespace {
+/** A message being hashed in one lane of SHA512Multi. */
+struct MultiLane {
+    const uint8_t *data = nullptr;
+    size_t remaining = 0;
+    uint64_t bytes = 0;
+    uint8_t *output = nullptr;
+    // 0 while reading data, 1 when only the length block is left, 2 once
+    // the last block has been handed out.
+    int stage = 0;
+};
+
+/**
+ * Return the next padded block of the lane's message. Whole blocks are read
+ * in place, the padded tail is built in block.
+ */
+const uint8_t *NextBlock(MultiLane &lane, uint8_t *block) {
+    size_t n = 0;
+    if (lane.stage == 0) {
+        if (lane.remaining >= 128) {
+            const uint8_t *chunk = lane.data;
+            lane.data += 128;
+            lane.remaining -= 128;
+            return chunk;
+        }
+        n = lane.remaining;
+        if (n) {
+            memcpy(block, lane.data, n);
+        }
+        lane.remaining = 0;
+        block[n++] = 0x80;
+        if (n > 112) {
+            memset(block + n, 0, 128 - n);
+            lane.stage = 1;
+            return block;
+        }
+    }
+    memset(block + n, 0, 120 - n);
+    WriteBE64(block + 120, lane.bytes << 3);
+    lane.stage = 2;
+    return block;
+}
+
+void FinishLane(const MultiLane &lane, const uint64_t *s, size_t outputSize) {
+    for (size_t i = 0; i < outputSize / 8; ++i) {
+        WriteBE64(lane.output + 8 * i, s[i]);
+    }
+}
+
+void HashLane(MultiLane &lane, uint64_t *s, size_t outputSize) {
+    uint8_t block[128];
+    if (lane.stage == 0) {
+        const size_t blocks = lane.remaining / 128;
+        Transform(s, lane.data, blocks);
+        lane.data += 128 * blocks;
+        lane.remaining -= 128 * blocks;
+    }
+    while (lane.stage != 2) {
+        Transform(s, NextBlock(lane, block), 1);
+    }
+    FinishLane(lane, s, outputSize);
+}
+} // namespace
+
+void SHA512FamilyMulti(const uint64_t *init, size_t outputSize, const uint8_t *const *inputs, const size_t *lengths, uint8_t *outputs, size_t count) {
+    static const uint8_t unused[128] = {0};
+
+    // Busy lanes are kept in slots [0, busy), with their state at 8 * slot.
+    MultiLane lanes[4];
+    uint64_t states[4 * 8] = {0};
+    uint8_t blocks[4][128];
+    const uint8_t *chunks[4];
+    size_t busy = 0;
+    size_t next = 0;
+    auto start = [&](size_t slot) {
+        lanes[slot] = MultiLane();
+        lanes[slot].data = inputs[next];
+        lanes[slot].remaining = lengths[next];
+        lanes[slot].bytes = lengths[next];
+        lanes[slot].output = outputs + outputSize * next;
+        std::copy(init, init + 8, states + 8 * slot);
+        ++next;
+    };
+    while (TransformMulti_4way) {
+        while (busy < 4 && next < count) {
+            start(busy++);
+        }
+        // Below half occupancy the single lane transform does the same work
+        // for less.
+        if (busy * 2 < 4) {
+            break;
+        }
+        for (size_t slot = 0; slot < 4; ++slot) {
+            chunks[slot] = slot < busy ? NextBlock(lanes[slot], blocks[slot]) : unused;
+        }
+        TransformMulti_4way(states, chunks);
+        for (size_t slot = 0; slot < busy;) {
+            if (lanes[slot].stage != 2) {
+                ++slot;
+                continue;
+            }
+            FinishLane(lanes[slot], states + 8 * slot, outputSize);
+            --busy;
+            lanes[slot] = lanes[busy];
+            std::copy(states + 8 * busy, states + 8 * busy + 8, states + 8 * slot);
+        }
+    }
+
+    for (size_t slot = 0; slot < busy; ++slot) {
+        HashLane(lanes[slot], states + 8 * slot, outputSize);
+    }
+    while (next < count) {
+        start(0);
+        HashLane(lanes[0], states, outputSize);
+    }
+}
+
+void SHA512Multi(const uint8_t *const *inputs, const size_t *lengths, uint8_t *outputs, size_t count) {
+    uint64_t init[8];
+    sha512::Initialize(init);
+    SHA512FamilyMulti(init, CSHA512::OUTPUT_SIZE, inputs, lengths, outputs, count);
+}
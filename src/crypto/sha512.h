@@ -6,6 +6,7 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <string>
 
 /** A hasher class for SHA-512. */
 class CSHA512 {
@@ -22,3 +23,30 @@ public:
     void Finalize(uint8_t hash[OUTPUT_SIZE]);
     CSHA512 &Reset();
 };
+
+/**
+ * Autodetect the best available SHA512 implementation.
+ * Returns the name of the implementation.
+ */
+std::string SHA512AutoDetect();
+
+/**
+ * Run the SHA512 transform selected by SHA512AutoDetect over blocks 128 byte
+ * chunks. CSHA512_256 shares it.
+ */
+void SHA512Transform(uint64_t *s, const uint8_t *chunk, size_t blocks);
+
+/**
+ * Compute the SHA512's of count independent messages of any length, running
+ * them side by side in the lanes of the multi-buffer transform when
+ * SHA512AutoDetect found one.
+ * output:  pointer to a count*64 byte output buffer
+ */
+void SHA512Multi(const uint8_t *const *inputs, const size_t *lengths, uint8_t *output, size_t count);
+
+/**
+ * SHA512Multi for any member of the SHA512 family: each message starts from
+ * the 8 word state init and the first outputSize bytes of its final state are
+ * written, outputSize apart.
+ */
+void SHA512FamilyMulti(const uint64_t *init, size_t outputSize, const uint8_t *const *inputs, const size_t *lengths, uint8_t *output, size_t count);
@@ -17,4 +17,10 @@ public:
     CSHA512_256 &Write(const uint8_t *data, size_t len);
     void Finalize(uint8_t hash[OUTPUT_SIZE]);
     CSHA512_256 &Reset();
-};
\ No newline at end of file
+};
+
+/**
+ * Compute the SHA512/256's of count independent messages, as SHA512Multi.
+ * output:  pointer to a count*32 byte output buffer
+ */
+void SHA512_256Multi(const uint8_t *const *inputs, const size_t *lengths, uint8_t *output, size_t count);
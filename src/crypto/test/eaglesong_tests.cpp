@@ -0,0 +1,43 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Checks EaglesongHash against the reference implementation for every input
+// length a script can hash, with the portable permutation and with the one
+// picked by EaglesongAutoDetect.
+
+#include <crypto/eaglesong.h>
+#include <script/script.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static bool CheckAllLengths(const std::string &implementation) {
+    std::vector<unsigned char> data(MAX_SCRIPT_ELEMENT_SIZE);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i * 181 + 43);
+    }
+
+    bool ok = true;
+    for (unsigned int length = 0; length <= MAX_SCRIPT_ELEMENT_SIZE; ++length) {
+        unsigned char out[32], expected[32];
+        EaglesongHash(out, data.data(), length);
+        eaglesong_ref::Hash(expected, data.data(), length);
+        if (memcmp(out, expected, sizeof(out))) {
+            fprintf(stderr, "%s: mismatch for a %u byte input\n", implementation.c_str(), length);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main() {
+    bool ok = CheckAllLengths("standard");
+    const std::string detected = EaglesongAutoDetect();
+    if (detected != "standard") {
+        ok &= CheckAllLengths(detected);
+    }
+    return ok ? 0 : 1;
+}
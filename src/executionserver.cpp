@@ -0,0 +1,462 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <executionserver.h>
+
+#include <crypto/common.h>
+#include <script/atomicalsconsensus.h>
+#include <streams.h>
+#include <tinyformat.h>
+#include <version.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ios>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+/**
+ * Room for each output of a call before it runs. An output is about the size of
+ * the input it updates, which is what it is given, and a call whose outputs do
+ * not fit runs again with buffers of the size they need.
+ */
+constexpr size_t MIN_OUTPUT_SIZE = 4 * 1024;
+constexpr size_t OUTPUT_COUNT = 11;
+
+//! Bytes read from a connection at once.
+constexpr size_t READ_SIZE = 256 * 1024;
+
+//! No more requests are read from a client that does not read its responses.
+constexpr size_t MAX_PENDING_OUTPUT = 64 * 1024 * 1024;
+
+//! Completions handled at once.
+constexpr unsigned int COMPLETION_BATCH = 64;
+
+bool SetNonBlocking(int fd) {
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1 && fcntl(fd, F_SETFD, FD_CLOEXEC) != -1;
+}
+
+//! Whether a socket call failed only because it would block or was interrupted.
+bool Retry(int error) {
+#if EWOULDBLOCK != EAGAIN
+    if (error == EWOULDBLOCK) {
+        return true;
+    }
+#endif
+    return error == EAGAIN || error == EINTR;
+}
+
+} // namespace
+
+struct ExecutionServer::Connection {
+    explicit Connection(int fdIn) : fd(fdIn) {}
+    ~Connection() { close(fd); }
+
+    int fd;
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> output;
+    size_t written = 0;
+    //! Requests read whose call has not completed yet.
+    size_t pending = 0;
+    //! Cleared at the end of the input or on a malformed frame: the connection
+    //! is closed once the responses to the requests already read are written.
+    bool reading = true;
+    //! Set when the connection fails: it is closed once its calls complete.
+    bool broken = false;
+};
+
+struct ExecutionServer::PendingCall {
+    atomicalsconsensus_call call{};
+    Connection *connection = nullptr;
+    ExecutionRequest request;
+    std::unique_ptr<uint8_t[]> outputs;
+    int result = 0;
+
+    //! Points the call to the request and to outputs sized from it.
+    void Prepare() {
+        call.lock_script = request.lockScript.data();
+        call.lock_script_len = request.lockScript.size();
+        call.unlock_script = request.unlockScript.data();
+        call.unlock_script_len = request.unlockScript.size();
+        call.tx_to = request.tx.data();
+        call.tx_to_len = request.tx.size();
+        call.auth_pub_key = request.authPubKey.data();
+        call.auth_pub_key_len = request.authPubKey.size();
+        call.ft_state_cbor = request.ftState.data();
+        call.ft_state_cbor_len = request.ftState.size();
+        call.ft_state_incoming_cbor = request.ftStateIncoming.data();
+        call.ft_state_incoming_cbor_len = request.ftStateIncoming.size();
+        call.nft_state_cbor = request.nftState.data();
+        call.nft_state_cbor_len = request.nftState.size();
+        call.nft_state_incoming_cbor = request.nftStateIncoming.data();
+        call.nft_state_incoming_cbor_len = request.nftStateIncoming.size();
+        call.contract_external_state_cbor = request.contractExternalState.data();
+        call.contract_external_state_cbor_len = request.contractExternalState.size();
+        call.contract_state_cbor = request.contractState.data();
+        call.contract_state_cbor_len = request.contractState.size();
+        call.prev_state_hash = request.prevStateHash.begin();
+        call.flags = request.flags;
+        // Without digests of the right size, a call asking for the v2 state
+        // hash fails with atomicalsconsensus_ERR_INVALID_FLAGS
+        if (request.stateDigests.size() == ATOMICALSCONSENSUS_STATE_DIGESTS_SIZE) {
+            call.state_digests = request.stateDigests.data();
+        }
+
+        call.user_data = this;
+
+        Allocate(MIN_OUTPUT_SIZE + std::max({request.contractState.size(),
+                                             request.ftState.size() + request.ftStateIncoming.size(),
+                                             request.nftState.size() + request.nftStateIncoming.size()}));
+    }
+
+    //! Points the call to new outputs of capacity bytes each. They are left
+    //! uninitialized, so that only the pages written to are backed.
+    void Allocate(size_t capacity) {
+        outputs.reset(new uint8_t[32 + OUTPUT_COUNT * capacity]);
+        uint8_t *output = outputs.get();
+        call.state_hash = output;
+        output += 32;
+        for (uint8_t **buffer : {&call.state_final, &call.state_updates, &call.state_deletes,
+                                 &call.ft_balances_result, &call.ft_balances_updates_result,
+                                 &call.nft_balances_result, &call.nft_balances_updates_result, &call.ft_withdraws,
+                                 &call.nft_withdraws, &call.ft_balances_added, &call.nft_puts}) {
+            *buffer = output;
+            output += capacity;
+        }
+        call.output_capacity = capacity;
+    }
+
+    //! Whether the call failed only because its outputs did not fit, after
+    //! growing them to the size they need.
+    bool Grow() {
+        if (result != 0 || call.err != atomicalsconsensus_ERR_OUTPUT_SIZE) {
+            return false;
+        }
+        const size_t needed = std::max({call.state_final_len, call.state_updates_len, call.state_deletes_len,
+                                        call.ft_balances_result_len, call.ft_balances_updates_result_len,
+                                        call.nft_balances_result_len, call.nft_balances_updates_result_len,
+                                        call.ft_withdraws_len, call.nft_withdraws_len, call.ft_balances_added_len,
+                                        call.nft_puts_len});
+        if (needed <= call.output_capacity) {
+            return false;
+        }
+        Allocate(needed);
+        return true;
+    }
+
+    ExecutionResponse Response() const {
+        ExecutionResponse response;
+        response.id = request.id;
+        response.result = result;
+        response.error = call.err;
+        response.scriptError = call.script_error;
+        response.scriptErrorOpNum = call.script_error_op_num;
+        // The outputs are only written by a call that succeeds
+        if (result != 1) {
+            return response;
+        }
+        std::copy(call.state_hash, call.state_hash + 32, response.stateHash.begin());
+        auto copy = [](const uint8_t *buffer, unsigned int size) { return std::vector<uint8_t>(buffer, buffer + size); };
+        response.stateFinal = copy(call.state_final, call.state_final_len);
+        response.stateUpdates = copy(call.state_updates, call.state_updates_len);
+        response.stateDeletes = copy(call.state_deletes, call.state_deletes_len);
+        response.ftBalances = copy(call.ft_balances_result, call.ft_balances_result_len);
+        response.ftBalancesUpdates = copy(call.ft_balances_updates_result, call.ft_balances_updates_result_len);
+        response.nftBalances = copy(call.nft_balances_result, call.nft_balances_result_len);
+        response.nftBalancesUpdates = copy(call.nft_balances_updates_result, call.nft_balances_updates_result_len);
+        response.ftWithdraws = copy(call.ft_withdraws, call.ft_withdraws_len);
+        response.nftWithdraws = copy(call.nft_withdraws, call.nft_withdraws_len);
+        response.ftBalancesAdded = copy(call.ft_balances_added, call.ft_balances_added_len);
+        response.nftPuts = copy(call.nft_puts, call.nft_puts_len);
+        if (call.state_digests) {
+            response.stateDigests = request.stateDigests;
+        }
+        return response;
+    }
+};
+
+ExecutionServer::ExecutionServer(std::string socketPath, unsigned int queueEntries, unsigned int threads)
+    : _socketPath(std::move(socketPath)), _queueEntries(std::max(queueEntries, 1u)), _threads(threads) {}
+
+ExecutionServer::~ExecutionServer() {
+    if (_ring) {
+        // The calls in flight point to requests and connections owned here
+        atomicalsconsensus_completion completions[COMPLETION_BATCH];
+        while (_inFlight > 0) {
+            const unsigned int count = atomicalsconsensus_ring_wait(_ring, completions, COMPLETION_BATCH);
+            for (unsigned int i = 0; i < count; i++) {
+                delete static_cast<PendingCall *>(completions[i].call->user_data);
+            }
+            _inFlight -= count;
+        }
+        atomicalsconsensus_ring_destroy(_ring);
+    }
+    _backlog.clear();
+    _connections.clear();
+    if (_listenFd != -1) {
+        close(_listenFd);
+        unlink(_socketPath.c_str());
+    }
+    for (int fd : _interruptFds) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+}
+
+bool ExecutionServer::Listen(std::string &error) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (_socketPath.empty() || _socketPath.size() >= sizeof(address.sun_path)) {
+        error = strprintf("Invalid socket path %s", _socketPath);
+        return false;
+    }
+    std::copy(_socketPath.begin(), _socketPath.end(), address.sun_path);
+
+    if (pipe(_interruptFds) != 0 || !SetNonBlocking(_interruptFds[0]) || !SetNonBlocking(_interruptFds[1])) {
+        error = strprintf("Cannot create a pipe: %s", strerror(errno));
+        return false;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || !SetNonBlocking(fd)) {
+        error = strprintf("Cannot create a socket: %s", strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return false;
+    }
+    int bound = bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+    if (bound != 0 && errno == EADDRINUSE) {
+        // Left by a server that did not exit cleanly, unless one answers on it
+        const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        const bool answered =
+            probe != -1 && connect(probe, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+        if (probe != -1) {
+            close(probe);
+        }
+        if (answered) {
+            close(fd);
+            error = strprintf("A server is already listening on %s", _socketPath);
+            return false;
+        }
+        unlink(_socketPath.c_str());
+        bound = bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+    }
+    if (bound != 0 || listen(fd, SOMAXCONN) != 0) {
+        error = strprintf("Cannot listen on %s: %s", _socketPath, strerror(errno));
+        close(fd);
+        return false;
+    }
+    _listenFd = fd;
+    _ring = atomicalsconsensus_ring_create(_queueEntries, _threads);
+    return true;
+}
+
+void ExecutionServer::Interrupt() {
+    const char byte = 0;
+    [[maybe_unused]] ssize_t written = write(_interruptFds[1], &byte, 1);
+}
+
+void ExecutionServer::Run() {
+    const int ringFd = atomicalsconsensus_ring_fd(_ring);
+    std::vector<pollfd> fds;
+    for (;;) {
+        // poll ignores negative descriptors, such as a ring without eventfd
+        fds.assign({{_interruptFds[0], POLLIN, 0}, {_listenFd, POLLIN, 0}, {ringFd, POLLIN, 0}});
+        const bool backlogFull = _backlog.size() >= _queueEntries;
+        for (const std::unique_ptr<Connection> &connection : _connections) {
+            short events = 0;
+            if (connection->reading && !backlogFull && connection->output.size() < MAX_PENDING_OUTPUT) {
+                events |= POLLIN;
+            }
+            if (connection->written < connection->output.size()) {
+                events |= POLLOUT;
+            }
+            fds.push_back({connection->fd, events, 0});
+        }
+        // Without eventfd, completions are polled for while calls are in flight
+        const int timeout = ringFd == -1 && _inFlight > 0 ? 1 : -1;
+        if (poll(fds.data(), fds.size(), timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (fds[0].revents) {
+            return;
+        }
+        if (fds[1].revents & POLLIN) {
+            Accept();
+        }
+        if (fds[2].revents & POLLIN) {
+            uint64_t count;
+            [[maybe_unused]] ssize_t read = ::read(ringFd, &count, sizeof(count));
+        }
+
+        // Completions first, to make room in the ring for the requests read
+        Complete();
+        const size_t polled = fds.size() - 3;
+        for (size_t i = 0; i < polled; i++) {
+            Connection &connection = *_connections[i];
+            if (fds[3 + i].revents & POLLERR) {
+                connection.broken = true;
+            } else if ((fds[3 + i].events & POLLIN) && (fds[3 + i].revents & (POLLIN | POLLHUP))) {
+                Read(connection);
+            }
+        }
+        Submit();
+        for (const std::unique_ptr<Connection> &connection : _connections) {
+            if (!connection->broken && connection->written < connection->output.size()) {
+                Write(*connection);
+            }
+        }
+
+        _connections.erase(std::remove_if(_connections.begin(), _connections.end(),
+                                          [](const std::unique_ptr<Connection> &connection) {
+                                              const bool done = connection->broken ||
+                                                                (!connection->reading &&
+                                                                 connection->written == connection->output.size());
+                                              return done && connection->pending == 0;
+                                          }),
+                           _connections.end());
+    }
+}
+
+void ExecutionServer::Accept() {
+    for (;;) {
+        const int fd = accept(_listenFd, nullptr, nullptr);
+        if (fd == -1) {
+            return;
+        }
+        if (!SetNonBlocking(fd)) {
+            close(fd);
+            continue;
+        }
+        _connections.push_back(std::make_unique<Connection>(fd));
+    }
+}
+
+void ExecutionServer::Read(Connection &connection) {
+    const size_t size = connection.input.size();
+    connection.input.resize(size + READ_SIZE);
+    const ssize_t received = recv(connection.fd, connection.input.data() + size, READ_SIZE, 0);
+    connection.input.resize(size + std::max<ssize_t>(received, 0));
+    if (received == 0) {
+        connection.reading = false;
+    } else if (received < 0) {
+        if (!Retry(errno)) {
+            connection.broken = true;
+        }
+        return;
+    }
+
+    // Every complete frame read becomes a call
+    size_t pos = 0;
+    while (connection.input.size() - pos >= 4) {
+        const uint32_t frameSize = ReadLE32(connection.input.data() + pos);
+        if (frameSize > MAX_EXECUTION_FRAME_SIZE) {
+            connection.reading = false;
+            break;
+        }
+        const size_t frameEnd = pos + 4 + frameSize;
+        if (frameEnd > connection.input.size()) {
+            break;
+        }
+        auto pending = std::make_unique<PendingCall>();
+        try {
+            VectorReader reader(SER_NETWORK, PROTOCOL_VERSION, connection.input, pos + 4);
+            reader >> pending->request;
+            if (reader.size() != connection.input.size() - frameEnd) {
+                throw std::ios_base::failure("ExecutionServer: frame size mismatch");
+            }
+        } catch (const std::ios_base::failure &) {
+            connection.reading = false;
+            break;
+        }
+        pos = frameEnd;
+        pending->connection = &connection;
+        pending->Prepare();
+        connection.pending++;
+        _backlog.push_back(std::move(pending));
+    }
+    // A partial frame is kept for the next read, unless nothing more is read
+    if (connection.reading) {
+        connection.input.erase(connection.input.begin(), connection.input.begin() + pos);
+    } else {
+        connection.input.clear();
+    }
+}
+
+void ExecutionServer::Submit() {
+    if (_backlog.empty()) {
+        return;
+    }
+    std::vector<atomicalsconsensus_call *> calls;
+    calls.reserve(_backlog.size());
+    for (const std::unique_ptr<PendingCall> &pending : _backlog) {
+        calls.push_back(&pending->call);
+    }
+    const unsigned int submitted = atomicalsconsensus_ring_submit(_ring, calls.data(), calls.size());
+    // Owned by the ring until they complete
+    for (unsigned int i = 0; i < submitted; i++) {
+        _backlog[i].release();
+    }
+    _inFlight += submitted;
+    _backlog.erase(_backlog.begin(), _backlog.begin() + submitted);
+}
+
+void ExecutionServer::Complete() {
+    atomicalsconsensus_completion completions[COMPLETION_BATCH];
+    unsigned int count;
+    while ((count = atomicalsconsensus_ring_poll(_ring, completions, COMPLETION_BATCH)) > 0) {
+        _inFlight -= count;
+        for (unsigned int i = 0; i < count; i++) {
+            std::unique_ptr<PendingCall> pending(static_cast<PendingCall *>(completions[i].call->user_data));
+            pending->result = completions[i].result;
+            Connection &connection = *pending->connection;
+            // Run again with room for the outputs it needs
+            if (!connection.broken && pending->Grow()) {
+                _backlog.push_back(std::move(pending));
+                continue;
+            }
+            connection.pending--;
+            if (connection.broken) {
+                continue;
+            }
+            const size_t start = connection.output.size();
+            connection.output.resize(start + 4);
+            CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, connection.output, connection.output.size())
+                << pending->Response();
+            WriteLE32(connection.output.data() + start, connection.output.size() - start - 4);
+        }
+    }
+}
+
+void ExecutionServer::Write(Connection &connection) {
+    const ssize_t sent = send(connection.fd, connection.output.data() + connection.written,
+                              connection.output.size() - connection.written, 0);
+    if (sent < 0) {
+        if (!Retry(errno)) {
+            connection.broken = true;
+        }
+        return;
+    }
+    connection.written += sent;
+    if (connection.written == connection.output.size()) {
+        connection.output.clear();
+        connection.written = 0;
+    } else if (connection.written > connection.output.size() / 2) {
+        connection.output.erase(connection.output.begin(), connection.output.begin() + connection.written);
+        connection.written = 0;
+    }
+}
@@ -0,0 +1,144 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <consensus/consensus.h>
+#include <script/constants.h>
+#include <script/script.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Protocol of the execution server: frames of a 4 byte little endian length,
+ * then as many bytes of a serialized request or response. Byte strings are
+ * serialized with a CompactSize length.
+ *
+ * A request carries the inputs of atomicalsconsensus_verify_script_avm_flags
+ * and a response its outputs, with the id of the request. Clients may write
+ * any number of requests without waiting for their responses: calls run in
+ * parallel and responses are written as they complete, so they may come in a
+ * different order than the requests.
+ */
+struct ExecutionRequest {
+    uint32_t id = 0;
+    uint32_t flags = 0;
+    std::vector<uint8_t> lockScript;
+    std::vector<uint8_t> unlockScript;
+    std::vector<uint8_t> tx;
+    std::vector<uint8_t> authPubKey;
+    std::vector<uint8_t> ftState;
+    std::vector<uint8_t> ftStateIncoming;
+    std::vector<uint8_t> nftState;
+    std::vector<uint8_t> nftStateIncoming;
+    std::vector<uint8_t> contractExternalState;
+    std::vector<uint8_t> contractState;
+    uint256 prevStateHash;
+    //! Empty, or the running state digests for the v2 state hash.
+    std::vector<uint8_t> stateDigests;
+
+    SERIALIZE_METHODS(ExecutionRequest, obj) {
+        READWRITE(obj.id, obj.flags, obj.lockScript, obj.unlockScript, obj.tx, obj.authPubKey, obj.ftState,
+                  obj.ftStateIncoming, obj.nftState, obj.nftStateIncoming, obj.contractExternalState,
+                  obj.contractState, obj.prevStateHash, obj.stateDigests);
+    }
+};
+
+struct ExecutionResponse {
+    uint32_t id = 0;
+    int32_t result = 0;
+    uint32_t error = 0;
+    uint32_t scriptError = 0;
+    uint32_t scriptErrorOpNum = 0;
+    uint256 stateHash;
+    std::vector<uint8_t> stateFinal;
+    std::vector<uint8_t> stateUpdates;
+    std::vector<uint8_t> stateDeletes;
+    std::vector<uint8_t> ftBalances;
+    std::vector<uint8_t> ftBalancesUpdates;
+    std::vector<uint8_t> nftBalances;
+    std::vector<uint8_t> nftBalancesUpdates;
+    std::vector<uint8_t> ftWithdraws;
+    std::vector<uint8_t> nftWithdraws;
+    std::vector<uint8_t> ftBalancesAdded;
+    std::vector<uint8_t> nftPuts;
+    //! The updated digests, if the request had some.
+    std::vector<uint8_t> stateDigests;
+
+    SERIALIZE_METHODS(ExecutionResponse, obj) {
+        READWRITE(obj.id, obj.result, obj.error, obj.scriptError, obj.scriptErrorOpNum, obj.stateHash,
+                  obj.stateFinal, obj.stateUpdates, obj.stateDeletes, obj.ftBalances, obj.ftBalancesUpdates,
+                  obj.nftBalances, obj.nftBalancesUpdates, obj.ftWithdraws, obj.nftWithdraws, obj.ftBalancesAdded,
+                  obj.nftPuts, obj.stateDigests);
+    }
+};
+
+/**
+ * Larger frames close the connection. A request holds at most the contract
+ * state and four balance tables, each limited in bytes of data and up to about
+ * four times as large as CBOR with hex keys and values, two scripts, a
+ * transaction and the external state, whose headers a client with many of them
+ * should put in the header store instead.
+ */
+static constexpr uint32_t MAX_EXECUTION_FRAME_SIZE =
+    4 * (MAX_STATE_FINAL_BYTES + 4 * MAX_BALANCES_BYTES) + 2 * MAX_SCRIPT_SIZE + MAX_TX_SIZE + ONE_MEGABYTE;
+
+static constexpr unsigned int DEFAULT_EXECUTION_QUEUE = 256;
+
+/**
+ * Runs calls for the clients of a Unix domain socket on an
+ * atomicalsconsensus_ring, so that processes on one host share the threads and
+ * the caches of one engine: decoded and compiled locking scripts, and headers
+ * already checked.
+ *
+ * Calls from all clients are submitted together, as many as were read by one
+ * pass of the event loop, and the responses ready for a client are written
+ * together.
+ */
+class ExecutionServer {
+public:
+    ExecutionServer(std::string socketPath, unsigned int queueEntries, unsigned int threads);
+    ~ExecutionServer();
+
+    ExecutionServer(const ExecutionServer &) = delete;
+    ExecutionServer &operator=(const ExecutionServer &) = delete;
+
+    //! Listens on the socket, replacing a stale socket file. Returns false with
+    //! error set if it cannot.
+    bool Listen(std::string &error);
+
+    //! Serves clients until Interrupt is called.
+    void Run();
+
+    //! Makes Run return. Safe to call from a signal handler.
+    void Interrupt();
+
+private:
+    struct Connection;
+    struct PendingCall;
+
+    void Accept();
+    void Read(Connection &connection);
+    void Write(Connection &connection);
+    void Submit();
+    void Complete();
+
+    std::string _socketPath;
+    unsigned int _queueEntries;
+    unsigned int _threads;
+    int _listenFd = -1;
+    //! Written to by Interrupt.
+    int _interruptFds[2] = {-1, -1};
+    struct atomicalsconsensus_ring *_ring = nullptr;
+    //! Calls submitted to the ring whose completion was not handled yet.
+    size_t _inFlight = 0;
+    std::vector<std::unique_ptr<Connection>> _connections;
+    //! Read, not taken by the ring yet.
+    std::vector<std::unique_ptr<PendingCall>> _backlog;
+};
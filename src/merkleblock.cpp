@@ -6,9 +6,12 @@
 #include <merkleblock.h>
 
 #include <consensus/consensus.h>
+#include <crypto/sha256.h>
 #include <hash.h>
 #include <util/strencodings.h>
 
+#include <algorithm>
+
 std::vector<unsigned char> BitsToBytes(const std::vector<bool> &bits) {
     std::vector<unsigned char> ret((bits.size() + 7) / 8);
     for (unsigned int p = 0; p < bits.size(); p++) {
@@ -110,53 +113,49 @@ void CPartialMerkleTree::TraverseAndBuild(int height, size_t pos,
     }
 }
 
-uint256 CPartialMerkleTree::TraverseAndExtract(int height, size_t pos,
-                                               size_t &nBitsUsed,
-                                               size_t &nHashUsed,
-                                               std::vector<uint256> &vMatch,
-                                               std::vector<size_t> &vnIndex) {
-    if (nBitsUsed >= vBits.size()) {
-        // Overflowed the bits array - failure
-        fBad = true;
-        return uint256();
-    }
-
-    bool fParentOfMatch = vBits[nBitsUsed++];
-    if (height == 0 || !fParentOfMatch) {
-        // If at height 0, or nothing interesting below, use stored hash and do
-        // not descend.
-        if (nHashUsed >= vHash.size()) {
-            // Overflowed the hash array - failure
+void CPartialMerkleTree::CollectNodes(int height, size_t tree,
+                                      size_t &nBitsUsed, size_t &nHashUsed,
+                                      std::vector<Node> &nodes,
+                                      std::vector<uint256> &vMatch,
+                                      std::vector<size_t> &vnIndex) {
+    std::vector<std::pair<int, size_t>> stack{{height, 0}};
+    while (!stack.empty()) {
+        const auto [nodeHeight, pos] = stack.back();
+        stack.pop_back();
+        if (nBitsUsed >= vBits.size()) {
+            // Overflowed the bits array - failure
             fBad = true;
-            return uint256();
+            return;
         }
-        const uint256 &hash = vHash[nHashUsed++];
-        // In case of height 0, we have a matched txid.
-        if (height == 0 && fParentOfMatch) {
-            vMatch.push_back(hash);
-            vnIndex.push_back(pos);
+
+        bool fParentOfMatch = vBits[nBitsUsed++];
+        const bool root = nodeHeight == height;
+        if (nodeHeight == 0 || !fParentOfMatch) {
+            // If at height 0, or nothing interesting below, use stored hash and
+            // do not descend.
+            if (nHashUsed >= vHash.size()) {
+                // Overflowed the hash array - failure
+                fBad = true;
+                return;
+            }
+            const uint256 &hash = vHash[nHashUsed++];
+            // In case of height 0, we have a matched txid.
+            if (nodeHeight == 0 && fParentOfMatch) {
+                vMatch.push_back(hash);
+                vnIndex.push_back(pos);
+            }
+            nodes.push_back({hash, pos, tree, nodeHeight, false, root});
+            continue;
         }
-        return hash;
-    }
 
-    // Otherwise, descend into the subtrees to extract matched txids and hashes.
-    uint256 left = TraverseAndExtract(height - 1, pos * 2, nBitsUsed, nHashUsed,
-                                      vMatch, vnIndex),
-            right;
-    if (pos * 2 + 1 < CalcTreeWidth(height - 1)) {
-        right = TraverseAndExtract(height - 1, pos * 2 + 1, nBitsUsed,
-                                   nHashUsed, vMatch, vnIndex);
-        if (right == left) {
-            // The left and right branches should never be identical, as the
-            // transaction hashes covered by them must each be unique.
-            fBad = true;
+        // Otherwise, descend into the subtrees, the left one first. The hash
+        // is computed once those of the children are known.
+        nodes.push_back({uint256(), pos, tree, nodeHeight, true, root});
+        if (pos * 2 + 1 < CalcTreeWidth(nodeHeight - 1)) {
+            stack.emplace_back(nodeHeight - 1, pos * 2 + 1);
         }
-    } else {
-        right = left;
+        stack.emplace_back(nodeHeight - 1, pos * 2);
     }
-
-    // and combine them before returning.
-    return Hash(left, right);
 }
 
 CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vTxid,
@@ -180,53 +179,142 @@ CPartialMerkleTree::CPartialMerkleTree() : nTransactions(0), fBad(true) {}
 
 uint256 CPartialMerkleTree::ExtractMatches(std::vector<uint256> &vMatch,
                                            std::vector<size_t> &vnIndex) {
-    vMatch.clear();
-
-    // An empty set will not work
-    if (nTransactions == 0) {
-        return uint256();
-    }
+    std::vector<std::vector<uint256>> vMatches(1);
+    std::vector<std::vector<size_t>> vnIndices(1);
+    vMatches[0].swap(vMatch);
+    vnIndices[0].swap(vnIndex);
+    const uint256 hashMerkleRoot =
+        ExtractMatches({this}, vMatches, vnIndices)[0];
+    vMatch.swap(vMatches[0]);
+    vnIndex.swap(vnIndices[0]);
+    return hashMerkleRoot;
+}
 
-    // Check for excessively high numbers of transactions.
-    // FIXME: Track the maximum block size we've seen and use it here.
+std::vector<uint256> CPartialMerkleTree::ExtractMatches(
+    const std::vector<CPartialMerkleTree *> &trees,
+    std::vector<std::vector<uint256>> &vMatches,
+    std::vector<std::vector<size_t>> &vnIndices) {
+    std::vector<uint256> roots(trees.size());
+    vMatches.resize(trees.size());
+    vnIndices.resize(trees.size());
+
+    // Nodes of every tree that traversed successfully, in traversal order
+    std::vector<Node> collected;
+    int maxHeight = 0;
+    for (size_t i = 0; i < trees.size(); i++) {
+        CPartialMerkleTree &tree = *trees[i];
+        vMatches[i].clear();
+
+        // An empty set will not work
+        if (tree.nTransactions == 0) {
+            continue;
+        }
 
-    // There can never be more hashes provided than one for every txid.
-    if (vHash.size() > nTransactions) {
-        return uint256();
-    }
+        // Check for excessively high numbers of transactions.
+        // FIXME: Track the maximum block size we've seen and use it here.
 
-    // There must be at least one bit per node in the partial tree, and at least
-    // one node per hash.
-    if (vBits.size() < vHash.size()) {
-        return uint256();
-    }
+        // There can never be more hashes provided than one for every txid.
+        if (tree.vHash.size() > tree.nTransactions) {
+            continue;
+        }
 
-    // calculate height of tree.
-    int nHeight = 0;
-    while (CalcTreeWidth(nHeight) > 1) {
-        nHeight++;
-    }
+        // There must be at least one bit per node in the partial tree, and at
+        // least one node per hash.
+        if (tree.vBits.size() < tree.vHash.size()) {
+            continue;
+        }
 
-    // traverse the partial tree.
-    size_t nBitsUsed = 0, nHashUsed = 0;
-    uint256 hashMerkleRoot =
-        TraverseAndExtract(nHeight, 0, nBitsUsed, nHashUsed, vMatch, vnIndex);
+        // calculate height of tree.
+        int nHeight = 0;
+        while (tree.CalcTreeWidth(nHeight) > 1) {
+            nHeight++;
+        }
 
-    // verify that no problems occurred during the tree traversal.
-    if (fBad) {
-        return uint256();
+        // traverse the partial tree.
+        const size_t begin = collected.size();
+        size_t nBitsUsed = 0, nHashUsed = 0;
+        tree.CollectNodes(nHeight, i, nBitsUsed, nHashUsed, collected,
+                          vMatches[i], vnIndices[i]);
+
+        // verify that the traversal succeeded, that all bits were consumed
+        // (except for the padding caused by serializing it as a byte sequence)
+        // and that all hashes were consumed.
+        if (tree.fBad || (nBitsUsed + 7) / 8 != (tree.vBits.size() + 7) / 8 ||
+            nHashUsed != tree.vHash.size()) {
+            collected.resize(begin);
+            continue;
+        }
+        maxHeight = std::max(maxHeight, nHeight);
     }
 
-    // verify that all bits were consumed (except for the padding caused by
-    // serializing it as a byte sequence)
-    if ((nBitsUsed + 7) / 8 != (vBits.size() + 7) / 8) {
-        return uint256();
+    // Group the nodes by height, keeping the traversal order within a height,
+    // so that the nodes of every tree at one height are contiguous.
+    std::vector<size_t> levelStart(maxHeight + 2, 0);
+    for (const Node &node : collected) {
+        levelStart[node.height + 1]++;
+    }
+    for (int height = 0; height <= maxHeight; height++) {
+        levelStart[height + 1] += levelStart[height];
+    }
+    std::vector<Node> nodes(collected.size());
+    {
+        std::vector<size_t> next(levelStart.begin(), levelStart.end() - 1);
+        for (const Node &node : collected) {
+            nodes[next[node.height]++] = node;
+        }
     }
 
-    // verify that all hashes were consumed.
-    if (nHashUsed != vHash.size()) {
-        return uint256();
+    // Hash the node pairs of every tree one height at a time, from the leaves
+    // up. A node with children is combined from the next two nodes at the
+    // height below that are not roots, as the traversal visits the children in
+    // the same order as their parents.
+    std::vector<uint256> pairs;
+    for (int height = 0; height < maxHeight; height++) {
+        pairs.clear();
+        size_t child = levelStart[height];
+        for (size_t i = levelStart[height + 1]; i < levelStart[height + 2];
+             i++) {
+            const Node &node = nodes[i];
+            if (!node.parent) {
+                continue;
+            }
+            while (nodes[child].root) {
+                child++;
+            }
+            const uint256 &left = nodes[child++].hash;
+            pairs.push_back(left);
+            if (node.pos * 2 + 1 < trees[node.tree]->CalcTreeWidth(height)) {
+                const uint256 &right = nodes[child++].hash;
+                if (right == left) {
+                    // The left and right branches should never be identical,
+                    // as the transaction hashes covered by them must each be
+                    // unique.
+                    trees[node.tree]->fBad = true;
+                }
+                pairs.push_back(right);
+            } else {
+                pairs.push_back(left);
+            }
+        }
+        if (pairs.empty()) {
+            continue;
+        }
+
+        SHA256D64(pairs[0].begin(), pairs[0].begin(), pairs.size() / 2);
+        size_t hashed = 0;
+        for (size_t i = levelStart[height + 1]; i < levelStart[height + 2];
+             i++) {
+            if (nodes[i].parent) {
+                nodes[i].hash = pairs[hashed++];
+            }
+        }
     }
 
-    return hashMerkleRoot;
+    for (const Node &node : nodes) {
+        // verify that no problems occurred during the tree traversal.
+        if (node.root && !trees[node.tree]->fBad) {
+            roots[node.tree] = node.hash;
+        }
+    }
+    return roots;
 }
@@ -87,14 +87,32 @@ protected:
                           const std::vector<uint256> &vTxid,
                           const std::vector<bool> &vMatch);
 
+    /** A node of the partial tree, as collected for ExtractMatches. */
+    struct Node {
+        //! Stored hash of the node, or its hash once computed for a node
+        //! with children
+        uint256 hash;
+        //! Position of the node at its height
+        size_t pos;
+        //! Index of the tree within the batch
+        size_t tree;
+        int height;
+        //! Whether the node has children in the partial tree
+        bool parent;
+        //! Whether the node is the root of its tree
+        bool root;
+    };
+
     /**
-     * Recursive function that traverses tree nodes, consuming the bits and
-     * hashes produced by TraverseAndBuild. It returns the hash of the
-     * respective node and its respective index.
+     * Traverses the tree nodes in depth-first order, consuming the bits and
+     * hashes produced by TraverseAndBuild, without hashing. Appends the nodes
+     * to nodes and collects the matched txids with their indices. Sets fBad in
+     * case of failure.
      */
-    uint256 TraverseAndExtract(int height, size_t pos, size_t &nBitsUsed,
-                               size_t &nHashUsed, std::vector<uint256> &vMatch,
-                               std::vector<size_t> &vnIndex);
+    void CollectNodes(int height, size_t tree, size_t &nBitsUsed,
+                      size_t &nHashUsed, std::vector<Node> &nodes,
+                      std::vector<uint256> &vMatch,
+                      std::vector<size_t> &vnIndex);
 
 public:
     SERIALIZE_METHODS(CPartialMerkleTree, obj) {
@@ -123,6 +141,17 @@ public:
     uint256 ExtractMatches(std::vector<uint256> &vMatch,
                            std::vector<size_t> &vnIndex);
 
+    /**
+     * ExtractMatches for several trees. The trees are hashed level by level,
+     * with the node pairs of every tree at a height hashed together by the
+     * multi-way SHA256D64, so a batch costs much less than its trees one at a
+     * time. Returns the merkle root of each tree, or 0 for those that fail.
+     */
+    static std::vector<uint256>
+    ExtractMatches(const std::vector<CPartialMerkleTree *> &trees,
+                   std::vector<std::vector<uint256>> &vMatches,
+                   std::vector<std::vector<size_t>> &vnIndices);
+
     /**
      * Get number of transactions the merkle proof is indicating for
      * cross-reference with local blockchain knowledge.
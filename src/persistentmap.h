@@ -0,0 +1,274 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * Ordered map with structural sharing (a persistent AVL tree).
+ *
+ * Nodes are immutable and reference counted. An update copies the path from
+ * the root to the node it touches and shares every other node with the map it
+ * was made from, so copying a map is O(1) and an update costs O(log n) new
+ * nodes whatever the number of copies alive. A copy is therefore a snapshot:
+ * updates made through one copy are never visible through another.
+ *
+ * Nodes are never modified once built, so copies of a map may be read and
+ * updated from different threads without locking.
+ *
+ * Subtree sizes are kept in the nodes to give O(log n) positional access.
+ */
+template <typename K, typename V, typename Compare = std::less<K>> class PersistentMap {
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node {
+        K key;
+        V value;
+        NodePtr left;
+        NodePtr right;
+        uint32_t height;
+        size_t size;
+    };
+
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef size_t size_type;
+
+    /** Forward iterator over the entries in key order. */
+    class const_iterator {
+    public:
+        const K &key() const { return path.back()->key; }
+        const V &value() const { return path.back()->value; }
+        const V &operator*() const { return value(); }
+
+        const_iterator &operator++() {
+            const Node *node = path.back();
+            if (node->right) {
+                PushLeftmost(node->right.get());
+                return *this;
+            }
+            path.pop_back();
+            while (!path.empty() && path.back()->right.get() == node) {
+                node = path.back();
+                path.pop_back();
+            }
+            return *this;
+        }
+
+        bool operator==(const const_iterator &other) const {
+            if (path.empty() || other.path.empty()) {
+                return path.empty() == other.path.empty();
+            }
+            return path.back() == other.path.back();
+        }
+        bool operator!=(const const_iterator &other) const { return !(*this == other); }
+
+    private:
+        friend class PersistentMap;
+
+        //! Ancestors of the current node that have it in their left subtree,
+        //! plus the node itself on top. Empty at the end.
+        std::vector<const Node *> path;
+
+        void PushLeftmost(const Node *node) {
+            for (; node; node = node->left.get()) {
+                path.push_back(node);
+            }
+        }
+    };
+
+    PersistentMap() = default;
+
+    /**
+     * Builds a balanced map in O(n) from entries sorted by strictly increasing
+     * key.
+     */
+    static PersistentMap FromSorted(std::vector<std::pair<K, V>> entries) {
+        for (size_t i = 1; i < entries.size(); i++) {
+            assert(Compare()(entries[i - 1].first, entries[i].first));
+        }
+        PersistentMap result;
+        result.root = Build(entries, 0, entries.size());
+        return result;
+    }
+
+    size_type size() const { return Size(root); }
+    bool empty() const { return !root; }
+
+    const_iterator begin() const {
+        const_iterator it;
+        it.PushLeftmost(root.get());
+        return it;
+    }
+    const_iterator end() const { return const_iterator(); }
+
+    //! Returns nullptr if the key is not in the map.
+    const V *find(const K &key) const {
+        const Node *node = root.get();
+        while (node) {
+            if (Compare()(key, node->key)) {
+                node = node->left.get();
+            } else if (Compare()(node->key, key)) {
+                node = node->right.get();
+            } else {
+                return &node->value;
+            }
+        }
+        return nullptr;
+    }
+
+    bool contains(const K &key) const { return find(key) != nullptr; }
+
+    //! Key of the entry at position index in key order, nullptr if out of range.
+    const K *keyAt(size_t index) const {
+        const Node *node = root.get();
+        while (node) {
+            size_t leftSize = Size(node->left);
+            if (index < leftSize) {
+                node = node->left.get();
+            } else if (index > leftSize) {
+                index -= leftSize + 1;
+                node = node->right.get();
+            } else {
+                return &node->key;
+            }
+        }
+        return nullptr;
+    }
+
+    void insert_or_assign(const K &key, V value) { root = Insert(root, key, std::move(value)); }
+
+    //! Returns whether the key was in the map.
+    bool erase(const K &key) {
+        bool erased = false;
+        root = Erase(root, key, erased);
+        return erased;
+    }
+
+    void clear() { root.reset(); }
+
+    //! Whether both maps are the same version, i.e. share their whole tree.
+    bool sameVersion(const PersistentMap &other) const { return root == other.root; }
+
+    bool operator==(const PersistentMap &other) const {
+        if (sameVersion(other)) {
+            return true;
+        }
+        if (size() != other.size()) {
+            return false;
+        }
+        for (auto a = begin(), b = other.begin(); a != end(); ++a, ++b) {
+            if (Compare()(a.key(), b.key()) || Compare()(b.key(), a.key()) || !(a.value() == b.value())) {
+                return false;
+            }
+        }
+        return true;
+    }
+    bool operator!=(const PersistentMap &other) const { return !(*this == other); }
+
+private:
+    NodePtr root;
+
+    static uint32_t Height(const NodePtr &node) { return node ? node->height : 0; }
+    static size_t Size(const NodePtr &node) { return node ? node->size : 0; }
+
+    static NodePtr Make(const K &key, V value, NodePtr left, NodePtr right) {
+        uint32_t height = 1 + std::max(Height(left), Height(right));
+        size_t size = 1 + Size(left) + Size(right);
+        return std::make_shared<const Node>(
+            Node{key, std::move(value), std::move(left), std::move(right), height, size});
+    }
+
+    // Builds a node whose subtrees differ in height by at most two, rotating
+    // it back into AVL shape.
+    static NodePtr Balance(const K &key, V value, NodePtr left, NodePtr right) {
+        uint32_t hl = Height(left);
+        uint32_t hr = Height(right);
+        if (hl > hr + 1) {
+            if (Height(left->left) >= Height(left->right)) {
+                return Make(left->key, left->value, left->left,
+                            Make(key, std::move(value), left->right, std::move(right)));
+            }
+            const NodePtr &lr = left->right;
+            return Make(lr->key, lr->value, Make(left->key, left->value, left->left, lr->left),
+                        Make(key, std::move(value), lr->right, std::move(right)));
+        }
+        if (hr > hl + 1) {
+            if (Height(right->right) >= Height(right->left)) {
+                return Make(right->key, right->value, Make(key, std::move(value), std::move(left), right->left),
+                            right->right);
+            }
+            const NodePtr &rl = right->left;
+            return Make(rl->key, rl->value, Make(key, std::move(value), std::move(left), rl->left),
+                        Make(right->key, right->value, rl->right, right->right));
+        }
+        return Make(key, std::move(value), std::move(left), std::move(right));
+    }
+
+    static NodePtr Insert(const NodePtr &node, const K &key, V value) {
+        if (!node) {
+            return Make(key, std::move(value), nullptr, nullptr);
+        }
+        if (Compare()(key, node->key)) {
+            return Balance(node->key, node->value, Insert(node->left, key, std::move(value)), node->right);
+        }
+        if (Compare()(node->key, key)) {
+            return Balance(node->key, node->value, node->left, Insert(node->right, key, std::move(value)));
+        }
+        return Make(key, std::move(value), node->left, node->right);
+    }
+
+    static NodePtr EraseMin(const NodePtr &node) {
+        if (!node->left) {
+            return node->right;
+        }
+        return Balance(node->key, node->value, EraseMin(node->left), node->right);
+    }
+
+    static NodePtr Erase(const NodePtr &node, const K &key, bool &erased) {
+        if (!node) {
+            return node;
+        }
+        if (Compare()(key, node->key)) {
+            NodePtr left = Erase(node->left, key, erased);
+            return erased ? Balance(node->key, node->value, std::move(left), node->right) : node;
+        }
+        if (Compare()(node->key, key)) {
+            NodePtr right = Erase(node->right, key, erased);
+            return erased ? Balance(node->key, node->value, node->left, std::move(right)) : node;
+        }
+        erased = true;
+        if (!node->left) {
+            return node->right;
+        }
+        if (!node->right) {
+            return node->left;
+        }
+        const Node *successor = node->right.get();
+        while (successor->left) {
+            successor = successor->left.get();
+        }
+        return Balance(successor->key, successor->value, node->left, EraseMin(node->right));
+    }
+
+    static NodePtr Build(std::vector<std::pair<K, V>> &entries, size_t begin, size_t end) {
+        if (begin == end) {
+            return nullptr;
+        }
+        size_t mid = begin + (end - begin) / 2;
+        NodePtr left = Build(entries, begin, mid);
+        NodePtr right = Build(entries, mid + 1, end);
+        return Make(entries[mid].first, std::move(entries[mid].second), std::move(left), std::move(right));
+    }
+};
@@ -6,15 +6,13 @@
 
 #include <arith_uint256.h>
 #include <pow.h>
-#include <primitives/block.h>
 #include <primitives/blockhash.h>
 #include <uint256.h>
-#include <util/system.h>
 
-#include <atomic>
+const arith_uint256 MAX_POW_TARGET =
+    UintToArith256(uint256S("7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"));
 
- 
-bool CheckProofOfWork(const BlockHash &hash, uint32_t nBits, const Consensus::Params &params) {
+bool CheckProofOfWork(const BlockHash &hash, uint32_t nBits, const arith_uint256 &powLimit) {
     bool fNegative;
     bool fOverflow;
     arith_uint256 bnTarget;
@@ -22,7 +20,7 @@ bool CheckProofOfWork(const BlockHash &hash, uint32_t nBits, const Consensus::Pa
     bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (fNegative || bnTarget == 0 || fOverflow || bnTarget > UintToArith256(params.powLimit)) {
+    if (fNegative || bnTarget == 0 || fOverflow || bnTarget > powLimit) {
         return false;
     }
 
@@ -32,4 +30,4 @@ bool CheckProofOfWork(const BlockHash &hash, uint32_t nBits, const Consensus::Pa
     }
 
     return true;
-}
\ No newline at end of file
+}
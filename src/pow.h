@@ -11,18 +11,17 @@
 #include <cstdint>
 
 struct BlockHash;
-class CBlockHeader;
-class CBlockIndex;
-class uint256;
 
-namespace Consensus {
-struct Params;
-} 
+/**
+ * Highest target allowed by any Bitcoin network (regtest). The library does
+ * not follow a chain, so it cannot check nBits against the difficulty
+ * adjustment: headers are only checked against the target they claim.
+ */
+extern const arith_uint256 MAX_POW_TARGET;
 
 /**
  * Check whether a block hash satisfies the proof-of-work requirement specified
  * by nBits
  */
 bool CheckProofOfWork(const BlockHash &hash, uint32_t nBits,
-                      const Consensus::Params &params);
- 
\ No newline at end of file
+                      const arith_uint256 &powLimit = MAX_POW_TARGET);
@@ -11,8 +11,11 @@
 #include <primitives/txid.h>
 #include <script/script.h>
 #include <serialize.h>
+#include <span.h>
 #include "hash.h"
 #include <iostream>
+#include <mutex>
+#include <type_traits>
 
 static const int SERIALIZE_TRANSACTION = 0x00;
  
@@ -451,41 +454,247 @@ struct PrecomputedTransactionData {
     template <class T> explicit PrecomputedTransactionData(const T &tx);
 };
 
-/// A class that wraps a pointer to either a CTransaction or a
-/// CMutableTransaction and presents a uniform view of the minimal
-/// intersection of both classes' exposed data.
+/**
+ * A transaction read in place from its serialization, as an alternative to
+ * deserializing a CTransaction when only a few of its fields are used.
+ *
+ * The constructor checks the serialization as CTransaction's deserialization
+ * does, throwing std::ios_base::failure on the same inputs, and keeps only
+ * the offsets of the inputs and outputs. Scripts are returned as spans of the
+ * buffer. The id and the hashes of the prevouts, sequences and outputs used
+ * by the signature hash are computed on first use.
+ *
+ * The buffer must outlive the view. The lazily computed hashes are safe to
+ * request from several threads.
+ */
+class CTransactionBufferView {
+    struct Input {
+        //! Offset of the prevout; the sequence follows the script
+        size_t offset;
+        size_t scriptOffset;
+        size_t scriptSize;
+    };
+
+    struct Output {
+        //! Offset of the value; the output ends with the script
+        size_t offset;
+        size_t scriptOffset;
+        size_t scriptSize;
+    };
+
+    Span<const uint8_t> data;
+    int32_t nVersion;
+    uint32_t nLockTime;
+    std::vector<Input> inputs;
+    std::vector<Output> outputs;
+    bool m_has_witness = false;
+
+    mutable std::once_flag hashOnce, prevoutsOnce, sequenceOnce, outputsOnce;
+    mutable uint256 hash, hashPrevouts, hashSequence, hashOutputs;
+
+public:
+    explicit CTransactionBufferView(Span<const uint8_t> dataIn);
+
+    CTransactionBufferView(const CTransactionBufferView &) = delete;
+    CTransactionBufferView &operator=(const CTransactionBufferView &) = delete;
+
+    int32_t GetVersion() const { return nVersion; }
+    uint32_t GetLockTime() const { return nLockTime; }
+    size_t GetInputCount() const { return inputs.size(); }
+    size_t GetOutputCount() const { return outputs.size(); }
+
+    COutPoint GetPrevout(size_t i) const;
+    uint32_t GetSequence(size_t i) const;
+    Span<const uint8_t> GetScriptSig(size_t i) const {
+        return data.subspan(inputs[i].scriptOffset, inputs[i].scriptSize);
+    }
+
+    Amount GetValue(size_t i) const;
+    Span<const uint8_t> GetScriptPubKey(size_t i) const {
+        return data.subspan(outputs[i].scriptOffset, outputs[i].scriptSize);
+    }
+    /** The serialization of an output, value and script. */
+    Span<const uint8_t> GetSerializedOutput(size_t i) const {
+        return data.subspan(outputs[i].offset,
+                            outputs[i].scriptOffset + outputs[i].scriptSize - outputs[i].offset);
+    }
+
+    /** The serialization of the transaction, without any bytes after it. */
+    Span<const uint8_t> GetSerialization() const { return data; }
+    unsigned int GetTotalSize() const { return data.size(); }
+    bool HasWitness() const { return m_has_witness; }
+
+    const TxId GetId() const;
+    const TxHash GetHash() const;
+
+    uint256 GetHashPrevouts() const;
+    uint256 GetHashSequence() const;
+    uint256 GetHashOutputs() const;
+};
+
+/// The accessors of CTransactionView for a CTransaction, a CMutableTransaction
+/// or a CTransactionBufferView known at compile time. Code templated on the
+/// transaction type uses it, so that only the path of that type is compiled.
+template <typename Tx> class CTransactionViewOf {
+    static constexpr bool IS_BUFFER = std::is_same_v<Tx, CTransactionBufferView>;
+
+    const Tx &tx;
+
+public:
+    explicit CTransactionViewOf(const Tx &txIn) noexcept : tx(txIn) {}
+
+    int32_t nVersion() const noexcept {
+        if constexpr (IS_BUFFER) {
+            return tx.GetVersion();
+        } else {
+            return tx.nVersion;
+        }
+    }
+    uint32_t nLockTime() const noexcept {
+        if constexpr (IS_BUFFER) {
+            return tx.GetLockTime();
+        } else {
+            return tx.nLockTime;
+        }
+    }
+
+    size_t inputCount() const noexcept {
+        if constexpr (IS_BUFFER) {
+            return tx.GetInputCount();
+        } else {
+            return tx.vin.size();
+        }
+    }
+    size_t outputCount() const noexcept {
+        if constexpr (IS_BUFFER) {
+            return tx.GetOutputCount();
+        } else {
+            return tx.vout.size();
+        }
+    }
+
+    COutPoint inputPrevout(size_t i) const {
+        if constexpr (IS_BUFFER) {
+            return tx.GetPrevout(i);
+        } else {
+            return tx.vin[i].prevout;
+        }
+    }
+    uint32_t inputSequence(size_t i) const {
+        if constexpr (IS_BUFFER) {
+            return tx.GetSequence(i);
+        } else {
+            return tx.vin[i].nSequence;
+        }
+    }
+    Span<const uint8_t> inputScript(size_t i) const {
+        if constexpr (IS_BUFFER) {
+            return tx.GetScriptSig(i);
+        } else {
+            return MakeUInt8Span(tx.vin[i].scriptSig);
+        }
+    }
+
+    Amount outputValue(size_t i) const {
+        if constexpr (IS_BUFFER) {
+            return tx.GetValue(i);
+        } else {
+            return tx.vout[i].nValue;
+        }
+    }
+    Span<const uint8_t> outputScript(size_t i) const {
+        if constexpr (IS_BUFFER) {
+            return tx.GetScriptPubKey(i);
+        } else {
+            return MakeUInt8Span(tx.vout[i].scriptPubKey);
+        }
+    }
+
+    TxId GetId() const { return tx.GetId(); }
+    TxHash GetHash() const { return tx.GetHash(); }
+};
+
+/// A class that wraps a pointer to a CTransaction, a CMutableTransaction or a
+/// CTransactionBufferView and presents a uniform view of the minimal
+/// intersection of the classes' exposed data.
 ///
 /// This is used by the native introspection code to make it possible for
-/// mutable txs as well constant txs to be treated uniformly for the purposes
-/// of the native introspection opcodes.
+/// mutable txs, constant txs and txs read in place to be treated uniformly for
+/// the purposes of the native introspection opcodes.
 ///
-/// Contract is: The wrapped tx or mtx pointer must have a lifetime at least
-///              as long as an instance of this class.
+/// Contract is: The wrapped tx, mtx or buf pointer must have a lifetime at
+///              least as long as an instance of this class.
 class CTransactionView {
     const CTransaction *tx{};
     const CMutableTransaction *mtx{};
+    const CTransactionBufferView *buf{};
+
+    /// Calls f with the CTransactionViewOf the wrapped transaction.
+    template <typename F> decltype(auto) Visit(F &&f) const {
+        if (buf) {
+            return f(CTransactionViewOf<CTransactionBufferView>(*buf));
+        }
+        if (mtx) {
+            return f(CTransactionViewOf<CMutableTransaction>(*mtx));
+        }
+        return f(CTransactionViewOf<CTransaction>(*tx));
+    }
+
 public:
     CTransactionView(const CTransaction &txIn) noexcept : tx(&txIn) {}
     CTransactionView(const CMutableTransaction &mtxIn) noexcept : mtx(&mtxIn) {}
+    CTransactionView(const CTransactionBufferView &bufIn) noexcept : buf(&bufIn) {}
 
     bool isMutableTx() const noexcept { return mtx; }
+    bool isBufferTx() const noexcept { return buf; }
 
-    const std::vector<CTxIn> &vin() const noexcept { return mtx ? mtx->vin : tx->vin; }
-    const std::vector<CTxOut> &vout() const noexcept { return mtx ? mtx->vout : tx->vout; }
-    const int32_t &nVersion() const noexcept { return mtx ? mtx->nVersion : tx->nVersion; }
-    const uint32_t &nLockTime() const noexcept { return mtx ? mtx->nLockTime : tx->nLockTime; }
+    int32_t nVersion() const noexcept {
+        return Visit([](const auto &view) { return view.nVersion(); });
+    }
+    uint32_t nLockTime() const noexcept {
+        return Visit([](const auto &view) { return view.nLockTime(); });
+    }
 
-    TxId GetId() const { return mtx ? mtx->GetId() : tx->GetId(); }
-    TxHash GetHash() const { return mtx ? mtx->GetHash() : tx->GetHash(); }
+    size_t inputCount() const noexcept {
+        return Visit([](const auto &view) { return view.inputCount(); });
+    }
+    size_t outputCount() const noexcept {
+        return Visit([](const auto &view) { return view.outputCount(); });
+    }
+
+    COutPoint inputPrevout(size_t i) const {
+        return Visit([i](const auto &view) { return view.inputPrevout(i); });
+    }
+    uint32_t inputSequence(size_t i) const {
+        return Visit([i](const auto &view) { return view.inputSequence(i); });
+    }
+    Span<const uint8_t> inputScript(size_t i) const {
+        return Visit([i](const auto &view) { return view.inputScript(i); });
+    }
+
+    Amount outputValue(size_t i) const {
+        return Visit([i](const auto &view) { return view.outputValue(i); });
+    }
+    Span<const uint8_t> outputScript(size_t i) const {
+        return Visit([i](const auto &view) { return view.outputScript(i); });
+    }
+
+    TxId GetId() const {
+        return Visit([](const auto &view) { return view.GetId(); });
+    }
+    TxHash GetHash() const {
+        return Visit([](const auto &view) { return view.GetHash(); });
+    }
 
     bool operator==(const CTransactionView &o) const noexcept {
-        return isMutableTx() == o.isMutableTx() && (mtx ? *mtx == *o.mtx : *tx == *o.tx);
+        return isMutableTx() == o.isMutableTx() && isBufferTx() == o.isBufferTx() &&
+               (buf ? buf->GetHash() == o.buf->GetHash() : mtx ? *mtx == *o.mtx : *tx == *o.tx);
     }
     bool operator!=(const CTransactionView &o) const noexcept { return !operator==(o); }
 
     /// Get a pointer to the underlying constant transaction, if such a thing exists.
     /// This is used by the validation engine which is always passed a CTransaction.
-    /// Returned pointer will be nullptr if this->isMutableTx()
+    /// Returned pointer will be nullptr if this->isMutableTx() or this->isBufferTx()
     const CTransaction *constantTx() const { return tx; }
 };
  
\ No newline at end of file
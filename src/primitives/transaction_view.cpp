@@ -0,0 +1,178 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <primitives/transaction.h>
+
+#include <crypto/common.h>
+#include <hash.h>
+#include <version.h>
+
+#include <ios>
+
+namespace {
+
+/** Reads a serialization in place, with the checks of a deserializing stream. */
+class SpanReader {
+public:
+    explicit SpanReader(Span<const uint8_t> dataIn) : data(dataIn) {}
+
+    void read(char *pch, size_t nSize) {
+        memcpy(pch, data.data() + Skip(nSize), nSize);
+    }
+
+    /** Step over nSize bytes, returning the offset of the first. */
+    size_t Skip(size_t nSize) {
+        if (nSize > data.size() - pos) {
+            throw std::ios_base::failure("CTransactionBufferView: end of data");
+        }
+        const size_t start = pos;
+        pos += nSize;
+        return start;
+    }
+
+    template <typename T> SpanReader &operator>>(T &&obj) {
+        ::Unserialize(*this, obj);
+        return *this;
+    }
+
+    size_t GetPos() const { return pos; }
+    size_t GetRemaining() const { return data.size() - pos; }
+    int GetVersion() const { return PROTOCOL_VERSION; }
+    int GetType() const { return SER_NETWORK; }
+
+private:
+    Span<const uint8_t> data;
+    size_t pos = 0;
+};
+
+/**
+ * Read the number of elements of a vector, each at least minSize bytes.
+ * Deserialization allocates as it reads, so a count that cannot fit in what
+ * is left of the buffer fails here rather than in a huge allocation.
+ */
+size_t ReadCount(SpanReader &s, size_t minSize) {
+    const uint64_t count = ReadCompactSize(s);
+    if (count > s.GetRemaining() / minSize) {
+        throw std::ios_base::failure("CTransactionBufferView: end of data");
+    }
+    return count;
+}
+
+} // namespace
+
+CTransactionBufferView::CTransactionBufferView(Span<const uint8_t> dataIn) {
+    // The layout is the one read by UnserializeTransaction, see there.
+    SpanReader s(dataIn);
+    s >> nVersion;
+
+    auto readInputs = [&] {
+        inputs.resize(ReadCount(s, 32 + 4 + 1 + 4));
+        for (Input &input : inputs) {
+            input.offset = s.Skip(32 + 4);
+            input.scriptSize = ReadCompactSize(s);
+            input.scriptOffset = s.Skip(input.scriptSize);
+            s.Skip(4);
+        }
+    };
+    auto readOutputs = [&] {
+        outputs.resize(ReadCount(s, 8 + 1));
+        for (Output &output : outputs) {
+            output.offset = s.Skip(8);
+            output.scriptSize = ReadCompactSize(s);
+            output.scriptOffset = s.Skip(output.scriptSize);
+        }
+    };
+
+    uint8_t flags = 0;
+    readInputs();
+    if (inputs.empty()) {
+        s >> flags;
+        if (flags != 0) {
+            readInputs();
+            readOutputs();
+        }
+    } else {
+        readOutputs();
+    }
+    if (flags & 1) {
+        flags ^= 1;
+        // CScriptWitness::stack is a CScript, one string of bytes per input.
+        for (size_t i = 0; i < inputs.size(); i++) {
+            const uint64_t size = ReadCompactSize(s);
+            m_has_witness |= size != 0;
+            s.Skip(size);
+        }
+        if (!m_has_witness) {
+            throw std::ios_base::failure("Superfluous witness record");
+        }
+    }
+    if (flags) {
+        throw std::ios_base::failure("Unknown transaction optional data");
+    }
+    s >> nLockTime;
+
+    data = dataIn.first(s.GetPos());
+}
+
+COutPoint CTransactionBufferView::GetPrevout(size_t i) const {
+    COutPoint prevout;
+    memcpy(prevout.hash.begin(), data.data() + inputs[i].offset, 32);
+    prevout.n = ReadLE32(data.data() + inputs[i].offset + 32);
+    return prevout;
+}
+
+uint32_t CTransactionBufferView::GetSequence(size_t i) const {
+    return ReadLE32(data.data() + inputs[i].scriptOffset + inputs[i].scriptSize);
+}
+
+Amount CTransactionBufferView::GetValue(size_t i) const {
+    return int64_t(ReadLE64(data.data() + outputs[i].offset)) * SATOSHI;
+}
+
+const TxId CTransactionBufferView::GetId() const {
+    // Like CTransaction, the hash is of the serialization with witnesses,
+    // which is the buffer itself.
+    std::call_once(hashOnce, [this] { hash = Hash(data); });
+    return TxId(hash);
+}
+
+const TxHash CTransactionBufferView::GetHash() const {
+    return TxHash(GetId());
+}
+
+uint256 CTransactionBufferView::GetHashPrevouts() const {
+    std::call_once(prevoutsOnce, [this] {
+        CHash256 hasher;
+        for (const Input &input : inputs) {
+            hasher.Write(data.subspan(input.offset, 32 + 4));
+        }
+        hasher.Finalize(hashPrevouts);
+    });
+    return hashPrevouts;
+}
+
+uint256 CTransactionBufferView::GetHashSequence() const {
+    std::call_once(sequenceOnce, [this] {
+        CHash256 hasher;
+        for (const Input &input : inputs) {
+            hasher.Write(data.subspan(input.scriptOffset + input.scriptSize, 4));
+        }
+        hasher.Finalize(hashSequence);
+    });
+    return hashSequence;
+}
+
+uint256 CTransactionBufferView::GetHashOutputs() const {
+    // The outputs are serialized back to back.
+    std::call_once(outputsOnce, [this] {
+        CHash256 hasher;
+        if (!outputs.empty()) {
+            hasher.Write(data.subspan(outputs.front().offset,
+                                      outputs.back().scriptOffset + outputs.back().scriptSize -
+                                          outputs.front().offset));
+        }
+        hasher.Finalize(hashOutputs);
+    });
+    return hashOutputs;
+}
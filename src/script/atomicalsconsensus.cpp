@@ -7,55 +7,27 @@
 #include <script/atomicalsconsensus.h>
 
 #include "json.hpp"
-#include <iostream>
+#include <crypto/eaglesong.h>
+#include <crypto/sha256.h>
+#include <crypto/sha3.h>
+#include <crypto/sha512.h>
+#include <ios>
+#include <optional>
 #include <primitives/transaction.h>
 #include <pubkey.h>
+#include <script/bitops.h>
+#include <script/block_header_store.h>
+#include <script/block_scheduler.h>
+#include <script/execution_ring.h>
 #include <script/interpreter.h>
+#include <script/script_jit.h>
 #include <script/script_utils.h>
+#include <streams.h>
+#include <util/strencodings.h>
 #include <version.h>
 using json = nlohmann::json;
 namespace {
 
-/** A class that deserializes a single CTransaction one time. */
-class TxInputStream {
-public:
-    TxInputStream(int nTypeIn, int nVersionIn, const uint8_t *txTo, size_t txToLen)
-        : m_type(nTypeIn), m_version(nVersionIn), m_data(txTo), m_remaining(txToLen) {}
-
-    void read(char *pch, size_t nSize) {
-        if (nSize > m_remaining) {
-            throw std::ios_base::failure(std::string(__func__) + ": end of data");
-        }
-
-        if (pch == nullptr) {
-            throw std::ios_base::failure(std::string(__func__) + ": bad destination buffer");
-        }
-
-        if (m_data == nullptr) {
-            throw std::ios_base::failure(std::string(__func__) + ": bad source buffer");
-        }
-
-        memcpy(pch, m_data, nSize);
-        m_remaining -= nSize;
-        m_data += nSize;
-    }
-
-    template <typename T>
-    TxInputStream &operator>>(T &&obj) {
-        ::Unserialize(*this, obj);
-        return *this;
-    }
-
-    int GetVersion() const { return m_version; }
-    int GetType() const { return m_type; }
-
-private:
-    const int m_type;
-    const int m_version;
-    const uint8_t *m_data;
-    size_t m_remaining;
-};
-
 inline int set_error(atomicalsconsensus_error *ret, atomicalsconsensus_error serror) {
     if (ret) {
         *ret = serror;
@@ -69,11 +41,71 @@ struct ECCryptoClosure {
 };
 
 ECCryptoClosure instance_of_eccryptoclosure;
+
+/** Select the SHA256 kernels for this CPU and self-test them, once. */
+const std::string &InitCryptoBackend() {
+    static const std::string backend =
+        "sha256=" + SHA256AutoDetect() + " sha512=" + SHA512AutoDetect() +
+        " sha3=" + SHA3AutoDetect() + " eaglesong=" + EaglesongAutoDetect() +
+        " bitops=" + BitopsAutoDetect() + " hex=" + HexAutoDetect();
+    return backend;
+}
+
+/** Done when the library is loaded, before any call can be hashing. */
+struct CryptoBackendClosure {
+    CryptoBackendClosure() { InitCryptoBackend(); }
+};
+
+CryptoBackendClosure instance_of_cryptobackendclosure;
 } // namespace
 
+/** The error reported for a state the call was rejected for. */
+static atomicalsconsensus_error state_error(StateError error) {
+    switch (error) {
+        case StateError::OK:
+            return atomicalsconsensus_ERR_OK;
+        case StateError::STATE_FORMAT:
+            return atomicalsconsensus_ERR_STATE_FORMAT_ERROR;
+        case StateError::STATE_DELETES_FORMAT:
+            return atomicalsconsensus_ERR_STATE_DELETES_FORMAT_ERROR;
+        case StateError::FT_BALANCES_FORMAT:
+            return atomicalsconsensus_ERR_STATE_FT_BALANCES_FORMAT_ERROR;
+        case StateError::NFT_BALANCES_FORMAT:
+            return atomicalsconsensus_ERR_STATE_NFT_BALANCES_FORMAT_ERROR;
+        case StateError::STATE_SIZE:
+            return atomicalsconsensus_ERR_STATE_SIZE_ERROR;
+        case StateError::STATE_UPDATES_SIZE:
+            return atomicalsconsensus_ERR_STATE_UPDATES_SIZE_ERROR;
+        case StateError::STATE_DELETES_SIZE:
+            return atomicalsconsensus_ERR_STATE_DELETES_SIZE_ERROR;
+        case StateError::FT_BALANCES_SIZE:
+            return atomicalsconsensus_ERR_STATE_FT_BALANCES_SIZE_ERROR;
+        case StateError::FT_BALANCES_UPDATES_SIZE:
+            return atomicalsconsensus_ERR_STATE_FT_BALANCES_UPDATES_SIZE_ERROR;
+        case StateError::NFT_BALANCES_SIZE:
+            return atomicalsconsensus_ERR_STATE_NFT_BALANCES_SIZE_ERROR;
+        case StateError::NFT_BALANCES_UPDATES_SIZE:
+            return atomicalsconsensus_ERR_STATE_NFT_BALANCES_UPDATES_SIZE_ERROR;
+        case StateError::HEIGHT_NOT_FOUND:
+        case StateError::HEIGHT_INVALID:
+        case StateError::BLOCK_INFO_HEIGHT:
+            return atomicalsconsensus_ERR_INVALID_HEIGHT;
+        case StateError::HEADER_DECODE:
+        case StateError::HEADERS_INVALID:
+            return atomicalsconsensus_ERR_INVALID_HEADERS;
+    }
+    // Every enumerator is handled above, and -Wswitch reports any that is not
+    return atomicalsconsensus_ERR_EXCEPTION;
+}
+
+/** Decode a CBOR state input, discarded if it is not valid CBOR. */
+static json decode_state(const uint8_t *cbor, unsigned int cborLen) {
+    return json::from_cbor(cbor, cbor + cborLen, true, false, json::cbor_tag_handler_t::error);
+}
+
 /** Check that all specified flags are part of the libconsensus interface. */
 static bool verify_flags(unsigned int flags) {
-    return (flags & ~(atomicalsconsensus_SCRIPT_FLAGS_VERIFY_ALL)) == 0;
+    return (flags & ~(atomicalsconsensus_SCRIPT_FLAGS_SUPPORTED)) == 0;
 }
 
 static int verify_script_avm(const uint8_t *lockScript, // The locking script established in the protocol code
@@ -94,37 +126,18 @@ static int verify_script_avm(const uint8_t *lockScript, // The locking script es
                              atomicalsconsensus_error *err, // Base error
                              unsigned int *script_err, // Script execution error
                              unsigned int *script_err_op_num, // Specific op index that threw the error
-                             ScriptStateContext *stateContext // Context of the execution 
+                             ScriptStateContext *stateContext, // Context of the execution 
+                             ScriptStateAccessSet *accessSet, // Read and write sets of the execution, if not null
+                             const ContractStateDigests *stateDigests // Digests of the state for the v2 state hash, if not null
                              ) {
-    if (!verify_flags(flags)) {
-        return atomicalsconsensus_ERR_INVALID_FLAGS;
-    }
-    TxInputStream stream(SER_NETWORK, PROTOCOL_VERSION, txTo, txToLen);
-    CTransaction tx(deserialize, stream);
-    /*  
-    //
-    // TODO: Figure out why the transaction does not serialize correctly
-    //  following code is what does not work for correct deserialization. The input witness is truncated for some reason...
-    //  if (GetSerializeSize(tx) != txToLen) {
-    //      return set_error(err, atomicalsconsensus_ERR_TX_SIZE_MISMATCH);
-    // }
-    CTransactionView txView(tx);
-    /*
-    if (GetSerializeSize(tx, PROTOCOL_VERSION) != txToLen) {
-        std::cout << "serailzied size: " << GetSerializeSize(tx, PROTOCOL_VERSION) << std::endl;
-        std::cout << "txToLen: " << txToLen << std::endl;
-        return set_error(err, atomicalsconsensus_ERR_TX_SIZE_MISMATCH);
-    }
-    //
-    */
+    // Read the transaction in place: introspection only touches the fields it asks for, and the id and
+    // signature hash midstates are only computed if a script needs them.
+    CTransactionBufferView tx(Span<const uint8_t>(txTo, txToLen));
     // Regardless of the verification result, the tx did not error.
     set_error(err, atomicalsconsensus_ERR_OK);
     CScript const spk(lockScript, lockScript + lockScriptLen);
     CScript const unlockSig(unlockScript, unlockScript + unlockScriptLen);
 
-    PrecomputedTransactionData txdata(tx);
-    json copiedState(contractState.begin(), contractState.end());
-
     CCoinsView coinsDummy;
     CCoinsViewCache coinsCache(&coinsDummy);
 
@@ -136,38 +149,42 @@ static int verify_script_avm(const uint8_t *lockScript, // The locking script es
     ScriptExecutionContext createdContext = ScriptExecutionContext::createForTx(tx, coinsCache, fullScriptVec, authPubKeyVec);
     ScriptExecutionContext const context = createdContext;
 
-    json ftStateCopy(ftState.begin(), ftState.end());
-    json ftStateIncomingCopy(ftStateIncoming.begin(), ftStateIncoming.end());
-    json nftStateCopy(nftState.begin(), nftState.end());
-    json nftStateIncomingCopy(nftStateIncoming.begin(), nftStateIncoming.end());
-    json contractStateCopy(contractState.begin(), contractState.end());
-    json contractExternalStateCopy(contractExternalState.begin(), contractExternalState.end());
-
-    std::cout << "ftStateCopy" << ftStateCopy << std::endl;
-    std::cout << "ftStateIncomingCopy" << ftStateIncomingCopy << std::endl;
-    std::cout << "nftStateCopy" << nftStateCopy << std::endl;
-    std::cout << "nftStateIncomingCopy" << nftStateIncomingCopy << std::endl;
-    std::cout << "contractStateCopy" << contractStateCopy << std::endl;
-    std::cout << "contractExternalStateCopy" << contractExternalStateCopy << std::endl;
+    // The snapshot is built from the decoded inputs: the call then changes it in place
+    StateResult<ScriptStateContext> createdState = ScriptStateContext::Create(
+        ftState, ftStateIncoming, nftState, nftStateIncoming, contractState, contractExternalState);
+    if (!createdState) {
+        return set_error(err, state_error(createdState.error()));
+    }
+    ScriptStateContext &state = *createdState;
+    if (flags & atomicalsconsensus_SCRIPT_FLAGS_VERIFY_HEADERS) {
+        if (const StateError error = state.verifyBlockInfoHeaders(); error != StateError::OK) {
+            return set_error(err, state_error(error));
+        }
+    }
+    state.setAccessSet(accessSet);
+    if (stateDigests) {
+        state.trackStateDigests(*stateDigests);
+    }
 
-    ScriptStateContext state(ftStateCopy, ftStateIncomingCopy, nftStateCopy, nftStateIncomingCopy, contractStateCopy,
-                             contractExternalStateCopy);
+    uint32_t scriptFlags = SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    if (flags & atomicalsconsensus_SCRIPT_FLAGS_ENABLE_CHECKTXINBLOCK) {
+        scriptFlags |= SCRIPT_ENABLE_CHECKTXINBLOCK;
+    }
 
     // Default script errors
     ScriptError tempScriptError = ScriptError::OK;
+    ScriptExecutionMetrics metrics;
     auto error_code = VerifyScriptAvm(unlockSig, // Use the provided unlocking script sig because we are in AVM context
-                                      spk, TransactionSignatureChecker(&tx, 0, Amount::zero(), txdata), context, state,
-                                      &tempScriptError, script_err_op_num);
-    json ftBalancesResult = state.getFtBalancesResult();
-    json nftBalancesResult = state.getNftBalancesResult();
-    *stateContext = state;
+                                      spk, scriptFlags, BufferTransactionSignatureChecker(&tx, 0, Amount::zero()),
+                                      metrics, context, state, &tempScriptError, script_err_op_num);
+    *stateContext = std::move(state);
     *script_err = (int)tempScriptError;
-    std::cout << "script_error_code: " << (int)(*script_err) << std::endl;
-    std::cout << "script_err_op_num: " << (int)(*script_err_op_num) << std::endl;
     return error_code;
 }
 
-int atomicalsconsensus_verify_script_avm(
+static_assert(ATOMICALSCONSENSUS_STATE_DIGESTS_SIZE == ContractStateDigests::SERIALIZED_SIZE);
+
+static int verify_script_avm_cbor(
     const uint8_t *lockScript, unsigned int lockScriptLen, const uint8_t *unlockScript, unsigned int unlockScriptLen,
     const uint8_t *txTo, unsigned int txToLen, const uint8_t *authPubKey, unsigned int authPubKeyLen, 
     const uint8_t *ftStateCbor, unsigned int ftStateCborLen,
@@ -186,132 +203,491 @@ int atomicalsconsensus_verify_script_avm(
     unsigned int *ftWithdrawsLen, uint8_t *nftWithdraws,
     unsigned int *nftWithdrawsLen,
     uint8_t *ftBalancesAdded, unsigned int *ftBalancesAddedLen,
-    uint8_t *nftPuts, unsigned int *nftPutsLen
-    ) {
+    uint8_t *nftPuts, unsigned int *nftPutsLen,
+    unsigned int flags, uint8_t *stateDigests,
+    ScriptStateAccessSet *accessSet, unsigned int outputCapacity) {
 
+    if (!verify_flags(flags)) {
+        return set_error(err, atomicalsconsensus_ERR_INVALID_FLAGS);
+    }
     // Regardless of the verification result, the tx did not error.
     set_error(err, atomicalsconsensus_ERR_OK);
 
     // Copy all of the states
     std::vector<std::uint8_t> prevStateHashBytes(prevStateHash, prevStateHash + 32);
-    std::vector<std::uint8_t> ftStateBytes(ftStateCbor, ftStateCbor + ftStateCborLen);
-    std::vector<std::uint8_t> ftStateIncomingBytes(ftStateIncomingCbor, ftStateIncomingCbor + ftStateIncomingCborLen);
-    std::vector<std::uint8_t> nftStateBytes(nftStateCbor, nftStateCbor + nftStateCborLen);
-    std::vector<std::uint8_t> nftStateIncomingBytes(nftStateIncomingCbor,
-                                                    nftStateIncomingCbor + nftStateIncomingCborLen);
-    std::vector<std::uint8_t> contractExternalStateBytes(contractExternalStateCbor,
-                                                         contractExternalStateCbor + contractExternalStateCborLen);
-    std::vector<std::uint8_t> contractStateBytes(contractStateCbor, contractStateCbor + contractStateCborLen);
-
-    auto ftState = json::from_cbor(ftStateBytes, true, true, json::cbor_tag_handler_t::error);
-    auto ftStateIncoming = json::from_cbor(ftStateIncomingBytes, true, true, json::cbor_tag_handler_t::error);
-    auto nftState = json::from_cbor(nftStateBytes, true, true, json::cbor_tag_handler_t::error);
-    auto nftStateIncoming = json::from_cbor(nftStateIncomingBytes, true, true, json::cbor_tag_handler_t::error);
-    auto contractExternalState =
-        json::from_cbor(contractExternalStateBytes, true, true, json::cbor_tag_handler_t::error);
-    auto contractState = json::from_cbor(contractStateBytes, true, true, json::cbor_tag_handler_t::error);
-
-    uint32_t flags(0);
+    auto ftState = decode_state(ftStateCbor, ftStateCborLen);
+    auto ftStateIncoming = decode_state(ftStateIncomingCbor, ftStateIncomingCborLen);
+    auto nftState = decode_state(nftStateCbor, nftStateCborLen);
+    auto nftStateIncoming = decode_state(nftStateIncomingCbor, nftStateIncomingCborLen);
+    auto contractExternalState = decode_state(contractExternalStateCbor, contractExternalStateCborLen);
+    auto contractState = decode_state(contractStateCbor, contractStateCborLen);
+    if (ftState.is_discarded() || ftStateIncoming.is_discarded() || nftState.is_discarded() ||
+        nftStateIncoming.is_discarded() || contractExternalState.is_discarded() || contractState.is_discarded()) {
+        return set_error(err, atomicalsconsensus_ERR_STATE_DECODE_ERROR);
+    }
+
+    bool stateHashV2 = flags & atomicalsconsensus_SCRIPT_FLAGS_STATE_HASH_V2;
+    if (stateHashV2 && !stateDigests) {
+        return set_error(err, atomicalsconsensus_ERR_INVALID_FLAGS);
+    }
+    std::optional<ContractStateDigests> prevStateDigests;
+    if (stateHashV2) {
+        prevStateDigests = ContractStateDigests::FromBytes(stateDigests);
+        if (!prevStateDigests) {
+            return set_error(err, atomicalsconsensus_ERR_STATE_DECODE_ERROR);
+        }
+    }
+
     ScriptStateContext stateContext;
     int result = ::verify_script_avm(lockScript, lockScriptLen, unlockScript, unlockScriptLen, ftState, ftStateIncoming,
                                      nftState, nftStateIncoming, contractState, contractExternalState,
-                                     txTo, txToLen,authPubKey, authPubKeyLen, flags, err, script_err, script_err_op_num, &stateContext);
+                                     txTo, txToLen,authPubKey, authPubKeyLen, flags, err, script_err, script_err_op_num, &stateContext,
+                                     accessSet, prevStateDigests ? &*prevStateDigests : nullptr);
     if (result != 1) {
         return result;
     }
 
     // Remove empty keyspaces
     // After various deletes there could be empty keyspaces, ensure they are removed prior to returning
-    stateContext.cleanupStateAndBalances();
-    // Throws state format error, which should return a runtime error and force the program to crash since it should
-    // never happen Also can throw state size limit error which should be caught and translated into a comprehensible
-    // error
-    try {
-        stateContext.validateFinalStateRestrictions();
-    } catch (StateValidationStateSizeLimitError &ex) {
-        return set_error(err, atomicalsconsensus_ERR_STATE_SIZE_ERROR);
-    } catch (StateValidationStateUpdateSizeLimitError &ex) {
-        return set_error(err, atomicalsconsensus_ERR_STATE_UPDATES_SIZE_ERROR);
-    } catch (StateValidationStateDeleteSizeLimitError &ex) {
-        return set_error(err, atomicalsconsensus_ERR_STATE_DELETES_SIZE_ERROR);
-    } catch (StateValidationTokenFtBalanceSizeLimitError &ex) {
-        return set_error(err, atomicalsconsensus_ERR_STATE_FT_BALANCES_SIZE_ERROR);
-    } catch (StateValidationTokenFtBalanceUpdateSizeLimitError &ex) {
-        return set_error(err, atomicalsconsensus_ERR_STATE_FT_BALANCES_UPDATES_SIZE_ERROR);
-    } catch (StateValidationTokenNftBalanceSizeLimitError &ex) {
-        return set_error(err, atomicalsconsensus_ERR_STATE_NFT_BALANCES_SIZE_ERROR);
-    } catch (StateValidationTokenNftBalanceUpdateSizeLimitError &ex) {
-        return set_error(err, atomicalsconsensus_ERR_STATE_NFT_BALANCES_UPDATES_SIZE_ERROR);
+    if (const StateError error = stateContext.cleanupStateAndBalances(); error != StateError::OK) {
+        return set_error(err, state_error(error));
+    }
+    // The size limits apply to the state as the call left it
+    if (const StateError error = stateContext.validateFinalStateRestrictions(); error != StateError::OK) {
+        return set_error(err, state_error(error));
     }
 
-    // Copy the Final contract state
+    struct Output {
+        std::vector<uint8_t> bytes;
+        uint8_t *dest;
+        unsigned int *destLen;
+    };
+    std::vector<Output> outputs;
+    outputs.reserve(11);
+
+    // Encode the Final contract state
     //
     json stateFinalJson = stateContext.getContractStateFinal();
-    CopyBytes(json::to_cbor(stateFinalJson), stateFinal, stateFinalLen);
+    outputs.push_back({json::to_cbor(stateFinalJson), stateFinal, stateFinalLen});
     //
-    // Copy the Updated State data
+    // Encode the Updated State data
     //
     json stateUpdatesJson = stateContext.getContractStateUpdates();
-    CopyBytes(json::to_cbor(stateUpdatesJson), stateUpdates, stateUpdatesLen);
+    outputs.push_back({json::to_cbor(stateUpdatesJson), stateUpdates, stateUpdatesLen});
     //
-    // Copy the Deleted State data
+    // Encode the Deleted State data
     //
     json stateDeletesJson = stateContext.getContractStateDeletes();
-    CopyBytes(json::to_cbor(stateDeletesJson), stateDeletes, stateDeletesLen);
+    outputs.push_back({json::to_cbor(stateDeletesJson), stateDeletes, stateDeletesLen});
     //
-    // Copy the FT balances result
+    // Encode the FT balances result
     //
     json ftBalancesJson = stateContext.getFtBalancesResult();
-    CopyBytes(json::to_cbor(ftBalancesJson), ftBalancesResult, ftBalancesResultLen);
+    outputs.push_back({json::to_cbor(ftBalancesJson), ftBalancesResult, ftBalancesResultLen});
     //
-    // Copy the FT balances updates result
+    // Encode the FT balances updates result
     //
     json ftBalancesUpdatesJson = stateContext.getFtBalancesUpdatesResult();
-    CopyBytes(json::to_cbor(ftBalancesUpdatesJson), ftBalancesUpdatesResult, ftBalancesUpdatesResultLen);
+    outputs.push_back({json::to_cbor(ftBalancesUpdatesJson), ftBalancesUpdatesResult, ftBalancesUpdatesResultLen});
     //
-    // Copy the NFT balances result
+    // Encode the NFT balances result
     //
     json nftBalancesJson = stateContext.getNftBalancesResult();
-    CopyBytes(json::to_cbor(nftBalancesJson), nftBalancesResult, nftBalancesResultLen);
+    outputs.push_back({json::to_cbor(nftBalancesJson), nftBalancesResult, nftBalancesResultLen});
     //
-    // Copy the NFT balances updates result
+    // Encode the NFT balances updates result
     //
     json nftBalancesUpdatesJson = stateContext.getNftBalancesUpdatesResult();
-    CopyBytes(json::to_cbor(nftBalancesUpdatesJson), nftBalancesUpdatesResult, nftBalancesUpdatesResultLen);
+    outputs.push_back({json::to_cbor(nftBalancesUpdatesJson), nftBalancesUpdatesResult, nftBalancesUpdatesResultLen});
     //
-    // Copy FT withdraws
+    // Encode FT withdraws
     //
     json ftWithdrawsJson = stateContext.getFtWithdrawsResult();
-    CopyBytes(json::to_cbor(ftWithdrawsJson), ftWithdraws, ftWithdrawsLen);
+    outputs.push_back({json::to_cbor(ftWithdrawsJson), ftWithdraws, ftWithdrawsLen});
     //
-    // Copy NFT withdraws
+    // Encode NFT withdraws
     //
     json nftWithdrawsJson = stateContext.getNftWithdrawsResult();
-    CopyBytes(json::to_cbor(nftWithdrawsJson), nftWithdraws, nftWithdrawsLen);
+    outputs.push_back({json::to_cbor(nftWithdrawsJson), nftWithdraws, nftWithdrawsLen});
 
     //
-    // Copy the FTs that were taken from incoming and added to balance
+    // Encode the FTs that were taken from incoming and added to balance
     //
     json ftIncomingBalancesAddedJson = stateContext.getFtIncomingBalancesAddedResult();
-    CopyBytes(json::to_cbor(ftIncomingBalancesAddedJson), ftBalancesAdded, ftBalancesAddedLen);
+    outputs.push_back({json::to_cbor(ftIncomingBalancesAddedJson), ftBalancesAdded, ftBalancesAddedLen});
     //
-    // Copy NFTs that were taken from incoming and put to balance
+    // Encode NFTs that were taken from incoming and put to balance
     //
     json nftIncomingPutsJson = stateContext.getNftIncomingPutsResult();
-    CopyBytes(json::to_cbor(nftIncomingPutsJson), nftPuts, nftPutsLen);
+    outputs.push_back({json::to_cbor(nftIncomingPutsJson), nftPuts, nftPutsLen});
+
+    // Nothing is written unless every output fits, and the caller learns the size of each
+    if (outputCapacity != 0) {
+        bool fits = true;
+        for (const Output &output : outputs) {
+            fits &= output.bytes.size() <= outputCapacity;
+        }
+        if (!fits) {
+            for (const Output &output : outputs) {
+                *output.destLen = output.bytes.size();
+            }
+            return set_error(err, atomicalsconsensus_ERR_OUTPUT_SIZE);
+        }
+    }
+    for (const Output &output : outputs) {
+        CopyBytes(output.bytes, output.dest, output.destLen);
+    }
 
     // Convert previous state hash into vector
     std::vector<uint8_t> vchprevStateHash(prevStateHash, prevStateHash + 32);
-    std::vector<uint8_t> updatedStateHash =
-        CalculateStateHash(vchprevStateHash, stateFinalJson, stateUpdatesJson, stateDeletesJson, ftStateIncoming,
-                           nftStateIncoming, ftBalancesJson, ftBalancesUpdatesJson, nftBalancesJson,
-                           nftBalancesUpdatesJson, ftWithdrawsJson, nftWithdrawsJson);
+    StateResult<std::vector<uint8_t>> updatedStateHash = StateError::STATE_FORMAT;
+    if (stateHashV2) {
+        const ContractStateDigests &updatedStateDigests = *stateContext.getContractState().digests();
+        updatedStateHash = CalculateStateHashV2(vchprevStateHash, updatedStateDigests, stateUpdatesJson,
+                                                stateDeletesJson, ftStateIncoming, nftStateIncoming,
+                                                ftBalancesUpdatesJson, nftBalancesUpdatesJson, ftWithdrawsJson,
+                                                nftWithdrawsJson);
+        if (!updatedStateHash) {
+            return set_error(err, state_error(updatedStateHash.error()));
+        }
+        updatedStateDigests.ToBytes(stateDigests);
+    } else {
+        updatedStateHash =
+            CalculateStateHash(vchprevStateHash, stateFinalJson, stateUpdatesJson, stateDeletesJson, ftStateIncoming,
+                               nftStateIncoming, ftBalancesJson, ftBalancesUpdatesJson, nftBalancesJson,
+                               nftBalancesUpdatesJson, ftWithdrawsJson, nftWithdrawsJson);
+        if (!updatedStateHash) {
+            return set_error(err, state_error(updatedStateHash.error()));
+        }
+    }
 
-    CopyBytesNoDestLen(updatedStateHash, stateHash);
+    CopyBytesNoDestLen(*updatedStateHash, stateHash);
     return result;
 }
 
+int atomicalsconsensus_verify_script_avm(
+    const uint8_t *lockScript, unsigned int lockScriptLen, const uint8_t *unlockScript, unsigned int unlockScriptLen,
+    const uint8_t *txTo, unsigned int txToLen, const uint8_t *authPubKey, unsigned int authPubKeyLen, 
+    const uint8_t *ftStateCbor, unsigned int ftStateCborLen,
+    const uint8_t *ftStateIncomingCbor, unsigned int ftStateIncomingCborLen, const uint8_t *nftStateCbor,
+    unsigned int nftStateCborLen, const uint8_t *nftStateIncomingCbor, unsigned int nftStateIncomingCborLen,
+    const uint8_t *contractExternalStateCbor, unsigned int contractExternalStateCborLen,
+    const uint8_t *contractStateCbor, unsigned int contractStateCborLen, const uint8_t *prevStateHash,
+    atomicalsconsensus_error *err, unsigned int *script_err, unsigned int *script_err_op_num, uint8_t *stateHash,
+    uint8_t *stateFinal, unsigned int *stateFinalLen, uint8_t *stateUpdates,
+    unsigned int *stateUpdatesLen, uint8_t *stateDeletes,
+    unsigned int *stateDeletesLen, uint8_t *ftBalancesResult,
+    unsigned int *ftBalancesResultLen, uint8_t *ftBalancesUpdatesResult,
+    unsigned int *ftBalancesUpdatesResultLen, uint8_t *nftBalancesResult,
+    unsigned int *nftBalancesResultLen, uint8_t *nftBalancesUpdatesResult,
+    unsigned int *nftBalancesUpdatesResultLen, uint8_t *ftWithdraws,
+    unsigned int *ftWithdrawsLen, uint8_t *nftWithdraws,
+    unsigned int *nftWithdrawsLen,
+    uint8_t *ftBalancesAdded, unsigned int *ftBalancesAddedLen,
+    uint8_t *nftPuts, unsigned int *nftPutsLen
+    ) {
+    return verify_script_avm_cbor(
+        lockScript, lockScriptLen, unlockScript, unlockScriptLen, txTo, txToLen, authPubKey, authPubKeyLen,
+        ftStateCbor, ftStateCborLen, ftStateIncomingCbor, ftStateIncomingCborLen, nftStateCbor, nftStateCborLen,
+        nftStateIncomingCbor, nftStateIncomingCborLen, contractExternalStateCbor, contractExternalStateCborLen,
+        contractStateCbor, contractStateCborLen, prevStateHash, err, script_err, script_err_op_num, stateHash,
+        stateFinal, stateFinalLen, stateUpdates, stateUpdatesLen, stateDeletes, stateDeletesLen, ftBalancesResult,
+        ftBalancesResultLen, ftBalancesUpdatesResult, ftBalancesUpdatesResultLen, nftBalancesResult,
+        nftBalancesResultLen, nftBalancesUpdatesResult, nftBalancesUpdatesResultLen, ftWithdraws, ftWithdrawsLen,
+        nftWithdraws, nftWithdrawsLen, ftBalancesAdded, ftBalancesAddedLen, nftPuts, nftPutsLen, 0, nullptr, nullptr, 0);
+}
+
+int atomicalsconsensus_verify_script_avm_access_set(
+    const uint8_t *lockScript, unsigned int lockScriptLen, const uint8_t *unlockScript, unsigned int unlockScriptLen,
+    const uint8_t *txTo, unsigned int txToLen, const uint8_t *authPubKey, unsigned int authPubKeyLen, 
+    const uint8_t *ftStateCbor, unsigned int ftStateCborLen,
+    const uint8_t *ftStateIncomingCbor, unsigned int ftStateIncomingCborLen, const uint8_t *nftStateCbor,
+    unsigned int nftStateCborLen, const uint8_t *nftStateIncomingCbor, unsigned int nftStateIncomingCborLen,
+    const uint8_t *contractExternalStateCbor, unsigned int contractExternalStateCborLen,
+    const uint8_t *contractStateCbor, unsigned int contractStateCborLen, const uint8_t *prevStateHash,
+    atomicalsconsensus_error *err, unsigned int *script_err, unsigned int *script_err_op_num, uint8_t *stateHash,
+    uint8_t *stateFinal, unsigned int *stateFinalLen, uint8_t *stateUpdates,
+    unsigned int *stateUpdatesLen, uint8_t *stateDeletes,
+    unsigned int *stateDeletesLen, uint8_t *ftBalancesResult,
+    unsigned int *ftBalancesResultLen, uint8_t *ftBalancesUpdatesResult,
+    unsigned int *ftBalancesUpdatesResultLen, uint8_t *nftBalancesResult,
+    unsigned int *nftBalancesResultLen, uint8_t *nftBalancesUpdatesResult,
+    unsigned int *nftBalancesUpdatesResultLen, uint8_t *ftWithdraws,
+    unsigned int *ftWithdrawsLen, uint8_t *nftWithdraws,
+    unsigned int *nftWithdrawsLen,
+    uint8_t *ftBalancesAdded, unsigned int *ftBalancesAddedLen,
+    uint8_t *nftPuts, unsigned int *nftPutsLen,
+    uint8_t *accessSet, unsigned int *accessSetLen) {
+    ScriptStateAccessSet recordedAccessSet;
+    int result = verify_script_avm_cbor(
+        lockScript, lockScriptLen, unlockScript, unlockScriptLen, txTo, txToLen, authPubKey, authPubKeyLen,
+        ftStateCbor, ftStateCborLen, ftStateIncomingCbor, ftStateIncomingCborLen, nftStateCbor, nftStateCborLen,
+        nftStateIncomingCbor, nftStateIncomingCborLen, contractExternalStateCbor, contractExternalStateCborLen,
+        contractStateCbor, contractStateCborLen, prevStateHash, err, script_err, script_err_op_num, stateHash,
+        stateFinal, stateFinalLen, stateUpdates, stateUpdatesLen, stateDeletes, stateDeletesLen, ftBalancesResult,
+        ftBalancesResultLen, ftBalancesUpdatesResult, ftBalancesUpdatesResultLen, nftBalancesResult,
+        nftBalancesResultLen, nftBalancesUpdatesResult, nftBalancesUpdatesResultLen, ftWithdraws, ftWithdrawsLen,
+        nftWithdraws, nftWithdrawsLen, ftBalancesAdded, ftBalancesAddedLen, nftPuts, nftPutsLen, 0, nullptr,
+        &recordedAccessSet, 0);
+    // Written whatever the result: the keys read by a failed call are still worth prefetching
+    std::vector<uint8_t> accessSetBytes;
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, accessSetBytes, 0) << recordedAccessSet;
+    CopyBytes(accessSetBytes, accessSet, accessSetLen);
+    return result;
+}
+
+int atomicalsconsensus_verify_script_avm_flags(
+    const uint8_t *lockScript, unsigned int lockScriptLen, const uint8_t *unlockScript, unsigned int unlockScriptLen,
+    const uint8_t *txTo, unsigned int txToLen, const uint8_t *authPubKey, unsigned int authPubKeyLen,
+    const uint8_t *ftStateCbor, unsigned int ftStateCborLen,
+    const uint8_t *ftStateIncomingCbor, unsigned int ftStateIncomingCborLen, const uint8_t *nftStateCbor,
+    unsigned int nftStateCborLen, const uint8_t *nftStateIncomingCbor, unsigned int nftStateIncomingCborLen,
+    const uint8_t *contractExternalStateCbor, unsigned int contractExternalStateCborLen,
+    const uint8_t *contractStateCbor, unsigned int contractStateCborLen, const uint8_t *prevStateHash,
+    atomicalsconsensus_error *err, unsigned int *script_err, unsigned int *script_err_op_num, uint8_t *stateHash,
+    uint8_t *stateFinal, unsigned int *stateFinalLen, uint8_t *stateUpdates,
+    unsigned int *stateUpdatesLen, uint8_t *stateDeletes,
+    unsigned int *stateDeletesLen, uint8_t *ftBalancesResult,
+    unsigned int *ftBalancesResultLen, uint8_t *ftBalancesUpdatesResult,
+    unsigned int *ftBalancesUpdatesResultLen, uint8_t *nftBalancesResult,
+    unsigned int *nftBalancesResultLen, uint8_t *nftBalancesUpdatesResult,
+    unsigned int *nftBalancesUpdatesResultLen, uint8_t *ftWithdraws,
+    unsigned int *ftWithdrawsLen, uint8_t *nftWithdraws,
+    unsigned int *nftWithdrawsLen,
+    uint8_t *ftBalancesAdded, unsigned int *ftBalancesAddedLen,
+    uint8_t *nftPuts, unsigned int *nftPutsLen,
+    unsigned int flags, uint8_t *stateDigests) {
+    return verify_script_avm_cbor(
+        lockScript, lockScriptLen, unlockScript, unlockScriptLen, txTo, txToLen, authPubKey, authPubKeyLen,
+        ftStateCbor, ftStateCborLen, ftStateIncomingCbor, ftStateIncomingCborLen, nftStateCbor, nftStateCborLen,
+        nftStateIncomingCbor, nftStateIncomingCborLen, contractExternalStateCbor, contractExternalStateCborLen,
+        contractStateCbor, contractStateCborLen, prevStateHash, err, script_err, script_err_op_num, stateHash,
+        stateFinal, stateFinalLen, stateUpdates, stateUpdatesLen, stateDeletes, stateDeletesLen, ftBalancesResult,
+        ftBalancesResultLen, ftBalancesUpdatesResult, ftBalancesUpdatesResultLen, nftBalancesResult,
+        nftBalancesResultLen, nftBalancesUpdatesResult, nftBalancesUpdatesResultLen, ftWithdraws, ftWithdrawsLen,
+        nftWithdraws, nftWithdrawsLen, ftBalancesAdded, ftBalancesAddedLen, nftPuts, nftPutsLen, flags, stateDigests,
+        nullptr, 0);
+}
+
+int atomicalsconsensus_state_digests(const uint8_t *ftStateCbor, unsigned int ftStateCborLen,
+                                     const uint8_t *nftStateCbor, unsigned int nftStateCborLen,
+                                     const uint8_t *contractStateCbor, unsigned int contractStateCborLen,
+                                     atomicalsconsensus_error *err, uint8_t *stateDigests) {
+    set_error(err, atomicalsconsensus_ERR_OK);
+    auto ftState = decode_state(ftStateCbor, ftStateCborLen);
+    auto nftState = decode_state(nftStateCbor, nftStateCborLen);
+    auto contractState = decode_state(contractStateCbor, contractStateCborLen);
+    if (ftState.is_discarded() || nftState.is_discarded() || contractState.is_discarded()) {
+        return set_error(err, atomicalsconsensus_ERR_STATE_DECODE_ERROR);
+    }
+
+    // Same checks as a call starting from this snapshot, and the same form once loaded: the digests match those the
+    // call would have kept up to date
+    if (const auto stateBytes = StateValidation::performValidateStateRestrictionsState(contractState); !stateBytes) {
+        return set_error(err, state_error(stateBytes.error()));
+    }
+    if (const auto ftBytes = StateValidation::performValidateStateRestrictionsTokenFtBalances(ftState); !ftBytes) {
+        return set_error(err, state_error(ftBytes.error()));
+    }
+    if (const auto nftBytes = StateValidation::performValidateStateRestrictionsTokenNftBalances(nftState);
+        !nftBytes) {
+        return set_error(err, state_error(nftBytes.error()));
+    }
+    ContractStateDigests(ContractState(contractState, ftState, nftState)).ToBytes(stateDigests);
+    return 1;
+}
+
+int atomicalsconsensus_headers_put(unsigned int height, const uint8_t *header, unsigned int headerLen) {
+    if (header == nullptr) {
+        return 0;
+    }
+    return BlockHeaderStore::Get().Put(height, std::vector<uint8_t>(header, header + headerLen)) ? 1 : 0;
+}
+
+int atomicalsconsensus_headers_remove(unsigned int height) {
+    return BlockHeaderStore::Get().Remove(height) ? 1 : 0;
+}
+
+int atomicalsconsensus_headers_set_tip(unsigned int height) {
+    return BlockHeaderStore::Get().SetTip(height) ? 1 : 0;
+}
+
+const char *atomicalsconsensus_crypto_backend() {
+    return InitCryptoBackend().c_str();
+}
+
 unsigned int atomicalsconsensus_version() {
     // Just use the API version for now
     return ATOMICALSCONSENSUS_API_VER;
 }
+
+int atomicalsconsensus_set_script_jit(int enabled, unsigned int callThreshold, int differential) {
+    ScriptJitConfig config;
+    config.enabled = enabled != 0;
+    config.callThreshold = callThreshold;
+    config.differential = differential != 0;
+    SetScriptJitConfig(config);
+    return GetScriptJitConfig().enabled ? 1 : 0;
+}
+
+uint64_t atomicalsconsensus_script_jit_mismatches() {
+    return GetScriptJitMismatches();
+}
+
+int atomicalsconsensus_analyze_script(const uint8_t *script, unsigned int scriptLen,
+                                      atomicalsconsensus_script_analysis *analysis) {
+    if (analysis == nullptr || (script == nullptr && scriptLen != 0)) {
+        return 0;
+    }
+    const ScriptAnalysis result = GetScriptAnalysis(CScript(script, script + scriptLen));
+    analysis->script_error = static_cast<unsigned int>(result.error);
+    analysis->script_error_op_num = result.errorOpNum;
+    analysis->script_size = result.scriptSize;
+    analysis->op_count = result.opCount;
+    analysis->push_count = result.pushCount;
+    analysis->max_push_size = result.maxPushSize;
+    analysis->nonminimal_pushes = result.nonMinimalPushes;
+    analysis->unknown_opcodes = result.unknownOpcodes;
+    analysis->max_conditional_depth = result.maxConditionalDepth;
+    analysis->sig_checks = result.sigChecks;
+    analysis->hash_ops = result.hashOps;
+    analysis->state_reads = result.stateReads;
+    analysis->state_writes = result.stateWrites;
+    analysis->proof_checks = result.proofChecks;
+    analysis->cost = result.cost;
+    return result.error == ScriptError::OK ? 1 : 0;
+}
+
+/**
+ * Runs a call submitted to a ring or a block, as
+ * atomicalsconsensus_verify_script_avm_flags would. Runs on threads of the
+ * library that have nobody to throw to, so it throws nothing.
+ */
+static int run_call(atomicalsconsensus_call &call) {
+    try {
+        ScriptStateAccessSet recordedAccessSet;
+        const int result = verify_script_avm_cbor(
+            call.lock_script, call.lock_script_len, call.unlock_script, call.unlock_script_len, call.tx_to,
+            call.tx_to_len, call.auth_pub_key, call.auth_pub_key_len, call.ft_state_cbor, call.ft_state_cbor_len,
+            call.ft_state_incoming_cbor, call.ft_state_incoming_cbor_len, call.nft_state_cbor, call.nft_state_cbor_len,
+            call.nft_state_incoming_cbor, call.nft_state_incoming_cbor_len, call.contract_external_state_cbor,
+            call.contract_external_state_cbor_len, call.contract_state_cbor, call.contract_state_cbor_len,
+            call.prev_state_hash, &call.err, &call.script_error, &call.script_error_op_num, call.state_hash,
+            call.state_final, &call.state_final_len, call.state_updates, &call.state_updates_len, call.state_deletes,
+            &call.state_deletes_len, call.ft_balances_result, &call.ft_balances_result_len,
+            call.ft_balances_updates_result, &call.ft_balances_updates_result_len, call.nft_balances_result,
+            &call.nft_balances_result_len, call.nft_balances_updates_result, &call.nft_balances_updates_result_len,
+            call.ft_withdraws, &call.ft_withdraws_len, call.nft_withdraws, &call.nft_withdraws_len,
+            call.ft_balances_added, &call.ft_balances_added_len, call.nft_puts, &call.nft_puts_len, call.flags,
+            call.state_digests, call.access_set ? &recordedAccessSet : nullptr, call.output_capacity);
+        if (call.access_set) {
+            std::vector<uint8_t> accessSetBytes;
+            CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, accessSetBytes, 0) << recordedAccessSet;
+            CopyBytes(accessSetBytes, call.access_set, &call.access_set_len);
+        }
+        return result;
+    } catch (const std::ios_base::failure &) {
+        return set_error(&call.err, atomicalsconsensus_ERR_TX_DESERIALIZE);
+    } catch (const std::exception &) {
+        return set_error(&call.err, atomicalsconsensus_ERR_EXCEPTION);
+    } catch (...) {
+        return set_error(&call.err, atomicalsconsensus_ERR_EXCEPTION);
+    }
+}
+
+struct atomicalsconsensus_ring {
+    atomicalsconsensus_ring(unsigned int entries, unsigned int threads) : ring(entries, threads, run_call) {}
+
+    ExecutionRing<atomicalsconsensus_call> ring;
+};
+
+atomicalsconsensus_ring *atomicalsconsensus_ring_create(unsigned int entries, unsigned int threads) {
+    return new atomicalsconsensus_ring(entries, threads);
+}
+
+void atomicalsconsensus_ring_destroy(atomicalsconsensus_ring *ring) {
+    delete ring;
+}
+
+unsigned int atomicalsconsensus_ring_submit(atomicalsconsensus_ring *ring, atomicalsconsensus_call *const *calls,
+                                            unsigned int count) {
+    return ring->ring.Submit(calls, count);
+}
+
+unsigned int atomicalsconsensus_ring_poll(atomicalsconsensus_ring *ring, atomicalsconsensus_completion *completions,
+                                          unsigned int max) {
+    ExecutionRing<atomicalsconsensus_call>::Completion completion;
+    unsigned int reaped = 0;
+    while (reaped < max && ring->ring.Poll(&completion, 1)) {
+        completions[reaped++] = {completion.call, completion.result};
+    }
+    return reaped;
+}
+
+unsigned int atomicalsconsensus_ring_wait(atomicalsconsensus_ring *ring, atomicalsconsensus_completion *completions,
+                                          unsigned int max) {
+    ExecutionRing<atomicalsconsensus_call>::Completion completion;
+    if (max == 0 || !ring->ring.Wait(&completion, 1)) {
+        return 0;
+    }
+    completions[0] = {completion.call, completion.result};
+    return 1 + atomicalsconsensus_ring_poll(ring, completions + 1, max - 1);
+}
+
+int atomicalsconsensus_ring_fd(const atomicalsconsensus_ring *ring) {
+    return ring->ring.fd();
+}
+
+int atomicalsconsensus_verify_block(atomicalsconsensus_block_call *calls, unsigned int count, unsigned int threads) {
+    if (calls == nullptr && count != 0) {
+        return 0;
+    }
+    // run_call throws nothing: only the scheduling can, for lack of memory
+    try {
+        std::vector<Span<const uint8_t>> contracts;
+        contracts.reserve(count);
+        for (unsigned int i = 0; i < count; i++) {
+            contracts.emplace_back(calls[i].contract_id, calls[i].contract_id_len);
+        }
+        const std::vector<std::vector<size_t>> chains = GroupCallChains(contracts);
+        RunCallChains(chains, threads, [&](size_t chain) {
+            // The call whose outputs are the state of the contract, none before one succeeds
+            const atomicalsconsensus_call *last = nullptr;
+            const uint8_t *stateDigests = calls[chains[chain].front()].call.state_digests;
+            for (const size_t i : chains[chain]) {
+                atomicalsconsensus_call &call = calls[i].call;
+                if (last) {
+                    call.ft_state_cbor = last->ft_balances_result;
+                    call.ft_state_cbor_len = last->ft_balances_result_len;
+                    call.nft_state_cbor = last->nft_balances_result;
+                    call.nft_state_cbor_len = last->nft_balances_result_len;
+                    call.contract_state_cbor = last->state_final;
+                    call.contract_state_cbor_len = last->state_final_len;
+                    call.prev_state_hash = last->state_hash;
+                } else if (i != chains[chain].front()) {
+                    const atomicalsconsensus_call &first = calls[chains[chain].front()].call;
+                    call.ft_state_cbor = first.ft_state_cbor;
+                    call.ft_state_cbor_len = first.ft_state_cbor_len;
+                    call.nft_state_cbor = first.nft_state_cbor;
+                    call.nft_state_cbor_len = first.nft_state_cbor_len;
+                    call.contract_state_cbor = first.contract_state_cbor;
+                    call.contract_state_cbor_len = first.contract_state_cbor_len;
+                    call.prev_state_hash = first.prev_state_hash;
+                }
+                if (call.state_digests && stateDigests && call.state_digests != stateDigests) {
+                    std::copy(stateDigests, stateDigests + ATOMICALSCONSENSUS_STATE_DIGESTS_SIZE, call.state_digests);
+                }
+                calls[i].result = run_call(call);
+                if (calls[i].result == 1) {
+                    last = &call;
+                    if (call.state_digests) {
+                        stateDigests = call.state_digests;
+                    }
+                }
+            }
+        });
+    } catch (const std::exception &) {
+        return 0;
+    }
+    return 1;
+}
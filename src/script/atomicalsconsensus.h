@@ -50,15 +50,40 @@ typedef enum atomicalsconsensus_error_t {
     atomicalsconsensus_ERR_STATE_FT_BALANCES_UPDATES_SIZE_ERROR,    //  
     atomicalsconsensus_ERR_STATE_NFT_BALANCES_SIZE_ERROR,           //  
     atomicalsconsensus_ERR_STATE_NFT_BALANCES_UPDATES_SIZE_ERROR,   //   
+    atomicalsconsensus_ERR_INVALID_HEADERS,                         // Used
+    atomicalsconsensus_ERR_STATE_FORMAT_ERROR,                      // Used
+    atomicalsconsensus_ERR_STATE_DELETES_FORMAT_ERROR,              // Used
+    atomicalsconsensus_ERR_STATE_FT_BALANCES_FORMAT_ERROR,          // Used
+    atomicalsconsensus_ERR_STATE_NFT_BALANCES_FORMAT_ERROR,         // Used
+    atomicalsconsensus_ERR_INVALID_HEIGHT,                          // Used
+    atomicalsconsensus_ERR_STATE_DECODE_ERROR,                      // Used
+    atomicalsconsensus_ERR_TX_DESERIALIZE,                          // Used
+    atomicalsconsensus_ERR_EXCEPTION,                               // Used
+    atomicalsconsensus_ERR_OUTPUT_SIZE,                             // Used
 } atomicalsconsensus_error;
  
  /** Script verification flags */
 enum {
     atomicalsconsensus_SCRIPT_FLAGS_VERIFY_NONE = 0,
-    // No flags for now, but could be in the future
-    atomicalsconsensus_SCRIPT_FLAGS_VERIFY_ALL =atomicalsconsensus_SCRIPT_FLAGS_VERIFY_NONE
+    // Commit to the final state and balances with their running multiset digests (v2 state hash)
+    atomicalsconsensus_SCRIPT_FLAGS_STATE_HASH_V2 = (1U << 0),
+    // Check the proof of work of the headers in the external state and that headers at consecutive heights link
+    atomicalsconsensus_SCRIPT_FLAGS_VERIFY_HEADERS = (1U << 1),
+    // Enable OP_CHECKTXINBLOCK (0xee): height proof txid -- bool. proof is a serialized CMerkleBlock, txid is in
+    // internal byte order and height is resolved as by OP_GETBLOCKINFO
+    atomicalsconsensus_SCRIPT_FLAGS_ENABLE_CHECKTXINBLOCK = (1U << 2),
+    // Every check that does not change the outputs of a call that passes it: the v2 state hash and
+    // OP_CHECKTXINBLOCK are modes a caller opts into
+    atomicalsconsensus_SCRIPT_FLAGS_VERIFY_ALL = atomicalsconsensus_SCRIPT_FLAGS_VERIFY_HEADERS,
+    // Every flag the library knows, others fail with atomicalsconsensus_ERR_INVALID_FLAGS
+    atomicalsconsensus_SCRIPT_FLAGS_SUPPORTED = atomicalsconsensus_SCRIPT_FLAGS_STATE_HASH_V2 |
+                                                atomicalsconsensus_SCRIPT_FLAGS_VERIFY_HEADERS |
+                                                atomicalsconsensus_SCRIPT_FLAGS_ENABLE_CHECKTXINBLOCK
 };
 
+/** Size of the running state digests used by the v2 state hash */
+#define ATOMICALSCONSENSUS_STATE_DIGESTS_SIZE 99
+
 EXPORT_SYMBOL int atomicalsconsensus_verify_script_avm(
     const uint8_t *lockScript, unsigned int lockScriptLen,
     const uint8_t *unlockScript, unsigned int unlockScriptLen, 
@@ -95,10 +120,403 @@ EXPORT_SYMBOL int atomicalsconsensus_verify_script_avm(
     unsigned int *nftWithdrawsLen,
     uint8_t *ftBalancesAdded, unsigned int *ftBalancesAddedLen,
     uint8_t *nftPuts, unsigned int *nftPutsLen);
- 
+
+/**
+ * Same as atomicalsconsensus_verify_script_avm, and also returns the read set
+ * and write set of the call in accessSet, whatever its result.
+ *
+ * Format, with n a CompactSize count, id a 36 byte token id, key a
+ * CompactSize length and the bytes, height a 4 byte little endian integer
+ * and sets sorted:
+ *
+ *   stateReads:    n (keyspace key)*
+ *   ftReads:       n id*
+ *   nftReads:      n id*
+ *   blockHeights:  n height*
+ *   ftBalancesEnumerated, nftBalancesEnumerated: 1 byte each, 0 or 1
+ *   statePuts:     n (keyspace key)*
+ *   stateDeletes:  n (keyspace key)*
+ *   ftBalanceAdds, ftWithdraws, nftPuts, nftWithdraws: n id* each
+ *
+ * Only state shared between calls is covered: the incoming balances are not.
+ * An enumerated flag is set when the call counted or indexed the contract's
+ * token balances, which depends on every token held.
+ */
+EXPORT_SYMBOL int atomicalsconsensus_verify_script_avm_access_set(
+    const uint8_t *lockScript, unsigned int lockScriptLen,
+    const uint8_t *unlockScript, unsigned int unlockScriptLen,
+    const uint8_t *txTo, unsigned int txToLen,
+    const uint8_t *authPubKey, unsigned int authPubKeyLen,
+    const uint8_t *ftStateCbor, unsigned int ftStateCborLen,
+    const uint8_t *ftStateIncomingCbor, unsigned int ftStateIncomingCborLen,
+    const uint8_t *nftStateCbor, unsigned int nftStateCborLen,
+    const uint8_t *nftStateIncomingCbor, unsigned int nftStateCborIncomingLen,
+    const uint8_t *contractExternalStateCbor, unsigned int contractStateExternalCborLen,
+    const uint8_t *contractStateCbor, unsigned int contractStateCborLen,
+    const uint8_t *prevStateHash,
+    atomicalsconsensus_error *err,
+    unsigned int *script_error,
+    unsigned int *script_error_op_num,
+    uint8_t *stateHash,
+    uint8_t *stateFinal,
+    unsigned int *stateFinalLen,
+    uint8_t *stateUpdates,
+    unsigned int *stateUpdatesLen,
+    uint8_t *stateDeletes,
+    unsigned int *stateDeletesLen,
+    uint8_t *ftBalancesResult,
+    unsigned int *ftBalancesResultLen,
+    uint8_t *ftBalancesUpdatesResult,
+    unsigned int *ftBalancesUpdatesResultLen,
+    uint8_t *nftBalancesResult,
+    unsigned int *nftBalancesResultLen,
+    uint8_t *nftBalancesUpdatesResult,
+    unsigned int *nftBalancesUpdatesResultLen,
+    uint8_t *ftWithdraws,
+    unsigned int *ftWithdrawsLen,
+    uint8_t *nftWithdraws,
+    unsigned int *nftWithdrawsLen,
+    uint8_t *ftBalancesAdded, unsigned int *ftBalancesAddedLen,
+    uint8_t *nftPuts, unsigned int *nftPutsLen,
+    uint8_t *accessSet, unsigned int *accessSetLen);
+
+
+/**
+ * Same as atomicalsconsensus_verify_script_avm, with script verification flags.
+ *
+ * With atomicalsconsensus_SCRIPT_FLAGS_STATE_HASH_V2, stateHash is the v2
+ * state hash. It commits to the same data as the v1 hash, but the final
+ * contract state, FT balances and NFT balances are committed to by the
+ * finalized multiset digest of each table rather than a hash of every entry,
+ * so its cost does not grow with the size of the state. stateDigests must then
+ * hold the ATOMICALSCONSENSUS_STATE_DIGESTS_SIZE bytes of running digests of
+ * the state passed in, as returned by the previous call or by
+ * atomicalsconsensus_state_digests, and is updated in place with each put and
+ * delete made by the call. It is left unchanged if the call fails.
+ *
+ * The call fails with atomicalsconsensus_ERR_STATE_DECODE_ERROR if a state
+ * input is not valid CBOR or stateDigests are not valid digests, with one of the atomicalsconsensus_ERR_STATE_*_ERROR
+ * codes if a state input is not in the expected form or the resulting state
+ * exceeds a size limit, with atomicalsconsensus_ERR_INVALID_HEIGHT if the
+ * external state has no valid height, and with
+ * atomicalsconsensus_ERR_INVALID_HEADERS if one of its headers cannot be
+ * decoded.
+ *
+ * With atomicalsconsensus_SCRIPT_FLAGS_VERIFY_HEADERS, the call fails with
+ * atomicalsconsensus_ERR_INVALID_HEADERS if a header in the external state
+ * does not meet the target of its nBits or does not link to the header passed
+ * for the height below it. Each header is checked once per process. Headers
+ * from the header store, see atomicalsconsensus_headers_put, were checked when
+ * they were put.
+ *
+ * With atomicalsconsensus_SCRIPT_FLAGS_ENABLE_CHECKTXINBLOCK, OP_CHECKTXINBLOCK
+ * pushes whether the proof shows txid is in the block at height. The header
+ * must have a valid proof of work and the proof's Merkle root. The script
+ * fails if there is no header at height or the proof cannot be decoded.
+ * Proofs found valid are cached for the process.
+ *
+ * The multiset elements are, with every key and value decoded from hex and
+ * written with a CompactSize length:
+ *
+ *   contract state: keyspace key value
+ *   FT balances:    id, then the balance as 8 byte little endian integer
+ *   NFT balances:   id
+ */
+EXPORT_SYMBOL int atomicalsconsensus_verify_script_avm_flags(
+    const uint8_t *lockScript, unsigned int lockScriptLen,
+    const uint8_t *unlockScript, unsigned int unlockScriptLen,
+    const uint8_t *txTo, unsigned int txToLen,
+    const uint8_t *authPubKey, unsigned int authPubKeyLen,
+    const uint8_t *ftStateCbor, unsigned int ftStateCborLen,
+    const uint8_t *ftStateIncomingCbor, unsigned int ftStateIncomingCborLen,
+    const uint8_t *nftStateCbor, unsigned int nftStateCborLen,
+    const uint8_t *nftStateIncomingCbor, unsigned int nftStateCborIncomingLen,
+    const uint8_t *contractExternalStateCbor, unsigned int contractStateExternalCborLen,
+    const uint8_t *contractStateCbor, unsigned int contractStateCborLen,
+    const uint8_t *prevStateHash,
+    atomicalsconsensus_error *err,
+    unsigned int *script_error,
+    unsigned int *script_error_op_num,
+    uint8_t *stateHash,
+    uint8_t *stateFinal,
+    unsigned int *stateFinalLen,
+    uint8_t *stateUpdates,
+    unsigned int *stateUpdatesLen,
+    uint8_t *stateDeletes,
+    unsigned int *stateDeletesLen,
+    uint8_t *ftBalancesResult,
+    unsigned int *ftBalancesResultLen,
+    uint8_t *ftBalancesUpdatesResult,
+    unsigned int *ftBalancesUpdatesResultLen,
+    uint8_t *nftBalancesResult,
+    unsigned int *nftBalancesResultLen,
+    uint8_t *nftBalancesUpdatesResult,
+    unsigned int *nftBalancesUpdatesResultLen,
+    uint8_t *ftWithdraws,
+    unsigned int *ftWithdrawsLen,
+    uint8_t *nftWithdraws,
+    unsigned int *nftWithdrawsLen,
+    uint8_t *ftBalancesAdded, unsigned int *ftBalancesAddedLen,
+    uint8_t *nftPuts, unsigned int *nftPutsLen,
+    unsigned int flags,
+    uint8_t *stateDigests);
+
+/**
+ * Compute the running v2 state digests of an existing state snapshot, in the
+ * same form as the three state inputs of atomicalsconsensus_verify_script_avm.
+ * This converts a contract to the v2 state hash: the digests are those to pass
+ * with its next call. Returns 1 on success, 0 with err set if the snapshot
+ * cannot be decoded or is not in the expected form.
+ */
+EXPORT_SYMBOL int atomicalsconsensus_state_digests(
+    const uint8_t *ftStateCbor, unsigned int ftStateCborLen,
+    const uint8_t *nftStateCbor, unsigned int nftStateCborLen,
+    const uint8_t *contractStateCbor, unsigned int contractStateCborLen,
+    atomicalsconsensus_error *err,
+    uint8_t *stateDigests);
+
+/**
+ * Header chain kept by the library for this process, so that calls need not
+ * pass the block headers with every call. A call whose external state has no
+ * "headers" reads block info from this chain, for heights up to its "height",
+ * which defaults to the tip set with atomicalsconsensus_headers_set_tip.
+ *
+ * atomicalsconsensus_headers_put stores the 80 byte header of the block at
+ * height. It fails if the hash does not meet the target of its nBits or the
+ * header does not link to the one stored at height - 1.
+ * Replacing the header at a height, as in a reorg, drops the headers above it.
+ * atomicalsconsensus_headers_remove drops the headers at height and above, as
+ * when disconnecting blocks, and atomicalsconsensus_headers_set_tip sets the
+ * tip to a stored header and drops those above it.
+ *
+ * Each returns 1 on success, remove when a header was stored at height.
+ */
+EXPORT_SYMBOL int atomicalsconsensus_headers_put(unsigned int height, const uint8_t *header, unsigned int headerLen);
+EXPORT_SYMBOL int atomicalsconsensus_headers_remove(unsigned int height);
+EXPORT_SYMBOL int atomicalsconsensus_headers_set_tip(unsigned int height);
 
 EXPORT_SYMBOL unsigned int atomicalsconsensus_version();
 
+/**
+ * The SHA256, SHA512, Keccak-f[1600], Eaglesong, bitwise opcode and hex
+ * implementations selected for this CPU when the library was loaded, for
+ * example "sha256=sse4(1way),sse41(4way),avx2(8way) sha512=bmi2(1way),avx2(4way)
+ * sha3=bmi2 eaglesong=avx2 bitops=avx2 hex=avx2", or "standard" for each.
+ */
+EXPORT_SYMBOL const char *atomicalsconsensus_crypto_backend();
+
+/**
+ * Enable or disable the script JIT for this process. Locking scripts are
+ * compiled to native code once they have been verified callThreshold times.
+ * With differential set, every native run is checked against the reference
+ * interpreter, whose result is the one used.
+ * Returns 1 if the JIT is enabled, 0 if it is disabled or not supported.
+ */
+EXPORT_SYMBOL int atomicalsconsensus_set_script_jit(int enabled, unsigned int callThreshold, int differential);
+
+/** Number of native runs that did not match the reference interpreter. */
+EXPORT_SYMBOL uint64_t atomicalsconsensus_script_jit_mismatches();
+
+/** Report of atomicalsconsensus_analyze_script. */
+typedef struct atomicalsconsensus_script_analysis {
+    // Script error the script always fails with, at script_error_op_num, unless an earlier instruction fails first,
+    // or 0 if there is none
+    unsigned int script_error;
+    unsigned int script_error_op_num;
+    unsigned int script_size;
+    // Opcodes counted against the limit of opcodes per script
+    unsigned int op_count;
+    unsigned int push_count;
+    unsigned int max_push_size;
+    // Pushes and opcodes that fail when executed, whether or not they are reached
+    unsigned int nonminimal_pushes;
+    unsigned int unknown_opcodes;
+    unsigned int max_conditional_depth;
+    // Upper bounds over any execution of the script
+    unsigned int sig_checks;
+    unsigned int hash_ops;
+    unsigned int state_reads;
+    unsigned int state_writes;
+    unsigned int proof_checks;
+    uint64_t cost;
+} atomicalsconsensus_script_analysis;
+
+/**
+ * Analyze a script without executing it, for example to reject or deprioritize
+ * a contract call before verifying it. Scripts have no loops, so each
+ * instruction runs at most once and the bounds are the sum of the worst cases
+ * of the instructions, taking the more expensive side of each conditional.
+ *
+ * cost weighs the bounds and the bytes each instruction may handle, in units
+ * of the dispatch of one opcode; a signature check weighs 2000. Byte strings
+ * are taken at the maximum element size: larger values read from the contract
+ * state, and numbers grown past that size by arithmetic, are not accounted
+ * for. OP_CHECKTXINBLOCK is taken as enabled.
+ *
+ * The analysis is cached with the program decoded for the script JIT, so a
+ * locking script analyzed before it is verified is decoded once.
+ * Returns 1 if the script may succeed, 0 if script_error is set or analysis is
+ * null.
+ */
+EXPORT_SYMBOL int atomicalsconsensus_analyze_script(const uint8_t *script, unsigned int scriptLen,
+                                                    atomicalsconsensus_script_analysis *analysis);
+
+/**
+ * A call run by an atomicalsconsensus_ring: the arguments of
+ * atomicalsconsensus_verify_script_avm_flags, with each output length and
+ * error written to the call itself. Buffers are of the same sizes as for the
+ * blocking call. The call and its buffers must stay valid, and unchanged, until
+ * its completion is reaped.
+ */
+typedef struct atomicalsconsensus_call {
+    const uint8_t *lock_script;
+    unsigned int lock_script_len;
+    const uint8_t *unlock_script;
+    unsigned int unlock_script_len;
+    const uint8_t *tx_to;
+    unsigned int tx_to_len;
+    const uint8_t *auth_pub_key;
+    unsigned int auth_pub_key_len;
+    const uint8_t *ft_state_cbor;
+    unsigned int ft_state_cbor_len;
+    const uint8_t *ft_state_incoming_cbor;
+    unsigned int ft_state_incoming_cbor_len;
+    const uint8_t *nft_state_cbor;
+    unsigned int nft_state_cbor_len;
+    const uint8_t *nft_state_incoming_cbor;
+    unsigned int nft_state_incoming_cbor_len;
+    const uint8_t *contract_external_state_cbor;
+    unsigned int contract_external_state_cbor_len;
+    const uint8_t *contract_state_cbor;
+    unsigned int contract_state_cbor_len;
+    const uint8_t *prev_state_hash;
+    unsigned int flags;
+    // Read and updated in place with atomicalsconsensus_SCRIPT_FLAGS_STATE_HASH_V2
+    uint8_t *state_digests;
+
+    atomicalsconsensus_error err;
+    unsigned int script_error;
+    unsigned int script_error_op_num;
+    uint8_t *state_hash;
+    uint8_t *state_final;
+    unsigned int state_final_len;
+    uint8_t *state_updates;
+    unsigned int state_updates_len;
+    uint8_t *state_deletes;
+    unsigned int state_deletes_len;
+    uint8_t *ft_balances_result;
+    unsigned int ft_balances_result_len;
+    uint8_t *ft_balances_updates_result;
+    unsigned int ft_balances_updates_result_len;
+    uint8_t *nft_balances_result;
+    unsigned int nft_balances_result_len;
+    uint8_t *nft_balances_updates_result;
+    unsigned int nft_balances_updates_result_len;
+    uint8_t *ft_withdraws;
+    unsigned int ft_withdraws_len;
+    uint8_t *nft_withdraws;
+    unsigned int nft_withdraws_len;
+    uint8_t *ft_balances_added;
+    unsigned int ft_balances_added_len;
+    uint8_t *nft_puts;
+    unsigned int nft_puts_len;
+    // If not null, receives the read and write sets of the call, as from
+    // atomicalsconsensus_verify_script_avm_access_set
+    uint8_t *access_set;
+    unsigned int access_set_len;
+    // If not 0, the bytes each output buffer holds instead of the sizes of the
+    // blocking call. A call whose outputs do not all fit writes none of them,
+    // sets each output length to the size it needs and fails with
+    // atomicalsconsensus_ERR_OUTPUT_SIZE: grow the buffers and run it again.
+    unsigned int output_capacity;
+
+    // Not used by the library
+    void *user_data;
+} atomicalsconsensus_call;
+
+/** A call that has run, with what atomicalsconsensus_verify_script_avm_flags returned. */
+typedef struct atomicalsconsensus_completion {
+    atomicalsconsensus_call *call;
+    int result;
+} atomicalsconsensus_completion;
+
+/**
+ * Submission and completion queues in the style of io_uring, so that a caller
+ * can keep preparing calls while library threads run those it submitted.
+ *
+ * Calls are taken from the submission queue in order by the worker threads, but
+ * may complete in any order: match completions to calls with the call pointer
+ * or its user_data. Submitting and reaping take no lock, and each of them may
+ * be done from any thread.
+ *
+ * atomicalsconsensus_ring_create returns a ring with a submission queue of at
+ * least entries calls and the given number of worker threads, or one per
+ * hardware thread if threads is 0. Up to twice the size of the submission
+ * queue, calls may be in flight: submitted and not reaped.
+ * atomicalsconsensus_ring_destroy runs the calls still queued, discards their
+ * completions and stops the workers.
+ *
+ * atomicalsconsensus_ring_submit queues calls in order and returns how many
+ * were queued, fewer than count when the submission queue is full or too many
+ * calls are in flight: reap completions, then submit the rest.
+ *
+ * atomicalsconsensus_ring_poll reaps up to max completions without blocking,
+ * atomicalsconsensus_ring_wait blocks until at least one can be reaped, unless
+ * no call is in flight. Both return the number reaped.
+ *
+ * atomicalsconsensus_ring_fd returns a non-blocking eventfd that becomes
+ * readable as calls complete, to wait for completions in an event loop: read
+ * it to clear it, then poll until no completion is left. It returns -1 on
+ * platforms without eventfd.
+ *
+ * A call whose transaction cannot be deserialized completes with
+ * atomicalsconsensus_ERR_TX_DESERIALIZE, and one that fails with any other
+ * exception, such as running out of memory, with atomicalsconsensus_ERR_EXCEPTION.
+ */
+typedef struct atomicalsconsensus_ring atomicalsconsensus_ring;
+
+EXPORT_SYMBOL atomicalsconsensus_ring *atomicalsconsensus_ring_create(unsigned int entries, unsigned int threads);
+EXPORT_SYMBOL void atomicalsconsensus_ring_destroy(atomicalsconsensus_ring *ring);
+EXPORT_SYMBOL unsigned int atomicalsconsensus_ring_submit(atomicalsconsensus_ring *ring,
+                                                          atomicalsconsensus_call *const *calls, unsigned int count);
+EXPORT_SYMBOL unsigned int atomicalsconsensus_ring_poll(atomicalsconsensus_ring *ring,
+                                                        atomicalsconsensus_completion *completions, unsigned int max);
+EXPORT_SYMBOL unsigned int atomicalsconsensus_ring_wait(atomicalsconsensus_ring *ring,
+                                                        atomicalsconsensus_completion *completions, unsigned int max);
+EXPORT_SYMBOL int atomicalsconsensus_ring_fd(const atomicalsconsensus_ring *ring);
+
+/** A call of a block, made to the contract identified by contract_id. */
+typedef struct atomicalsconsensus_block_call {
+    atomicalsconsensus_call call;
+    const uint8_t *contract_id;
+    unsigned int contract_id_len;
+    // What atomicalsconsensus_verify_script_avm_flags returned for the call
+    int result;
+} atomicalsconsensus_block_call;
+
+/**
+ * Run the calls of a block, in block order for each contract and the calls of
+ * different contracts in parallel, on up to threads threads including the
+ * calling one, 0 for one per hardware thread. Returns once every call has run,
+ * 1 on success and 0 if calls is null or there is not enough memory to schedule
+ * them. Calls fail as on a ring: no exception is thrown.
+ *
+ * The state of a contract chains through its calls: the first call of each
+ * contract passes its state, and every later one runs on the state left by the
+ * last call of the contract that returned 1, or on the state of the first call
+ * if none did. Its ft_state_cbor, nft_state_cbor, contract_state_cbor and
+ * prev_state_hash are replaced with the outputs of that call, and its
+ * state_digests, if set, are overwritten with theirs. Each call therefore needs
+ * output buffers of its own. The incoming balances and external state are those
+ * of each call.
+ *
+ * Calls of different contracts do not share state, so the results do not depend
+ * on how calls are spread over threads, and the time taken approaches that of
+ * the contract with the most calls.
+ */
+EXPORT_SYMBOL int atomicalsconsensus_verify_block(atomicalsconsensus_block_call *calls, unsigned int count,
+                                                  unsigned int threads);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,248 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <script/bitops.h>
+
+#include <compat/byteswap.h>
+#include <compat/cpuid.h>
+#include <script/bitops_impl.h>
+
+#include <cassert>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#if defined(ENABLE_AVX2)
+namespace bitops_avx2 {
+void And(uint8_t *a, const uint8_t *b, size_t n);
+void Or(uint8_t *a, const uint8_t *b, size_t n);
+void Xor(uint8_t *a, const uint8_t *b, size_t n);
+void Invert(uint8_t *a, size_t n);
+void Reverse(uint8_t *a, size_t n);
+void LShift(uint8_t *a, size_t n, size_t bits);
+void RShift(uint8_t *a, size_t n, size_t bits);
+} // namespace bitops_avx2
+#endif
+#endif
+
+namespace {
+
+/** 64-bit words, available everywhere. */
+struct Word64 {
+    using V = uint64_t;
+    static constexpr size_t SIZE = 8;
+
+    static V Load(const uint8_t *p) {
+        V v;
+        memcpy(&v, p, SIZE);
+        return v;
+    }
+    static void Store(uint8_t *p, V v) { memcpy(p, &v, SIZE); }
+    static V And(V a, V b) { return a & b; }
+    static V Or(V a, V b) { return a | b; }
+    static V Xor(V a, V b) { return a ^ b; }
+    static V Not(V a) { return ~a; }
+    static V Set1(uint8_t byte) { return 0x0101010101010101ULL * byte; }
+    static V Shl(V v, int bits) { return v << bits; }
+    static V Shr(V v, int bits) { return v >> bits; }
+    static V Reverse(V v) { return bswap_64(v); }
+};
+
+#if defined(__SSE2__)
+/** SSE2 registers, part of the x86-64 baseline. */
+struct Sse2 {
+    using V = __m128i;
+    static constexpr size_t SIZE = 16;
+
+    static V Load(const uint8_t *p) {
+        return _mm_loadu_si128((const __m128i *)p);
+    }
+    static void Store(uint8_t *p, V v) { _mm_storeu_si128((__m128i *)p, v); }
+    static V And(V a, V b) { return _mm_and_si128(a, b); }
+    static V Or(V a, V b) { return _mm_or_si128(a, b); }
+    static V Xor(V a, V b) { return _mm_xor_si128(a, b); }
+    static V Not(V a) { return _mm_xor_si128(a, _mm_set1_epi32(-1)); }
+    static V Set1(uint8_t byte) { return _mm_set1_epi8(char(byte)); }
+    static V Shl(V v, int bits) {
+        return _mm_sll_epi16(v, _mm_cvtsi32_si128(bits));
+    }
+    static V Shr(V v, int bits) {
+        return _mm_srl_epi16(v, _mm_cvtsi32_si128(bits));
+    }
+    static V Reverse(V v) {
+        // Reverse the 32-bit words, then the 16-bit halves of each, then the
+        // bytes of each half.
+        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    }
+};
+
+using Baseline = Sse2;
+const char *const BASELINE_NAME = "sse2";
+#else
+using Baseline = Word64;
+const char *const BASELINE_NAME = "standard";
+#endif
+
+using BinaryFn = void (*)(uint8_t *, const uint8_t *, size_t);
+using UnaryFn = void (*)(uint8_t *, size_t);
+using ShiftFn = void (*)(uint8_t *, size_t, size_t);
+
+BinaryFn And = bitops::impl::And<Baseline>;
+BinaryFn Or = bitops::impl::Or<Baseline>;
+BinaryFn Xor = bitops::impl::Xor<Baseline>;
+UnaryFn Invert = bitops::impl::Invert<Baseline>;
+UnaryFn Reverse = bitops::impl::Reverse<Baseline>;
+ShiftFn LShift = bitops::impl::LShift<Baseline>;
+ShiftFn RShift = bitops::impl::RShift<Baseline>;
+
+/** Compare the selected kernels with the 64-bit word ones. */
+bool SelfTest() {
+    static const size_t lengths[] = {0, 1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 130};
+    static const size_t shifts[] = {0, 1, 7, 8, 9, 63, 64, 65, 255, 256, 257, 1039, 1040};
+    uint8_t a[130], b[130], x[130], y[130];
+    for (size_t i = 0; i < sizeof(a); i++) {
+        a[i] = uint8_t(i * 151 + 17);
+        b[i] = uint8_t(i * 89 + 203);
+    }
+
+    for (const size_t n : lengths) {
+        const BinaryFn binary[][2] = {
+            {And, bitops::impl::And<Word64>},
+            {Or, bitops::impl::Or<Word64>},
+            {Xor, bitops::impl::Xor<Word64>},
+        };
+        for (const auto &fn : binary) {
+            memcpy(x, a, n);
+            memcpy(y, a, n);
+            fn[0](x, b, n);
+            fn[1](y, b, n);
+            if (memcmp(x, y, n)) {
+                return false;
+            }
+        }
+
+        const UnaryFn unary[][2] = {
+            {Invert, bitops::impl::Invert<Word64>},
+            {Reverse, bitops::impl::Reverse<Word64>},
+        };
+        for (const auto &fn : unary) {
+            memcpy(x, a, n);
+            memcpy(y, a, n);
+            fn[0](x, n);
+            fn[1](y, n);
+            if (memcmp(x, y, n)) {
+                return false;
+            }
+        }
+
+        const ShiftFn shift[][2] = {
+            {LShift, bitops::impl::LShift<Word64>},
+            {RShift, bitops::impl::RShift<Word64>},
+        };
+        for (const auto &fn : shift) {
+            for (const size_t bits : shifts) {
+                memcpy(x, a, n);
+                memcpy(y, a, n);
+                fn[0](x, n, bits);
+                fn[1](y, n, bits);
+                if (memcmp(x, y, n)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+/** Check whether the OS has enabled AVX registers. */
+bool AVXEnabled() {
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+} // namespace
+
+namespace bitops {
+
+void And(uint8_t *a, const uint8_t *b, size_t n) {
+    ::And(a, b, n);
+}
+
+void Or(uint8_t *a, const uint8_t *b, size_t n) {
+    ::Or(a, b, n);
+}
+
+void Xor(uint8_t *a, const uint8_t *b, size_t n) {
+    ::Xor(a, b, n);
+}
+
+void Invert(uint8_t *a, size_t n) {
+    ::Invert(a, n);
+}
+
+void Reverse(uint8_t *a, size_t n) {
+    ::Reverse(a, n);
+}
+
+void LShift(uint8_t *a, size_t n, size_t bits) {
+    ::LShift(a, n, bits);
+}
+
+void RShift(uint8_t *a, size_t n, size_t bits) {
+    ::RShift(a, n, bits);
+}
+
+} // namespace bitops
+
+std::string BitopsAutoDetect() {
+    std::string ret = BASELINE_NAME;
+#if defined(HAVE_GETCPUID)
+    bool have_xsave = false;
+    bool have_avx = false;
+    bool have_avx2 = false;
+    bool enabled_avx = false;
+
+    (void)have_avx;
+    (void)have_avx2;
+    (void)enabled_avx;
+
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(0, 0, eax, ebx, ecx, edx);
+    const uint32_t max_leaf = eax;
+    GetCPUID(1, 0, eax, ebx, ecx, edx);
+    have_xsave = (ecx >> 27) & 1;
+    have_avx = (ecx >> 28) & 1;
+    if (have_xsave && have_avx) {
+        enabled_avx = AVXEnabled();
+    }
+    if (max_leaf >= 7) {
+        GetCPUID(7, 0, eax, ebx, ecx, edx);
+        have_avx2 = (ebx >> 5) & 1;
+    }
+
+#if defined(ENABLE_AVX2)
+    if (have_avx2 && have_avx && enabled_avx) {
+        And = bitops_avx2::And;
+        Or = bitops_avx2::Or;
+        Xor = bitops_avx2::Xor;
+        Invert = bitops_avx2::Invert;
+        Reverse = bitops_avx2::Reverse;
+        LShift = bitops_avx2::LShift;
+        RShift = bitops_avx2::RShift;
+        ret = "avx2";
+    }
+#endif
+#endif
+
+    assert(SelfTest());
+    return ret;
+}
@@ -0,0 +1,47 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Kernels of the bitwise and byte order opcodes. They update the operand in
+ * place, a 64-bit word or a vector register at a time, and produce the same
+ * bytes as the byte loops they replace.
+ */
+namespace bitops {
+
+/** a[i] &= b[i] for the n bytes of a and b. Implements OP_AND. */
+void And(uint8_t *a, const uint8_t *b, size_t n);
+/** a[i] |= b[i] for the n bytes of a and b. Implements OP_OR. */
+void Or(uint8_t *a, const uint8_t *b, size_t n);
+/** a[i] ^= b[i] for the n bytes of a and b. Implements OP_XOR. */
+void Xor(uint8_t *a, const uint8_t *b, size_t n);
+/** a[i] = ~a[i] for the n bytes of a. Implements OP_INVERT. */
+void Invert(uint8_t *a, size_t n);
+/** Reverses the order of the n bytes of a. Implements OP_REVERSEBYTES. */
+void Reverse(uint8_t *a, size_t n);
+/**
+ * Shifts the n bytes of a, read as a big endian number, left by the given
+ * number of bits. Bits shifted out are lost and zeros are shifted in.
+ * Implements OP_LSHIFT.
+ */
+void LShift(uint8_t *a, size_t n, size_t bits);
+/**
+ * Shifts the n bytes of a, read as a big endian number, right by the given
+ * number of bits. Bits shifted out are lost and zeros are shifted in.
+ * Implements OP_RSHIFT.
+ */
+void RShift(uint8_t *a, size_t n, size_t bits);
+
+} // namespace bitops
+
+/**
+ * Autodetect the best available implementation of the bitwise kernels.
+ * Returns the name of the implementation.
+ */
+std::string BitopsAutoDetect();
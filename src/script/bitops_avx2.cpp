@@ -0,0 +1,78 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include <cstdint>
+#include <immintrin.h>
+
+#include <script/bitops_impl.h>
+
+namespace bitops_avx2 {
+namespace {
+
+    struct Avx2 {
+        using V = __m256i;
+        static constexpr size_t SIZE = 32;
+
+        static V Load(const uint8_t *p) {
+            return _mm256_loadu_si256((const __m256i *)p);
+        }
+        static void Store(uint8_t *p, V v) {
+            _mm256_storeu_si256((__m256i *)p, v);
+        }
+        static V And(V a, V b) { return _mm256_and_si256(a, b); }
+        static V Or(V a, V b) { return _mm256_or_si256(a, b); }
+        static V Xor(V a, V b) { return _mm256_xor_si256(a, b); }
+        static V Not(V a) { return _mm256_xor_si256(a, _mm256_set1_epi32(-1)); }
+        static V Set1(uint8_t byte) { return _mm256_set1_epi8(char(byte)); }
+        static V Shl(V v, int bits) {
+            return _mm256_sll_epi16(v, _mm_cvtsi32_si128(bits));
+        }
+        static V Shr(V v, int bits) {
+            return _mm256_srl_epi16(v, _mm_cvtsi32_si128(bits));
+        }
+        static V Reverse(V v) {
+            // Reverse the bytes of each 128-bit lane, then swap the lanes.
+            const __m256i mask = _mm256_setr_epi8(
+                15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+            v = _mm256_shuffle_epi8(v, mask);
+            return _mm256_permute2x128_si256(v, v, 1);
+        }
+    };
+
+} // namespace
+
+void And(uint8_t *a, const uint8_t *b, size_t n) {
+    bitops::impl::And<Avx2>(a, b, n);
+}
+
+void Or(uint8_t *a, const uint8_t *b, size_t n) {
+    bitops::impl::Or<Avx2>(a, b, n);
+}
+
+void Xor(uint8_t *a, const uint8_t *b, size_t n) {
+    bitops::impl::Xor<Avx2>(a, b, n);
+}
+
+void Invert(uint8_t *a, size_t n) {
+    bitops::impl::Invert<Avx2>(a, n);
+}
+
+void Reverse(uint8_t *a, size_t n) {
+    bitops::impl::Reverse<Avx2>(a, n);
+}
+
+void LShift(uint8_t *a, size_t n, size_t bits) {
+    bitops::impl::LShift<Avx2>(a, n, bits);
+}
+
+void RShift(uint8_t *a, size_t n, size_t bits) {
+    bitops::impl::RShift<Avx2>(a, n, bits);
+}
+
+} // namespace bitops_avx2
+
+#endif
@@ -0,0 +1,161 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * The kernels of script/bitops.h, written once over a register type R. Each
+ * implementation instantiates them with its own R, in a translation unit
+ * compiled for its instruction set.
+ *
+ * R provides the register type V of R::SIZE bytes with unaligned Load and
+ * Store, And, Or, Xor, Not, Set1 of a byte, Shl and Shr of lanes at least 16
+ * bits wide by 0 to 8 bits, and Reverse of its bytes.
+ *
+ * The byte loops that handle what does not fill a register are part of the
+ * templates too, so that no code compiled for one instruction set can be
+ * picked by the linker for another.
+ */
+namespace bitops {
+namespace impl {
+
+    template <typename R> void And(uint8_t *a, const uint8_t *b, size_t n) {
+        size_t i = 0;
+        for (; i + R::SIZE <= n; i += R::SIZE) {
+            R::Store(a + i, R::And(R::Load(a + i), R::Load(b + i)));
+        }
+        for (; i < n; i++) {
+            a[i] &= b[i];
+        }
+    }
+
+    template <typename R> void Or(uint8_t *a, const uint8_t *b, size_t n) {
+        size_t i = 0;
+        for (; i + R::SIZE <= n; i += R::SIZE) {
+            R::Store(a + i, R::Or(R::Load(a + i), R::Load(b + i)));
+        }
+        for (; i < n; i++) {
+            a[i] |= b[i];
+        }
+    }
+
+    template <typename R> void Xor(uint8_t *a, const uint8_t *b, size_t n) {
+        size_t i = 0;
+        for (; i + R::SIZE <= n; i += R::SIZE) {
+            R::Store(a + i, R::Xor(R::Load(a + i), R::Load(b + i)));
+        }
+        for (; i < n; i++) {
+            a[i] ^= b[i];
+        }
+    }
+
+    template <typename R> void Invert(uint8_t *a, size_t n) {
+        size_t i = 0;
+        for (; i + R::SIZE <= n; i += R::SIZE) {
+            R::Store(a + i, R::Not(R::Load(a + i)));
+        }
+        for (; i < n; i++) {
+            a[i] = ~a[i];
+        }
+    }
+
+    template <typename R> void Reverse(uint8_t *a, size_t n) {
+        // Swap registers from both ends, then the bytes left in the middle.
+        size_t lo = 0, hi = n;
+        while (hi - lo >= 2 * R::SIZE) {
+            hi -= R::SIZE;
+            const typename R::V front = R::Load(a + lo);
+            const typename R::V back = R::Load(a + hi);
+            R::Store(a + lo, R::Reverse(back));
+            R::Store(a + hi, R::Reverse(front));
+            lo += R::SIZE;
+        }
+        while (hi - lo >= 2) {
+            const uint8_t front = a[lo];
+            a[lo++] = a[--hi];
+            a[hi] = front;
+        }
+    }
+
+    /** Each byte of v shifted left by 0 to 8 bits. */
+    template <typename R>
+    typename R::V ShlBytes(typename R::V v, int bits) {
+        return R::And(R::Shl(v, bits), R::Set1(uint8_t(0xFF << bits)));
+    }
+
+    /** Each byte of v shifted right by 0 to 8 bits. */
+    template <typename R>
+    typename R::V ShrBytes(typename R::V v, int bits) {
+        return R::And(R::Shr(v, bits), R::Set1(uint8_t(0xFF >> bits)));
+    }
+
+    template <typename R> void LShift(uint8_t *a, size_t n, size_t bits) {
+        if (bits >= n * 8) {
+            for (size_t i = 0; i < n; i++) {
+                a[i] = 0;
+            }
+            return;
+        }
+
+        // Byte i of the result is a[i + byteShift] shifted left, with the
+        // high bits of the byte after it below. Only bytes from i up are
+        // read, so the result is written from the start.
+        const size_t byteShift = bits / 8;
+        const int bitShift = bits % 8;
+        size_t i = 0;
+        for (; i + byteShift + R::SIZE + 1 <= n; i += R::SIZE) {
+            const uint8_t *src = a + i + byteShift;
+            R::Store(a + i, R::Or(ShlBytes<R>(R::Load(src), bitShift),
+                                  ShrBytes<R>(R::Load(src + 1), 8 - bitShift)));
+        }
+        for (; i < n; i++) {
+            uint8_t val = 0;
+            if (i + byteShift < n) {
+                val = a[i + byteShift] << bitShift;
+                if (i + byteShift + 1 < n) {
+                    val |= a[i + byteShift + 1] >> (8 - bitShift);
+                }
+            }
+            a[i] = val;
+        }
+    }
+
+    template <typename R> void RShift(uint8_t *a, size_t n, size_t bits) {
+        if (bits >= n * 8) {
+            for (size_t i = 0; i < n; i++) {
+                a[i] = 0;
+            }
+            return;
+        }
+
+        // Byte i of the result is a[i - byteShift] shifted right, with the
+        // low bits of the byte before it on top. Only bytes up to i are read,
+        // so the result is written from the end.
+        const size_t byteShift = bits / 8;
+        const int bitShift = bits % 8;
+        size_t i = n;
+        while (i >= byteShift + R::SIZE + 1) {
+            i -= R::SIZE;
+            const uint8_t *src = a + i - byteShift;
+            R::Store(a + i, R::Or(ShrBytes<R>(R::Load(src), bitShift),
+                                  ShlBytes<R>(R::Load(src - 1), 8 - bitShift)));
+        }
+        while (i > 0) {
+            i--;
+            uint8_t val = 0;
+            if (i >= byteShift) {
+                val = a[i - byteShift] >> bitShift;
+                if (i > byteShift) {
+                    val |= a[i - byteShift - 1] << (8 - bitShift);
+                }
+            }
+            a[i] = val;
+        }
+    }
+
+} // namespace impl
+} // namespace bitops
@@ -0,0 +1,97 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <script/block_header_store.h>
+
+#include <script/script_execution_context.h>
+
+BlockHeaderStore &BlockHeaderStore::Get() {
+    static BlockHeaderStore store;
+    return store;
+}
+
+bool BlockHeaderStore::Put(uint32_t height, const std::vector<uint8_t> &header) {
+    if (header.size() != HEADER_SIZE) {
+        return false;
+    }
+    const StateResult<DecodedBlockHeader> decoded = ScriptStateContext::decodeHeaderChecked(header);
+    if (!decoded || !decoded->validProofOfWork) {
+        return false;
+    }
+    const DecodedBlockHeader &decodedHeader = *decoded;
+    const BlockHash &hash = decodedHeader.hash;
+
+    LOCK(cs);
+    if (height > 0) {
+        const auto prev = headers.find(height - 1);
+        if (prev != headers.end() && prev->second.hash != decodedHeader.header.hashPrevBlock) {
+            return false;
+        }
+    }
+    const auto it = headers.find(height);
+    if (it != headers.end()) {
+        if (it->second.hash == hash) {
+            return true;
+        }
+        // A new header at this height is a reorg: whatever was above it was built on the old one
+        headers.erase(it, headers.end());
+    } else {
+        const auto next = headers.upper_bound(height);
+        if (next != headers.end() && next->first == height + 1) {
+            // Stored headers are HEADER_SIZE bytes, they always decode
+            const StateResult<CBlockHeader> nextHeader = ScriptStateContext::decodeHeader(next->second.header);
+            if (nextHeader->hashPrevBlock != hash) {
+                headers.erase(next, headers.end());
+            }
+        }
+    }
+    headers.emplace(height, Entry{header, hash});
+    // The tip cannot stay on a header that was dropped: the highest left is the new one
+    if (tip && *tip > height && !headers.count(*tip)) {
+        tip = height;
+    }
+    return true;
+}
+
+bool BlockHeaderStore::Remove(uint32_t height) {
+    LOCK(cs);
+    const auto it = headers.lower_bound(height);
+    const bool found = it != headers.end() && it->first == height;
+    headers.erase(it, headers.end());
+    if (tip && *tip >= height) {
+        // Heights below may have gaps: the tip goes to the highest header left
+        tip = headers.empty() ? std::nullopt : std::optional<uint32_t>(headers.rbegin()->first);
+    }
+    return found;
+}
+
+bool BlockHeaderStore::SetTip(uint32_t height) {
+    LOCK(cs);
+    if (headers.find(height) == headers.end()) {
+        return false;
+    }
+    headers.erase(headers.upper_bound(height), headers.end());
+    tip = height;
+    return true;
+}
+
+std::optional<uint32_t> BlockHeaderStore::GetTip() const {
+    LOCK(cs);
+    return tip;
+}
+
+bool BlockHeaderStore::Contains(uint32_t height) const {
+    LOCK(cs);
+    return headers.count(height) != 0;
+}
+
+bool BlockHeaderStore::Lookup(uint32_t height, std::vector<uint8_t> &header) const {
+    LOCK(cs);
+    const auto it = headers.find(height);
+    if (it == headers.end()) {
+        return false;
+    }
+    header = it->second.header;
+    return true;
+}
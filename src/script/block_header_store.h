@@ -0,0 +1,59 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <primitives/blockhash.h>
+#include <sync.h>
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <vector>
+
+/**
+ * Process-wide chain of block headers indexed by height, kept up to date by
+ * the caller as blocks are connected and disconnected. Calls that do not pass
+ * headers in their external state read block info from it.
+ *
+ * The store follows reorgs: a header without a valid proof of work or that
+ * does not link to the header below it is refused, and replacing the header
+ * at a height drops every header above it, which belonged to the old branch.
+ * The tip is always a stored header: if it was dropped, it is lowered to the
+ * highest header left.
+ */
+class BlockHeaderStore {
+public:
+    //! Size of a serialized block header.
+    static constexpr size_t HEADER_SIZE = 80;
+
+    //! The store shared by every call in the process.
+    static BlockHeaderStore &Get();
+
+    //! Stores the header at height. Returns false, leaving the store
+    //! unchanged, if it is not HEADER_SIZE bytes, does not meet the target of
+    //! its nBits or does not link to the header stored at height - 1.
+    bool Put(uint32_t height, const std::vector<uint8_t> &header);
+    //! Drops the headers at height and above, and lowers the tip to the highest
+    //! header left, if it was among them. Returns whether a header was stored
+    //! at height.
+    bool Remove(uint32_t height);
+    //! Sets the tip and drops the headers above it. Returns false, leaving the
+    //! store unchanged, if no header is stored at height.
+    bool SetTip(uint32_t height);
+
+    std::optional<uint32_t> GetTip() const;
+    bool Contains(uint32_t height) const;
+    bool Lookup(uint32_t height, std::vector<uint8_t> &header) const;
+
+private:
+    struct Entry {
+        std::vector<uint8_t> header;
+        BlockHash hash;
+    };
+
+    mutable Mutex cs;
+    std::map<uint32_t, Entry> headers GUARDED_BY(cs);
+    std::optional<uint32_t> tip GUARDED_BY(cs);
+};
@@ -0,0 +1,136 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <script/block_scheduler.h>
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <system_error>
+#include <thread>
+
+namespace {
+
+/** Chains dealt to a thread. Others steal from the end it does not take from. */
+class ChainDeque {
+public:
+    void Push(size_t chain) { _chains.push_back(chain); }
+
+    bool PopBack(size_t &chain) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_chains.empty()) {
+            return false;
+        }
+        chain = _chains.back();
+        _chains.pop_back();
+        return true;
+    }
+
+    bool StealFront(size_t &chain) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_chains.empty()) {
+            return false;
+        }
+        chain = _chains.front();
+        _chains.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex _mutex;
+    std::deque<size_t> _chains;
+};
+
+} // namespace
+
+std::vector<std::vector<size_t>> GroupCallChains(const std::vector<Span<const uint8_t>> &keys) {
+    std::vector<std::vector<size_t>> chains;
+    std::map<std::vector<uint8_t>, size_t> chainOfKey;
+    for (size_t i = 0; i < keys.size(); i++) {
+        const auto inserted = chainOfKey.emplace(std::vector<uint8_t>(keys[i].begin(), keys[i].end()), chains.size());
+        if (inserted.second) {
+            chains.emplace_back();
+        }
+        chains[inserted.first->second].push_back(i);
+    }
+    return chains;
+}
+
+void RunCallChains(const std::vector<std::vector<size_t>> &chains, unsigned int threads,
+                   const std::function<void(size_t)> &run) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min<size_t>(threads, chains.size());
+
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    auto runChain = [&](size_t chain) {
+        try {
+            run(chain);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    };
+    if (threads <= 1) {
+        for (size_t chain = 0; chain < chains.size(); chain++) {
+            runChain(chain);
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return;
+    }
+
+    // Longest first, dealt round robin. Each thread takes from the back, so
+    // the longest are put last.
+    std::vector<size_t> order(chains.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return chains[a].size() > chains[b].size(); });
+    std::unique_ptr<ChainDeque[]> deques(new ChainDeque[threads]);
+    for (size_t i = order.size(); i-- > 0;) {
+        deques[i % threads].Push(order[i]);
+    }
+
+    // No chain is added once started, so a thread that finds every deque
+    // empty is done
+    auto work = [&](unsigned int self) {
+        size_t chain;
+        for (;;) {
+            bool found = deques[self].PopBack(chain);
+            for (unsigned int i = 1; !found && i < threads; i++) {
+                found = deques[(self + i) % threads].StealFront(chain);
+            }
+            if (!found) {
+                return;
+            }
+            runChain(chain);
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned int i = 1; i < threads; i++) {
+        try {
+            workers.emplace_back(work, i);
+        } catch (const std::system_error &) {
+            // The chains dealt to the threads not started are stolen
+            break;
+        }
+    }
+    work(0);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
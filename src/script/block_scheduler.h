@@ -0,0 +1,34 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <span.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * Groups the calls of a block by the contract they are made to: one chain per
+ * distinct key, holding the indexes of its calls in block order. Chains are in
+ * the order of their first call.
+ */
+std::vector<std::vector<size_t>> GroupCallChains(const std::vector<Span<const uint8_t>> &keys);
+
+/**
+ * Runs run(chain) once for every chain, on up to threads threads including the
+ * calling one, 0 for one per hardware thread, and returns when all have run.
+ *
+ * Chains are dealt to the threads longest first, each thread taking from the
+ * back of its own deque and, once it is empty, stealing from the front of
+ * another's. A long chain is so started early and the short ones fill in
+ * around it: the wall time approaches that of the longest chain.
+ *
+ * If run throws, the other chains still run and the first exception is
+ * rethrown once all threads are done.
+ */
+void RunCallChains(const std::vector<std::vector<size_t>> &chains, unsigned int threads,
+                   const std::function<void(size_t)> &run);
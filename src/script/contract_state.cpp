@@ -0,0 +1,322 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <script/contract_state.h>
+
+#include <streams.h>
+#include <util/strencodings.h>
+#include <version.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Bytes of a hex key or value, as counted by StateValidation
+uint64_t HexBytes(const std::string &hex) {
+    return hex.length() / 2;
+}
+
+// Size of a token balance value, as counted by StateValidation
+constexpr uint64_t FT_BALANCE_VALUE_BYTES = 8;
+
+// The multiset functions need no precomputed tables
+const secp256k1_context *MultisetContext() {
+    return secp256k1_context_no_precomp;
+}
+
+// A hex key or value, serialized as the vector ParseHex returns but decoded
+// straight into the element
+struct DecodedHex {
+    const std::string &hex;
+
+    template <typename Stream> void Serialize(Stream &s) const {
+        if (!IsHexDigits(hex)) {
+            s << ParseHex(hex);
+            return;
+        }
+        const size_t size = hex.size() / 2;
+        WriteCompactSize(s, size);
+        uint8_t buf[256];
+        for (size_t pos = 0; pos < size; pos += sizeof(buf)) {
+            const size_t count = std::min(size - pos, sizeof(buf));
+            HexDecode(Span<const char>(hex.data() + 2 * pos, 2 * count), buf);
+            s.write((const char *)buf, count);
+        }
+    }
+};
+
+// Elements are the decoded keys and values, each with a CompactSize length
+template <typename... Args>
+std::vector<uint8_t> MultisetElement(const Args &...args) {
+    std::vector<uint8_t> element;
+    CVectorWriter writer(SER_NETWORK, PROTOCOL_VERSION, element, 0);
+    (writer << ... << args);
+    return element;
+}
+
+void MultisetAdd(secp256k1_multiset &multiset, const std::vector<uint8_t> &element) {
+    secp256k1_multiset_add(MultisetContext(), &multiset, element.data(), element.size());
+}
+
+void MultisetRemove(secp256k1_multiset &multiset, const std::vector<uint8_t> &element) {
+    secp256k1_multiset_remove(MultisetContext(), &multiset, element.data(), element.size());
+}
+
+std::vector<uint8_t> MultisetHash(const secp256k1_multiset &multiset) {
+    std::vector<uint8_t> hash(32);
+    secp256k1_multiset_finalize(MultisetContext(), hash.data(), &multiset);
+    return hash;
+}
+
+} // namespace
+
+ContractStateDigests::ContractStateDigests() {
+    secp256k1_multiset_init(MultisetContext(), &_state);
+    secp256k1_multiset_init(MultisetContext(), &_ftBalances);
+    secp256k1_multiset_init(MultisetContext(), &_nftBalances);
+}
+
+ContractStateDigests::ContractStateDigests(const ContractState &state) : ContractStateDigests() {
+    for (auto it = state._state.begin(); it != state._state.end(); ++it) {
+        for (auto keyIt = it.value().begin(); keyIt != it.value().end(); ++keyIt) {
+            addStateEntry(it.key(), keyIt.key(), keyIt.value());
+        }
+    }
+    for (auto it = state._ftBalances.begin(); it != state._ftBalances.end(); ++it) {
+        addFtBalance(it.key(), it.value());
+    }
+    for (auto it = state._nftBalances.begin(); it != state._nftBalances.end(); ++it) {
+        addNft(it.key());
+    }
+}
+
+std::optional<ContractStateDigests> ContractStateDigests::FromBytes(const uint8_t *bytes) {
+    ContractStateDigests digests;
+    if (!secp256k1_multiset_parse(MultisetContext(), &digests._state, bytes) ||
+        !secp256k1_multiset_parse(MultisetContext(), &digests._ftBalances, bytes + MULTISET_SIZE) ||
+        !secp256k1_multiset_parse(MultisetContext(), &digests._nftBalances, bytes + 2 * MULTISET_SIZE)) {
+        return std::nullopt;
+    }
+    return digests;
+}
+
+void ContractStateDigests::ToBytes(uint8_t *bytes) const {
+    secp256k1_multiset_serialize(MultisetContext(), bytes, &_state);
+    secp256k1_multiset_serialize(MultisetContext(), bytes + MULTISET_SIZE, &_ftBalances);
+    secp256k1_multiset_serialize(MultisetContext(), bytes + 2 * MULTISET_SIZE, &_nftBalances);
+}
+
+void ContractStateDigests::addStateEntry(const std::string &keySpace, const std::string &keyName,
+                                         const std::string &value) {
+    MultisetAdd(_state, MultisetElement(DecodedHex{keySpace}, DecodedHex{keyName}, DecodedHex{value}));
+}
+
+void ContractStateDigests::removeStateEntry(const std::string &keySpace, const std::string &keyName,
+                                            const std::string &value) {
+    MultisetRemove(_state, MultisetElement(DecodedHex{keySpace}, DecodedHex{keyName}, DecodedHex{value}));
+}
+
+void ContractStateDigests::addFtBalance(const std::string &ftId, uint64_t balance) {
+    MultisetAdd(_ftBalances, MultisetElement(DecodedHex{ftId}, balance));
+}
+
+void ContractStateDigests::removeFtBalance(const std::string &ftId, uint64_t balance) {
+    MultisetRemove(_ftBalances, MultisetElement(DecodedHex{ftId}, balance));
+}
+
+void ContractStateDigests::addNft(const std::string &nftId) {
+    MultisetAdd(_nftBalances, MultisetElement(DecodedHex{nftId}));
+}
+
+void ContractStateDigests::removeNft(const std::string &nftId) {
+    MultisetRemove(_nftBalances, MultisetElement(DecodedHex{nftId}));
+}
+
+std::vector<uint8_t> ContractStateDigests::stateHash() const {
+    return MultisetHash(_state);
+}
+
+std::vector<uint8_t> ContractStateDigests::ftBalancesHash() const {
+    return MultisetHash(_ftBalances);
+}
+
+std::vector<uint8_t> ContractStateDigests::nftBalancesHash() const {
+    return MultisetHash(_nftBalances);
+}
+
+ContractState::ContractState(const json &contractState, const json &ftBalances, const json &nftBalances) {
+    // Json objects iterate in key order, so every map is built bottom-up
+    std::vector<std::pair<std::string, Keyspace>> keyspaces;
+    for (auto &[keySpace, keys] : contractState.items()) {
+        std::vector<std::pair<std::string, std::string>> entries;
+        for (auto &[keyName, value] : keys.items()) {
+            std::string valueStr = value.template get<std::string>();
+            _stateBytes += HexBytes(keyName) + HexBytes(valueStr);
+            entries.emplace_back(keyName, std::move(valueStr));
+        }
+        if (entries.empty()) {
+            continue;
+        }
+        _stateBytes += HexBytes(keySpace);
+        keyspaces.emplace_back(keySpace, Keyspace::FromSorted(std::move(entries)));
+    }
+    _state = PersistentMap<std::string, Keyspace>::FromSorted(std::move(keyspaces));
+
+    std::vector<std::pair<std::string, uint64_t>> fts;
+    for (auto &[ftId, balance] : ftBalances.items()) {
+        uint64_t balanceInt = balance.template get<uint64_t>();
+        if (balanceInt == 0) {
+            continue;
+        }
+        _ftBalancesBytes += HexBytes(ftId) + FT_BALANCE_VALUE_BYTES;
+        fts.emplace_back(ftId, balanceInt);
+    }
+    _ftBalances = PersistentMap<std::string, uint64_t>::FromSorted(std::move(fts));
+
+    std::vector<std::pair<std::string, bool>> nfts;
+    for (auto &[nftId, held] : nftBalances.items()) {
+        if (!held.template get<bool>()) {
+            continue;
+        }
+        _nftBalancesBytes += HexBytes(nftId);
+        nfts.emplace_back(nftId, true);
+    }
+    _nftBalances = PersistentMap<std::string, bool>::FromSorted(std::move(nfts));
+}
+
+const std::string *ContractState::get(const std::string &keySpace, const std::string &keyName) const {
+    const Keyspace *keyspace = _state.find(keySpace);
+    if (!keyspace) {
+        return nullptr;
+    }
+    return keyspace->find(keyName);
+}
+
+void ContractState::put(const std::string &keySpace, const std::string &keyName, const std::string &value) {
+    Keyspace keyspace;
+    if (const Keyspace *found = _state.find(keySpace)) {
+        keyspace = *found;
+    } else {
+        _stateBytes += HexBytes(keySpace);
+    }
+    if (const std::string *previous = keyspace.find(keyName)) {
+        _stateBytes -= HexBytes(keyName) + HexBytes(*previous);
+        if (_digests) {
+            _digests->removeStateEntry(keySpace, keyName, *previous);
+        }
+    }
+    _stateBytes += HexBytes(keyName) + HexBytes(value);
+    if (_digests) {
+        _digests->addStateEntry(keySpace, keyName, value);
+    }
+    keyspace.insert_or_assign(keyName, value);
+    _state.insert_or_assign(keySpace, std::move(keyspace));
+}
+
+bool ContractState::erase(const std::string &keySpace, const std::string &keyName) {
+    const Keyspace *found = _state.find(keySpace);
+    if (!found) {
+        return false;
+    }
+    const std::string *previous = found->find(keyName);
+    if (!previous) {
+        return false;
+    }
+    _stateBytes -= HexBytes(keyName) + HexBytes(*previous);
+    if (_digests) {
+        _digests->removeStateEntry(keySpace, keyName, *previous);
+    }
+    Keyspace keyspace = *found;
+    keyspace.erase(keyName);
+    if (keyspace.empty()) {
+        _stateBytes -= HexBytes(keySpace);
+        _state.erase(keySpace);
+    } else {
+        _state.insert_or_assign(keySpace, std::move(keyspace));
+    }
+    return true;
+}
+
+const uint64_t *ContractState::ftBalance(const std::string &ftId) const {
+    return _ftBalances.find(ftId);
+}
+
+void ContractState::setFtBalance(const std::string &ftId, uint64_t balance) {
+    const uint64_t *previous = _ftBalances.find(ftId);
+    bool held = previous != nullptr;
+    if (_digests) {
+        if (held) {
+            _digests->removeFtBalance(ftId, *previous);
+        }
+        if (balance != 0) {
+            _digests->addFtBalance(ftId, balance);
+        }
+    }
+    if (balance == 0) {
+        if (held) {
+            _ftBalancesBytes -= HexBytes(ftId) + FT_BALANCE_VALUE_BYTES;
+            _ftBalances.erase(ftId);
+        }
+        return;
+    }
+    if (!held) {
+        _ftBalancesBytes += HexBytes(ftId) + FT_BALANCE_VALUE_BYTES;
+    }
+    _ftBalances.insert_or_assign(ftId, balance);
+}
+
+void ContractState::putNft(const std::string &nftId) {
+    if (_nftBalances.contains(nftId)) {
+        return;
+    }
+    _nftBalancesBytes += HexBytes(nftId);
+    _nftBalances.insert_or_assign(nftId, true);
+    if (_digests) {
+        _digests->addNft(nftId);
+    }
+}
+
+bool ContractState::eraseNft(const std::string &nftId) {
+    if (!_nftBalances.erase(nftId)) {
+        return false;
+    }
+    _nftBalancesBytes -= HexBytes(nftId);
+    if (_digests) {
+        _digests->removeNft(nftId);
+    }
+    return true;
+}
+
+json ContractState::stateJson() const {
+    json result = json::object();
+    for (auto it = _state.begin(); it != _state.end(); ++it) {
+        json &keyspaceNode = result[it.key()] = json::object();
+        for (auto keyIt = it.value().begin(); keyIt != it.value().end(); ++keyIt) {
+            keyspaceNode[keyIt.key()] = keyIt.value();
+        }
+    }
+    return result;
+}
+
+json ContractState::ftBalancesJson() const {
+    json result = json::object();
+    for (auto it = _ftBalances.begin(); it != _ftBalances.end(); ++it) {
+        result[it.key()] = it.value();
+    }
+    return result;
+}
+
+json ContractState::nftBalancesJson() const {
+    json result = json::object();
+    for (auto it = _nftBalances.begin(); it != _nftBalances.end(); ++it) {
+        result[it.key()] = true;
+    }
+    return result;
+}
+
+bool ContractState::operator==(const ContractState &other) const {
+    return _state == other._state && _ftBalances == other._ftBalances && _nftBalances == other._nftBalances;
+}
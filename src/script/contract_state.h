@@ -0,0 +1,140 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <persistentmap.h>
+#include <secp256k1_multiset.h>
+
+#include "json.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+using json = nlohmann::json;
+
+class ContractState;
+
+/**
+ * Running multiset digests of the contract state, the FT balances and the NFT
+ * balances, the tables committed to by the v2 state hash. Every entry of a
+ * table is one element of its multiset, so a put or delete is an O(1) add or
+ * remove whatever the size of the state.
+ *
+ * The serialized form is the canonical encoding of the three multisets, state
+ * first: each a compressed curve point, or zeros for an empty table. Equal
+ * tables serialize the same on every node and build.
+ */
+class ContractStateDigests {
+public:
+    static constexpr size_t MULTISET_SIZE = 33;
+    static constexpr size_t SERIALIZED_SIZE = 3 * MULTISET_SIZE;
+
+    //! Digests of empty tables.
+    ContractStateDigests();
+    //! Digests of every entry of state, as a conversion from a snapshot.
+    explicit ContractStateDigests(const ContractState &state);
+
+    //! Parses SERIALIZED_SIZE bytes, nullopt if they do not encode three multisets.
+    static std::optional<ContractStateDigests> FromBytes(const uint8_t *bytes);
+    void ToBytes(uint8_t *bytes) const;
+
+    // Elements, with keys and values in their json form
+    void addStateEntry(const std::string &keySpace, const std::string &keyName, const std::string &value);
+    void removeStateEntry(const std::string &keySpace, const std::string &keyName, const std::string &value);
+    void addFtBalance(const std::string &ftId, uint64_t balance);
+    void removeFtBalance(const std::string &ftId, uint64_t balance);
+    void addNft(const std::string &nftId);
+    void removeNft(const std::string &nftId);
+
+    // Finalized 32 byte hashes
+    std::vector<uint8_t> stateHash() const;
+    std::vector<uint8_t> ftBalancesHash() const;
+    std::vector<uint8_t> nftBalancesHash() const;
+
+private:
+    secp256k1_multiset _state;
+    secp256k1_multiset _ftBalances;
+    secp256k1_multiset _nftBalances;
+};
+
+/**
+ * The contract state and token balances of a contract, held in persistent
+ * maps keyed like their json form (lowercase hex strings).
+ *
+ * Copying a ContractState is O(1) and gives an independent snapshot: starting a
+ * call from a base state, keeping a snapshot for mempool simulation, forking it
+ * to try several pending transactions, or discarding the state of a failed call
+ * never copies the entries that did not change.
+ *
+ * Keyspaces never stay empty and balances never drop to zero: entries are
+ * removed as soon as they would, so the state is always in the form
+ * ScriptStateContext::cleanupStateAndBalances() used to produce. The byte
+ * counts checked against the size limits are maintained as entries change.
+ */
+class ContractState {
+public:
+    using Keyspace = PersistentMap<std::string, std::string>;
+
+    ContractState() = default;
+
+    //! Builds the state from its json form, which must already have passed
+    //! StateValidation.
+    ContractState(const json &contractState, const json &ftBalances, const json &nftBalances);
+
+    //! Keeps digests up to date from here on. They must be the digests of the
+    //! current entries.
+    void trackDigests(const ContractStateDigests &digests) { _digests = digests; }
+    //! The v2 digests, nullptr unless tracked.
+    const ContractStateDigests *digests() const { return _digests ? &*_digests : nullptr; }
+
+    // Contract state
+    const std::string *get(const std::string &keySpace, const std::string &keyName) const;
+    void put(const std::string &keySpace, const std::string &keyName, const std::string &value);
+    //! Returns whether the key existed.
+    bool erase(const std::string &keySpace, const std::string &keyName);
+
+    // Balances
+    const uint64_t *ftBalance(const std::string &ftId) const;
+    //! A zero balance removes the token.
+    void setFtBalance(const std::string &ftId, uint64_t balance);
+    bool hasNft(const std::string &nftId) const { return _nftBalances.contains(nftId); }
+    void putNft(const std::string &nftId);
+    //! Returns whether the token was held.
+    bool eraseNft(const std::string &nftId);
+
+    size_t ftCount() const { return _ftBalances.size(); }
+    size_t nftCount() const { return _nftBalances.size(); }
+    //! Token id at position index in key order, nullptr if out of range.
+    const std::string *ftIdAt(size_t index) const { return _ftBalances.keyAt(index); }
+    const std::string *nftIdAt(size_t index) const { return _nftBalances.keyAt(index); }
+
+    // Sizes as counted by StateValidation
+    uint64_t stateBytes() const { return _stateBytes; }
+    uint64_t ftBalancesBytes() const { return _ftBalancesBytes; }
+    uint64_t nftBalancesBytes() const { return _nftBalancesBytes; }
+
+    // Json form, built on demand
+    json stateJson() const;
+    json ftBalancesJson() const;
+    json nftBalancesJson() const;
+
+    bool operator==(const ContractState &other) const;
+    bool operator!=(const ContractState &other) const { return !(*this == other); }
+
+private:
+    PersistentMap<std::string, Keyspace> _state;
+    PersistentMap<std::string, uint64_t> _ftBalances;
+    PersistentMap<std::string, bool> _nftBalances;
+
+    uint64_t _stateBytes = 0;
+    uint64_t _ftBalancesBytes = 0;
+    uint64_t _nftBalancesBytes = 0;
+
+    std::optional<ContractStateDigests> _digests;
+
+    friend class ContractStateDigests;
+};
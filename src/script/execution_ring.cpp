@@ -0,0 +1,48 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
+#include <script/execution_ring.h>
+
+#if defined(HAVE_SYS_EVENTFD_H)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+RingEvent::RingEvent(bool withFd) {
+#if defined(HAVE_SYS_EVENTFD_H)
+    if (withFd) {
+        _fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    }
+#endif
+}
+
+RingEvent::~RingEvent() {
+#if defined(HAVE_SYS_EVENTFD_H)
+    if (_fd != -1) {
+        close(_fd);
+    }
+#endif
+}
+
+void RingEvent::Notify() {
+#if defined(HAVE_SYS_EVENTFD_H)
+    if (_fd != -1) {
+        // Only fails when the counter would overflow, and then it is readable
+        // anyway
+        const uint64_t one = 1;
+        [[maybe_unused]] ssize_t written = write(_fd, &one, sizeof(one));
+    }
+#endif
+    if (_waiters.load(std::memory_order_seq_cst) == 0) {
+        return;
+    }
+    // Taking the lock orders the notification after a waiter that has checked
+    // its condition started to wait
+    { std::lock_guard<std::mutex> lock(_mutex); }
+    _cond.notify_all();
+}
@@ -0,0 +1,299 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Bounded queue for any number of producers and consumers, without locks.
+ *
+ * Each slot carries a sequence number telling whether it is free to be written
+ * or ready to be read in the current lap around the ring: a producer or
+ * consumer claims a slot with one compare-and-swap on the tail or the head,
+ * then publishes it by storing the next sequence number.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    //! capacity is rounded up to a power of two.
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        _mask = size - 1;
+        _slots.reset(new Slot[size]);
+        for (size_t i = 0; i < size; i++) {
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue &) = delete;
+    BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+    size_t capacity() const { return _mask + 1; }
+
+    //! Returns false if the queue is full.
+    bool TryPush(const T &value) {
+        size_t pos = _tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = _slots[pos & _mask];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.value = value;
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // The slot still holds the value pushed a lap ago
+                return false;
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //! Returns false if the queue is empty.
+    bool TryPop(T &value) {
+        size_t pos = _head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &slot = _slots[pos & _mask];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = intptr_t(sequence) - intptr_t(pos + 1);
+            if (diff == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = slot.value;
+                    slot.sequence.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // Nothing was pushed to the slot in this lap yet
+                return false;
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    size_t _mask;
+    // Apart, so that producers and consumers do not share a cache line
+    alignas(64) std::atomic<size_t> _tail{0};
+    alignas(64) std::atomic<size_t> _head{0};
+};
+
+/**
+ * Wakes the threads waiting for something to become available. Notify costs an
+ * atomic load when nobody waits: the lock is only taken to sleep and to wake a
+ * sleeper. With an eventfd, each Notify also adds 1 to its counter, so that a
+ * caller can wait for it in its own event loop.
+ */
+class RingEvent {
+public:
+    //! The eventfd is created where the platform has one.
+    explicit RingEvent(bool withFd);
+    ~RingEvent();
+
+    RingEvent(const RingEvent &) = delete;
+    RingEvent &operator=(const RingEvent &) = delete;
+
+    //! The eventfd, or -1 without one.
+    int fd() const { return _fd; }
+
+    //! Call after making something available.
+    void Notify();
+
+    //! Returns once ready() holds, which is checked under the lock.
+    template <typename Ready>
+    void Wait(Ready ready) {
+        if (ready()) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        // Published before ready() is checked again: a Notify after the
+        // check sees the waiter and takes the lock to wake it
+        _waiters.fetch_add(1, std::memory_order_seq_cst);
+        _cond.wait(lock, ready);
+        _waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    int _fd = -1;
+    std::atomic<uint32_t> _waiters{0};
+    std::mutex _mutex;
+    std::condition_variable _cond;
+};
+
+/**
+ * Runs calls on worker threads, with a submission queue and a completion queue
+ * in the style of io_uring.
+ *
+ * The caller submits pointers to call descriptors, which must stay valid until
+ * their completion is reaped, and reaps completions by polling, by waiting, or
+ * by waiting on the eventfd and then polling. Neither side locks: the queues
+ * are BoundedQueues and the locks of the RingEvents are only taken by threads
+ * going to sleep or waking one.
+ *
+ * No more calls are in flight, submitted but not reaped, than the completion
+ * queue holds, so that a worker never waits for room to complete a call.
+ *
+ * execute must not throw: an exception would escape a worker thread. Errors
+ * are reported in its result.
+ */
+template <typename Call>
+class ExecutionRing {
+public:
+    struct Completion {
+        Call *call;
+        int result;
+    };
+
+    using Execute = std::function<int(Call &)>;
+
+    //! entries is the size of the submission queue, the completion queue
+    //! holds twice as many. threads is the number of workers, 0 for one per
+    //! hardware thread.
+    ExecutionRing(size_t entries, unsigned int threads, Execute execute)
+        : _submissions(std::max<size_t>(entries, 1)), _completions(2 * _submissions.capacity()),
+          _execute(std::move(execute)), _submitted(false), _completed(true) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        _workers.reserve(threads);
+        for (unsigned int i = 0; i < threads; i++) {
+            _workers.emplace_back([this] { Work(); });
+        }
+    }
+
+    //! Calls still queued are run first, their completions are discarded.
+    ~ExecutionRing() {
+        _stopping.store(true, std::memory_order_seq_cst);
+        _submitted.Notify();
+        for (std::thread &worker : _workers) {
+            worker.join();
+        }
+    }
+
+    ExecutionRing(const ExecutionRing &) = delete;
+    ExecutionRing &operator=(const ExecutionRing &) = delete;
+
+    int fd() const { return _completed.fd(); }
+
+    //! Queues calls in order, returns how many were queued: fewer than count
+    //! when the submission queue is full or too many calls are in flight.
+    size_t Submit(Call *const *calls, size_t count) {
+        size_t queued = 0;
+        while (queued < count) {
+            // Reserves a completion slot: submitters racing on the check and
+            // the increment could otherwise overfill the completion queue
+            size_t inFlight = _inFlight.load(std::memory_order_relaxed);
+            do {
+                if (inFlight >= _completions.capacity()) {
+                    break;
+                }
+            } while (!_inFlight.compare_exchange_weak(inFlight, inFlight + 1, std::memory_order_relaxed));
+            if (inFlight >= _completions.capacity()) {
+                break;
+            }
+            if (!_submissions.TryPush(calls[queued])) {
+                _inFlight.fetch_sub(1, std::memory_order_relaxed);
+                break;
+            }
+            _pending.fetch_add(1, std::memory_order_seq_cst);
+            queued++;
+        }
+        if (queued > 0) {
+            _submitted.Notify();
+        }
+        return queued;
+    }
+
+    //! Reaps up to max completions without blocking.
+    size_t Poll(Completion *completions, size_t max) {
+        size_t reaped = 0;
+        while (reaped < max && _completions.TryPop(completions[reaped])) {
+            _ready.fetch_sub(1, std::memory_order_relaxed);
+            _inFlight.fetch_sub(1, std::memory_order_relaxed);
+            reaped++;
+        }
+        return reaped;
+    }
+
+    //! Reaps up to max completions, waiting for at least one if a call is in
+    //! flight.
+    size_t Wait(Completion *completions, size_t max) {
+        if (max == 0) {
+            return 0;
+        }
+        for (;;) {
+            const size_t reaped = Poll(completions, max);
+            if (reaped > 0 || _inFlight.load(std::memory_order_relaxed) == 0) {
+                return reaped;
+            }
+            _completed.Wait([this] { return _ready.load(std::memory_order_seq_cst) > 0; });
+        }
+    }
+
+private:
+    void Work() {
+        Call *call;
+        for (;;) {
+            if (_submissions.TryPop(call)) {
+                _pending.fetch_sub(1, std::memory_order_relaxed);
+                Completion completion{call, _execute(*call)};
+                if (_stopping.load(std::memory_order_relaxed)) {
+                    continue;
+                }
+                // There is room, see the class comment. Should that ever not
+                // hold, wait for the caller to reap rather than lose the call.
+                while (!_completions.TryPush(completion)) {
+                    assert(!"completion queue full");
+                    std::this_thread::yield();
+                }
+                _ready.fetch_add(1, std::memory_order_seq_cst);
+                _completed.Notify();
+                continue;
+            }
+            if (_stopping.load(std::memory_order_seq_cst) && _pending.load(std::memory_order_seq_cst) == 0) {
+                return;
+            }
+            _submitted.Wait([this] {
+                return _pending.load(std::memory_order_seq_cst) > 0 || _stopping.load(std::memory_order_seq_cst);
+            });
+        }
+    }
+
+    BoundedQueue<Call *> _submissions;
+    BoundedQueue<Completion> _completions;
+    Execute _execute;
+    //! Submitted calls not taken by a worker yet.
+    std::atomic<size_t> _pending{0};
+    //! Completions not reaped yet.
+    std::atomic<size_t> _ready{0};
+    //! Submitted calls whose completion was not reaped yet.
+    std::atomic<size_t> _inFlight{0};
+    std::atomic<bool> _stopping{false};
+    RingEvent _submitted;
+    RingEvent _completed;
+    std::vector<std::thread> _workers;
+};
@@ -18,6 +18,7 @@
 #include <primitives/transaction.h>
 #include <pubkey.h>
 #include <script/bitfield.h>
+#include <script/bitops.h>
 #include <script/script.h>
 #include <script/script_flags.h>
 #include <script/sigencoding.h>
@@ -25,72 +26,12 @@
 #include <util/bitmanip.h>
 #include <util/strencodings.h>
 #include <script/script_num.h>
+#include <script/script_jit.h>
+#include <script/script_program.h>
 
 #include "json.hpp"
 using json = nlohmann::json;
 
-inline uint8_t make_rshift_mask(size_t n) {
-    static uint8_t mask[] = {0xFF, 0xFE, 0xFC, 0xF8, 0xF0, 0xE0, 0xC0, 0x80};
-    return mask[n];
-}
-
-inline uint8_t make_lshift_mask(size_t n) {
-    static uint8_t mask[] = {0xFF, 0x7F, 0x3F, 0x1F, 0x0F, 0x07, 0x03, 0x01};
-    return mask[n];
-}
-
-// shift x right by n bits, implements OP_RSHIFT
-static valtype RShift(const valtype &x, int n) {
-    int bit_shift = n % 8;
-    int byte_shift = n / 8;
-
-    uint8_t mask = make_rshift_mask(bit_shift);
-    uint8_t overflow_mask = ~mask;
-
-    valtype result(x.size(), 0x00);
-    for (int i = 0; i < (int)x.size(); i++) {
-        int k = i + byte_shift;
-        if (k < (int)x.size()) {
-            uint8_t val = (x[i] & mask);
-            val >>= bit_shift;
-            result[k] |= val;
-        }
-
-        if (k + 1 < (int)x.size()) {
-            uint8_t carryval = (x[i] & overflow_mask);
-            carryval <<= 8 - bit_shift;
-            result[k + 1] |= carryval;
-        }
-    }
-    return result;
-}
-
-// shift x left by n bits, implements OP_LSHIFT
-static valtype LShift(const valtype &x, int n) {
-    int bit_shift = n % 8;
-    int byte_shift = n / 8;
-
-    uint8_t mask = make_lshift_mask(bit_shift);
-    uint8_t overflow_mask = ~mask;
-
-    valtype result(x.size(), 0x00);
-    for (int i = x.size() - 1; i >= 0; i--) {
-        int k = i - byte_shift;
-        if (k >= 0) {
-            uint8_t val = (x[i] & mask);
-            val <<= bit_shift;
-            result[k] |= val;
-        }
-
-        if (k - 1 >= 0) {
-            uint8_t carryval = (x[i] & overflow_mask);
-            carryval >>= 8 - bit_shift;
-            result[k - 1] |= carryval;
-        }
-    }
-    return result;
-}
-
 bool CastToBool(const valtype &vch) {
     for (size_t i = 0; i < vch.size(); i++) {
         if (vch[i] != 0) {
@@ -143,7 +84,7 @@ int FindAndDelete(CScript &script, const CScript &b) {
     return nFound;
 }
 
-static bool IsOpcodeDisabled(opcodetype opcode, uint32_t flags) {
+bool IsOpcodeDisabled(opcodetype opcode, uint32_t flags) {
     switch (opcode) {
         case OP_2MUL:
         case OP_2DIV:
@@ -221,14 +162,15 @@ public:
 bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t flags, const BaseSignatureChecker &checker,
                 ScriptExecutionMetrics &metrics, ScriptExecutionContextOpt const &context, ScriptError *serror,
                 unsigned int *serror_op_num) {
-    json a({});
-    json b({});
-    json c({});
-    json d({});
-    json e({});
-    json f({});
-    ScriptStateContext state(a, b, c, d, e, f);
-    return EvalScript(stack, script, flags, checker, metrics, context, state, serror, serror_op_num);
+    const json empty({});
+    StateResult<ScriptStateContext> state = ScriptStateContext::Create(empty, empty, empty, empty, empty, empty);
+    if (!state) {
+        // Without headers the height defaults to the tip of the header store, which may not be set: the script then
+        // runs without block info
+        ScriptStateContext noBlockInfo;
+        return EvalScript(stack, script, flags, checker, metrics, context, noBlockInfo, serror, serror_op_num);
+    }
+    return EvalScript(stack, script, flags, checker, metrics, context, *state, serror, serror_op_num);
 }
 
 bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t flags, const BaseSignatureChecker &checker,
@@ -700,19 +642,13 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                         // To avoid allocating, we modify vch1 in place.
                         switch (opcode) {
                             case OP_AND:
-                                for (size_t i = 0; i < vch1.size(); ++i) {
-                                    vch1[i] &= vch2[i];
-                                }
+                                bitops::And(vch1.data(), vch2.data(), vch1.size());
                                 break;
                             case OP_OR:
-                                for (size_t i = 0; i < vch1.size(); ++i) {
-                                    vch1[i] |= vch2[i];
-                                }
+                                bitops::Or(vch1.data(), vch2.data(), vch1.size());
                                 break;
                             case OP_XOR:
-                                for (size_t i = 0; i < vch1.size(); ++i) {
-                                    vch1[i] ^= vch2[i];
-                                }
+                                bitops::Xor(vch1.data(), vch2.data(), vch1.size());
                                 break;
                             default:
                                 break;
@@ -729,67 +665,32 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                         }
                         valtype &vch1 = stacktop(-1);
                         // To avoid allocating, we modify vch1 in place
-                        for (size_t i = 0; i < vch1.size(); i++) {
-                            vch1[i] = ~vch1[i];
-                        }
+                        bitops::Invert(vch1.data(), vch1.size());
                     } break;
 
-                    case OP_LSHIFT: {
+                    case OP_LSHIFT:
+                    case OP_RSHIFT: {
                         // (x n -- out)
                         if (stack.size() < 2) {
                             return set_error(serror, ScriptError::INVALID_STACK_OPERATION);
                         }
 
-                        const valtype vch1 = stacktop(-2);
                         CScriptNum n(stacktop(-1), maxIntegerSize);
                         if (n < 0) {
                             return set_error(serror, ScriptError::INVALID_NUMBER_RANGE);
                         }
 
-                        stack.pop_back();
-                        stack.pop_back();
-
-                        auto values{vch1};
-                        if(n >= values.size() * bitsPerByte)
-                            fill(begin(values), end(values), 0);
-                        else
-                        {
-                            do
-                            {
-                                values = LShift(values, n.getint());
-                                n -= CScriptNum{avm::bigint{INT32_MAX}};
-                            } while(n > 0);
-                        }
-                        stack.push_back(values);
-                    } break;
-
-                    case OP_RSHIFT: {
-                        // (x n -- out)
-                        if (stack.size() < 2) {
-                            return set_error( serror, ScriptError::INVALID_STACK_OPERATION);
-                        }
-
-                        const valtype vch1 = stacktop(-2);
-                        CScriptNum n(stacktop(-1), maxIntegerSize);
-                        if (n < 0) {
-                            return set_error(serror, ScriptError::INVALID_NUMBER_RANGE);
-                        }
+                        popstack(stack);
 
-                        stack.pop_back();
-                        stack.pop_back();
-                        auto values{vch1};
-                        if(n >= values.size() * bitsPerByte)
-                            fill(begin(values), end(values), 0);
-                        else
-                        {
-                            do
-                            {
-                                values = RShift(values, n.getint());
-                                n -= CScriptNum{avm::bigint{INT32_MAX}};
-                            } while(n > 0);
+                        // To avoid allocating, we shift x in place. Shifts of
+                        // the whole size or more clear it.
+                        valtype &values = stacktop(-1);
+                        const size_t bits = n >= values.size() * bitsPerByte ? values.size() * bitsPerByte : n.getint();
+                        if (opcode == OP_LSHIFT) {
+                            bitops::LShift(values.data(), values.size(), bits);
+                        } else {
+                            bitops::RShift(values.data(), values.size(), bits);
                         }
-                        stack.push_back(values);
-
                     } break;
 
                     case OP_EQUAL:
@@ -1160,7 +1061,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                         }
 
                         valtype &data = stacktop(-1);
-                        std::reverse(data.begin(), data.end());
+                        bitops::Reverse(data.data(), data.size());
                     } break;
 
                     //
@@ -1242,11 +1143,11 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                                 stack.push_back(bn.getvch());
                             } break;
                             case OP_TXINPUTCOUNT: {
-                                CScriptNum const bn(context->tx().vin().size());
+                                CScriptNum const bn(context->tx().inputCount());
                                 stack.push_back(bn.getvch());
                             } break;
                             case OP_TXOUTPUTCOUNT: {
-                                CScriptNum const bn(context->tx().vout().size());
+                                CScriptNum const bn(context->tx().outputCount());
                                 stack.push_back(bn.getvch());
                             } break;
                             case OP_TXLOCKTIME: {
@@ -1280,13 +1181,13 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                         auto const index = sn.getint();
 
                         auto is_valid_input_index = [&] {
-                            if (index < 0 || uint64_t(index) >= context->tx().vin().size()) {
+                            if (index < 0 || uint64_t(index) >= context->tx().inputCount()) {
                                 return set_error(serror, ScriptError::INVALID_TX_INPUT_INDEX);
                             }
                             return true;
                         };
                         auto is_valid_output_index = [&] {
-                            if (index < 0 || uint64_t(index) >= context->tx().vout().size()) {
+                            if (index < 0 || uint64_t(index) >= context->tx().outputCount()) {
                                 return set_error(serror, ScriptError::INVALID_TX_OUTPUT_INDEX);
                             }
                             return true;
@@ -1297,21 +1198,20 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                         switch (opcode) {
 
                             case OP_OUTPOINTTXHASH: {
-                                if (index < 0 || index >= context->tx().vin().size()) {
+                                if (index < 0 || index >= context->tx().inputCount()) {
                                     return set_error(serror, ScriptError::INVALID_TX_INPUT_INDEX);
                                 }
-                                auto const &input = context->tx().vin()[index];
-                                auto const &txid = input.prevout.GetTxId();
+                                auto const prevout = context->tx().inputPrevout(index);
+                                auto const &txid = prevout.GetTxId();
                                 static_assert(TxId::size() <= MAX_SCRIPT_ELEMENT_SIZE);
                                 stack.emplace_back(txid.begin(), txid.end());
                             } break;
 
                             case OP_OUTPOINTINDEX: {
-                                if (index < 0 || index >= context->tx().vin().size()) {
+                                if (index < 0 || index >= context->tx().inputCount()) {
                                     return set_error(serror, ScriptError::INVALID_TX_INPUT_INDEX);
                                 }
-                                auto const &input = context->tx().vin()[index];
-                                CScriptNum const bn(input.prevout.GetN());
+                                CScriptNum const bn(context->tx().inputPrevout(index).GetN());
                                 stack.push_back(bn.getvch());
                             } break;
 
@@ -1319,7 +1219,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                                 if ( ! is_valid_input_index()) {
                                     return false; // serror set by is_invalid_input_index lambda
                                 }
-                                auto const& inputScript = context->scriptSig(index);
+                                auto const inputScript = context->scriptSig(index);
                                 if (inputScript.size() > MAX_SCRIPT_ELEMENT_SIZE) {
                                     return set_error(serror, ScriptError::PUSH_SIZE);
                                 }
@@ -1331,26 +1231,24 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                                 if ( ! is_valid_input_index()) {
                                     return false; // serror set by is_invalid_input_index lambda
                                 }
-                                auto const& input = context->tx().vin()[index];
-                                CScriptNum const bn(input.nSequence);
-                                std::cout << "OP_INPUTSEQUENCENUMBER: " << input.nSequence << std::endl;
+                                auto const nSequence = context->tx().inputSequence(index);
+                                CScriptNum const bn(nSequence);
                                 stack.push_back(bn.getvch());
                             } break;
 
                             case OP_OUTPUTVALUE: {
-                                if (index < 0 || index >= context->tx().vout().size()) {
+                                if (index < 0 || index >= context->tx().outputCount()) {
                                     return set_error(serror, ScriptError::INVALID_TX_OUTPUT_INDEX);
                                 }
-                                auto const &output = context->tx().vout()[index];
-                                CScriptNum const bn(output.nValue / SATOSHI);
+                                CScriptNum const bn(context->tx().outputValue(index) / SATOSHI);
                                 stack.push_back(bn.getvch());
                             } break;
 
                             case OP_OUTPUTBYTECODE: {
-                                if (index < 0 || index >= context->tx().vout().size()) {
+                                if (index < 0 || index >= context->tx().outputCount()) {
                                     return set_error(serror, ScriptError::INVALID_TX_OUTPUT_INDEX);
                                 }
-                                auto const &outputScript = context->tx().vout()[index].scriptPubKey;
+                                auto const outputScript = context->tx().outputScript(index);
                                 if (outputScript.size() > MAX_SCRIPT_ELEMENT_SIZE) {
                                     return set_error(serror, ScriptError::PUSH_SIZE);
                                 }
@@ -1479,44 +1377,49 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                                 }
                                 popstack(stack); // consume element
                                 popstack(stack); // consume element
+                                if (blockField == 7) {
+                                    std::vector<uint8_t> currentblockheader;
+                                    if (stateContext.getCurrentBlockInfoHeader(heightNumber, currentblockheader) !=
+                                        StateError::OK) {
+                                        return set_error(serror, ScriptError::INVALID_AVM_BLOCKINFO_HEIGHT);
+                                    }
+                                    stack.emplace_back(currentblockheader.begin(), currentblockheader.end());
+                                    break;
+                                }
+                                if (blockField == 8) {
+                                    const StateResult<uint32_t> currentHeight =
+                                        stateContext.getCurrentBlockInfoHeight(heightNumber);
+                                    if (!currentHeight) {
+                                        return set_error(serror, ScriptError::INVALID_AVM_BLOCKINFO_HEIGHT);
+                                    }
+                                    CScriptNum const bn(*currentHeight);
+                                    stack.push_back(bn.getvch());
+                                    break;
+                                }
+                                // The header is looked up and decoded once, whichever field is read
+                                const StateResult<CBlockHeader> header = stateContext.getBlockInfoByHeight(heightNumber);
+                                if (!header) {
+                                    return set_error(serror, ScriptError::INVALID_AVM_BLOCKINFO_HEIGHT);
+                                }
                                 if (blockField == 0) {
-                                    auto version = stateContext.getCurrentBlockInfoVersion(heightNumber);
-                                    CScriptNum const bn(version);
+                                    CScriptNum const bn(header->nVersion);
                                     stack.push_back(bn.getvch());
                                 } else if (blockField == 1) {
-                                    std::vector<uint8_t> prevHash;
-                                    stateContext.getCurrentBlockInfoPrevHash(heightNumber, prevHash);
-                                    stack.emplace_back(prevHash.begin(), prevHash.end());
+                                    stack.emplace_back(header->hashPrevBlock.begin(), header->hashPrevBlock.end());
                                 } else if (blockField == 2) {
-                                    std::vector<uint8_t> merkleRoot;
-                                    stateContext.getCurrentBlockInfoMerkleRoot(heightNumber, merkleRoot);
-                                    stack.emplace_back(merkleRoot.begin(), merkleRoot.end());
+                                    stack.emplace_back(header->hashMerkleRoot.begin(), header->hashMerkleRoot.end());
                                 } else if (blockField == 3) {
-                                    auto time = stateContext.getCurrentBlockInfoTime(heightNumber);
-                                    CScriptNum const bn(time);
+                                    CScriptNum const bn(header->nTime);
                                     stack.push_back(bn.getvch());
                                 } else if (blockField == 4) {
-                                    auto bits = stateContext.getCurrentBlockInfoBits(heightNumber);
-                                    CScriptNum const bn(bits);
+                                    CScriptNum const bn(header->nBits);
                                     stack.push_back(bn.getvch());
                                 } else if (blockField == 5) {
-                                    auto nonce = stateContext.getCurrentBlockInfoNonce(heightNumber);
-                                    CScriptNum const bn(nonce);
-                                    stack.push_back(bn.getvch());
-                                } else if (blockField == 6) {
-                                    auto diff = stateContext.getCurrentBlockInfoDifficulty(heightNumber);
-                                    CScriptNum const bn(diff);
-                                    stack.push_back(bn.getvch());
-                                } else if (blockField == 7) {
-                                    std::vector<uint8_t> currentblockheader;
-                                    stateContext.getCurrentBlockInfoHeader(heightNumber, currentblockheader);
-                                    stack.emplace_back(currentblockheader.begin(), currentblockheader.end());
-                                } else if (blockField == 8) {
-                                    auto currentHeight = stateContext.getCurrentBlockInfoHeight(heightNumber);
-                                    CScriptNum const bn(currentHeight);
+                                    CScriptNum const bn(header->nNonce);
                                     stack.push_back(bn.getvch());
                                 } else {
-                                    return set_error(serror, ScriptError::INVALID_AVM_INVALID_BLOCKINFO_ITEM);
+                                    CScriptNum const bn(ScriptStateContext::getBlockInfoDifficulty(*header));
+                                    stack.push_back(bn.getvch());
                                 }
                             } break;
                             case OP_FT_BALANCE: {
@@ -1647,7 +1550,7 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                                     return set_error(serror, ScriptError::INVALID_ATOMICAL_REF_SIZE);
                                 }
                                 auto const index = CScriptNum(vch1, maxIntegerSize).getint();
-                                if (index < 0 || uint64_t(index) >= context->tx().vout().size()) {
+                                if (index < 0 || uint64_t(index) >= context->tx().outputCount()) {
                                     return set_error(serror, ScriptError::INVALID_AVM_WITHDRAW_NFT_OUTPUT_INDEX);
                                 }
                                 uint288 atomref(vch2);
@@ -1665,47 +1568,31 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                                 if (blockField < 0 || uint64_t(blockField) > 6) {
                                     return set_error(serror, ScriptError::INVALID_AVM_INVALID_BLOCKINFO_ITEM);
                                 }
+                                // The size is checked above, the header always decodes
+                                const StateResult<CBlockHeader> header = ScriptStateContext::decodeHeader(vch1);
+                                if (!header) {
+                                    return set_error(serror, ScriptError::INVALID_AVM_BLOCK_HEADER_SIZE);
+                                }
+                                popstack(stack); // consume element
+                                popstack(stack); // consume element
                                 if (blockField == 0) {
-                                    auto version = stateContext.getBlockInfoVersion(vch1);
-                                    CScriptNum const bn(version);
-                                    popstack(stack); // consume element
-                                    popstack(stack); // consume element
+                                    CScriptNum const bn(header->nVersion);
                                     stack.push_back(bn.getvch());
                                 } else if (blockField == 1) {
-                                    std::vector<uint8_t> prevHash;
-                                    stateContext.getBlockInfoPrevHash(vch1, prevHash);
-                                    popstack(stack); // consume element
-                                    popstack(stack); // consume element
-                                    stack.emplace_back(prevHash.begin(), prevHash.end());
+                                    stack.emplace_back(header->hashPrevBlock.begin(), header->hashPrevBlock.end());
                                 } else if (blockField == 2) {
-                                    std::vector<uint8_t> merkleRoot;
-                                    stateContext.getBlockInfoMerkleRoot(vch1, merkleRoot);
-                                    popstack(stack); // consume element
-                                    popstack(stack); // consume element
-                                    stack.emplace_back(merkleRoot.begin(), merkleRoot.end());
+                                    stack.emplace_back(header->hashMerkleRoot.begin(), header->hashMerkleRoot.end());
                                 } else if (blockField == 3) {
-                                    auto time = stateContext.getBlockInfoTime(vch1);
-                                    CScriptNum const bn(time);
-                                    popstack(stack); // consume element
-                                    popstack(stack); // consume element
+                                    CScriptNum const bn(header->nTime);
                                     stack.push_back(bn.getvch());
                                 } else if (blockField == 4) {
-                                    auto bits = stateContext.getBlockInfoBits(vch1);
-                                    CScriptNum const bn(bits);
-                                    popstack(stack); // consume element
-                                    popstack(stack); // consume element
+                                    CScriptNum const bn(header->nBits);
                                     stack.push_back(bn.getvch());
                                 } else if (blockField == 5) {
-                                    auto nonce = stateContext.getBlockInfoNonce(vch1);
-                                    CScriptNum const bn(nonce);
-                                    popstack(stack); // consume element
-                                    popstack(stack); // consume element
+                                    CScriptNum const bn(header->nNonce);
                                     stack.push_back(bn.getvch());
-                                } else if (blockField == 6) {
-                                    auto diff = stateContext.getBlockInfoDifficulty(vch1);
-                                    CScriptNum const bn(diff);
-                                    popstack(stack); // consume element
-                                    popstack(stack); // consume element
+                                } else {
+                                    CScriptNum const bn(ScriptStateContext::getBlockInfoDifficulty(*header));
                                     stack.push_back(bn.getvch());
                                 }
                             } break;
@@ -1749,6 +1636,39 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                             }
                         }
                     } break;
+                    case OP_CHECKTXINBLOCK: {
+                        if (!(flags & SCRIPT_ENABLE_CHECKTXINBLOCK)) {
+                            return set_error(serror, ScriptError::BAD_OPCODE);
+                        }
+                        if (!context) {
+                            return set_error(serror, ScriptError::CONTEXT_NOT_PRESENT);
+                        }
+
+                        // (height proof txid -- bool)
+                        if (stack.size() < 3) {
+                            return set_error(serror, ScriptError::INVALID_STACK_OPERATION);
+                        }
+
+                        valtype &vch1 = stacktop(-3);
+                        valtype &vch2 = stacktop(-2);
+                        valtype &vch3 = stacktop(-1);
+                        if (vch3.size() != uint256::size()) {
+                            return set_error(serror, ScriptError::INVALID_AVM_TXID_SIZE);
+                        }
+                        auto const heightNumber = CScriptNum(vch1, maxIntegerSize).getint();
+                        if (heightNumber < 0) {
+                            return set_error(serror, ScriptError::INVALID_AVM_CHECKTXINBLOCK_ERROR);
+                        }
+                        std::optional<bool> const found =
+                            stateContext.checkTxInBlockAtHeight(heightNumber, vch2, uint256(vch3));
+                        if (!found) {
+                            return set_error(serror, ScriptError::INVALID_AVM_CHECKTXINBLOCK_ERROR);
+                        }
+                        popstack(stack); // consume element
+                        popstack(stack); // consume element
+                        popstack(stack); // consume element
+                        stack.push_back(*found ? vchTrue : vchFalse);
+                    } break;
                     // Atomicals Virtual Machine opcodes (Ternary)
                     case OP_KV_PUT:
                     case OP_FT_WITHDRAW: {
@@ -1784,12 +1704,12 @@ bool EvalScript(std::vector<valtype> &stack, const CScript &script, uint32_t fla
                                     return set_error(serror, ScriptError::INVALID_ATOMICAL_REF_SIZE);
                                 }
                                 auto const index = CScriptNum(vch2, maxIntegerSize).getint();
-                                if (index < 0 || uint64_t(index) >= context->tx().vout().size()) {
+                                if (index < 0 || uint64_t(index) >= context->tx().outputCount()) {
                                     return set_error(serror, ScriptError::INVALID_AVM_WITHDRAW_FT_OUTPUT_INDEX);
                                 }
-                                auto const &output = context->tx().vout()[index];
+                                auto const outputValue = context->tx().outputValue(index);
                                 auto withdrawAmount = CScriptNum(vch1, maxIntegerSize).getint();
-                                if (withdrawAmount <= 0 || withdrawAmount > output.nValue.GetSatoshis()) {
+                                if (withdrawAmount <= 0 || withdrawAmount > outputValue.GetSatoshis()) {
                                     return set_error(serror, ScriptError::INVALID_AVM_WITHDRAW_FT_AMOUNT);
                                 }
                                 uint288 atomref(vch3);
@@ -1958,6 +1878,19 @@ uint256 GetOutputsHash(const T &txTo) {
     return ss.GetHash();
 }
 
+// A CTransactionBufferView computes these once, on first use.
+uint256 GetPrevoutHash(const CTransactionBufferView &txTo) {
+    return txTo.GetHashPrevouts();
+}
+
+uint256 GetSequenceHash(const CTransactionBufferView &txTo) {
+    return txTo.GetHashSequence();
+}
+
+uint256 GetOutputsHash(const CTransactionBufferView &txTo) {
+    return txTo.GetHashOutputs();
+}
+
 } // namespace
 
 template <class T>
@@ -1974,7 +1907,8 @@ template PrecomputedTransactionData::PrecomputedTransactionData(const CMutableTr
 template <class T>
 uint256 SignatureHash(const CScript &scriptCode, const T &txTo, unsigned int nIn, SigHashType sigHashType,
                       const Amount amount, const PrecomputedTransactionData *cache, uint32_t flags) {
-    assert(nIn < txTo.vin.size());
+    const CTransactionViewOf<T> tx(txTo);
+    assert(nIn < tx.inputCount());
 
     uint256 hashPrevouts;
     uint256 hashSequence;
@@ -1992,29 +1926,33 @@ uint256 SignatureHash(const CScript &scriptCode, const T &txTo, unsigned int nIn
     if ((sigHashType.getBaseType() != BaseSigHashType::SINGLE) &&
         (sigHashType.getBaseType() != BaseSigHashType::NONE)) {
         hashOutputs = cache ? cache->hashOutputs : GetOutputsHash(txTo);
-    } else if ((sigHashType.getBaseType() == BaseSigHashType::SINGLE) && (nIn < txTo.vout.size())) {
+    } else if ((sigHashType.getBaseType() == BaseSigHashType::SINGLE) && (nIn < tx.outputCount())) {
         CHashWriter ss(SER_GETHASH, 0);
-        ss << txTo.vout[nIn];
+        // The output as a CTxOut serializes, value then script.
+        const Span<const uint8_t> script = tx.outputScript(nIn);
+        ss << tx.outputValue(nIn);
+        ::WriteCompactSize(ss, script.size());
+        ::Serialize(ss, script);
         hashOutputs = ss.GetHash();
     }
 
     CHashWriter ss(SER_GETHASH, 0);
     // Version
-    ss << txTo.nVersion;
+    ss << tx.nVersion();
     // Input prevouts/nSequence (none/all, depending on flags)
     ss << hashPrevouts;
     ss << hashSequence;
     // The input being signed (replacing the scriptSig with scriptCode +
     // amount). The prevout may already be contained in hashPrevout, and the
     // nSequence may already be contain in hashSequence.
-    ss << txTo.vin[nIn].prevout;
+    ss << tx.inputPrevout(nIn);
     ss << scriptCode;
     ss << amount;
-    ss << txTo.vin[nIn].nSequence;
+    ss << tx.inputSequence(nIn);
     // Outputs (none/one/all, depending on flags)
     ss << hashOutputs;
     // Locktime
-    ss << txTo.nLockTime;
+    ss << tx.nLockTime();
     // Sighash type
     ss << sigHashType;
 
@@ -2065,14 +2003,15 @@ bool GenericTransactionSignatureChecker<T>::CheckLockTime(const CScriptNum &nLoc
     // We want to compare apples to apples, so fail the script unless the type
     // of nLockTime being tested is the same as the nLockTime in the
     // transaction.
-    if (!((txTo->nLockTime < LOCKTIME_THRESHOLD && nLockTime < LOCKTIME_THRESHOLD) ||
-          (txTo->nLockTime >= LOCKTIME_THRESHOLD && nLockTime >= LOCKTIME_THRESHOLD))) {
+    const CTransactionViewOf<T> tx(*txTo);
+    if (!((tx.nLockTime() < LOCKTIME_THRESHOLD && nLockTime < LOCKTIME_THRESHOLD) ||
+          (tx.nLockTime() >= LOCKTIME_THRESHOLD && nLockTime >= LOCKTIME_THRESHOLD))) {
         return false;
     }
 
     // Now that we know we're comparing apples-to-apples, the comparison is a
     // simple numeric one.
-    if (nLockTime > int64_t(txTo->nLockTime)) {
+    if (nLockTime > int64_t(tx.nLockTime())) {
         return false;
     }
 
@@ -2085,7 +2024,7 @@ bool GenericTransactionSignatureChecker<T>::CheckLockTime(const CScriptNum &nLoc
     // Alternatively we could test all inputs, but testing just this input
     // minimizes the data required to prove correct CHECKLOCKTIMEVERIFY
     // execution.
-    if (CTxIn::SEQUENCE_FINAL == txTo->vin[nIn].nSequence) {
+    if (CTxIn::SEQUENCE_FINAL == tx.inputSequence(nIn)) {
         return false;
     }
 
@@ -2096,11 +2035,12 @@ template <class T>
 bool GenericTransactionSignatureChecker<T>::CheckSequence(const CScriptNum &nSequence) const {
     // Relative lock times are supported by comparing the passed in operand to
     // the sequence number of the input.
-    const int64_t txToSequence = int64_t(txTo->vin[nIn].nSequence);
+    const CTransactionViewOf<T> tx(*txTo);
+    const int64_t txToSequence = int64_t(tx.inputSequence(nIn));
 
     // Fail if the transaction's version number is not set high enough to
     // trigger BIP 68 rules.
-    if (static_cast<uint32_t>(txTo->nVersion) < 2) {
+    if (static_cast<uint32_t>(tx.nVersion()) < 2) {
         return false;
     }
 
@@ -2144,6 +2084,7 @@ bool GenericTransactionSignatureChecker<T>::CheckSequence(const CScriptNum &nSeq
 // explicit instantiation
 template class GenericTransactionSignatureChecker<CTransaction>;
 template class GenericTransactionSignatureChecker<CMutableTransaction>;
+template class GenericTransactionSignatureChecker<CTransactionBufferView>;
 
 bool VerifyScriptAvm(const CScript &scriptSig, const CScript &scriptPubKey, uint32_t flags,
                      const BaseSignatureChecker &checker, ScriptExecutionMetrics &metricsOut,
@@ -2160,11 +2101,15 @@ bool VerifyScriptAvm(const CScript &scriptSig, const CScript &scriptPubKey, uint
     ScriptExecutionMetrics metrics = {};
 
     std::vector<valtype> stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, flags, checker, metrics, context, stateContext, serror, serror_op_num)) {
+    if (!EvalScriptProgram(stack, ScriptProgram(scriptSig), flags, checker, metrics, context, stateContext, serror,
+                           serror_op_num)) {
         // serror is set
         return false;
     }
-    if (!EvalScript(stack, scriptPubKey, flags, checker, metrics, context, stateContext, serror, serror_op_num)) {
+    // Locking scripts are the ones that run again and again: they go through
+    // the program cache and, once hot, the JIT.
+    if (!EvalScriptTiered(stack, scriptPubKey, flags, checker, metrics, context, stateContext, serror,
+                          serror_op_num)) {
         // serror serror
         return set_error(serror, *serror);
     }
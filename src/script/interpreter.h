@@ -8,6 +8,7 @@
 #pragma once
 
 #include <primitives/transaction.h>
+#include <script/script.h>
 #include <script/script_error.h>
 #include <script/script_execution_context.h>
 #include <script/script_flags.h>
@@ -71,6 +72,7 @@ public:
 
 using TransactionSignatureChecker = GenericTransactionSignatureChecker<CTransaction>;
 using MutableTransactionSignatureChecker = GenericTransactionSignatureChecker<CMutableTransaction>;
+using BufferTransactionSignatureChecker = GenericTransactionSignatureChecker<CTransactionBufferView>;
 
 bool EvalScript(StackT &stack, const CScript &script, uint32_t flags, const BaseSignatureChecker &checker,
                 ScriptExecutionMetrics &metrics, ScriptExecutionContextOpt const &context,
@@ -87,8 +89,12 @@ static inline bool EvalScript(StackT &stack, const CScript &script, uint32_t fla
     return EvalScript(stack, script, flags, checker, dummymetrics, context, serror, serror_op_num);
 }
 
+bool CastToBool(const std::vector<uint8_t> &vch);
+
 int FindAndDelete(CScript &script, const CScript &b);
 
+bool IsOpcodeDisabled(opcodetype opcode, uint32_t flags);
+
 /**
  * Added for Atomicals AVM
  * Execute an unlocking and locking script together.
@@ -208,6 +208,7 @@ enum opcodetype {
     OP_FT_BALANCE_ADD = 0xd3,           // TESTED. Add to FT balance internal token table storage
  
     OP_KV_EXISTS = 0xed,                // TESTED. Check if KV exists.
+    OP_CHECKTXINBLOCK = 0xee,           // Check a Merkle proof that a tx is in the block at a height.
     OP_KV_GET = 0xef,                   // TESTED. Get KV. 
     OP_KV_PUT = 0xf0,                   // TESTED. Put KV.
     OP_KV_DELETE = 0xf1,                // TESTED. Delete KV.
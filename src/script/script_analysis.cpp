@@ -0,0 +1,325 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <script/script_analysis.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+/**
+ * Relative weights of the cost bound, in units of the dispatch of one opcode.
+ * They are rough orders of magnitude, enough to rank scripts, not a
+ * measurement of any particular machine.
+ */
+constexpr uint64_t COST_OP = 1;
+//! Per 64 bytes copied, compared or transformed.
+constexpr uint64_t COST_BLOCK = 1;
+//! Per 64 bytes hashed.
+constexpr uint64_t COST_HASH_BLOCK = 8;
+//! A signature verification.
+constexpr uint64_t COST_SIGCHECK = 2000;
+//! A lookup or update of the contract state or of the header chain.
+constexpr uint64_t COST_STATE = 100;
+
+constexpr uint64_t Blocks(uint64_t size) {
+    return (size + 63) / 64;
+}
+
+constexpr uint64_t ELEMENT_BLOCKS = Blocks(MAX_SCRIPT_ELEMENT_SIZE);
+
+/** Worst case of a sequence of instructions. */
+struct PathCost {
+    uint64_t cost = 0;
+    uint32_t sigChecks = 0;
+    uint32_t hashOps = 0;
+    uint32_t stateReads = 0;
+    uint32_t stateWrites = 0;
+    uint32_t proofChecks = 0;
+
+    void Add(const PathCost &other) {
+        cost += other.cost;
+        sigChecks += other.sigChecks;
+        hashOps += other.hashOps;
+        stateReads += other.stateReads;
+        stateWrites += other.stateWrites;
+        proofChecks += other.proofChecks;
+    }
+
+    //! Bounds either of two paths, each bound taken separately.
+    void Max(const PathCost &other) {
+        cost = std::max(cost, other.cost);
+        sigChecks = std::max(sigChecks, other.sigChecks);
+        hashOps = std::max(hashOps, other.hashOps);
+        stateReads = std::max(stateReads, other.stateReads);
+        stateWrites = std::max(stateWrites, other.stateWrites);
+        proofChecks = std::max(proofChecks, other.proofChecks);
+    }
+};
+
+/**
+ * Adds the worst case of an opcode other than a push to path. Returns false
+ * for opcodes EvalScript fails on with BAD_OPCODE when they are executed.
+ */
+bool AddOpcodeCost(opcodetype opcode, PathCost &path) {
+    path.cost += COST_OP;
+    switch (opcode) {
+        case OP_NOP:
+        case OP_NOP1:
+        case OP_CHECKLOCKTIMEVERIFY:
+        case OP_CHECKSEQUENCEVERIFY:
+        case OP_NOP4:
+        case OP_NOP5:
+        case OP_NOP6:
+        case OP_NOP7:
+        case OP_NOP8:
+        case OP_NOP9:
+        case OP_NOP10:
+        case OP_IF:
+        case OP_NOTIF:
+        case OP_ELSE:
+        case OP_ENDIF:
+        case OP_VERIFY:
+        case OP_RETURN:
+        case OP_TOALTSTACK:
+        case OP_FROMALTSTACK:
+        case OP_2DROP:
+        case OP_2ROT:
+        case OP_2SWAP:
+        case OP_DEPTH:
+        case OP_DROP:
+        case OP_NIP:
+        case OP_ROT:
+        case OP_SWAP:
+        case OP_SIZE:
+        case OP_TXVERSION:
+        case OP_TXINPUTCOUNT:
+        case OP_TXOUTPUTCOUNT:
+        case OP_TXLOCKTIME:
+        case OP_OUTPOINTINDEX:
+        case OP_INPUTSEQUENCENUMBER:
+        case OP_OUTPUTVALUE:
+            return true;
+
+        // Copies of up to three elements.
+        case OP_3DUP:
+            path.cost += COST_BLOCK * ELEMENT_BLOCKS;
+            [[fallthrough]];
+        case OP_2DUP:
+        case OP_2OVER:
+            path.cost += COST_BLOCK * ELEMENT_BLOCKS;
+            [[fallthrough]];
+        case OP_IFDUP:
+        case OP_DUP:
+        case OP_OVER:
+        case OP_PICK:
+        case OP_ROLL:
+        case OP_TUCK:
+        // Byte string operations.
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+        case OP_INVERT:
+        case OP_LSHIFT:
+        case OP_RSHIFT:
+        case OP_EQUAL:
+        case OP_EQUALVERIFY:
+        case OP_CAT:
+        case OP_SPLIT:
+        case OP_REVERSEBYTES:
+        case OP_NUM2BIN:
+        case OP_BIN2NUM:
+        case OP_DECODEBLOCKINFO:
+        // Arithmetic, linear in the size of the operands.
+        case OP_1ADD:
+        case OP_1SUB:
+        case OP_NEGATE:
+        case OP_ABS:
+        case OP_NOT:
+        case OP_0NOTEQUAL:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_BOOLAND:
+        case OP_BOOLOR:
+        case OP_NUMEQUAL:
+        case OP_NUMEQUALVERIFY:
+        case OP_NUMNOTEQUAL:
+        case OP_LESSTHAN:
+        case OP_GREATERTHAN:
+        case OP_LESSTHANOREQUAL:
+        case OP_GREATERTHANOREQUAL:
+        case OP_MIN:
+        case OP_MAX:
+        case OP_WITHIN:
+        // Introspection pushing up to an element.
+        case OP_OUTPOINTTXHASH:
+        case OP_INPUTBYTECODE:
+        case OP_OUTPUTBYTECODE:
+            path.cost += COST_BLOCK * ELEMENT_BLOCKS;
+            return true;
+
+        // Quadratic in the size of the operands.
+        case OP_MUL:
+        case OP_DIV:
+        case OP_MOD:
+            path.cost += COST_BLOCK * ELEMENT_BLOCKS * ELEMENT_BLOCKS;
+            return true;
+
+        case OP_RIPEMD160:
+        case OP_SHA1:
+        case OP_SHA256:
+        case OP_HASH160:
+        case OP_HASH256:
+        case OP_HASH_FN:
+            path.hashOps++;
+            path.cost += COST_HASH_BLOCK * ELEMENT_BLOCKS;
+            return true;
+
+        case OP_CHECKDATASIG:
+        case OP_CHECKDATASIGVERIFY:
+        case OP_CHECKAUTHSIG:
+        case OP_CHECKAUTHSIGVERIFY:
+            // The message is hashed before the signature is checked.
+            path.sigChecks++;
+            path.hashOps++;
+            path.cost += COST_SIGCHECK + COST_HASH_BLOCK * ELEMENT_BLOCKS;
+            return true;
+
+        case OP_KV_EXISTS:
+        case OP_KV_GET:
+        case OP_FT_BALANCE:
+        case OP_FT_COUNT:
+        case OP_FT_ITEM:
+        case OP_NFT_EXISTS:
+        case OP_NFT_COUNT:
+        case OP_NFT_ITEM:
+        case OP_GETBLOCKINFO:
+            path.stateReads++;
+            path.cost += COST_STATE + COST_BLOCK * ELEMENT_BLOCKS;
+            return true;
+
+        case OP_KV_PUT:
+        case OP_KV_DELETE:
+        case OP_FT_BALANCE_ADD:
+        case OP_FT_WITHDRAW:
+        case OP_NFT_PUT:
+        case OP_NFT_WITHDRAW:
+            path.stateWrites++;
+            path.cost += COST_STATE + COST_BLOCK * ELEMENT_BLOCKS;
+            return true;
+
+        case OP_CHECKTXINBLOCK:
+            // A header lookup, then a partial Merkle tree of at most an
+            // element, whose nodes are hashed about twice.
+            path.proofChecks++;
+            path.cost += COST_STATE + 2 * COST_HASH_BLOCK * ELEMENT_BLOCKS;
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+} // namespace
+
+ScriptAnalysis AnalyzeScript(const CScript &script, const ScriptProgram &program) {
+    ScriptAnalysis analysis;
+    analysis.scriptSize = uint32_t(std::min<size_t>(script.size(), UINT32_MAX));
+
+    // The worst case of each open conditional: of the instructions that run
+    // when its condition holds and of those that run when it does not. Each
+    // OP_ELSE switches between the two.
+    struct Conditional {
+        PathCost sides[2];
+        int side = 0;
+    };
+    std::vector<Conditional> open;
+    PathCost outer;
+    auto path = [&]() -> PathCost & { return open.empty() ? outer : open.back().sides[open.back().side]; };
+    auto close = [&] {
+        PathCost worst = open.back().sides[0];
+        worst.Max(open.back().sides[1]);
+        open.pop_back();
+        path().Add(worst);
+    };
+
+    bool returned = false;
+    auto fail = [&](ScriptError error, uint32_t opNum) {
+        if (analysis.error == ScriptError::OK && !returned) {
+            analysis.error = error;
+            analysis.errorOpNum = opNum;
+        }
+    };
+
+    // Superinstructions leave the instructions they cover in place, so every
+    // opcode of the script has its own entry. The last one is the terminal
+    // instruction.
+    const std::vector<ScriptInstruction> &code = program.code();
+    const std::vector<uint8_t> &data = program.data();
+    for (size_t i = 0; i + 1 < code.size(); ++i) {
+        const ScriptInstruction &ins = code[i];
+        const auto opcode = opcodetype(ins.opcode);
+
+        if (opcode <= OP_PUSHDATA4) {
+            analysis.pushCount++;
+            analysis.maxPushSize = std::max(analysis.maxPushSize, ins.dataSize);
+            path().cost += COST_OP + COST_BLOCK * Blocks(ins.dataSize);
+            const std::vector<uint8_t> push(data.begin() + ins.dataPos, data.begin() + ins.dataPos + ins.dataSize);
+            if (!CheckMinimalPush(push, opcode)) {
+                analysis.nonMinimalPushes++;
+                if (open.empty()) {
+                    fail(ScriptError::MINIMALDATA, ins.opNum);
+                }
+            }
+            continue;
+        }
+        if (opcode == OP_1NEGATE || (OP_1 <= opcode && opcode <= OP_16)) {
+            analysis.pushCount++;
+            path().cost += COST_OP;
+            continue;
+        }
+
+        // Note how OP_RESERVED does not count towards the opcode limit.
+        if (opcode > OP_16) {
+            analysis.opCount++;
+        }
+        if (opcode == OP_ELSE || opcode == OP_ENDIF) {
+            // Decoding guarantees a matching OP_IF/OP_NOTIF.
+            if (opcode == OP_ELSE) {
+                open.back().side ^= 1;
+            } else {
+                close();
+            }
+        }
+        if (!AddOpcodeCost(opcode, path())) {
+            analysis.unknownOpcodes++;
+            if (open.empty()) {
+                fail(ScriptError::BAD_OPCODE, ins.opNum);
+            }
+        }
+        if (opcode == OP_IF || opcode == OP_NOTIF) {
+            open.emplace_back();
+            analysis.maxConditionalDepth = std::max(analysis.maxConditionalDepth, uint32_t(open.size()));
+        }
+        returned |= opcode == OP_RETURN;
+    }
+
+    // Conditionals left open end the program, which fails when it reaches
+    // the end anyway.
+    while (!open.empty()) {
+        close();
+    }
+    if (program.terminalError() != ScriptError::OK) {
+        fail(program.terminalError(), code.back().opNum);
+    }
+
+    analysis.cost = outer.cost;
+    analysis.sigChecks = outer.sigChecks;
+    analysis.hashOps = outer.hashOps;
+    analysis.stateReads = outer.stateReads;
+    analysis.stateWrites = outer.stateWrites;
+    analysis.proofChecks = outer.proofChecks;
+    return analysis;
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <script/script.h>
+#include <script/script_error.h>
+#include <script/script_program.h>
+
+#include <cstdint>
+
+/**
+ * What can be told about a script without executing it.
+ *
+ * Scripts have no loops: every instruction runs at most once and of the two
+ * sides of an OP_IF only one runs. The worst case of a script is therefore
+ * the sum of the worst cases of its instructions, taking the more expensive
+ * side of each conditional.
+ */
+struct ScriptAnalysis {
+    //! Error evaluating the script always fails with, at errorOpNum, unless an
+    //! earlier instruction fails first. ScriptError::OK when there is none.
+    //! This is a decoding error of the program, or an unknown opcode or a
+    //! non-minimal push outside of any conditional. An OP_RETURN before it may
+    //! end the script successfully, so none is reported past an OP_RETURN.
+    ScriptError error = ScriptError::OK;
+    uint32_t errorOpNum = 0;
+
+    uint32_t scriptSize = 0;
+    //! Opcodes counted against MAX_OPS_PER_SCRIPT.
+    uint32_t opCount = 0;
+    uint32_t pushCount = 0;
+    uint32_t maxPushSize = 0;
+    //! Pushes that fail with MINIMALDATA and opcodes that fail with BAD_OPCODE
+    //! when executed, whether or not they are reached. OP_CHECKTXINBLOCK is
+    //! taken as enabled.
+    uint32_t nonMinimalPushes = 0;
+    uint32_t unknownOpcodes = 0;
+    uint32_t maxConditionalDepth = 0;
+
+    //! Upper bounds over any execution.
+    uint32_t sigChecks = 0;
+    uint32_t hashOps = 0;
+    uint32_t stateReads = 0;
+    uint32_t stateWrites = 0;
+    uint32_t proofChecks = 0;
+    //! Weighted sum of the above and of the bytes handled, in units of the
+    //! dispatch of one opcode (see script_analysis.cpp for the weights).
+    //! Byte strings are taken at MAX_SCRIPT_ELEMENT_SIZE bytes: larger values
+    //! read from the contract state and numbers grown past that size by
+    //! arithmetic are not accounted for.
+    uint64_t cost = 0;
+};
+
+/** Analyzes the program decoded from script. */
+ScriptAnalysis AnalyzeScript(const CScript &script, const ScriptProgram &program);
@@ -129,7 +129,8 @@ enum class ScriptError {
     INVALID_AVM_CHECKAUTHSIGVERIFY,                 // Used
     INVALID_AVM_CHECKAUTHSIGNULL,                   // Used      
     // Script enhancements
-    SCRIPT_ERR_BIG_INT
+    SCRIPT_ERR_BIG_INT,
+    INVALID_AVM_BLOCKINFO_HEIGHT,                   // Used
 };
 
 #define SCRIPT_ERR_LAST ScriptError::ERROR_COUNT
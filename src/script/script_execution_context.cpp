@@ -4,11 +4,19 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <script/script_execution_context.h>
+#include <script/block_header_store.h>
 #include <script/script_utils.h>
 
 #include <merkleblock.h>
+#include <pow.h>
+#include <sync.h>
+#include <util/saltedhashers.h>
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "json.hpp"
 
@@ -16,6 +24,44 @@
 
 using json = nlohmann::json;
 
+namespace {
+
+//! Size of a serialized block header, bytes after it are ignored when decoding
+constexpr size_t BLOCK_HEADER_SIZE = 80;
+
+using RawBlockHeader = std::array<uint8_t, BLOCK_HEADER_SIZE>;
+
+struct SaltedRawBlockHeaderHasher : SaltedHasherBase {
+    SaltedRawBlockHeaderHasher() noexcept {}
+    size_t operator()(const RawBlockHeader &raw) const noexcept {
+        return static_cast<size_t>(CSipHasher(k0(), k1()).Write(raw.data(), raw.size()).Finalize());
+    }
+};
+
+//! Bound on the number of cached headers, the cache is emptied when it is full.
+constexpr size_t MAX_CACHED_HEADERS = 16384;
+
+Mutex cs_headerCache;
+std::unordered_map<RawBlockHeader, DecodedBlockHeader, SaltedRawBlockHeaderHasher>
+    headerCache GUARDED_BY(cs_headerCache);
+
+struct SaltedBytesHasher : SaltedHasherBase {
+    SaltedBytesHasher() noexcept {}
+    size_t operator()(const std::vector<uint8_t> &bytes) const noexcept {
+        return static_cast<size_t>(CSipHasher(k0(), k1()).Write(bytes.data(), bytes.size()).Finalize());
+    }
+};
+
+//! Bound on the number of cached proofs, the cache is emptied when it is full.
+constexpr size_t MAX_CACHED_PROOFS = 16384;
+
+//! Merkle root, txid and proof of every valid proof checked by checkTxInBlock. The proof is part of the key so that
+//! a malformed proof fails whether or not a valid one was checked before.
+Mutex cs_proofCache;
+std::unordered_set<std::vector<uint8_t>, SaltedBytesHasher> proofCache GUARDED_BY(cs_proofCache);
+
+} // namespace
+
 ScriptExecutionContext::ScriptExecutionContext(const CCoinsViewCache &coinsCache, CTransactionView tx, const std::vector<uint8_t>& fullScript, const std::vector<uint8_t>& pubKey) {
     shared = std::make_shared<Shared>(tx);
     _fullScript = fullScript;
@@ -31,33 +77,122 @@ ScriptExecutionContext ScriptExecutionContext::createForTx(CTransactionView tx,
     return ScriptExecutionContext(coinsCache, tx, fullScript, pubKey); // private c'tor, must use push_back
 }
 
-ScriptStateContext::ScriptStateContext(json &ftState, json &ftStateIncoming, json &nftState, json &nftStateIncoming,
-                                       json &contractState, json &contractStateExternal)
-    : _contractStateExternal(contractStateExternal), _ftState(ftState), _ftStateIncoming(ftStateIncoming),
-      _nftState(nftState), _nftStateIncoming(nftStateIncoming), _contractState(contractState),
-      _contractStateUpdates({}), _contractStateDeletes({}), _ftBalancesUpdates({}), _nftBalancesUpdates({}) {
-    ContractStateExternalStruct external = ScriptStateContext::validateContractStateExternal(_contractStateExternal);
-    _externalStateStruct = external;
+ScriptStateContext::ScriptStateContext(const ContractState &state, const json &ftStateIncoming,
+                                       const json &nftStateIncoming, const json &contractStateExternal,
+                                       ContractStateExternalStruct externalStateStruct)
+    : _contractStateExternal(contractStateExternal), _ftStateIncoming(ftStateIncoming),
+      _nftStateIncoming(nftStateIncoming), _state(state), _contractStateUpdates({}), _contractStateDeletes({}),
+      _ftBalancesUpdates({}), _nftBalancesUpdates({}), _externalStateStruct(std::move(externalStateStruct)) {}
 
-    // Validate that all states are in the correct expected form
-    // Can throw state format error or state size limit error
-    StateValidation::performValidateStateRestrictions(_ftState, _ftBalancesUpdates, _ftStateIncoming, _nftState,
-                                                      _nftBalancesUpdates, _nftStateIncoming, _contractState,
-                                                      _contractStateUpdates, _contractStateDeletes);
+/* static */
+StateResult<ScriptStateContext> ScriptStateContext::Create(const json &ftState, const json &ftStateIncoming,
+                                                           const json &nftState, const json &nftStateIncoming,
+                                                           const json &contractState,
+                                                           const json &contractStateExternal) {
+    StateResult<ContractStateExternalStruct> external =
+        ScriptStateContext::validateContractStateExternal(contractStateExternal);
+    if (!external) {
+        return external.error();
+    }
+
+    // Validate that all states are in the correct expected form and within the size limits, nothing has been
+    // changed yet
+    const json noChanges({});
+    const StateError error = StateValidation::performValidateStateRestrictions(
+        ftState, noChanges, ftStateIncoming, nftState, noChanges, nftStateIncoming, contractState, noChanges,
+        noChanges);
+    if (error != StateError::OK) {
+        return error;
+    }
+    return ScriptStateContext(ContractState(contractState, ftState, nftState), ftStateIncoming, nftStateIncoming,
+                              contractStateExternal, std::move(*external));
 }
 
-void ScriptStateContext::validateFinalStateRestrictions() const {
-    StateValidation::performValidateStateRestrictions(_ftState, _ftBalancesUpdates, _ftStateIncoming, _nftState,
-                                                      _nftBalancesUpdates, _nftStateIncoming, _contractState,
-                                                      _contractStateUpdates, _contractStateDeletes);
+/* static */
+StateResult<ScriptStateContext> ScriptStateContext::Create(const ContractState &state, const json &ftStateIncoming,
+                                                           const json &nftStateIncoming,
+                                                           const json &contractStateExternal) {
+    StateResult<ContractStateExternalStruct> external =
+        ScriptStateContext::validateContractStateExternal(contractStateExternal);
+    if (!external) {
+        return external.error();
+    }
+
+    // The snapshot was validated when it was first built, only the incoming balances are new
+    if (const auto ftIncoming = StateValidation::performValidateStateRestrictionsTokenFtBalances(ftStateIncoming);
+        !ftIncoming) {
+        return ftIncoming.error();
+    }
+    if (const auto nftIncoming = StateValidation::performValidateStateRestrictionsTokenNftBalances(nftStateIncoming);
+        !nftIncoming) {
+        return nftIncoming.error();
+    }
+    return ScriptStateContext(state, ftStateIncoming, nftStateIncoming, contractStateExternal, std::move(*external));
+}
+
+StateError ScriptStateContext::validateFinalStateRestrictions() const {
+    // Same checks in the same order as StateValidation::performValidateStateRestrictions, using the byte counts
+    // maintained by the contract state instead of walking it. The contract state and balances cannot be in the
+    // wrong form: they are only changed through ContractState.
+    if (_state.stateBytes() > MAX_STATE_FINAL_BYTES) {
+        return StateError::STATE_SIZE;
+    }
+    const StateResult<uint32_t> stateUpdatesBytes =
+        StateValidation::performValidateStateRestrictionsState(_contractStateUpdates);
+    if (!stateUpdatesBytes) {
+        return stateUpdatesBytes.error();
+    }
+    if (*stateUpdatesBytes > MAX_STATE_UPDATE_BYTES) {
+        return StateError::STATE_UPDATES_SIZE;
+    }
+    const StateResult<uint32_t> stateDeletesBytes =
+        StateValidation::performValidateStateRestrictionsStateDeletes(_contractStateDeletes);
+    if (!stateDeletesBytes) {
+        return stateDeletesBytes.error();
+    }
+    if (*stateDeletesBytes > MAX_STATE_UPDATE_BYTES) {
+        return StateError::STATE_DELETES_SIZE;
+    }
+    if (_state.ftBalancesBytes() > MAX_BALANCES_BYTES) {
+        return StateError::FT_BALANCES_SIZE;
+    }
+    const StateResult<uint32_t> ftBalancesUpdatesBytes =
+        StateValidation::performValidateStateRestrictionsTokenFtBalances(_ftBalancesUpdates, true);
+    if (!ftBalancesUpdatesBytes) {
+        return ftBalancesUpdatesBytes.error();
+    }
+    if (*ftBalancesUpdatesBytes > MAX_BALANCES_UPDATE_BYTES) {
+        return StateError::FT_BALANCES_UPDATES_SIZE;
+    }
+    if (const auto ftIncoming = StateValidation::performValidateStateRestrictionsTokenFtBalances(_ftStateIncoming);
+        !ftIncoming) {
+        return ftIncoming.error();
+    }
+    if (_state.nftBalancesBytes() > MAX_BALANCES_BYTES) {
+        return StateError::NFT_BALANCES_SIZE;
+    }
+    const StateResult<uint32_t> nftBalancesUpdatesBytes =
+        StateValidation::performValidateStateRestrictionsTokenNftBalances(_nftBalancesUpdates, true);
+    if (!nftBalancesUpdatesBytes) {
+        return nftBalancesUpdatesBytes.error();
+    }
+    if (*nftBalancesUpdatesBytes > MAX_BALANCES_UPDATE_BYTES) {
+        return StateError::NFT_BALANCES_UPDATES_SIZE;
+    }
+    if (const auto nftIncoming = StateValidation::performValidateStateRestrictionsTokenNftBalances(_nftStateIncoming);
+        !nftIncoming) {
+        return nftIncoming.error();
+    }
+    return StateError::OK;
 }
 
-void ScriptStateContext::cleanupStateAndBalances() {
-    ScriptStateContext::cleanupKeyspaces(_contractState);
-    ScriptStateContext::cleanupKeyspaces(_contractStateUpdates);
-    ScriptStateContext::cleanupKeyspaces(_contractStateDeletes);
-    ScriptStateContext::cleanupEmptyFtTokenBalance(_ftState);
-    ScriptStateContext::cleanupEmptyNftTokenBalance(_nftState);
+StateError ScriptStateContext::cleanupStateAndBalances() {
+    // The contract state never keeps empty keyspaces or zero balances, only the change sets need cleaning
+    if (const StateError error = ScriptStateContext::cleanupKeyspaces(_contractStateUpdates);
+        error != StateError::OK) {
+        return error;
+    }
+    return ScriptStateContext::cleanupKeyspaces(_contractStateDeletes);
 }
 
 void ScriptStateContext::contractStatePut(const std::vector<uint8_t> &keySpace, const std::vector<uint8_t> &keyName,
@@ -65,10 +200,12 @@ void ScriptStateContext::contractStatePut(const std::vector<uint8_t> &keySpace,
     std::string keySpaceStr = HexStrWith00Null(keySpace);
     std::string keyNameStr = HexStrWith00Null(keyName);
     std::string valueStr = HexStrWith00Null(value);
-    json &keyspaceNodeState = ScriptStateContext::ensureKeyspaceExists(_contractState, keySpaceStr);
     json &keyspaceNodeUpdates = ScriptStateContext::ensureKeyspaceExists(_contractStateUpdates, keySpaceStr);
     json &keyspaceNodeDeletes = ScriptStateContext::ensureKeyspaceExists(_contractStateDeletes, keySpaceStr);
-    keyspaceNodeState[keyNameStr] = valueStr;
+    _state.put(keySpaceStr, keyNameStr, valueStr);
+    if (_accessSet) {
+        _accessSet->statePuts.emplace(ParseHex(keySpaceStr), ParseHex(keyNameStr));
+    }
     keyspaceNodeUpdates[keyNameStr] = valueStr;
     keyspaceNodeDeletes.erase(keyNameStr);
 }
@@ -81,11 +218,13 @@ void ScriptStateContext::contractStateDelete(const std::vector<uint8_t> &keySpac
     std::cout << "keySpaceStr="  << keySpaceStr << std::endl;
     std::cout << "keyNameStr="  << keyNameStr << std::endl;
     // Ensure the keyspaces exists
-    json &keyspaceNodeState = ScriptStateContext::ensureKeyspaceExists(_contractState, keySpaceStr);
     json &keyspaceNodeUpdates = ScriptStateContext::ensureKeyspaceExists(_contractStateUpdates, keySpaceStr);
     json &keyspaceNodeDeletes = ScriptStateContext::ensureKeyspaceExists(_contractStateDeletes, keySpaceStr);
     // Remove it from the main state
-    keyspaceNodeState.erase(keyNameStr);
+    _state.erase(keySpaceStr, keyNameStr);
+    if (_accessSet) {
+        _accessSet->stateDeletes.emplace(ParseHex(keySpaceStr), ParseHex(keyNameStr));
+    }
     // Remove it from the updates
     keyspaceNodeUpdates.erase(keyNameStr);
     // Mark it as deleted
@@ -97,16 +236,20 @@ json::const_iterator ScriptStateContext::getKeyspaceNode(const json &entity, con
     return entity.find(keySpaceStr);
 }
 
-void ScriptStateContext::cleanupKeyspaces(json &entity) {
-    for (auto &[key, value] : entity.items()) {
+StateError ScriptStateContext::cleanupKeyspaces(json &entity) {
+    // Erasing invalidates the iterator, advance through the one returned by erase
+    for (auto it = entity.begin(); it != entity.end();) {
         // Should never happen
-        if (!value.is_object()) {
-            throw new StateKeyspaceCleanupError();
+        if (!it->is_object()) {
+            return StateError::STATE_FORMAT;
         }
-         if (value.empty()) {
-            entity.erase(key);
+        if (it->empty()) {
+            it = entity.erase(it);
+        } else {
+            ++it;
         }
     }
+    return StateError::OK;
 }
 
 void ScriptStateContext::cleanupEmptyKeyspace(json &entity, const std::string &keySpaceStr) {
@@ -151,29 +294,35 @@ json &ScriptStateContext::ensureKeyspaceExists(json &entity, const std::string &
     return entity[keySpaceStr];
 }
 
-bool ScriptStateContext::contractStateGet(const std::vector<uint8_t> &keySpace, const std::vector<uint8_t> &keyName,
+bool ScriptStateContext::contractStateGet(Span<const uint8_t> keySpace, Span<const uint8_t> keyName,
                                           std::vector<uint8_t> &value) const {
-    json::const_iterator keyspaceNode = ScriptStateContext::getKeyspaceNode(_contractState, HexStr(keySpace));
-    if (keyspaceNode == _contractState.end()) {
-        return false;
-    }
-    auto it = keyspaceNode->find(HexStr(keyName));
-    if (it != keyspaceNode->end()) {
-        std::string keyValue = it->template get<std::string>();
-        auto ss = ParseHex(keyValue);
-        std::move(ss.begin(), ss.end(), std::back_inserter(value));
+    if (_accessSet) {
+        _accessSet->stateReads.emplace(std::vector<uint8_t>(keySpace.begin(), keySpace.end()),
+                                       std::vector<uint8_t>(keyName.begin(), keyName.end()));
+    }
+    const std::string *keyValue = _state.get(HexStr(keySpace), HexStr(keyName));
+    if (keyValue) {
+        // Stored values are normally hex digits only, decoded straight into value
+        const size_t offset = value.size();
+        const Span<const char> hex(*keyValue);
+        if (!IsHexDigits(hex)) {
+            auto ss = ParseHex(*keyValue);
+            std::move(ss.begin(), ss.end(), std::back_inserter(value));
+            return true;
+        }
+        value.resize(offset + hex.size() / 2);
+        HexDecode(hex.first(hex.size() & ~size_t(1)), value.data() + offset);
         return true;
     }
     return false;
 }
 
-bool ScriptStateContext::contractStateExists(const std::vector<uint8_t> &keySpace,
-                                             const std::vector<uint8_t> &keyName) const {
-    json::const_iterator keyspaceNode = ScriptStateContext::getKeyspaceNode(_contractState, HexStr(keySpace));
-    if (keyspaceNode == _contractState.end()) {
-        return false;
+bool ScriptStateContext::contractStateExists(Span<const uint8_t> keySpace, Span<const uint8_t> keyName) const {
+    if (_accessSet) {
+        _accessSet->stateReads.emplace(std::vector<uint8_t>(keySpace.begin(), keySpace.end()),
+                                       std::vector<uint8_t>(keyName.begin(), keyName.end()));
     }
-    if (keyspaceNode->contains(HexStr(keyName))) {
+    if (_state.get(HexStr(keySpace), HexStr(keyName))) {
         return true;
     }
     return false;
@@ -183,25 +332,29 @@ bool ScriptStateContext::contractWithdrawFt(const uint288 &ftId, uint32_t index,
     if (withdrawAmount <= 0) {
         return false;
     }
+    if (_accessSet) {
+        _accessSet->ftReads.insert(ftId);
+    }
     // Second check if the existing balance is adequate to cover the requested withdraw amount
     std::string ftIdStr = ftId.GetHex();
-    if (!_ftState.contains(ftIdStr)) {
+    const uint64_t *balance = _state.ftBalance(ftIdStr);
+    if (!balance) {
         // No balance can be added
         return false;
     }
-    auto valtype = _ftState[ftIdStr];
-    uint64_t availableBalance = valtype.template get<std::uint64_t>();
+    uint64_t availableBalance = *balance;
     if (withdrawAmount > availableBalance) {
         return false;
     }
     uint64_t updatedBalance = availableBalance - withdrawAmount;
-    if (updatedBalance == 0) {
-        _ftState.erase(ftIdStr);
-    } else {
-        _ftState[ftIdStr] = updatedBalance;
-    }
+    // A zero balance removes the token
+    _state.setFtBalance(ftIdStr, updatedBalance);
     _ftBalancesUpdates[ftIdStr] = updatedBalance;
 
+    if (_accessSet) {
+        _accessSet->ftWithdraws.insert(ftId);
+    }
+
     // Update the withdraw map
     auto findIt = _ftWithdrawMap.find(ftId);
     if (findIt == _ftWithdrawMap.end()) {
@@ -214,13 +367,18 @@ bool ScriptStateContext::contractWithdrawFt(const uint288 &ftId, uint32_t index,
 }
 
 bool ScriptStateContext::contractWithdrawNft(const uint288 &nftId, uint32_t index) {
+    if (_accessSet) {
+        _accessSet->nftReads.insert(nftId);
+    }
     // Second check if the existing balance is adequate to cover the requested withdraw amount
     std::string nftIdStr = nftId.GetHex();
-    if (!_nftState.contains(nftIdStr)) {
+    if (!_state.eraseNft(nftIdStr)) {
         // Cannot withdraw because it does not exist
         return false;
     }
-    _nftState.erase(nftIdStr);
+    if (_accessSet) {
+        _accessSet->nftWithdraws.insert(nftId);
+    }
     _nftBalancesUpdates[nftIdStr] = false;
     _nftWithdrawMap.insert(std::make_pair(nftId, index));
     return true;
@@ -238,7 +396,8 @@ bool ScriptStateContext::contractNftPut(const uint288 &nftId) {
     auto valtype = _nftStateIncoming[nftId.GetHex()];
     auto incomingAllowed = valtype.template get<bool>();
     if (!incomingAllowed) {
-        throw new StateValidationTokenNftBalanceFormatError();
+        // Incoming NFTs are validated to be true when the context is created
+        return false;
     }
     if (!performNftPut(nftId)) {
         return false;
@@ -263,7 +422,10 @@ bool ScriptStateContext::performNftPut(const uint288& nftId) {
         return false;
     }
     auto valtype = _nftStateIncoming[nftIdStr];
-    _nftState[nftIdStr] = true;
+    _state.putNft(nftIdStr);
+    if (_accessSet) {
+        _accessSet->nftPuts.insert(nftId);
+    }
     _nftBalancesUpdates[nftIdStr] = true;
     return true;
 }
@@ -311,22 +473,28 @@ bool ScriptStateContext::performFtBalanceAdd(const uint288& ftId, uint64_t amoun
         return false;
     }
     uint64_t currentValue = 0;
-    if (_ftState.contains(ftIdStr)) {
-        currentValue = _ftState[ftIdStr].template get<std::uint64_t>();
+    if (const uint64_t *balance = _state.ftBalance(ftIdStr)) {
+        currentValue = *balance;
     }
     currentValue += amount;
-    _ftState[ftIdStr] = currentValue;
+    _state.setFtBalance(ftIdStr, currentValue);
+    if (_accessSet) {
+        _accessSet->ftBalanceAdds.insert(ftId);
+    }
     _ftBalancesUpdates[ftIdStr] = currentValue;
     return true;
 }
 
 uint64_t ScriptStateContext::contractFtBalance(const uint288 &ftId) {
-    auto ftBalanceIt = _ftState.find(ftId.GetHex());
-    if (ftBalanceIt == _ftState.end()) {
+    if (_accessSet) {
+        _accessSet->ftReads.insert(ftId);
+    }
+    const uint64_t *balance = _state.ftBalance(ftId.GetHex());
+    if (!balance) {
         // No balance found
         return 0;
     }
-    return ftBalanceIt->template get<std::uint64_t>();
+    return *balance;
 }
 
 uint64_t ScriptStateContext::contractFtBalanceIncoming(const uint288 &ftId) {
@@ -339,13 +507,10 @@ uint64_t ScriptStateContext::contractFtBalanceIncoming(const uint288 &ftId) {
 }
 
 bool ScriptStateContext::contractNftExists(const uint288 &nftId) {
-    auto nftBalanceIt = _nftState.find(nftId.GetHex());
-    if (nftBalanceIt == _nftState.end()) {
-        // No balance found
-        return false;
+    if (_accessSet) {
+        _accessSet->nftReads.insert(nftId);
     }
-    auto result = nftBalanceIt->template get<bool>();
-    return result;
+    return _state.hasNft(nftId.GetHex());
 }
 
 bool ScriptStateContext::contractNftExistsIncoming(const uint288 &nftId) {
@@ -360,7 +525,10 @@ bool ScriptStateContext::contractNftExistsIncoming(const uint288 &nftId) {
 
 
 uint32_t ScriptStateContext::getFtCount() const {
-    return _ftState.size();
+    if (_accessSet) {
+        _accessSet->ftBalancesEnumerated = true;
+    }
+    return _state.ftCount();
 }
 
 uint32_t ScriptStateContext::getFtCountIncoming() const {
@@ -368,7 +536,10 @@ uint32_t ScriptStateContext::getFtCountIncoming() const {
 }
 
 uint32_t ScriptStateContext::getNftCount() const {
-    return _nftState.size();
+    if (_accessSet) {
+        _accessSet->nftBalancesEnumerated = true;
+    }
+    return _state.nftCount();
 }
 
 uint32_t ScriptStateContext::getNftCountIncoming() const {
@@ -376,20 +547,15 @@ uint32_t ScriptStateContext::getNftCountIncoming() const {
 }
 
 bool ScriptStateContext::getFtItem(uint32_t index, uint288 &tokenId) const {
-    // Inefficient, but it's okay for now
-    // Todo: future optimization is create a vector representation of token ids in sorted order to have random access
-    uint32_t counter = 0;
-    auto it = _ftState.begin();
-    while (it != _ftState.end()) {
-        if (counter == index) {
-            uint288 ref = uint288S(it.key().c_str());
-            tokenId = ref;
-            return true;
-        }
-        counter++;
-        it++;
+    if (_accessSet) {
+        _accessSet->ftBalancesEnumerated = true;
     }
-    return false;
+    const std::string *ftId = _state.ftIdAt(index);
+    if (!ftId) {
+        return false;
+    }
+    tokenId = uint288S(ftId->c_str());
+    return true;
 }
 
 bool ScriptStateContext::getFtItemIncoming(uint32_t index, uint288 &tokenId) const {
@@ -410,18 +576,15 @@ bool ScriptStateContext::getFtItemIncoming(uint32_t index, uint288 &tokenId) con
 }
 
 bool ScriptStateContext::getNftItem(uint32_t index, uint288 &tokenId) const {
-    uint32_t counter = 0;
-    auto it = _nftState.begin();
-    while (it != _nftState.end()) {
-        if (counter == index) {
-            uint288 ref = uint288S(it.key().c_str());
-            tokenId = ref;
-            return true;
-        }
-        counter++;
-        it++;
+    if (_accessSet) {
+        _accessSet->nftBalancesEnumerated = true;
     }
-    return false;
+    const std::string *nftId = _state.nftIdAt(index);
+    if (!nftId) {
+        return false;
+    }
+    tokenId = uint288S(nftId->c_str());
+    return true;
 }
 
 bool ScriptStateContext::getNftItemIncoming(uint32_t index, uint288 &tokenId) const {
@@ -439,7 +602,7 @@ bool ScriptStateContext::getNftItemIncoming(uint32_t index, uint288 &tokenId) co
     return false;
 }
 
-bool ScriptStateContext::encodeFtWithdrawMap(json &ftWithdraws) const {
+void ScriptStateContext::encodeFtWithdrawMap(json &ftWithdraws) const {
     std::map<uint288, std::map<uint32_t, uint64_t>>::const_iterator _ftWithdrawMapIt;
     json contractFtWithdraws({});
     for (_ftWithdrawMapIt = _ftWithdrawMap.begin(); _ftWithdrawMapIt != _ftWithdrawMap.end(); _ftWithdrawMapIt++) {
@@ -453,12 +616,10 @@ bool ScriptStateContext::encodeFtWithdrawMap(json &ftWithdraws) const {
             contractFtWithdraws[tokenIdS][std::to_string(outputsIt->first)] = outputsIt->second;
         }
     }
-    // If succeeded, then assign
     ftWithdraws = contractFtWithdraws;
-    return true;
 }
 
-bool ScriptStateContext::encodeNftWithdrawMap(json &nftWithdraws) const {
+void ScriptStateContext::encodeNftWithdrawMap(json &nftWithdraws) const {
     std::map<uint288, uint32_t>::const_iterator _nftWithdrawMapIt;
     json contractNftWithdraws({});
     for (_nftWithdrawMapIt = _nftWithdrawMap.begin(); _nftWithdrawMapIt != _nftWithdrawMap.end(); _nftWithdrawMapIt++) {
@@ -470,9 +631,7 @@ bool ScriptStateContext::encodeNftWithdrawMap(json &nftWithdraws) const {
         }
         contractNftWithdraws[tokenIdS] = outputIdx;
     }
-    // If succeeded, then assign
     nftWithdraws = contractNftWithdraws;
-    return true;
 }
 
 bool ScriptStateContext::isAllowedBlockInfoHeight(const uint32_t height) const {
@@ -480,6 +639,12 @@ bool ScriptStateContext::isAllowedBlockInfoHeight(const uint32_t height) const {
     if (revisedHeight == 0) {
         revisedHeight = _externalStateStruct.currentHeight;
     }
+    if (_accessSet) {
+        _accessSet->blockHeights.insert(revisedHeight);
+    }
+    if (_externalStateStruct.useHeaderStore) {
+        return revisedHeight <= _externalStateStruct.currentHeight && BlockHeaderStore::Get().Contains(revisedHeight);
+    }
     auto it = _externalStateStruct.headers.find(revisedHeight);
     if (it == _externalStateStruct.headers.end()) {
         return false;
@@ -487,140 +652,65 @@ bool ScriptStateContext::isAllowedBlockInfoHeight(const uint32_t height) const {
     return true;
 }
 
-CBlockHeader ScriptStateContext::getBlockInfoByHeight(uint32_t height) const {
-    uint32_t revisedHeight = height;
-    if (revisedHeight == 0) {
-        revisedHeight = _externalStateStruct.currentHeight;
+bool ScriptStateContext::lookupBlockInfoHeader(uint32_t revisedHeight, std::vector<uint8_t> &header) const {
+    if (_externalStateStruct.useHeaderStore) {
+        return revisedHeight <= _externalStateStruct.currentHeight &&
+               BlockHeaderStore::Get().Lookup(revisedHeight, header);
     }
-
     HeightToBlockInfoStruct::const_iterator itemIt = _externalStateStruct.headers.find(revisedHeight);
     if (itemIt == _externalStateStruct.headers.end()) {
-        throw new InvalidBlockInfoHeight();
-    }
-    return itemIt->second.header;
-}
-
-void ScriptStateContext::getCurrentBlockInfoHeader(uint32_t height, std::vector<uint8_t> &value) const {
-    if (!isAllowedBlockInfoHeight(height)) {
-        // Throw exception because we should not have been called at this level if it wasnt valid
-        throw new InvalidBlockInfoHeight();
-    }
-    uint32_t revisedHeight = height;
-    if (revisedHeight == 0) {
-        revisedHeight = _externalStateStruct.currentHeight;
-    }
-
-    HeightToBlockInfoStruct::const_iterator itemIt = _externalStateStruct.headers.find(revisedHeight);
-    if (itemIt == _externalStateStruct.headers.end()) {
-        throw new InvalidBlockInfoHeight();
+        return false;
     }
-    value = itemIt->second.headerHex;
+    header = itemIt->second.headerHex;
+    return true;
 }
 
-uint64_t ScriptStateContext::getCurrentBlockInfoHeight(const uint32_t height) const {
-    if (!isAllowedBlockInfoHeight(height)) {
-        // Throw exception because we should not have been called at this level if it wasnt valid
-        throw new InvalidBlockInfoHeight();
-    }
+StateResult<CBlockHeader> ScriptStateContext::getBlockInfoByHeight(uint32_t height) const {
     uint32_t revisedHeight = height;
     if (revisedHeight == 0) {
         revisedHeight = _externalStateStruct.currentHeight;
     }
-    return revisedHeight;
-}
-
-uint32_t ScriptStateContext::getCurrentBlockInfoVersion(uint32_t height) const {
-    if (!isAllowedBlockInfoHeight(height)) {
-        // Throw exception because we should not have been called at this level if it wasnt valid
-        throw new InvalidBlockInfoHeight();
+    if (_accessSet) {
+        _accessSet->blockHeights.insert(revisedHeight);
     }
-    uint32_t revisedHeight = height;
-    if (revisedHeight == 0) {
-        revisedHeight = _externalStateStruct.currentHeight;
-    }
-    CBlockHeader currentHeader = getBlockInfoByHeight(revisedHeight);
-    return currentHeader.nVersion;
-}
 
-void ScriptStateContext::getCurrentBlockInfoPrevHash(uint32_t height, std::vector<uint8_t> &value) const {
-    if (!isAllowedBlockInfoHeight(height)) {
-        // Throw exception because we should not have been called at this level if it wasnt valid
-        throw new InvalidBlockInfoHeight();
-    }
-    uint32_t revisedHeight = height;
-    if (revisedHeight == 0) {
-        revisedHeight = _externalStateStruct.currentHeight;
+    std::vector<uint8_t> header;
+    if (!lookupBlockInfoHeader(revisedHeight, header)) {
+        return StateError::BLOCK_INFO_HEIGHT;
     }
-    CBlockHeader currentHeader = getBlockInfoByHeight(revisedHeight);
-    std::copy(currentHeader.hashPrevBlock.begin(), currentHeader.hashPrevBlock.end(), std::back_inserter(value));
+    return ScriptStateContext::decodeHeader(header);
 }
 
-void ScriptStateContext::getCurrentBlockInfoMerkleRoot(uint32_t height, std::vector<uint8_t> &value) const {
-    if (!isAllowedBlockInfoHeight(height)) {
-        // Throw exception because we should not have been called at this level if it wasnt valid
-        throw new InvalidBlockInfoHeight();
-    }
+StateError ScriptStateContext::getCurrentBlockInfoHeader(uint32_t height, std::vector<uint8_t> &value) const {
     uint32_t revisedHeight = height;
     if (revisedHeight == 0) {
         revisedHeight = _externalStateStruct.currentHeight;
     }
-    CBlockHeader currentHeader = getBlockInfoByHeight(revisedHeight);
-    std::copy(currentHeader.hashMerkleRoot.begin(), currentHeader.hashMerkleRoot.end(), std::back_inserter(value));
-}
-
-uint32_t ScriptStateContext::getCurrentBlockInfoTime(uint32_t height) const {
-    if (!isAllowedBlockInfoHeight(height)) {
-        // Throw exception because we should not have been called at this level if it wasnt valid
-        throw new InvalidBlockInfoHeight();
-    }
-    uint32_t revisedHeight = height;
-    if (revisedHeight == 0) {
-        revisedHeight = _externalStateStruct.currentHeight;
+    if (_accessSet) {
+        _accessSet->blockHeights.insert(revisedHeight);
     }
-    CBlockHeader currentHeader = getBlockInfoByHeight(revisedHeight);
-    return currentHeader.nTime;
-}
 
-uint32_t ScriptStateContext::getCurrentBlockInfoBits(uint32_t height) const {
-    if (!isAllowedBlockInfoHeight(height)) {
-        // Throw exception because we should not have been called at this level if it wasnt valid
-        throw new InvalidBlockInfoHeight();
-    }
-    uint32_t revisedHeight = height;
-    if (revisedHeight == 0) {
-        revisedHeight = _externalStateStruct.currentHeight;
+    if (!lookupBlockInfoHeader(revisedHeight, value)) {
+        return StateError::BLOCK_INFO_HEIGHT;
     }
-    CBlockHeader currentHeader = getBlockInfoByHeight(revisedHeight);
-    return currentHeader.nBits;
+    return StateError::OK;
 }
 
-uint32_t ScriptStateContext::getCurrentBlockInfoNonce(uint32_t height) const {
+StateResult<uint32_t> ScriptStateContext::getCurrentBlockInfoHeight(const uint32_t height) const {
     if (!isAllowedBlockInfoHeight(height)) {
-        // Throw exception because we should not have been called at this level if it wasnt valid
-        throw new InvalidBlockInfoHeight();
+        return StateError::BLOCK_INFO_HEIGHT;
     }
     uint32_t revisedHeight = height;
     if (revisedHeight == 0) {
         revisedHeight = _externalStateStruct.currentHeight;
     }
-
-    CBlockHeader currentHeader = getBlockInfoByHeight(revisedHeight);
-    return currentHeader.nNonce;
+    return revisedHeight;
 }
 
-uint64_t ScriptStateContext::getCurrentBlockInfoDifficulty(uint32_t height) const {
-    if (!isAllowedBlockInfoHeight(height)) {
-        // Throw exception because we should not have been called at this level if it wasnt valid
-        throw new InvalidBlockInfoHeight();
-    }
-    uint32_t revisedHeight = height;
-    if (revisedHeight == 0) {
-        revisedHeight = _externalStateStruct.currentHeight;
-    }
-    CBlockHeader currentHeader = getBlockInfoByHeight(revisedHeight);
-
-    int nShift = (currentHeader.nBits >> 24) & 0xff;
-    double dDiff = double(0x0000ffff) / double(currentHeader.nBits & 0x00ffffff);
+/* static */
+uint64_t ScriptStateContext::getBlockInfoDifficulty(const CBlockHeader &header) {
+    int nShift = (header.nBits >> 24) & 0xff;
+    double dDiff = double(0x0000ffff) / double(header.nBits & 0x00ffffff);
 
     while (nShift < 29) {
         dDiff *= 256.0;
@@ -634,69 +724,68 @@ uint64_t ScriptStateContext::getCurrentBlockInfoDifficulty(uint32_t height) cons
     return std::llround(dDiff);
 }
 
-uint32_t ScriptStateContext::getBlockInfoVersion(const std::vector<uint8_t> &header) const {
-    CBlockHeader decodedHeader = ScriptStateContext::decodeHeader(header);
-    return decodedHeader.nVersion;
-}
-
-void ScriptStateContext::getBlockInfoPrevHash(const std::vector<uint8_t> &header, std::vector<uint8_t> &value) const {
-    CBlockHeader decodedHeader = ScriptStateContext::decodeHeader(header);
-    std::copy(decodedHeader.hashPrevBlock.begin(), decodedHeader.hashPrevBlock.end(), std::back_inserter(value));
-}
-
-void ScriptStateContext::getBlockInfoMerkleRoot(const std::vector<uint8_t> &header, std::vector<uint8_t> &value) const {
-    CBlockHeader decodedHeader = ScriptStateContext::decodeHeader(header);
-    std::copy(decodedHeader.hashMerkleRoot.begin(), decodedHeader.hashMerkleRoot.end(), std::back_inserter(value));
-}
-
-uint32_t ScriptStateContext::getBlockInfoTime(const std::vector<uint8_t> &header) const {
-    CBlockHeader decodedHeader = ScriptStateContext::decodeHeader(header);
-    return decodedHeader.nTime;
-}
-
-uint32_t ScriptStateContext::getBlockInfoBits(const std::vector<uint8_t> &header) const {
-    CBlockHeader decodedHeader = ScriptStateContext::decodeHeader(header);
-    return decodedHeader.nBits;
-}
-
-uint32_t ScriptStateContext::getBlockInfoNonce(const std::vector<uint8_t> &header) const {
-    CBlockHeader decodedHeader = ScriptStateContext::decodeHeader(header);
-    return decodedHeader.nNonce;
+StateResult<CBlockHeader> ScriptStateContext::decodeHeader(const std::vector<uint8_t> &header) {
+    const StateResult<DecodedBlockHeader> decodedHeader = ScriptStateContext::decodeHeaderChecked(header);
+    if (!decodedHeader) {
+        return decodedHeader.error();
+    }
+    return decodedHeader->header;
 }
 
-uint64_t ScriptStateContext::getBlockInfoDifficulty(const std::vector<uint8_t> &header) const {
-    CBlockHeader decodedHeader = ScriptStateContext::decodeHeader(header);
-    int nShift = (decodedHeader.nBits >> 24) & 0xff;
-    double dDiff = double(0x0000ffff) / double(decodedHeader.nBits & 0x00ffffff);
-
-    while (nShift < 29) {
-        dDiff *= 256.0;
-        nShift++;
+StateResult<DecodedBlockHeader> ScriptStateContext::decodeHeaderChecked(const std::vector<uint8_t> &header) {
+    if (header.size() < BLOCK_HEADER_SIZE) {
+        return StateError::HEADER_DECODE;
     }
-    while (nShift > 29) {
-        dDiff /= 256.0;
-        nShift--;
+    RawBlockHeader raw;
+    std::copy_n(header.begin(), BLOCK_HEADER_SIZE, raw.begin());
+    {
+        LOCK(cs_headerCache);
+        const auto it = headerCache.find(raw);
+        if (it != headerCache.end()) {
+            return it->second;
+        }
     }
-    // Round to the nearest
-    return std::llround(dDiff);
-}
 
-CBlockHeader ScriptStateContext::decodeHeader(const std::vector<uint8_t> &header) {
-    CBlockHeader decodedHeader;
-    if (!DecodeHexBlockHeaderDup(HexStr(header), decodedHeader)) {
-        throw HeaderDecodeError();
+    DecodedBlockHeader decodedHeader;
+    VectorReader(SER_NETWORK, PROTOCOL_VERSION, header, 0) >> decodedHeader.header;
+    decodedHeader.hash = decodedHeader.header.GetHash();
+    decodedHeader.validProofOfWork = CheckProofOfWork(decodedHeader.hash, decodedHeader.header.nBits);
+
+    LOCK(cs_headerCache);
+    if (headerCache.size() >= MAX_CACHED_HEADERS) {
+        headerCache.clear();
     }
+    headerCache.emplace(raw, decodedHeader);
     return decodedHeader;
 }
 
 bool ScriptStateContext::checkTxInBlock(const std::vector<uint8_t> &header, const std::vector<uint8_t> &proof,
                                         const uint256 &txid) const {
-    // Todo: Decode the header
-    // Verify header has the POW correct and also matches the hash merkle root of the merkleblock
+    // The header must have a valid proof of work and be the header the proof was built for
+    const StateResult<DecodedBlockHeader> decoded = ScriptStateContext::decodeHeaderChecked(header);
+    if (!decoded || !decoded->validProofOfWork) {
+        return false;
+    }
+    const DecodedBlockHeader &decodedHeader = *decoded;
+
+    std::vector<uint8_t> key;
+    key.reserve(2 * uint256::size() + proof.size());
+    key.insert(key.end(), decodedHeader.header.hashMerkleRoot.begin(), decodedHeader.header.hashMerkleRoot.end());
+    key.insert(key.end(), txid.begin(), txid.end());
+    key.insert(key.end(), proof.begin(), proof.end());
+    {
+        LOCK(cs_proofCache);
+        if (proofCache.count(key)) {
+            return true;
+        }
+    }
 
     CDataStream ssMB(proof, SER_NETWORK, PROTOCOL_VERSION);
     CMerkleBlock merkleBlock;
     ssMB >> merkleBlock;
+    if (merkleBlock.header.hashMerkleRoot != decodedHeader.header.hashMerkleRoot) {
+        return false;
+    }
     std::vector<uint256> vMatch;
     std::vector<size_t> vIndex;
     if (merkleBlock.txn.ExtractMatches(vMatch, vIndex) != merkleBlock.header.hashMerkleRoot) {
@@ -706,82 +795,137 @@ bool ScriptStateContext::checkTxInBlock(const std::vector<uint8_t> &header, cons
     for (const uint256 &hash : vMatch) {
         // One of them matches the txid which means it is a valid merkle proof
         if (hash == txid) {
+            LOCK(cs_proofCache);
+            if (proofCache.size() >= MAX_CACHED_PROOFS) {
+                proofCache.clear();
+            }
+            proofCache.insert(std::move(key));
             return true;
         }
     }
     return false;
 }
 
-ContractStateExternalStruct ScriptStateContext::validateContractStateExternal(const json &contractStateExternalJson) {
-    // Validate the header is present and validate
-    auto headersJsonEntry = contractStateExternalJson.find("headers");
-    if (headersJsonEntry == contractStateExternalJson.end()) {
-        throw HeaderKeyNotFoundError();
+std::optional<bool> ScriptStateContext::checkTxInBlockAtHeight(uint32_t height, const std::vector<uint8_t> &proof,
+                                                               const uint256 &txid) const {
+    if (!isAllowedBlockInfoHeight(height)) {
+        return std::nullopt;
     }
+    uint32_t revisedHeight = height;
+    if (revisedHeight == 0) {
+        revisedHeight = _externalStateStruct.currentHeight;
+    }
+    std::vector<uint8_t> header;
+    if (!lookupBlockInfoHeader(revisedHeight, header)) {
+        return std::nullopt;
+    }
+    try {
+        return checkTxInBlock(header, proof, txid);
+    } catch (const std::ios_base::failure &) {
+        return std::nullopt;
+    }
+}
+
+StateError ScriptStateContext::verifyBlockInfoHeaders() const {
+    if (_externalStateStruct.useHeaderStore) {
+        return StateError::OK;
+    }
+    // Headers are sorted by height, so the header below each one, if passed, is the one before it
+    std::optional<BlockHash> prevHash;
+    uint32_t prevHeight = 0;
+    for (const auto &[height, blockInfo] : _externalStateStruct.headers) {
+        const StateResult<DecodedBlockHeader> decodedHeader =
+            ScriptStateContext::decodeHeaderChecked(blockInfo.headerHex);
+        if (!decodedHeader) {
+            return decodedHeader.error();
+        }
+        if (!decodedHeader->validProofOfWork) {
+            return StateError::HEADERS_INVALID;
+        }
+        if (prevHash && prevHeight + 1 == height && decodedHeader->header.hashPrevBlock != *prevHash) {
+            return StateError::HEADERS_INVALID;
+        }
+        prevHash = decodedHeader->hash;
+        prevHeight = height;
+    }
+    return StateError::OK;
+}
+
+StateResult<ContractStateExternalStruct>
+ScriptStateContext::validateContractStateExternal(const json &contractStateExternalJson) {
+    // Without headers, block info is read from the header store and the height defaults to its tip
+    auto headersJsonEntry = contractStateExternalJson.find("headers");
+    const bool useHeaderStore = headersJsonEntry == contractStateExternalJson.end();
     // Validate the height is present and validate
+    uint64_t currentHeight;
     auto heightJsonEntry = contractStateExternalJson.find("height");
-    if (heightJsonEntry == contractStateExternalJson.end()) {
-        throw HeightKeyNotFoundError();
+    if (heightJsonEntry != contractStateExternalJson.end()) {
+        if (!heightJsonEntry->is_number_integer() || *heightJsonEntry < 0) {
+            return StateError::HEIGHT_INVALID;
+        }
+        currentHeight = heightJsonEntry->template get<std::uint64_t>();
+    } else if (const auto tip = BlockHeaderStore::Get().GetTip(); useHeaderStore && tip) {
+        currentHeight = *tip;
+    } else {
+        return StateError::HEIGHT_NOT_FOUND;
     }
     // Check the height range is valid
-    uint32_t currentHeight = heightJsonEntry->template get<std::uint32_t>();
     if (currentHeight > 10000000) {
-        throw new HeightInvalidError();
+        return StateError::HEIGHT_INVALID;
     }
     ContractStateExternalStruct external;
+    external.currentHeight = currentHeight;
+    if (useHeaderStore) {
+        external.useHeaderStore = true;
+        return external;
+    }
+    if (!headersJsonEntry->is_object()) {
+        return StateError::HEADER_DECODE;
+    }
     HeightToBlockInfoStruct heightHeaderSet;
     for (auto &[keyHeight, headerString] : headersJsonEntry->items()) {
-        CBlockHeader currentHeader;
         unsigned int height = atoi(keyHeight.c_str());
-        if (!DecodeHexBlockHeaderDup(headerString, currentHeader)) {
-            throw CurrentHeaderDecodeError();
+        // Only check the header can be decoded here, it is decoded when a call first reads it
+        if (!headerString.is_string()) {
+            return StateError::HEADER_DECODE;
+        }
+        const std::string &hexHeader = headerString.template get_ref<const std::string &>();
+        if (!IsHex(hexHeader) || hexHeader.size() < 2 * BLOCK_HEADER_SIZE) {
+            return StateError::HEADER_DECODE;
         }
 
         ExternalBlockInfoStruct externalBlockInfoStruct;
-        externalBlockInfoStruct.header = currentHeader;
         externalBlockInfoStruct.height = height;
-        const std::vector<uint8_t> header_data{ParseHex(headerString)};
-        externalBlockInfoStruct.headerHex = header_data;
-        heightHeaderSet.insert(std::make_pair(height, externalBlockInfoStruct));
+        externalBlockInfoStruct.headerHex = ParseHex(hexHeader);
+        heightHeaderSet.emplace(height, std::move(externalBlockInfoStruct));
     }
     external.headers = heightHeaderSet;
-    external.currentHeight = currentHeight;
     return external;
 }
 
 json ScriptStateContext::getFtWithdrawsResult() const {
     json ftWithdraws({});
-    if (!this->encodeFtWithdrawMap(ftWithdraws)) {
-        throw new CriticalUnexpectedError();
-    }
-  
+    encodeFtWithdrawMap(ftWithdraws);
     return ftWithdraws;
 }
 json ScriptStateContext::getNftWithdrawsResult() const {
     json nftWithdraws({});
-    if (!this->encodeNftWithdrawMap(nftWithdraws)) {
-        throw new CriticalUnexpectedError();
-    }  
+    encodeNftWithdrawMap(nftWithdraws);
     return nftWithdraws;
 }
  
 json ScriptStateContext::getFtIncomingBalancesAddedResult() const {
     json ftBalancesAdded({});
-    if (!this->encodeFtIncomingBalancesAddedMap(ftBalancesAdded)) {
-        throw new CriticalUnexpectedError();
-    }
-  
+    encodeFtIncomingBalancesAddedMap(ftBalancesAdded);
     return ftBalancesAdded;
 }
 json ScriptStateContext::getNftIncomingPutsResult() const {
     json nftPuts({});
-    if (!this->encodeNftIncomingPutsMap(nftPuts)) {
-        throw new CriticalUnexpectedError();
-    }  
+    encodeNftIncomingPutsMap(nftPuts);
     return nftPuts;
 }
  
-bool ScriptStateContext::encodeFtIncomingBalancesAddedMap(json &ftBalancesAdded) const {
+void ScriptStateContext::encodeFtIncomingBalancesAddedMap(json &ftBalancesAdded) const {
     std::set<uint288>::const_iterator ftAddsSetIt;
     json ftAddsSetJson({});
     for (ftAddsSetIt = _ftAddsSet.begin(); ftAddsSetIt != _ftAddsSet.end(); ftAddsSetIt++) {
@@ -789,12 +933,10 @@ bool ScriptStateContext::encodeFtIncomingBalancesAddedMap(json &ftBalancesAdded)
         std::string tokenIdS = tokenId.GetHex();
         ftAddsSetJson[tokenIdS] = true;
     }
-    // If succeeded, then assign
     ftBalancesAdded = ftAddsSetJson;
-    return true;
 }
 
-bool ScriptStateContext::encodeNftIncomingPutsMap(json &nftPuts) const {
+void ScriptStateContext::encodeNftIncomingPutsMap(json &nftPuts) const {
     std::set<uint288>::const_iterator nftPutsSetIt;
     json nftPutsJson({});
     for (nftPutsSetIt = _nftPutsSet.begin(); nftPutsSetIt != _nftPutsSet.end(); nftPutsSetIt++) {
@@ -802,7 +944,5 @@ bool ScriptStateContext::encodeNftIncomingPutsMap(json &nftPuts) const {
         std::string tokenIdS = tokenId.GetHex();
         nftPutsJson[tokenIdS] = true;
     }
-    // If succeeded, then assign
     nftPuts = nftPutsJson;
-    return true;
 }
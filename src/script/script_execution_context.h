@@ -8,6 +8,8 @@
 #include <coins.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
+#include <script/contract_state.h>
+#include <script/state_error.h>
 #include <streams.h>
 #include "json.hpp"
 #include <boost/algorithm/hex.hpp>
@@ -40,10 +42,10 @@ enum GetAuthInfoResult {
     ERR_INVALID = 4
 };
  
-// External blockchain state input internal struct representation
+// External blockchain state input internal struct representation. The header is only decoded when a call reads
+// it, see ScriptStateContext::decodeHeader
 struct ExternalBlockInfoStruct {
 public:
-    CBlockHeader header;
     uint32_t height;
     std::vector<uint8_t> headerHex;
 };
@@ -54,43 +56,19 @@ typedef std::map<uint32_t, ExternalBlockInfoStruct> HeightToBlockInfoStruct;
 struct ContractStateExternalStruct {
 public:
     HeightToBlockInfoStruct headers;
-    uint32_t currentHeight;
+    uint32_t currentHeight = 0;
+    // No headers were passed: block info is read from the BlockHeaderStore, up to the current height
+    bool useHeaderStore = false;
 };
 
-class HeaderKeyNotFoundError : public std::exception {};
-
-class HeightKeyNotFoundError : public std::exception {};
-
-class CurrentHeaderKeyNotFoundError : public std::exception {};
-
-class CurrentHeightKeyNotFoundError : public std::exception {};
-
-class HeaderInvalidError : public std::exception {};
-
-class HeaderDecodeError : public std::exception {};
-
-class CurrentHeaderDecodeError : public std::exception {};
-
-class HeightInvalidError : public std::exception {};
-
-class InvalidBlockInfoHeight : public std::exception {};
-
-class CriticalUnexpectedError : public std::exception {};
-
-// Decode hex string to a block header. Returns true on success or false on any error
-static bool DecodeHexBlockHeaderDup(const std::string &hex_header, CBlockHeader &header) {
-    if (!IsHex(hex_header)) {
-        return false;
-    }
-    const std::vector<uint8_t> header_data{ParseHex(hex_header)};
-    CDataStream ser_header(header_data, SER_NETWORK, PROTOCOL_VERSION);
-    try {
-        ser_header >> header;
-    } catch (const std::exception &) {
-        return false;
-    }
-    return true;
-}
+// A block header as decoded once per process, see ScriptStateContext::decodeHeaderChecked
+struct DecodedBlockHeader {
+public:
+    CBlockHeader header;
+    BlockHash hash;
+    // Whether the hash meets the target of nBits
+    bool validProofOfWork;
+};
 
 static std::vector<uint8_t> writeUint64(uint64_t x) {
     std::vector<uint8_t> v;
@@ -137,8 +115,11 @@ public:
     const CTransactionView &tx() const { return shared->tx; }
 
     /// Get the scriptSig (unlock script) for the input index
-    const CScript & scriptSig(unsigned inputIdx) const {
-         return tx().vin().at(inputIdx).scriptSig;
+    Span<const uint8_t> scriptSig(unsigned inputIdx) const {
+        if (inputIdx >= tx().inputCount()) {
+            throw std::out_of_range("scriptSig: input index out of range");
+        }
+        return tx().inputScript(inputIdx);
     }
  
     bool getAuthPubKey(std::vector<uint8_t>& pubKey) const {
@@ -150,10 +131,9 @@ public:
     }
 
     bool getAuthSig(std::vector<uint8_t>& sig) const {
-        for (unsigned int index = 0; index < tx().vout().size(); index++) {
-            auto const &output = tx().vout()[index];
-            auto const &outputScript = tx().vout()[index].scriptPubKey;
-            std::vector<uint8_t> outputScriptVec(outputScript.begin(), outputScript.end());
+        for (unsigned int index = 0; index < tx().outputCount(); index++) {
+            auto const outputScriptSpan = tx().outputScript(index);
+            CScript const outputScript(outputScriptSpan.begin(), outputScriptSpan.end());
             if (outputScript.IsSigOpReturn(sig)) {
                return true;
             }
@@ -170,26 +150,25 @@ public:
         // 
         //
         std::vector<uint8_t> authMessage;
-        auto const &input = tx().vin()[0];
-        auto const &txid = input.prevout.GetTxId();
+        auto const prevout = tx().inputPrevout(0);
+        auto const &txid = prevout.GetTxId();
         // prevTx
         authMessage.insert(authMessage.end(), txid.begin(), txid.end());
         // prevIndex
-        std::vector<uint8_t> prevoutN = writeUint32(input.prevout.GetN());
+        std::vector<uint8_t> prevoutN = writeUint32(prevout.GetN());
         authMessage.insert(authMessage.end(), prevoutN.begin(), prevoutN.end());
         // unlockscript+lockscript
         authMessage.insert(authMessage.end(), _fullScript.begin(), _fullScript.end());
         // For each output, serialize but skip the op_return which contains the signature
-        for (unsigned int index = 0; index < tx().vout().size(); index++) {
-            auto const &output = tx().vout()[index];
-            CScriptNum const bn(output.nValue / SATOSHI);
+        for (unsigned int index = 0; index < tx().outputCount(); index++) {
+            CScriptNum const bn(tx().outputValue(index) / SATOSHI);
             std::vector<uint8_t> outputValVec = writeUint64(bn.getint());
-            auto const &outputScript = tx().vout()[index].scriptPubKey;
-            std::vector<uint8_t> outputScriptVec(outputScript.begin(), outputScript.end());
+            auto const outputScriptSpan = tx().outputScript(index);
+            CScript const outputScript(outputScriptSpan.begin(), outputScriptSpan.end());
             std::vector<uint8_t> sig;
             if (!outputScript.IsSigOpReturn(sig)) {
                 authMessage.insert(authMessage.end(), outputValVec.begin(), outputValVec.end());
-                authMessage.insert(authMessage.end(), outputScriptVec.begin(), outputScriptVec.end());
+                authMessage.insert(authMessage.end(), outputScriptSpan.begin(), outputScriptSpan.end());
             }
         }
         // std::cerr << "getAuthMessage: " << HexStr(authMessage) << std::endl;
@@ -197,13 +176,48 @@ public:
     }
 };
 
+/**
+ * Read set and write set of a contract call: the contract state keys, token ids and block heights the call
+ * accessed, recorded while it executes (see ScriptStateContext::setAccessSet).
+ *
+ * Only state shared between calls is recorded. The incoming balances belong to the transaction and are not.
+ * Contract state keys are recorded as stored: writes with an empty key name or keyspace store it as 00.
+ */
+struct ScriptStateAccessSet {
+    //! Keyspace and key name
+    using StateKey = std::pair<std::vector<uint8_t>, std::vector<uint8_t>>;
+
+    // Read set
+    std::set<StateKey> stateReads;
+    std::set<uint288> ftReads;
+    std::set<uint288> nftReads;
+    std::set<uint32_t> blockHeights;
+    //! Whether the call counted or indexed the contract's balances, which depends on every token held
+    bool ftBalancesEnumerated = false;
+    bool nftBalancesEnumerated = false;
+
+    // Write set
+    std::set<StateKey> statePuts;
+    std::set<StateKey> stateDeletes;
+    std::set<uint288> ftBalanceAdds;
+    std::set<uint288> ftWithdraws;
+    std::set<uint288> nftPuts;
+    std::set<uint288> nftWithdraws;
+
+    SERIALIZE_METHODS(ScriptStateAccessSet, obj) {
+        READWRITE(obj.stateReads, obj.ftReads, obj.nftReads, obj.blockHeights, obj.ftBalancesEnumerated,
+                  obj.nftBalancesEnumerated, obj.statePuts, obj.stateDeletes, obj.ftBalanceAdds, obj.ftWithdraws,
+                  obj.nftPuts, obj.nftWithdraws);
+    }
+};
+
 class ScriptStateContext {
     json _contractStateExternal;
-    json _ftState;
     json _ftStateIncoming;
-    json _nftState;
     json _nftStateIncoming;
-    json _contractState;
+    // Contract state and balances, updated in place: copying the context or
+    // the state is O(1), see ContractState
+    ContractState _state;
     json _contractStateUpdates;
     json _contractStateDeletes;
     json _ftBalancesUpdates;
@@ -215,38 +229,68 @@ class ScriptStateContext {
     std::map<uint288, std::map<uint32_t, uint64_t>> _ftWithdrawMap;
     std::map<uint288, uint32_t> _nftWithdrawMap;
     ContractStateExternalStruct _externalStateStruct;
+    // Where to record the keys accessed, nullptr when not recording
+    ScriptStateAccessSet *_accessSet = nullptr;
+
+    // Serialized header at a height already resolved from 0, false if the call has no header at that height
+    bool lookupBlockInfoHeader(uint32_t revisedHeight, std::vector<uint8_t> &header) const;
+
+    // The inputs are validated by Create
+    ScriptStateContext(const ContractState &state, const json &ftStateIncoming, const json &nftStateIncoming,
+                       const json &contractStateExternal, ContractStateExternalStruct externalStateStruct);
 
 public:
-    ScriptStateContext(json &ftState, json &ftStateIncoming, json &nftState, json &nftStateIncoming, json &contractState, json &contractStateExternal);
+    // Validates the state of the call and its external state, returning the first error found
+    static StateResult<ScriptStateContext> Create(const json &ftState, const json &ftStateIncoming,
+                                                  const json &nftState, const json &nftStateIncoming,
+                                                  const json &contractState, const json &contractStateExternal);
+    // Starts a call from a snapshot of the contract state and balances, without copying them
+    static StateResult<ScriptStateContext> Create(const ContractState &state, const json &ftStateIncoming,
+                                                  const json &nftStateIncoming, const json &contractStateExternal);
     ScriptStateContext() {}
 
-    void cleanupStateAndBalances();
-    void validateFinalStateRestrictions() const;
+    // Records the read set and write set of the call into accessSet, which must outlive the context and its copies
+    void setAccessSet(ScriptStateAccessSet *accessSet) { _accessSet = accessSet; }
+    // Keeps the v2 state digests up to date as the call changes the state, starting from the digests of the state
+    // the context was created with
+    void trackStateDigests(const ContractStateDigests &digests) { _state.trackDigests(digests); }
+
+    StateError cleanupStateAndBalances();
+    StateError validateFinalStateRestrictions() const;
     bool isAllowedBlockInfoHeight(uint32_t height) const;
-    static CBlockHeader decodeHeader(const std::vector<uint8_t> &header);
-    static ContractStateExternalStruct validateContractStateExternal(const json &contractStateExternal);
+    // Decodes a serialized block header, fails with HEADER_DECODE if it is too short. Decoded headers are kept in a
+    // process-wide cache keyed by their bytes, shared by all calls and threads
+    static StateResult<CBlockHeader> decodeHeader(const std::vector<uint8_t> &header);
+    // Same as decodeHeader, with the hash and proof of work of the header, checked once when it is first decoded
+    static StateResult<DecodedBlockHeader> decodeHeaderChecked(const std::vector<uint8_t> &header);
+    // Checks the proof of work of every header the call can read and that headers at consecutive heights link,
+    // fails with HEADERS_INVALID. Headers in the BlockHeaderStore were checked when they were stored
+    StateError verifyBlockInfoHeaders() const;
+    static StateResult<ContractStateExternalStruct> validateContractStateExternal(const json &contractStateExternal);
     static json::const_iterator getKeyspaceNode(const json &entity, const std::string &keySpace);
     static json &ensureKeyspaceExists(json &entity, const std::string &keySpace);
-    static void cleanupKeyspaces(json &entity);
+    static StateError cleanupKeyspaces(json &entity);
     static void cleanupEmptyKeyspace(json &entity, const std::string &keySpace);
     static void cleanupEmptyFtTokenBalance(json &entity);
     static void cleanupEmptyNftTokenBalance(json &entity);
 
     // Contract state manipulation
-    bool contractStateGet(const std::vector<uint8_t> &keySpace, const std::vector<uint8_t> &keyName,
+    bool contractStateGet(Span<const uint8_t> keySpace, Span<const uint8_t> keyName,
                           std::vector<uint8_t> &value) const;
     void contractStatePut(const std::vector<uint8_t> &keySpace, const std::vector<uint8_t> &keyName,
                           const std::vector<uint8_t> &value);
     void contractStateDelete(const std::vector<uint8_t> &keySpace, const std::vector<uint8_t> &keyName);
-    bool contractStateExists(const std::vector<uint8_t> &keySpace, const std::vector<uint8_t> &keyName) const;
+    bool contractStateExists(Span<const uint8_t> keySpace, Span<const uint8_t> keyName) const;
 
     // Public methods to retrieve the resulting states, balances and withdraws
-    json const &getContractStateFinal() const { return _contractState; }
+    // Snapshot of the contract state and balances as they are now
+    ContractState const &getContractState() const { return _state; }
+    json getContractStateFinal() const { return _state.stateJson(); }
     json const &getContractStateUpdates() const { return _contractStateUpdates; }
     json const &getContractStateDeletes() const { return _contractStateDeletes; }
-    json const &getFtBalancesResult() const { return _ftState; }
+    json getFtBalancesResult() const { return _state.ftBalancesJson(); }
     json const &getFtBalancesUpdatesResult() const { return _ftBalancesUpdates; }
-    json const &getNftBalancesResult() const { return _nftState; }
+    json getNftBalancesResult() const { return _state.nftBalancesJson(); }
     json const &getNftBalancesUpdatesResult() const { return _nftBalancesUpdates; }
     json getFtWithdrawsResult() const;
     json getNftWithdrawsResult() const;
@@ -280,35 +324,26 @@ public:
     // contract token withdrawl functions
     bool contractWithdrawFt(const uint288 &ftId, uint32_t index, uint64_t withdrawAmount);
     bool contractWithdrawNft(const uint288 &nftId, uint32_t index);
-    bool encodeFtWithdrawMap(json &withdrawFt) const;
-    bool encodeNftWithdrawMap(json &withdrawNft) const;
-    bool encodeFtIncomingBalancesAddedMap(json &ftBalancesAdded) const; 
-    bool encodeNftIncomingPutsMap(json &nftPuts) const;
-
-    // Additional methods
-    CBlockHeader getBlockInfoByHeight(uint32_t height) const;
-    void getCurrentBlockInfoHeader(uint32_t height, std::vector<uint8_t> &value) const;
-    uint64_t getCurrentBlockInfoHeight(uint32_t height) const;
-    uint32_t getCurrentBlockInfoVersion(uint32_t height) const;
-    void getCurrentBlockInfoPrevHash(uint32_t height, std::vector<uint8_t> &value) const;
-    void getCurrentBlockInfoMerkleRoot(uint32_t height, std::vector<uint8_t> &value) const;
-    uint32_t getCurrentBlockInfoTime(uint32_t height) const;
-    uint32_t getCurrentBlockInfoBits(uint32_t height) const;
-    uint32_t getCurrentBlockInfoNonce(uint32_t height) const;
-    uint64_t getCurrentBlockInfoDifficulty(uint32_t height) const;
-
-    // Decode block header
-    uint32_t getBlockInfoVersion(const std::vector<uint8_t> &header) const;
-    void getBlockInfoPrevHash(const std::vector<uint8_t> &header, std::vector<uint8_t> &value) const;
-    void getBlockInfoMerkleRoot(const std::vector<uint8_t> &header, std::vector<uint8_t> &value) const;
-    uint32_t getBlockInfoTime(const std::vector<uint8_t> &header) const;
-    uint32_t getBlockInfoBits(const std::vector<uint8_t> &header) const;
-    uint32_t getBlockInfoNonce(const std::vector<uint8_t> &header) const;
-    uint64_t getBlockInfoDifficulty(const std::vector<uint8_t> &header) const;
-
-    // checkTxInBlock
+    void encodeFtWithdrawMap(json &withdrawFt) const;
+    void encodeNftWithdrawMap(json &withdrawNft) const;
+    void encodeFtIncomingBalancesAddedMap(json &ftBalancesAdded) const;
+    void encodeNftIncomingPutsMap(json &nftPuts) const;
+
+    // Block info at height, 0 for the current block. Each fails with BLOCK_INFO_HEIGHT if the call has no header at
+    // height, the header is looked up once for all of its fields
+    StateResult<CBlockHeader> getBlockInfoByHeight(uint32_t height) const;
+    StateError getCurrentBlockInfoHeader(uint32_t height, std::vector<uint8_t> &value) const;
+    StateResult<uint32_t> getCurrentBlockInfoHeight(uint32_t height) const;
+    static uint64_t getBlockInfoDifficulty(const CBlockHeader &header);
+
+    // checkTxInBlock. proof is a serialized CMerkleBlock, which throws if it cannot be decoded. Proofs found valid are
+    // kept in a process-wide cache, so checking the same proof again is a lookup
     bool checkTxInBlock(const std::vector<uint8_t> &header, const std::vector<uint8_t> &proof,
                         const uint256 &txid) const;
+    // checkTxInBlock against the header at height, 0 for the current block. Returns nullopt if the call has no header
+    // at height or the proof cannot be decoded
+    std::optional<bool> checkTxInBlockAtHeight(uint32_t height, const std::vector<uint8_t> &proof,
+                                               const uint256 &txid) const;
 };
 #if defined(__GNUG__) && !defined(__clang__)
 #pragma GCC diagnostic pop
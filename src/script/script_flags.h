@@ -39,5 +39,10 @@ enum {
     //
     // See BIP112 for details
     SCRIPT_VERIFY_CHECKSEQUENCEVERIFY = (1U << 10),
+
+    // Enable OP_CHECKTXINBLOCK, which checks a Merkle proof that a transaction
+    // is in a block of the call's block info. Without it the opcode is
+    // undefined.
+    SCRIPT_ENABLE_CHECKTXINBLOCK = (1U << 11),
  
 };
@@ -0,0 +1,376 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <script/script_jit.h>
+
+#include <random.h>
+#include <sync.h>
+#include <util/saltedhashers.h>
+#include <util/strencodings.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define SCRIPT_JIT_X86_64 1
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+#ifdef SCRIPT_JIT_X86_64
+
+//! Upper bounds of the code emitted around and for each instruction.
+constexpr size_t PROLOGUE_SIZE = 4;
+constexpr size_t MAX_TEMPLATE_SIZE = 3 + 10 + 12 + 2 + 6 + 11;
+constexpr size_t EPILOGUE_SIZE = 2;
+
+/**
+ * Encodes the few x86-64 instructions the templates are made of, for code
+ * that will be copied to base.
+ */
+class CodeBuffer {
+public:
+    explicit CodeBuffer(uintptr_t base) : _base(base) {}
+
+    size_t size() const { return _bytes.size(); }
+    const uint8_t *data() const { return _bytes.data(); }
+
+    void Emit(std::initializer_list<uint8_t> bytes) { _bytes.insert(_bytes.end(), bytes); }
+
+    void Emit32(uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            _bytes.push_back(uint8_t(value >> (8 * i)));
+        }
+    }
+
+    void Emit64(uint64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            _bytes.push_back(uint8_t(value >> (8 * i)));
+        }
+    }
+
+    //! Calls target directly when it is within reach of a rel32, through rax
+    //! otherwise.
+    void EmitCall(uintptr_t target) {
+        const int64_t rel = int64_t(target) - int64_t(_base + size() + 5);
+        if (rel >= std::numeric_limits<int32_t>::min() && rel <= std::numeric_limits<int32_t>::max()) {
+            Emit({0xe8}); // call rel32
+            Emit32(uint32_t(int32_t(rel)));
+        } else {
+            Emit({0x48, 0xb8}); // mov rax, target
+            Emit64(target);
+            Emit({0xff, 0xd0}); // call rax
+        }
+    }
+
+    //! Emits a rel32 placeholder and returns its position for PatchRel32.
+    size_t EmitRel32() {
+        Emit32(0);
+        return size() - 4;
+    }
+
+    void PatchRel32(size_t pos, size_t target) {
+        const auto rel = uint32_t(int32_t(int64_t(target) - int64_t(pos + 4)));
+        for (int i = 0; i < 4; ++i) {
+            _bytes[pos + i] = uint8_t(rel >> (8 * i));
+        }
+    }
+
+private:
+    const uintptr_t _base;
+    std::vector<uint8_t> _bytes;
+};
+
+#endif
+
+} // namespace
+
+ScriptNativeCode::~ScriptNativeCode() {
+#ifdef SCRIPT_JIT_X86_64
+    munmap(_code, _size);
+#endif
+}
+
+bool IsScriptJitSupported() {
+#ifdef SCRIPT_JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::unique_ptr<ScriptNativeCode> ScriptNativeCode::Compile(const ScriptProgram &program) {
+#ifdef SCRIPT_JIT_X86_64
+    const std::vector<ScriptInstruction> &code = program.code();
+
+    // Map the code next to the helpers if possible, so that they can be
+    // called directly rather than through a register.
+    const size_t capacity = PROLOGUE_SIZE + code.size() * MAX_TEMPLATE_SIZE + EPILOGUE_SIZE;
+    const auto helpers = reinterpret_cast<uintptr_t>(&GetScriptNativeHelper);
+    void *hint = reinterpret_cast<void *>((helpers & ~uintptr_t(0xffff)) - (uintptr_t(1) << 24));
+    void *mem = mmap(hint, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+
+    CodeBuffer buf(reinterpret_cast<uintptr_t>(mem));
+    // Native offset of every instruction that is not inside a superinstruction.
+    std::vector<size_t> labels(code.size(), SIZE_MAX);
+    // Pending rel32 operands: (position, index of the target instruction).
+    std::vector<std::pair<size_t, uint32_t>> jumps;
+    std::vector<size_t> exits;
+
+    // int32_t entry(ScriptProgramFrame *frame): the frame lives in rbx, which
+    // the helpers preserve. Pushing it also aligns the stack for the calls.
+    buf.Emit({0x53});             // push rbx
+    buf.Emit({0x48, 0x89, 0xfb}); // mov rbx, rdi
+
+    for (size_t i = 0; i < code.size(); i += code[i].length) {
+        const ScriptInstruction &ins = code[i];
+        labels[i] = buf.size();
+
+        buf.Emit({0x48, 0x89, 0xdf}); // mov rdi, rbx
+        buf.Emit({0x48, 0xbe});       // mov rsi, &ins
+        buf.Emit64(reinterpret_cast<uintptr_t>(&ins));
+        buf.EmitCall(reinterpret_cast<uintptr_t>(GetScriptNativeHelper(ins)));
+
+        const ScriptInstructionFlow flow = GetScriptInstructionFlow(ins);
+        if (flow == ScriptInstructionFlow::End) {
+            // Always finishes the program: fall through to the exit.
+            break;
+        }
+        buf.Emit({0x85, 0xc0}); // test eax, eax
+        buf.Emit({0x0f, 0x88}); // js exit
+        exits.push_back(buf.EmitRel32());
+        if (flow == ScriptInstructionFlow::Branch) {
+            buf.Emit({0x3d}); // cmp eax, arg
+            buf.Emit32(ins.arg);
+            buf.Emit({0x0f, 0x84}); // je arg
+            jumps.emplace_back(buf.EmitRel32(), ins.arg);
+        } else if (flow == ScriptInstructionFlow::Jump) {
+            buf.Emit({0xe9}); // jmp arg
+            jumps.emplace_back(buf.EmitRel32(), ins.arg);
+        }
+    }
+
+    const size_t exit = buf.size();
+    buf.Emit({0x5b}); // pop rbx
+    buf.Emit({0xc3}); // ret
+    assert(buf.size() <= capacity);
+
+    for (const auto &jump : jumps) {
+        // Branch targets follow an OP_ELSE/OP_ENDIF and are never inside a
+        // superinstruction.
+        assert(labels[jump.second] != SIZE_MAX);
+        buf.PatchRel32(jump.first, labels[jump.second]);
+    }
+    for (const size_t pos : exits) {
+        buf.PatchRel32(pos, exit);
+    }
+
+    // Write the code, then make it executable: the mapping is never writable
+    // and executable at the same time.
+    std::memcpy(mem, buf.data(), buf.size());
+    if (mprotect(mem, capacity, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, capacity);
+        return nullptr;
+    }
+    return std::unique_ptr<ScriptNativeCode>(new ScriptNativeCode(mem, capacity));
+#else
+    return nullptr;
+#endif
+}
+
+namespace {
+
+/** A locking script seen by EvalScriptTiered or GetScriptAnalysis. */
+struct CachedScript {
+    explicit CachedScript(const CScript &script) : program(script), analysis(AnalyzeScript(script, program)) {}
+
+    const ScriptProgram program;
+    const ScriptAnalysis analysis;
+    std::atomic<uint32_t> calls{0};
+    //! Set by the one caller that compiles the program.
+    std::atomic<bool> compiling{false};
+    //! Written once by the compiling caller, before entry is published.
+    std::unique_ptr<ScriptNativeCode> native;
+    std::atomic<ScriptNativeEntry> entry{nullptr};
+};
+
+struct SaltedScriptHasher : SaltedHasherBase {
+    SaltedScriptHasher() noexcept {}
+    size_t operator()(const CScript &script) const noexcept {
+        return static_cast<size_t>(CSipHasher(k0(), k1()).Write(script.data(), script.size()).Finalize());
+    }
+};
+
+//! Bound on the number of cached scripts. When it is full, one script picked
+//! at random is evicted for each new one, so that a working set slightly over
+//! the bound still mostly hits.
+constexpr size_t MAX_CACHED_SCRIPTS = 4096;
+
+//! Scripts sampled to find one that has not reached the JIT yet, which is
+//! cheaper to evict than compiled code.
+constexpr int EVICTION_SAMPLES = 8;
+
+Mutex cs_scriptCache;
+std::unordered_map<CScript, std::shared_ptr<CachedScript>, SaltedScriptHasher>
+    scriptCache GUARDED_BY(cs_scriptCache);
+FastRandomContext evictionRng GUARDED_BY(cs_scriptCache);
+
+void EvictScript() EXCLUSIVE_LOCKS_REQUIRED(cs_scriptCache) {
+    const size_t buckets = scriptCache.bucket_count();
+    const CScript *victim = nullptr;
+    for (int i = 0; i < EVICTION_SAMPLES; i++) {
+        // The first script of a random bucket that has one
+        size_t bucket = evictionRng.randrange(buckets);
+        while (scriptCache.bucket_size(bucket) == 0) {
+            bucket = (bucket + 1) % buckets;
+        }
+        const auto it = scriptCache.begin(bucket);
+        victim = &it->first;
+        if (!it->second->entry.load(std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    scriptCache.erase(scriptCache.find(*victim));
+}
+
+std::atomic<bool> jitEnabled{false};
+std::atomic<uint32_t> jitCallThreshold{ScriptJitConfig().callThreshold};
+std::atomic<bool> jitDifferential{false};
+std::atomic<uint64_t> jitMismatches{0};
+
+std::shared_ptr<CachedScript> LookupScript(const CScript &script) {
+    {
+        LOCK(cs_scriptCache);
+        const auto it = scriptCache.find(script);
+        if (it != scriptCache.end()) {
+            return it->second;
+        }
+    }
+
+    // Decode outside of the lock; a concurrent caller may win the insertion.
+    auto cached = std::make_shared<CachedScript>(script);
+
+    LOCK(cs_scriptCache);
+    const auto it = scriptCache.find(script);
+    if (it != scriptCache.end()) {
+        return it->second;
+    }
+    if (scriptCache.size() >= MAX_CACHED_SCRIPTS) {
+        EvictScript();
+    }
+    return scriptCache.emplace(script, std::move(cached)).first->second;
+}
+
+bool SameStateResults(const ScriptStateContext &a, const ScriptStateContext &b) {
+    return a.getContractState() == b.getContractState() &&
+           a.getContractStateUpdates() == b.getContractStateUpdates() &&
+           a.getContractStateDeletes() == b.getContractStateDeletes() &&
+           a.getFtBalancesUpdatesResult() == b.getFtBalancesUpdatesResult() &&
+           a.getNftBalancesUpdatesResult() == b.getNftBalancesUpdatesResult();
+}
+
+/**
+ * Runs the reference interpreter on the caller's state and the native code on
+ * a copy of it, and reports any difference. The reference result is returned.
+ */
+bool EvalScriptDifferential(StackT &stack, const CScript &script, const CachedScript &cached,
+                            ScriptNativeEntry entry, uint32_t flags, const BaseSignatureChecker &checker,
+                            ScriptExecutionMetrics &metrics, ScriptExecutionContextOpt const &context,
+                            ScriptStateContext &stateContext, ScriptError *serror, unsigned int *serror_op_num) {
+    StackT nativeStack(stack);
+    ScriptExecutionMetrics nativeMetrics(metrics);
+    // The copy would record into the access set of the call: the shadow run records into its own
+    ScriptStateAccessSet nativeAccessSet;
+    ScriptStateContext nativeState(stateContext);
+    nativeState.setAccessSet(&nativeAccessSet);
+
+    ScriptError error = ScriptError::UNKNOWN;
+    unsigned int opNum = 0;
+    const bool result = EvalScript(stack, script, flags, checker, metrics, context, stateContext, &error, &opNum);
+
+    ScriptError nativeError = ScriptError::UNKNOWN;
+    unsigned int nativeOpNum = 0;
+    bool nativeResult = !result;
+    try {
+        nativeResult = EvalScriptNative(nativeStack, cached.program, entry, flags, checker, nativeMetrics, context,
+                                        nativeState, &nativeError, &nativeOpNum);
+    } catch (...) {
+        // The reference did not throw: reported as a mismatch below.
+    }
+
+    // A failed script leaves its stack and state to be discarded, and superinstructions fail with a different
+    // partial stack than the opcodes they stand for: those are only compared on success
+    if (nativeResult != result || nativeError != error || nativeOpNum != opNum ||
+        (result && (nativeStack != stack || nativeMetrics.nSigChecks != metrics.nSigChecks ||
+                    !SameStateResults(nativeState, stateContext)))) {
+        ++jitMismatches;
+        std::cerr << "Script JIT mismatch: script=" << HexStr(script) << " result=" << result << "/" << nativeResult
+                  << " error=" << ScriptErrorString(error) << "/" << ScriptErrorString(nativeError)
+                  << " op=" << opNum << "/" << nativeOpNum << std::endl;
+    }
+
+    set_error_op_num(serror_op_num, opNum);
+    set_error(serror, error);
+    return result;
+}
+
+} // namespace
+
+void SetScriptJitConfig(const ScriptJitConfig &config) {
+    jitCallThreshold = config.callThreshold;
+    jitDifferential = config.differential;
+    jitEnabled = config.enabled && IsScriptJitSupported();
+}
+
+ScriptJitConfig GetScriptJitConfig() {
+    ScriptJitConfig config;
+    config.enabled = jitEnabled;
+    config.callThreshold = jitCallThreshold;
+    config.differential = jitDifferential;
+    return config;
+}
+
+uint64_t GetScriptJitMismatches() {
+    return jitMismatches;
+}
+
+ScriptAnalysis GetScriptAnalysis(const CScript &script) {
+    return LookupScript(script)->analysis;
+}
+
+bool EvalScriptTiered(StackT &stack, const CScript &script, uint32_t flags, const BaseSignatureChecker &checker,
+                      ScriptExecutionMetrics &metrics, ScriptExecutionContextOpt const &context,
+                      ScriptStateContext &stateContext, ScriptError *serror, unsigned int *serror_op_num) {
+    const std::shared_ptr<CachedScript> cached = LookupScript(script);
+    const uint32_t calls = ++cached->calls;
+    ScriptNativeEntry entry = cached->entry.load(std::memory_order_acquire);
+    if (!entry && jitEnabled && calls >= jitCallThreshold && !cached->compiling.exchange(true)) {
+        cached->native = ScriptNativeCode::Compile(cached->program);
+        if (cached->native) {
+            entry = cached->native->entry();
+            cached->entry.store(entry, std::memory_order_release);
+        }
+    }
+
+    if (!entry) {
+        return EvalScriptProgram(stack, cached->program, flags, checker, metrics, context, stateContext, serror,
+                                 serror_op_num);
+    }
+    if (jitDifferential) {
+        return EvalScriptDifferential(stack, script, *cached, entry, flags, checker, metrics, context, stateContext,
+                                      serror, serror_op_num);
+    }
+    return EvalScriptNative(stack, cached->program, entry, flags, checker, metrics, context, stateContext, serror,
+                            serror_op_num);
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <script/interpreter.h>
+#include <script/script_analysis.h>
+#include <script/script_program.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * Native code compiled from a ScriptProgram by a template JIT.
+ *
+ * Scripts have no loops, so every instruction is compiled once, in program
+ * order, into a call to the helper of its handler followed by the branch its
+ * control flow needs. The frame stays in a callee-saved register for the whole
+ * run and branch targets are resolved at compile time, which removes the
+ * indirect dispatch of the threaded core.
+ *
+ * The code embeds the address of the program's instructions: the program must
+ * outlive it.
+ */
+class ScriptNativeCode {
+public:
+    ~ScriptNativeCode();
+
+    ScriptNativeCode(const ScriptNativeCode &) = delete;
+    ScriptNativeCode &operator=(const ScriptNativeCode &) = delete;
+
+    //! Returns nullptr where the JIT is not supported or executable memory
+    //! cannot be allocated.
+    static std::unique_ptr<ScriptNativeCode> Compile(const ScriptProgram &program);
+
+    ScriptNativeEntry entry() const { return reinterpret_cast<ScriptNativeEntry>(_code); }
+
+private:
+    ScriptNativeCode(void *code, size_t size) : _code(code), _size(size) {}
+
+    void *_code;
+    size_t _size;
+};
+
+//! Whether the JIT supports this platform (Linux x86-64).
+bool IsScriptJitSupported();
+
+/** Process-wide JIT settings. The JIT is disabled by default. */
+struct ScriptJitConfig {
+    bool enabled = false;
+    //! Calls of the same locking script before it is compiled.
+    uint32_t callThreshold = 64;
+    //! Check every native run against EvalScript. The reference result is the
+    //! one returned; mismatches are reported and counted.
+    bool differential = false;
+};
+
+void SetScriptJitConfig(const ScriptJitConfig &config);
+ScriptJitConfig GetScriptJitConfig();
+
+//! Number of native runs that did not match EvalScript in differential mode.
+uint64_t GetScriptJitMismatches();
+
+/**
+ * Static analysis of a script, computed once when the script is decoded and
+ * cached with its program, so that a script analyzed before it is called is
+ * not decoded again.
+ */
+ScriptAnalysis GetScriptAnalysis(const CScript &script);
+
+/**
+ * Evaluates a script through the tier it has reached: the threaded core over a
+ * cached program, then, with the JIT enabled, native code once the script has
+ * been called often enough. Same contract as EvalScript.
+ */
+bool EvalScriptTiered(StackT &stack, const CScript &script, uint32_t flags, const BaseSignatureChecker &checker,
+                      ScriptExecutionMetrics &metrics, ScriptExecutionContextOpt const &context,
+                      ScriptStateContext &stateContext, ScriptError *serror = nullptr,
+                      unsigned int *serror_op_num = nullptr);
@@ -0,0 +1,1282 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <script/script_program.h>
+
+#include <crypto/ripemd160.h>
+#include <crypto/sha1.h>
+#include <crypto/sha256.h>
+#include <hash.h>
+#include <script/bitops.h>
+#include <script/script_flags.h>
+#include <script/script_num.h>
+#include <script/sigencoding.h>
+#include <util/bitmanip.h>
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <limits>
+
+#if defined(__GNUC__)
+// GCC and Clang support taking the address of a label, which lets every
+// handler end in its own indirect jump instead of returning to a shared switch.
+#define SCRIPT_THREADED_DISPATCH 1
+#define SCRIPT_ALWAYS_INLINE __attribute__((always_inline))
+#else
+#define SCRIPT_ALWAYS_INLINE
+#endif
+
+/**
+ * Handler table of the threaded interpreter: X(name, arity).
+ *
+ * The arity is the stack depth a handler needs; it is checked once before
+ * dispatch so the handlers themselves can access the stack unchecked. Handlers
+ * whose depth check is not a plain INVALID_STACK_OPERATION (OP_IF, OP_NOTIF,
+ * OP_FROMALTSTACK), that run other checks first (COLD) or whose depth
+ * requirement belongs to a later part of a superinstruction declare arity 0
+ * and check for themselves.
+ */
+#define SCRIPT_HANDLERS(X)                                                                                            \
+    X(END, 0)                                                                                                          \
+    X(PUSH, 0)                                                                                                         \
+    X(PUSH_NONMINIMAL, 0)                                                                                              \
+    X(NOP, 0)                                                                                                          \
+    X(NOP_UPGRADABLE, 0)                                                                                               \
+    X(IF, 0)                                                                                                           \
+    X(NOTIF, 0)                                                                                                        \
+    X(ELSE, 0)                                                                                                         \
+    X(ENDIF, 0)                                                                                                        \
+    X(VERIFY, 1)                                                                                                       \
+    X(RETURN, 0)                                                                                                       \
+    X(TOALTSTACK, 1)                                                                                                   \
+    X(FROMALTSTACK, 0)                                                                                                 \
+    X(2DROP, 2)                                                                                                        \
+    X(2DUP, 2)                                                                                                         \
+    X(3DUP, 3)                                                                                                         \
+    X(2OVER, 4)                                                                                                        \
+    X(2ROT, 6)                                                                                                         \
+    X(2SWAP, 4)                                                                                                        \
+    X(IFDUP, 1)                                                                                                        \
+    X(DEPTH, 0)                                                                                                        \
+    X(DROP, 1)                                                                                                         \
+    X(DUP, 1)                                                                                                          \
+    X(NIP, 2)                                                                                                          \
+    X(OVER, 2)                                                                                                         \
+    X(PICK, 2)                                                                                                         \
+    X(ROLL, 2)                                                                                                         \
+    X(ROT, 3)                                                                                                          \
+    X(SWAP, 2)                                                                                                         \
+    X(TUCK, 2)                                                                                                         \
+    X(SIZE, 1)                                                                                                         \
+    X(AND, 2)                                                                                                          \
+    X(OR, 2)                                                                                                           \
+    X(XOR, 2)                                                                                                          \
+    X(INVERT, 1)                                                                                                       \
+    X(LSHIFT, 2)                                                                                                       \
+    X(RSHIFT, 2)                                                                                                       \
+    X(EQUAL, 2)                                                                                                        \
+    X(EQUALVERIFY, 2)                                                                                                  \
+    X(1ADD, 1)                                                                                                         \
+    X(1SUB, 1)                                                                                                         \
+    X(NEGATE, 1)                                                                                                       \
+    X(ABS, 1)                                                                                                          \
+    X(NOT, 1)                                                                                                          \
+    X(0NOTEQUAL, 1)                                                                                                    \
+    X(ADD, 2)                                                                                                          \
+    X(SUB, 2)                                                                                                          \
+    X(MUL, 2)                                                                                                          \
+    X(DIV, 2)                                                                                                          \
+    X(MOD, 2)                                                                                                          \
+    X(BOOLAND, 2)                                                                                                      \
+    X(BOOLOR, 2)                                                                                                       \
+    X(NUMEQUAL, 2)                                                                                                     \
+    X(NUMEQUALVERIFY, 2)                                                                                               \
+    X(NUMNOTEQUAL, 2)                                                                                                  \
+    X(LESSTHAN, 2)                                                                                                     \
+    X(GREATERTHAN, 2)                                                                                                  \
+    X(LESSTHANOREQUAL, 2)                                                                                              \
+    X(GREATERTHANOREQUAL, 2)                                                                                           \
+    X(MIN, 2)                                                                                                          \
+    X(MAX, 2)                                                                                                          \
+    X(WITHIN, 3)                                                                                                       \
+    X(RIPEMD160, 1)                                                                                                    \
+    X(SHA1, 1)                                                                                                         \
+    X(SHA256, 1)                                                                                                       \
+    X(HASH160, 1)                                                                                                      \
+    X(HASH256, 1)                                                                                                      \
+    X(CAT, 2)                                                                                                          \
+    X(SPLIT, 2)                                                                                                        \
+    X(REVERSEBYTES, 1)                                                                                                 \
+    X(NUM2BIN, 2)                                                                                                      \
+    X(BIN2NUM, 1)                                                                                                      \
+    X(COLD, 0)                                                                                                         \
+    X(PUSH_PUSH_KV_GET, 0)                                                                                             \
+    X(PUSH_PICK, 0)                                                                                                    \
+    X(DUP_EQUALVERIFY, 1)                                                                                              \
+    X(SWAP_CAT, 2)
+
+namespace {
+
+enum ScriptHandler : uint8_t {
+#define SCRIPT_HANDLER_ENUM(name, arity) H_##name,
+    SCRIPT_HANDLERS(SCRIPT_HANDLER_ENUM)
+#undef SCRIPT_HANDLER_ENUM
+    H_COUNT
+};
+
+static_assert(H_COUNT <= std::numeric_limits<uint8_t>::max(), "handler ids must fit ScriptInstruction::handler");
+
+const uint8_t HANDLER_ARITY[H_COUNT] = {
+#define SCRIPT_HANDLER_ARITY(name, arity) arity,
+    SCRIPT_HANDLERS(SCRIPT_HANDLER_ARITY)
+#undef SCRIPT_HANDLER_ARITY
+};
+
+/**
+ * Handler for an opcode that is not a push and not part of the conditional
+ * structure. Everything without a native handler is COLD: introspection, the
+ * AVM state opcodes, signature checks and undefined opcodes are evaluated by
+ * the reference interpreter, one opcode at a time, so their semantics cannot
+ * drift between the two cores.
+ */
+ScriptHandler HandlerForOpcode(opcodetype opcode) {
+    switch (opcode) {
+        case OP_NOP:
+            return H_NOP;
+        case OP_NOP1:
+        case OP_NOP4:
+        case OP_NOP5:
+        case OP_NOP6:
+        case OP_NOP7:
+        case OP_NOP8:
+        case OP_NOP9:
+        case OP_NOP10:
+            return H_NOP_UPGRADABLE;
+        case OP_VERIFY:
+            return H_VERIFY;
+        case OP_RETURN:
+            return H_RETURN;
+        case OP_TOALTSTACK:
+            return H_TOALTSTACK;
+        case OP_FROMALTSTACK:
+            return H_FROMALTSTACK;
+        case OP_2DROP:
+            return H_2DROP;
+        case OP_2DUP:
+            return H_2DUP;
+        case OP_3DUP:
+            return H_3DUP;
+        case OP_2OVER:
+            return H_2OVER;
+        case OP_2ROT:
+            return H_2ROT;
+        case OP_2SWAP:
+            return H_2SWAP;
+        case OP_IFDUP:
+            return H_IFDUP;
+        case OP_DEPTH:
+            return H_DEPTH;
+        case OP_DROP:
+            return H_DROP;
+        case OP_DUP:
+            return H_DUP;
+        case OP_NIP:
+            return H_NIP;
+        case OP_OVER:
+            return H_OVER;
+        case OP_PICK:
+            return H_PICK;
+        case OP_ROLL:
+            return H_ROLL;
+        case OP_ROT:
+            return H_ROT;
+        case OP_SWAP:
+            return H_SWAP;
+        case OP_TUCK:
+            return H_TUCK;
+        case OP_SIZE:
+            return H_SIZE;
+        case OP_AND:
+            return H_AND;
+        case OP_OR:
+            return H_OR;
+        case OP_XOR:
+            return H_XOR;
+        case OP_INVERT:
+            return H_INVERT;
+        case OP_LSHIFT:
+            return H_LSHIFT;
+        case OP_RSHIFT:
+            return H_RSHIFT;
+        case OP_EQUAL:
+            return H_EQUAL;
+        case OP_EQUALVERIFY:
+            return H_EQUALVERIFY;
+        case OP_1ADD:
+            return H_1ADD;
+        case OP_1SUB:
+            return H_1SUB;
+        case OP_NEGATE:
+            return H_NEGATE;
+        case OP_ABS:
+            return H_ABS;
+        case OP_NOT:
+            return H_NOT;
+        case OP_0NOTEQUAL:
+            return H_0NOTEQUAL;
+        case OP_ADD:
+            return H_ADD;
+        case OP_SUB:
+            return H_SUB;
+        case OP_MUL:
+            return H_MUL;
+        case OP_DIV:
+            return H_DIV;
+        case OP_MOD:
+            return H_MOD;
+        case OP_BOOLAND:
+            return H_BOOLAND;
+        case OP_BOOLOR:
+            return H_BOOLOR;
+        case OP_NUMEQUAL:
+            return H_NUMEQUAL;
+        case OP_NUMEQUALVERIFY:
+            return H_NUMEQUALVERIFY;
+        case OP_NUMNOTEQUAL:
+            return H_NUMNOTEQUAL;
+        case OP_LESSTHAN:
+            return H_LESSTHAN;
+        case OP_GREATERTHAN:
+            return H_GREATERTHAN;
+        case OP_LESSTHANOREQUAL:
+            return H_LESSTHANOREQUAL;
+        case OP_GREATERTHANOREQUAL:
+            return H_GREATERTHANOREQUAL;
+        case OP_MIN:
+            return H_MIN;
+        case OP_MAX:
+            return H_MAX;
+        case OP_WITHIN:
+            return H_WITHIN;
+        case OP_RIPEMD160:
+            return H_RIPEMD160;
+        case OP_SHA1:
+            return H_SHA1;
+        case OP_SHA256:
+            return H_SHA256;
+        case OP_HASH160:
+            return H_HASH160;
+        case OP_HASH256:
+            return H_HASH256;
+        case OP_CAT:
+            return H_CAT;
+        case OP_SPLIT:
+            return H_SPLIT;
+        case OP_REVERSEBYTES:
+            return H_REVERSEBYTES;
+        case OP_NUM2BIN:
+            return H_NUM2BIN;
+        case OP_BIN2NUM:
+            return H_BIN2NUM;
+        default:
+            return H_COLD;
+    }
+}
+
+} // namespace
+
+ScriptProgram::ScriptProgram(const CScript &script) : _terminalError(ScriptError::OK) {
+    // Indices of the OP_IF/OP_NOTIF/OP_ELSE instructions whose branch target
+    // is still open, innermost last.
+    std::vector<uint32_t> openBranches;
+    uint32_t terminalOpNum = 0;
+
+    if (script.size() > MAX_SCRIPT_SIZE) {
+        _terminalError = ScriptError::SCRIPT_SIZE;
+    } else {
+        CScript::const_iterator pc = script.begin();
+        opcodetype opcode;
+        valtype vchPushValue;
+        int nOpCount = 0;
+        uint32_t opNum = 0;
+        for (; pc < script.end(); ++opNum) {
+            // The checks below run in the same order as in EvalScript. They do
+            // not depend on the stack, so the first one to fail ends the program.
+            terminalOpNum = opNum;
+            if (!script.GetOp(pc, opcode, vchPushValue)) {
+                _terminalError = ScriptError::BAD_OPCODE;
+                break;
+            }
+            if (vchPushValue.size() > MAX_SCRIPT_ELEMENT_SIZE) {
+                _terminalError = ScriptError::PUSH_SIZE;
+                break;
+            }
+            if (opcode > OP_16 && ++nOpCount > MAX_OPS_PER_SCRIPT) {
+                _terminalError = ScriptError::OP_COUNT;
+                break;
+            }
+            // The set of disabled opcodes does not depend on the flags.
+            if (IsOpcodeDisabled(opcode, SCRIPT_VERIFY_NONE)) {
+                _terminalError = ScriptError::DISABLED_OPCODE;
+                break;
+            }
+            // These are evaluated even in an unexecuted branch and always fail.
+            if (opcode == OP_VERIF || opcode == OP_VERNOTIF) {
+                _terminalError = ScriptError::BAD_OPCODE;
+                break;
+            }
+
+            const auto index = uint32_t(_code.size());
+            ScriptInstruction ins{};
+            ins.opcode = uint8_t(opcode);
+            ins.length = 1;
+            ins.opNum = opNum;
+
+            if (opcode <= OP_PUSHDATA4) {
+                ins.handler = CheckMinimalPush(vchPushValue, opcode) ? H_PUSH : H_PUSH_NONMINIMAL;
+            } else if (opcode == OP_1NEGATE || (OP_1 <= opcode && opcode <= OP_16)) {
+                // The minimal encoding of -1 and 1..16, as CScriptNum::getvch
+                // would produce it.
+                ins.handler = H_PUSH;
+                vchPushValue.assign(1, opcode == OP_1NEGATE ? 0x81 : uint8_t(opcode - (OP_1 - 1)));
+            } else if (opcode == OP_IF || opcode == OP_NOTIF) {
+                ins.handler = opcode == OP_IF ? H_IF : H_NOTIF;
+                openBranches.push_back(index);
+            } else if (opcode == OP_ELSE || opcode == OP_ENDIF) {
+                // The depth of the condition stack only depends on the script,
+                // so an unmatched OP_ELSE/OP_ENDIF always fails when reached.
+                if (openBranches.empty()) {
+                    _terminalError = ScriptError::UNBALANCED_CONDITIONAL;
+                    break;
+                }
+                // A branch that is not taken resumes right after the next
+                // OP_ELSE/OP_ENDIF at the same depth.
+                _code[openBranches.back()].arg = index + 1;
+                openBranches.pop_back();
+                if (opcode == OP_ELSE) {
+                    ins.handler = H_ELSE;
+                    openBranches.push_back(index);
+                } else {
+                    ins.handler = H_ENDIF;
+                }
+            } else {
+                ins.handler = HandlerForOpcode(opcode);
+            }
+
+            if (!vchPushValue.empty()) {
+                ins.dataPos = uint32_t(_data.size());
+                ins.dataSize = uint32_t(vchPushValue.size());
+                _data.insert(_data.end(), vchPushValue.begin(), vchPushValue.end());
+            }
+            _code.push_back(ins);
+        }
+        if (_terminalError == ScriptError::OK && !openBranches.empty()) {
+            _terminalError = ScriptError::UNBALANCED_CONDITIONAL;
+        }
+    }
+
+    // Branches still open skip straight to the end of the program.
+    const auto terminal = uint32_t(_code.size());
+    for (const auto index : openBranches) {
+        _code[index].arg = terminal;
+    }
+    ScriptInstruction end{};
+    end.handler = H_END;
+    end.length = 1;
+    end.opNum = terminalOpNum;
+    _code.push_back(end);
+
+    FuseSuperinstructions();
+}
+
+/**
+ * Peephole pass over the decoded program. The fused sequences are the idioms
+ * contract scripts repeat the most: reading a constant state key, picking a
+ * constant stack slot, and the DUP/EQUALVERIFY and SWAP/CAT pairs.
+ *
+ * Branch targets always follow an OP_ELSE/OP_ENDIF, which none of the fused
+ * sequences contain, so no jump can land inside a superinstruction.
+ */
+void ScriptProgram::FuseSuperinstructions() {
+    // The terminal instruction is never part of a sequence.
+    const size_t size = _code.size() - 1;
+    for (size_t i = 0; i < size; ++i) {
+        ScriptInstruction &ins = _code[i];
+        const size_t remaining = size - i;
+
+        if (ins.handler == H_PUSH && remaining >= 3 && _code[i + 1].handler == H_PUSH &&
+            _code[i + 2].handler == H_COLD && _code[i + 2].opcode == OP_KV_GET) {
+            ins.handler = H_PUSH_PUSH_KV_GET;
+            ins.length = 3;
+            i += 2;
+        } else if (ins.handler == H_PUSH && remaining >= 2 && _code[i + 1].handler == H_PICK) {
+            // Only fuse stack slots that decode like CScriptNum would, without
+            // throwing: a minimally encoded, non-negative number.
+            const Span<const uint8_t> n(_data.data() + ins.dataPos, ins.dataSize);
+            if (n.size() > 2 || !avm::IsMinimallyEncoded(n, 2) || (!n.empty() && (n.back() & 0x80))) {
+                continue;
+            }
+            ins.handler = H_PUSH_PICK;
+            ins.length = 2;
+            ins.arg = n.empty() ? 0 : (n.size() == 1 ? n[0] : n[0] | (uint32_t(n[1]) << 8));
+            i += 1;
+        } else if (ins.handler == H_DUP && remaining >= 2 && _code[i + 1].handler == H_EQUALVERIFY) {
+            ins.handler = H_DUP_EQUALVERIFY;
+            ins.length = 2;
+            i += 1;
+        } else if (ins.handler == H_SWAP && remaining >= 2 && _code[i + 1].handler == H_CAT) {
+            ins.handler = H_SWAP_CAT;
+            ins.length = 2;
+            i += 1;
+        }
+    }
+}
+namespace {
+
+const CScriptNum bnZero(0);
+const valtype vchFalse(0);
+const valtype vchTrue(1, 1);
+
+const size_t maxIntegerSize = CScriptNum::MAXIMUM_ITEM_SIZE;
+
+//! Outcome of a handler.
+enum class ScriptStep : uint8_t {
+    //! Continue at the instruction the handler left ip on.
+    Continue,
+    //! The script failed, the error has been set.
+    Fail,
+    //! The script terminated successfully.
+    Success,
+};
+
+//! Values returned by native helpers once the program has finished.
+constexpr int32_t NATIVE_FAIL = -1;
+constexpr int32_t NATIVE_SUCCESS = -2;
+
+} // namespace
+
+/**
+ * The handlers are member functions of the frame so that the threaded core can
+ * inline all of them into a single function, while native code calls them one
+ * by one through GetScriptNativeHelper.
+ */
+struct ScriptProgramFrame {
+    StackT &stack;
+    StackT altstack;
+    const ScriptProgram &program;
+    const uint8_t *const pool;
+    const ScriptInstruction *const code;
+    const uint32_t flags;
+    const BaseSignatureChecker &checker;
+    ScriptExecutionMetrics &metrics;
+    ScriptExecutionContextOpt const &context;
+    ScriptStateContext &stateContext;
+    ScriptError *const serror;
+    unsigned int *const serror_op_num;
+    //! An exception no handler maps to a ScriptError, held by a native helper
+    //! so that it does not unwind through native code. Rethrown once the
+    //! native code returned.
+    std::exception_ptr pendingException;
+
+    ScriptProgramFrame(StackT &stackIn, const ScriptProgram &programIn, uint32_t flagsIn,
+                       const BaseSignatureChecker &checkerIn, ScriptExecutionMetrics &metricsIn,
+                       ScriptExecutionContextOpt const &contextIn, ScriptStateContext &stateContextIn,
+                       ScriptError *serrorIn, unsigned int *serror_op_numIn)
+        : stack(stackIn), program(programIn), pool(programIn.data().data()), code(programIn.code().data()),
+          flags(flagsIn), checker(checkerIn), metrics(metricsIn), context(contextIn), stateContext(stateContextIn),
+          serror(serrorIn), serror_op_num(serror_op_numIn) {}
+
+    ScriptStep Fail(const ScriptInstruction *ip, ScriptError err) {
+        set_error_op_num(serror_op_num, ip->opNum);
+        set_error(serror, err);
+        return ScriptStep::Fail;
+    }
+
+    ScriptStep Succeed(const ScriptInstruction *ip) {
+        set_error_op_num(serror_op_num, ip->opNum);
+        set_success(serror);
+        return ScriptStep::Success;
+    }
+
+    //! The stack holds fewer elements than the handler of ip needs.
+    ScriptStep StackUnderflow(const ScriptInstruction *ip) {
+        // OP_EQUAL and OP_EQUALVERIFY read the top element before checking
+        // the depth, which EvalScript reports as an exception.
+        if (stack.empty() && (ip->handler == H_EQUAL || ip->handler == H_EQUALVERIFY)) {
+            return Fail(ip, ScriptError::UNKNOWN);
+        }
+        return Fail(ip, ScriptError::INVALID_STACK_OPERATION);
+    }
+
+#define SCRIPT_HANDLER_DECLARE(name, arity) SCRIPT_ALWAYS_INLINE ScriptStep Op_##name(const ScriptInstruction *&ip);
+    SCRIPT_HANDLERS(SCRIPT_HANDLER_DECLARE)
+#undef SCRIPT_HANDLER_DECLARE
+};
+
+//
+// Handlers. Each one is entered with at least its arity on the stack, and
+// either fails or leaves ip on the instruction to continue at.
+//
+
+#define SCRIPT_OP(name) inline ScriptStep ScriptProgramFrame::Op_##name(const ScriptInstruction *&ip)
+
+#define SCRIPT_OP_ALIAS(name, impl)                                                                                    \
+    SCRIPT_OP(name) { return Op_##impl(ip); }
+
+// Unchecked stack access: the depth has been checked against HANDLER_ARITY.
+#define TOP(i) (stack.end()[(i)])
+
+#define FAIL(err)                                                                                                      \
+    do {                                                                                                               \
+        return Fail(ip, (err));                                                                                        \
+    } while (0)
+
+#define CHECK_STACK_SIZE()                                                                                             \
+    do {                                                                                                               \
+        if (stack.size() + altstack.size() > MAX_STACK_SIZE) {                                                         \
+            FAIL(ScriptError::STACK_SIZE);                                                                             \
+        }                                                                                                              \
+    } while (0)
+
+#define NEXT()                                                                                                         \
+    do {                                                                                                               \
+        CHECK_STACK_SIZE();                                                                                            \
+        ++ip;                                                                                                          \
+        return ScriptStep::Continue;                                                                                   \
+    } while (0)
+
+#define JUMP()                                                                                                         \
+    do {                                                                                                               \
+        CHECK_STACK_SIZE();                                                                                            \
+        ip = code + ip->arg;                                                                                           \
+        return ScriptStep::Continue;                                                                                   \
+    } while (0)
+
+SCRIPT_OP(END) {
+    if (program.terminalError() != ScriptError::OK) {
+        FAIL(program.terminalError());
+    }
+    return Succeed(ip);
+}
+
+SCRIPT_OP(PUSH) {
+    stack.emplace_back(pool + ip->dataPos, pool + ip->dataPos + ip->dataSize);
+    NEXT();
+}
+
+SCRIPT_OP(PUSH_NONMINIMAL) { FAIL(ScriptError::MINIMALDATA); }
+
+SCRIPT_OP(NOP) { NEXT(); }
+
+SCRIPT_OP(NOP_UPGRADABLE) {
+    if (flags & SCRIPT_VERIFY_DISCOURAGE_UPGRADABLE_NOPS) {
+        FAIL(ScriptError::DISCOURAGE_UPGRADABLE_NOPS);
+    }
+    NEXT();
+}
+
+SCRIPT_OP(IF) {
+    if (stack.empty()) {
+        FAIL(ScriptError::UNBALANCED_CONDITIONAL);
+    }
+    valtype &vch = TOP(-1);
+    if (vch.size() > 1) {
+        FAIL(ScriptError::MINIMALIF);
+    }
+    if (vch.size() == 1 && vch[0] != 1) {
+        FAIL(ScriptError::MINIMALIF);
+    }
+    bool fValue = CastToBool(vch);
+    if (ip->handler == H_NOTIF) {
+        fValue = !fValue;
+    }
+    stack.pop_back();
+    if (fValue) {
+        NEXT();
+    }
+    JUMP();
+}
+
+// Only reached at the end of a taken branch: the other branch is
+// skipped. Untaken branches jump past their OP_ELSE.
+SCRIPT_OP(ELSE) { JUMP(); }
+
+SCRIPT_OP(ENDIF) { NEXT(); }
+
+SCRIPT_OP(VERIFY) {
+    if (!CastToBool(TOP(-1))) {
+        FAIL(ScriptError::VERIFY);
+    }
+    stack.pop_back();
+    NEXT();
+}
+
+SCRIPT_OP(RETURN) {
+    if (!stack.empty()) {
+        FAIL(ScriptError::OP_RETURN);
+    }
+    // Terminate the execution as successful, as EvalScript does.
+    return Succeed(ip);
+}
+
+SCRIPT_OP(TOALTSTACK) {
+    altstack.push_back(std::move(TOP(-1)));
+    stack.pop_back();
+    NEXT();
+}
+
+SCRIPT_OP(FROMALTSTACK) {
+    if (altstack.empty()) {
+        FAIL(ScriptError::INVALID_ALTSTACK_OPERATION);
+    }
+    stack.push_back(std::move(altstack.back()));
+    altstack.pop_back();
+    NEXT();
+}
+
+SCRIPT_OP(2DROP) {
+    stack.pop_back();
+    stack.pop_back();
+    NEXT();
+}
+
+SCRIPT_OP(2DUP) {
+    stack.reserve(stack.size() + 2);
+    stack.push_back(TOP(-2));
+    stack.push_back(TOP(-2));
+    NEXT();
+}
+
+SCRIPT_OP(3DUP) {
+    stack.reserve(stack.size() + 3);
+    stack.push_back(TOP(-3));
+    stack.push_back(TOP(-3));
+    stack.push_back(TOP(-3));
+    NEXT();
+}
+
+SCRIPT_OP(2OVER) {
+    stack.reserve(stack.size() + 2);
+    stack.push_back(TOP(-4));
+    stack.push_back(TOP(-4));
+    NEXT();
+}
+
+SCRIPT_OP(2ROT) {
+    // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
+    std::rotate(stack.end() - 6, stack.end() - 4, stack.end());
+    NEXT();
+}
+
+SCRIPT_OP(2SWAP) {
+    swap(TOP(-4), TOP(-2));
+    swap(TOP(-3), TOP(-1));
+    NEXT();
+}
+
+SCRIPT_OP(IFDUP) {
+    if (CastToBool(TOP(-1))) {
+        stack.push_back(TOP(-1));
+    }
+    NEXT();
+}
+
+SCRIPT_OP(DEPTH) {
+    const CScriptNum bn(avm::bigint{stack.size()});
+    stack.push_back(bn.getvch());
+    NEXT();
+}
+
+SCRIPT_OP(DROP) {
+    stack.pop_back();
+    NEXT();
+}
+
+SCRIPT_OP(DUP) {
+    stack.push_back(TOP(-1));
+    NEXT();
+}
+
+SCRIPT_OP(NIP) {
+    stack.erase(stack.end() - 2);
+    NEXT();
+}
+
+SCRIPT_OP(OVER) {
+    stack.push_back(TOP(-2));
+    NEXT();
+}
+
+SCRIPT_OP(PICK) {
+    auto const sn = CScriptNum(TOP(-1), maxIntegerSize);
+    const auto n{sn.getSizeType()};
+    stack.pop_back();
+    if (sn < 0 || sn >= stack.size()) {
+        FAIL(ScriptError::INVALID_STACK_OPERATION);
+    }
+    const auto it = stack.end() - n - 1;
+    if (ip->handler == H_ROLL) {
+        std::rotate(it, it + 1, stack.end());
+    } else {
+        stack.push_back(*it);
+    }
+    NEXT();
+}
+
+SCRIPT_OP(ROT) {
+    swap(TOP(-3), TOP(-2));
+    swap(TOP(-2), TOP(-1));
+    NEXT();
+}
+
+SCRIPT_OP(SWAP) {
+    swap(TOP(-2), TOP(-1));
+    NEXT();
+}
+
+SCRIPT_OP(TUCK) {
+    valtype vch = TOP(-1);
+    stack.insert(stack.end() - 2, std::move(vch));
+    NEXT();
+}
+
+SCRIPT_OP(SIZE) {
+    CScriptNum bn(avm::bigint{TOP(-1).size()});
+    stack.push_back(bn.getvch());
+    NEXT();
+}
+
+SCRIPT_OP(AND) {
+    valtype &vch1 = TOP(-2);
+    valtype &vch2 = TOP(-1);
+    if (vch1.size() != vch2.size()) {
+        FAIL(ScriptError::INVALID_OPERAND_SIZE);
+    }
+    if (ip->handler == H_AND) {
+        bitops::And(vch1.data(), vch2.data(), vch1.size());
+    } else if (ip->handler == H_OR) {
+        bitops::Or(vch1.data(), vch2.data(), vch1.size());
+    } else {
+        bitops::Xor(vch1.data(), vch2.data(), vch1.size());
+    }
+    stack.pop_back();
+    NEXT();
+}
+
+SCRIPT_OP(INVERT) {
+    valtype &vch = TOP(-1);
+    bitops::Invert(vch.data(), vch.size());
+    NEXT();
+}
+
+SCRIPT_OP(LSHIFT) {
+    const CScriptNum n(TOP(-1), maxIntegerSize);
+    if (n < 0) {
+        FAIL(ScriptError::INVALID_NUMBER_RANGE);
+    }
+    stack.pop_back();
+    valtype &values = TOP(-1);
+    const size_t bits = n >= values.size() * bitsPerByte ? values.size() * bitsPerByte : n.getint();
+    if (ip->handler == H_LSHIFT) {
+        bitops::LShift(values.data(), values.size(), bits);
+    } else {
+        bitops::RShift(values.data(), values.size(), bits);
+    }
+    NEXT();
+}
+
+SCRIPT_OP(EQUAL) {
+    bool fEqual = (TOP(-2) == TOP(-1));
+    stack.pop_back();
+    stack.pop_back();
+    if (ip->handler == H_EQUALVERIFY) {
+        if (!fEqual) {
+            stack.push_back(vchFalse);
+            FAIL(ScriptError::EQUALVERIFY);
+        }
+        NEXT();
+    }
+    stack.push_back(fEqual ? vchTrue : vchFalse);
+    NEXT();
+}
+
+SCRIPT_OP(1ADD) {
+    CScriptNum bn(TOP(-1), maxIntegerSize);
+    switch (ip->handler) {
+        case H_1ADD:
+            bn += CScriptNum{avm::bigint{1}};
+            break;
+        case H_1SUB:
+            bn -= CScriptNum{avm::bigint{1}};
+            break;
+        case H_NEGATE:
+            bn = -bn;
+            break;
+        case H_ABS:
+            if (bn < bnZero) {
+                bn = -bn;
+            }
+            break;
+        case H_NOT:
+            bn = (bn == bnZero);
+            break;
+        default:
+            bn = (bn != bnZero);
+            break;
+    }
+    TOP(-1) = bn.getvch();
+    NEXT();
+}
+
+SCRIPT_OP(ADD) {
+    CScriptNum bn1(TOP(-2), maxIntegerSize);
+    CScriptNum bn2(TOP(-1), maxIntegerSize);
+    CScriptNum bn;
+    switch (ip->handler) {
+        case H_ADD:
+            bn = bn1 + bn2;
+            break;
+        case H_SUB:
+            bn = bn1 - bn2;
+            break;
+        case H_MUL:
+            bn = bn1 * bn2;
+            break;
+        case H_DIV:
+            if (bn2 == bnZero) {
+                FAIL(ScriptError::DIV_BY_ZERO);
+            }
+            bn = bn1 / bn2;
+            break;
+        case H_MOD:
+            if (bn2 == bnZero) {
+                FAIL(ScriptError::MOD_BY_ZERO);
+            }
+            bn = bn1 % bn2;
+            break;
+        case H_BOOLAND:
+            bn = (bn1 != bnZero && bn2 != bnZero);
+            break;
+        case H_BOOLOR:
+            bn = (bn1 != bnZero || bn2 != bnZero);
+            break;
+        case H_NUMEQUAL:
+        case H_NUMEQUALVERIFY:
+            bn = (bn1 == bn2);
+            break;
+        case H_NUMNOTEQUAL:
+            bn = (bn1 != bn2);
+            break;
+        case H_LESSTHAN:
+            bn = (bn1 < bn2);
+            break;
+        case H_GREATERTHAN:
+            bn = (bn1 > bn2);
+            break;
+        case H_LESSTHANOREQUAL:
+            bn = (bn1 <= bn2);
+            break;
+        case H_GREATERTHANOREQUAL:
+            bn = (bn1 >= bn2);
+            break;
+        case H_MIN:
+            bn = (bn1 < bn2 ? bn1 : bn2);
+            break;
+        default:
+            bn = (bn1 > bn2 ? bn1 : bn2);
+            break;
+    }
+    stack.pop_back();
+    TOP(-1) = bn.getvch();
+    if (ip->handler == H_NUMEQUALVERIFY) {
+        if (!CastToBool(TOP(-1))) {
+            FAIL(ScriptError::NUMEQUALVERIFY);
+        }
+        stack.pop_back();
+    }
+    NEXT();
+}
+
+SCRIPT_OP(WITHIN) {
+    CScriptNum bn1(TOP(-3), maxIntegerSize);
+    CScriptNum bn2(TOP(-2), maxIntegerSize);
+    CScriptNum bn3(TOP(-1), maxIntegerSize);
+    bool fValue = (bn2 <= bn1 && bn1 < bn3);
+    stack.pop_back();
+    stack.pop_back();
+    TOP(-1) = fValue ? vchTrue : vchFalse;
+    NEXT();
+}
+
+SCRIPT_OP(RIPEMD160) {
+    valtype &vch = TOP(-1);
+    valtype vchHash(CRIPEMD160::OUTPUT_SIZE);
+    CRIPEMD160().Write(vch.data(), vch.size()).Finalize(vchHash.data());
+    vch = std::move(vchHash);
+    NEXT();
+}
+
+SCRIPT_OP(SHA1) {
+    valtype &vch = TOP(-1);
+    valtype vchHash(CSHA1::OUTPUT_SIZE);
+    CSHA1().Write(vch.data(), vch.size()).Finalize(vchHash.data());
+    vch = std::move(vchHash);
+    NEXT();
+}
+
+SCRIPT_OP(SHA256) {
+    valtype &vch = TOP(-1);
+    valtype vchHash(CSHA256::OUTPUT_SIZE);
+    CSHA256().Write(vch.data(), vch.size()).Finalize(vchHash.data());
+    vch = std::move(vchHash);
+    NEXT();
+}
+
+SCRIPT_OP(HASH160) {
+    valtype &vch = TOP(-1);
+    valtype vchHash(CHash160::OUTPUT_SIZE);
+    CHash160().Write(vch).Finalize(vchHash);
+    vch = std::move(vchHash);
+    NEXT();
+}
+
+SCRIPT_OP(HASH256) {
+    valtype &vch = TOP(-1);
+    valtype vchHash(CHash256::OUTPUT_SIZE);
+    CHash256().Write(vch).Finalize(vchHash);
+    vch = std::move(vchHash);
+    NEXT();
+}
+
+SCRIPT_OP(CAT) {
+    valtype &vch1 = TOP(-2);
+    valtype &vch2 = TOP(-1);
+    if (vch1.size() + vch2.size() > MAX_SCRIPT_ELEMENT_SIZE) {
+        FAIL(ScriptError::PUSH_SIZE);
+    }
+    vch1.insert(vch1.end(), vch2.begin(), vch2.end());
+    stack.pop_back();
+    NEXT();
+}
+
+SCRIPT_OP(SPLIT) {
+    valtype &data = TOP(-2);
+    auto const n = CScriptNum(TOP(-1), maxIntegerSize);
+    if (n < 0 || n > data.size()) {
+        FAIL(ScriptError::INVALID_SPLIT_RANGE);
+    }
+    const auto position{n.getSizeType()};
+    valtype n2(data.begin() + position, data.end());
+    data.resize(position);
+    TOP(-1) = std::move(n2);
+    NEXT();
+}
+
+SCRIPT_OP(REVERSEBYTES) {
+    valtype &data = TOP(-1);
+    bitops::Reverse(data.data(), data.size());
+    NEXT();
+}
+
+SCRIPT_OP(NUM2BIN) {
+    const CScriptNum n(TOP(-1), maxIntegerSize);
+    if (n < 0 || n > std::numeric_limits<int32_t>::max()) {
+        FAIL(ScriptError::PUSH_SIZE);
+    }
+    const auto size{n.getSizeType()};
+    if (size > MAX_SCRIPT_ELEMENT_SIZE) {
+        FAIL(ScriptError::PUSH_SIZE);
+    }
+    stack.pop_back();
+    auto &rawnum = TOP(-1);
+    avm::MinimallyEncode(rawnum);
+    if (rawnum.size() > size) {
+        FAIL(ScriptError::IMPOSSIBLE_ENCODING);
+    }
+    if (rawnum.size() < size) {
+        uint8_t signbit = 0x00;
+        if (rawnum.size() > 0) {
+            signbit = rawnum.back() & 0x80;
+            rawnum[rawnum.size() - 1] &= 0x7f;
+        }
+        rawnum.resize(size, 0x00);
+        rawnum.back() = signbit;
+    }
+    NEXT();
+}
+
+SCRIPT_OP(BIN2NUM) {
+    auto &n = TOP(-1);
+    avm::MinimallyEncode(n);
+    if (!avm::IsMinimallyEncoded(n, maxIntegerSize)) {
+        FAIL(ScriptError::INVALID_NUMBER_RANGE);
+    }
+    NEXT();
+}
+
+SCRIPT_OP(COLD) {
+    const CScript single(&ip->opcode, &ip->opcode + 1);
+    if (!EvalScript(stack, single, flags, checker, metrics, context, stateContext, serror)) {
+        set_error_op_num(serror_op_num, ip->opNum);
+        return ScriptStep::Fail;
+    }
+    NEXT();
+}
+
+//
+// Superinstructions. Each one leaves ip on the part being executed so
+// that FAIL reports the op number of the opcode that failed, and on the
+// last part when it completes.
+//
+
+SCRIPT_OP(PUSH_PUSH_KV_GET) {
+    // <keyspace> <key> OP_KV_GET: the key is read straight from the
+    // program instead of being pushed and popped again.
+    if (stack.size() + altstack.size() + 1 > MAX_STACK_SIZE) {
+        FAIL(ScriptError::STACK_SIZE);
+    }
+    ++ip;
+    if (stack.size() + altstack.size() + 2 > MAX_STACK_SIZE) {
+        FAIL(ScriptError::STACK_SIZE);
+    }
+    ++ip;
+    if (!context) {
+        FAIL(ScriptError::CONTEXT_NOT_PRESENT);
+    }
+    const Span<const uint8_t> keySpace(pool + ip[-2].dataPos, ip[-2].dataSize);
+    const Span<const uint8_t> keyName(pool + ip[-1].dataPos, ip[-1].dataSize);
+    valtype value;
+    if (!stateContext.contractStateGet(keySpace, keyName, value)) {
+        FAIL(ScriptError::INVALID_AVM_STATE_KEY_NOT_FOUND);
+    }
+    stack.push_back(std::move(value));
+    NEXT();
+}
+
+SCRIPT_OP(PUSH_PICK) {
+    // <n> OP_PICK with a constant, non-negative n.
+    if (stack.size() + altstack.size() + 1 > MAX_STACK_SIZE) {
+        FAIL(ScriptError::STACK_SIZE);
+    }
+    const uint32_t n = ip->arg;
+    ++ip;
+    if (n >= stack.size()) {
+        FAIL(ScriptError::INVALID_STACK_OPERATION);
+    }
+    stack.push_back(TOP(-int64_t(n) - 1));
+    NEXT();
+}
+
+SCRIPT_OP(DUP_EQUALVERIFY) {
+    // Comparing the top element with its own copy always succeeds.
+    if (stack.size() + altstack.size() + 1 > MAX_STACK_SIZE) {
+        FAIL(ScriptError::STACK_SIZE);
+    }
+    ++ip;
+    stack.pop_back();
+    NEXT();
+}
+
+SCRIPT_OP(SWAP_CAT) {
+    // (x1 x2 -- x2x1)
+    ++ip;
+    valtype &vch1 = TOP(-2);
+    valtype &vch2 = TOP(-1);
+    if (vch1.size() + vch2.size() > MAX_SCRIPT_ELEMENT_SIZE) {
+        FAIL(ScriptError::PUSH_SIZE);
+    }
+    vch2.insert(vch2.end(), vch1.begin(), vch1.end());
+    vch1 = std::move(vch2);
+    stack.pop_back();
+    NEXT();
+}
+
+// Handlers shared by several opcodes tell them apart by ip->handler.
+SCRIPT_OP_ALIAS(NOTIF, IF)
+SCRIPT_OP_ALIAS(ROLL, PICK)
+SCRIPT_OP_ALIAS(OR, AND)
+SCRIPT_OP_ALIAS(XOR, AND)
+SCRIPT_OP_ALIAS(RSHIFT, LSHIFT)
+SCRIPT_OP_ALIAS(EQUALVERIFY, EQUAL)
+SCRIPT_OP_ALIAS(1SUB, 1ADD)
+SCRIPT_OP_ALIAS(NEGATE, 1ADD)
+SCRIPT_OP_ALIAS(ABS, 1ADD)
+SCRIPT_OP_ALIAS(NOT, 1ADD)
+SCRIPT_OP_ALIAS(0NOTEQUAL, 1ADD)
+SCRIPT_OP_ALIAS(SUB, ADD)
+SCRIPT_OP_ALIAS(MUL, ADD)
+SCRIPT_OP_ALIAS(DIV, ADD)
+SCRIPT_OP_ALIAS(MOD, ADD)
+SCRIPT_OP_ALIAS(BOOLAND, ADD)
+SCRIPT_OP_ALIAS(BOOLOR, ADD)
+SCRIPT_OP_ALIAS(NUMEQUAL, ADD)
+SCRIPT_OP_ALIAS(NUMEQUALVERIFY, ADD)
+SCRIPT_OP_ALIAS(NUMNOTEQUAL, ADD)
+SCRIPT_OP_ALIAS(LESSTHAN, ADD)
+SCRIPT_OP_ALIAS(GREATERTHAN, ADD)
+SCRIPT_OP_ALIAS(LESSTHANOREQUAL, ADD)
+SCRIPT_OP_ALIAS(GREATERTHANOREQUAL, ADD)
+SCRIPT_OP_ALIAS(MIN, ADD)
+SCRIPT_OP_ALIAS(MAX, ADD)
+
+#undef JUMP
+#undef NEXT
+#undef CHECK_STACK_SIZE
+#undef FAIL
+#undef TOP
+#undef SCRIPT_OP_ALIAS
+#undef SCRIPT_OP
+
+namespace {
+
+/**
+ * Native helper for one handler. Exceptions are handled here as in the
+ * threaded core, as native code has no unwind information.
+ */
+template <uint8_t arity, ScriptStep (ScriptProgramFrame::*op)(const ScriptInstruction *&)>
+int32_t NativeStep(ScriptProgramFrame *frame, const ScriptInstruction *ip) {
+    ScriptStep step;
+    try {
+        step = frame->stack.size() < arity ? frame->StackUnderflow(ip) : (frame->*op)(ip);
+    } catch (const avm::BigIntException &) {
+        step = frame->Fail(ip, ScriptError::SCRIPT_ERR_BIG_INT);
+    } catch (const std::exception &ex) {
+        std::cerr << ex.what() << std::endl;
+        step = frame->Fail(ip, ScriptError::UNKNOWN);
+    } catch (...) {
+        frame->pendingException = std::current_exception();
+        return NATIVE_FAIL;
+    }
+    switch (step) {
+        case ScriptStep::Continue:
+            return int32_t(ip - frame->code);
+        case ScriptStep::Success:
+            return NATIVE_SUCCESS;
+        default:
+            return NATIVE_FAIL;
+    }
+}
+
+const ScriptNativeHelper NATIVE_HELPERS[H_COUNT] = {
+#define SCRIPT_HANDLER_NATIVE(name, arity) &NativeStep<arity, &ScriptProgramFrame::Op_##name>,
+    SCRIPT_HANDLERS(SCRIPT_HANDLER_NATIVE)
+#undef SCRIPT_HANDLER_NATIVE
+};
+
+} // namespace
+
+ScriptNativeHelper GetScriptNativeHelper(const ScriptInstruction &ins) {
+    assert(ins.handler < H_COUNT);
+    return NATIVE_HELPERS[ins.handler];
+}
+
+ScriptInstructionFlow GetScriptInstructionFlow(const ScriptInstruction &ins) {
+    switch (ins.handler) {
+        case H_IF:
+        case H_NOTIF:
+            return ScriptInstructionFlow::Branch;
+        case H_ELSE:
+            return ScriptInstructionFlow::Jump;
+        case H_END:
+            return ScriptInstructionFlow::End;
+        default:
+            return ScriptInstructionFlow::Next;
+    }
+}
+
+bool EvalScriptProgram(StackT &stack, const ScriptProgram &program, uint32_t flags,
+                       const BaseSignatureChecker &checker, ScriptExecutionMetrics &metrics,
+                       ScriptExecutionContextOpt const &context, ScriptStateContext &stateContext,
+                       ScriptError *serror, unsigned int *serror_op_num) {
+    set_error(serror, ScriptError::UNKNOWN);
+    set_error_op_num(serror_op_num, 0);
+
+    ScriptProgramFrame frame(stack, program, flags, checker, metrics, context, stateContext, serror, serror_op_num);
+    const ScriptInstruction *ip = frame.code;
+
+#ifdef SCRIPT_THREADED_DISPATCH
+    static const void *const dispatchTable[H_COUNT] = {
+#define SCRIPT_HANDLER_LABEL(name, arity) &&L_##name,
+        SCRIPT_HANDLERS(SCRIPT_HANDLER_LABEL)
+#undef SCRIPT_HANDLER_LABEL
+    };
+#define HANDLER(name) L_##name
+#define DISPATCH()                                                                                                     \
+    do {                                                                                                               \
+        if (stack.size() < HANDLER_ARITY[ip->handler]) {                                                               \
+            goto stack_underflow;                                                                                      \
+        }                                                                                                              \
+        goto *dispatchTable[ip->handler];                                                                              \
+    } while (0)
+#else
+#define HANDLER(name) case H_##name
+#define DISPATCH() goto dispatch
+#endif
+
+// Runs a handler, then dispatches the instruction it left ip on.
+#define STEP(handlerStep)                                                                                              \
+    do {                                                                                                               \
+        const ScriptStep step = (handlerStep);                                                                         \
+        if (step == ScriptStep::Continue) {                                                                            \
+            DISPATCH();                                                                                                \
+        }                                                                                                              \
+        return step == ScriptStep::Success;                                                                            \
+    } while (0)
+
+    try {
+#ifdef SCRIPT_THREADED_DISPATCH
+        DISPATCH();
+#else
+    dispatch:
+        if (stack.size() < HANDLER_ARITY[ip->handler]) {
+            goto stack_underflow;
+        }
+        switch (ip->handler) {
+#endif
+
+#define SCRIPT_HANDLER_STEP(name, arity)                                                                               \
+    HANDLER(name) : STEP(frame.Op_##name(ip));
+        SCRIPT_HANDLERS(SCRIPT_HANDLER_STEP)
+#undef SCRIPT_HANDLER_STEP
+
+#ifndef SCRIPT_THREADED_DISPATCH
+        default:
+            assert(!"invalid handler");
+            frame.Fail(ip, ScriptError::UNKNOWN);
+            return false;
+        }
+#endif
+
+    stack_underflow:
+        frame.StackUnderflow(ip);
+        return false;
+    } catch (const avm::BigIntException &) {
+        frame.Fail(ip, ScriptError::SCRIPT_ERR_BIG_INT);
+        return false;
+    } catch (const std::exception &ex) {
+        std::cerr << ex.what() << std::endl;
+        frame.Fail(ip, ScriptError::UNKNOWN);
+        return false;
+    }
+
+#undef STEP
+#undef DISPATCH
+#undef HANDLER
+}
+
+bool EvalScriptNative(StackT &stack, const ScriptProgram &program, ScriptNativeEntry entry, uint32_t flags,
+                      const BaseSignatureChecker &checker, ScriptExecutionMetrics &metrics,
+                      ScriptExecutionContextOpt const &context, ScriptStateContext &stateContext,
+                      ScriptError *serror, unsigned int *serror_op_num) {
+    set_error(serror, ScriptError::UNKNOWN);
+    set_error_op_num(serror_op_num, 0);
+
+    ScriptProgramFrame frame(stack, program, flags, checker, metrics, context, stateContext, serror, serror_op_num);
+    const int32_t result = entry(&frame);
+    if (frame.pendingException) {
+        std::rethrow_exception(frame.pendingException);
+    }
+    return result == NATIVE_SUCCESS;
+}
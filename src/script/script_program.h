@@ -0,0 +1,127 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <script/interpreter.h>
+#include <script/script.h>
+#include <script/script_error.h>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A single pre-decoded instruction of a ScriptProgram.
+ *
+ * Push data lives in the program's data pool and is referenced by offset so
+ * the instruction array stays compact and trivially copyable.
+ */
+struct ScriptInstruction {
+    //! Index into the threaded interpreter's handler table.
+    uint8_t handler;
+    //! The original opcode, used by handlers shared between several opcodes.
+    uint8_t opcode;
+    //! Number of script opcodes covered: more than one for superinstructions.
+    uint8_t length;
+    //! Index of the opcode in the original script, reported as serror_op_num.
+    uint32_t opNum;
+    //! For OP_IF/OP_NOTIF/OP_ELSE: the instruction to continue at when the
+    //! branch that follows is not taken. For superinstructions: an immediate
+    //! operand decoded from the fused pushes.
+    uint32_t arg;
+    //! Push data offset and size in ScriptProgram::data.
+    uint32_t dataPos;
+    uint32_t dataSize;
+};
+
+/**
+ * A script decoded once into a flat instruction array for the threaded
+ * interpreter core (see EvalScriptProgram).
+ *
+ * Everything EvalScript checks without looking at the stack is resolved while
+ * decoding: push sizes, the op count limit, disabled and reserved opcodes,
+ * minimal push encoding and the OP_IF/OP_ELSE/OP_ENDIF structure. A check
+ * that fails turns into the terminal instruction at the position where the
+ * reference loop would have failed, so errors and op numbers still surface in
+ * execution order.
+ *
+ * Common opcode sequences are then fused into superinstructions. A fused
+ * instruction replaces the handler of the first instruction of the sequence
+ * and leaves the others in place, so errors raised by any part of it are still
+ * reported with the op number of the opcode that raised them.
+ *
+ * The program does not reference the script it was decoded from.
+ */
+class ScriptProgram {
+public:
+    explicit ScriptProgram(const CScript &script);
+
+    const std::vector<ScriptInstruction> &code() const { return _code; }
+    const std::vector<uint8_t> &data() const { return _data; }
+
+    //! Error raised by the terminal instruction, ScriptError::OK if the script
+    //! decodes cleanly and its conditionals are balanced.
+    ScriptError terminalError() const { return _terminalError; }
+
+private:
+    void FuseSuperinstructions();
+
+    std::vector<ScriptInstruction> _code;
+    std::vector<uint8_t> _data;
+    ScriptError _terminalError;
+};
+
+/**
+ * Execution state of a program, shared by the threaded core and by native code
+ * compiled from the program (see script_jit.h).
+ */
+struct ScriptProgramFrame;
+
+/**
+ * Executes one instruction, every part of it for a superinstruction, on behalf
+ * of native code. Returns the index of the instruction to continue at, or a
+ * negative value once the program has finished.
+ */
+using ScriptNativeHelper = int32_t (*)(ScriptProgramFrame *frame, const ScriptInstruction *ip);
+
+/** Native code compiled from a program: runs it to completion. */
+using ScriptNativeEntry = int32_t (*)(ScriptProgramFrame *frame);
+
+/** How control leaves an instruction once its helper returned. */
+enum class ScriptInstructionFlow {
+    //! Continues at the instruction following the ones it covers.
+    Next,
+    //! Continues at the next instruction or at ScriptInstruction::arg.
+    Branch,
+    //! Always continues at ScriptInstruction::arg.
+    Jump,
+    //! The terminal instruction, which never continues.
+    End,
+};
+
+ScriptNativeHelper GetScriptNativeHelper(const ScriptInstruction &ins);
+ScriptInstructionFlow GetScriptInstructionFlow(const ScriptInstruction &ins);
+
+/**
+ * Threaded-code interpreter core: evaluates a pre-decoded program, jumping
+ * from handler to handler through a table of label addresses (computed goto)
+ * where the compiler supports it, and through a switch loop otherwise.
+ *
+ * Produces the same result, ScriptError and serror_op_num as EvalScript on
+ * the script the program was decoded from. EvalScript remains the reference
+ * implementation.
+ */
+bool EvalScriptProgram(StackT &stack, const ScriptProgram &program, uint32_t flags,
+                       const BaseSignatureChecker &checker, ScriptExecutionMetrics &metrics,
+                       ScriptExecutionContextOpt const &context, ScriptStateContext &stateContext,
+                       ScriptError *serror = nullptr, unsigned int *serror_op_num = nullptr);
+
+/**
+ * Evaluates a program through native code compiled from it. Same contract as
+ * EvalScriptProgram.
+ */
+bool EvalScriptNative(StackT &stack, const ScriptProgram &program, ScriptNativeEntry entry, uint32_t flags,
+                      const BaseSignatureChecker &checker, ScriptExecutionMetrics &metrics,
+                      ScriptExecutionContextOpt const &context, ScriptStateContext &stateContext,
+                      ScriptError *serror = nullptr, unsigned int *serror_op_num = nullptr);
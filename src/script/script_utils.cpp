@@ -9,4 +9,57 @@
 #include <util/strencodings.h>
 #include <script/interpreter.h>
 
-using json = nlohmann::json; 
\ No newline at end of file
+using json = nlohmann::json;
+
+StateResult<std::vector<uint8_t>>
+CalculateStateHashV2(const std::vector<uint8_t> &prevHash, const ContractStateDigests &digests,
+                     const json &stateUpdates, const json &stateDeletes, const json &ftIncoming,
+                     const json &nftIncoming, const json &ftBalancesUpdates, const json &nftBalancesUpdates,
+                     const json &ftWithdraws, const json &nftWithdraws) {
+    using Layout = StatePreimageReader::Layout;
+    StatePreimageReader readers[] = {
+        {nftIncoming, Layout::NftBalances},
+        {ftIncoming, Layout::FtBalances},
+        {stateUpdates, Layout::State},
+        {stateDeletes, Layout::Deletes},
+        {nftBalancesUpdates, Layout::NftBalances},
+        {ftBalancesUpdates, Layout::FtBalances},
+        {nftWithdraws, Layout::NftWithdraws},
+        {ftWithdraws, Layout::FtWithdraws},
+    };
+    constexpr size_t count = sizeof(readers) / sizeof(readers[0]);
+    SHA256MultiSource *sources[count];
+    for (size_t i = 0; i < count; i++) {
+        sources[i] = &readers[i];
+    }
+    uint8_t hashes[count * CSHA256::OUTPUT_SIZE];
+    SHA256Multi(sources, hashes, count);
+    for (const StatePreimageReader &reader : readers) {
+        if (reader.error() != StateError::OK) {
+            return reader.error();
+        }
+    }
+    auto componentHash = [&](size_t i) { return hashes + i * CSHA256::OUTPUT_SIZE; };
+
+    std::vector<uint8_t> stateFinalHash = digests.stateHash();
+    std::vector<uint8_t> nftBalancesHash = digests.nftBalancesHash();
+    std::vector<uint8_t> ftBalancesHash = digests.ftBalancesHash();
+
+    // Store the updated state hash
+    std::vector<uint8_t> vchHash(32);
+    CSHA256()
+        .Write(prevHash.data(), prevHash.size())
+        .Write(componentHash(0), CSHA256::OUTPUT_SIZE)
+        .Write(componentHash(1), CSHA256::OUTPUT_SIZE)
+        .Write(stateFinalHash.data(), stateFinalHash.size())
+        .Write(componentHash(2), CSHA256::OUTPUT_SIZE)
+        .Write(componentHash(3), CSHA256::OUTPUT_SIZE)
+        .Write(nftBalancesHash.data(), nftBalancesHash.size())
+        .Write(ftBalancesHash.data(), ftBalancesHash.size())
+        .Write(componentHash(4), CSHA256::OUTPUT_SIZE)
+        .Write(componentHash(5), CSHA256::OUTPUT_SIZE)
+        .Write(componentHash(6), CSHA256::OUTPUT_SIZE)
+        .Write(componentHash(7), CSHA256::OUTPUT_SIZE)
+        .Finalize(vchHash.data());
+    return vchHash;
+}
@@ -1,36 +1,19 @@
 #pragma once
 #include "constants.h"
 #include "json.hpp"
+#include <algorithm>
 #include <crypto/sha256.h>
 #include <crypto/sha512.h>
+#include <script/contract_state.h>
+#include <script/state_error.h>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <util/strencodings.h>
 #include <vector>
 
 using json = nlohmann::json;
 
-class UnexpectedStateKeyTypeError : public std::exception {};
-
-// Size limit errors
-class StateValidationStateSizeLimitError : public std::exception {};
-class StateValidationStateUpdateSizeLimitError : public std::exception {};
-class StateValidationStateDeleteSizeLimitError : public std::exception {};
-class StateValidationTokenFtBalanceSizeLimitError : public std::exception {};
-class StateValidationTokenFtBalanceUpdateSizeLimitError : public std::exception {};
-class StateValidationTokenNftBalanceSizeLimitError : public std::exception {};
-class StateValidationTokenNftBalanceUpdateSizeLimitError : public std::exception {};
-// Format errors
-class StateValidationStateFormatError : public std::exception {};
-class StateValidationStateUpdateFormatError : public std::exception {};
-class StateValidationStateDeleteFormatError : public std::exception {};
-class StateValidationTokenFtBalanceFormatError : public std::exception {};
-class StateValidationTokenFtBalanceZeroFormatError : public std::exception {};
-class StateValidationTokenFtBalanceUpdateFormatError : public std::exception {};
-class StateValidationTokenNftBalanceFormatError : public std::exception {};
-class StateValidationTokenNftBalanceUpdateFormatError : public std::exception {};
-
-class StateKeyspaceCleanupError : public std::exception {};
-
 template <typename T>
 void AppendVector(std::vector<T> &a, const std::vector<T> &b) {
     a.reserve(a.size() + b.size());
@@ -45,7 +28,7 @@ static inline void CopyBytesNoDestLen(const std::vector<std::uint8_t> &bytes, ui
 }
 
 static inline bool isHexStr(std::string const &s) {
-    return s.find_first_not_of("0123456789abcdef") == std::string::npos && s.length() % 2 == 0 && s.length() >= 2;
+    return s.length() % 2 == 0 && s.length() >= 2 && IsLowerHexDigits(s);
 }
 
 static inline std::string HexStrWith00Null(const std::vector<uint8_t> &value) {
@@ -57,81 +40,105 @@ static inline std::string HexStrWith00Null(const std::vector<uint8_t> &value) {
 
 class StateValidation {
 public:
-    static void performValidateStateRestrictions(const json &ftState, const json &ftStateUpdates,
-                                                 const json &ftStateIncoming, const json &nftState,
-                                                 const json &nftStateUpdates, const json &nftStateIncoming,
-                                                 const json &contractState, const json &contractStateUpdates,
-                                                 const json &contractStateDeletes) {
+    static StateError performValidateStateRestrictions(const json &ftState, const json &ftStateUpdates,
+                                                       const json &ftStateIncoming, const json &nftState,
+                                                       const json &nftStateUpdates, const json &nftStateIncoming,
+                                                       const json &contractState, const json &contractStateUpdates,
+                                                       const json &contractStateDeletes) {
         // validate each in turn...
-        uint32_t stateByteCount = StateValidation::performValidateStateRestrictionsState(contractState);
-        if (stateByteCount > MAX_STATE_FINAL_BYTES) {
-            throw new StateValidationStateSizeLimitError();
+        const StateResult<uint32_t> stateByteCount = performValidateStateRestrictionsState(contractState);
+        if (!stateByteCount) {
+            return stateByteCount.error();
         }
-        uint32_t stateUpdatesByteCount = StateValidation::performValidateStateRestrictionsState(contractStateUpdates);
-
-        if (stateUpdatesByteCount > MAX_STATE_UPDATE_BYTES) {
-            throw new StateValidationStateUpdateSizeLimitError();
+        if (*stateByteCount > MAX_STATE_FINAL_BYTES) {
+            return StateError::STATE_SIZE;
+        }
+        const StateResult<uint32_t> stateUpdatesByteCount = performValidateStateRestrictionsState(contractStateUpdates);
+        if (!stateUpdatesByteCount) {
+            return stateUpdatesByteCount.error();
+        }
+        if (*stateUpdatesByteCount > MAX_STATE_UPDATE_BYTES) {
+            return StateError::STATE_UPDATES_SIZE;
         }
-        uint32_t stateDeletesByteCount =
-            StateValidation::performValidateStateRestrictionsStateDeletes(contractStateDeletes);
-        if (stateDeletesByteCount > MAX_STATE_UPDATE_BYTES) {
-            throw new StateValidationStateDeleteSizeLimitError();
+        const StateResult<uint32_t> stateDeletesByteCount =
+            performValidateStateRestrictionsStateDeletes(contractStateDeletes);
+        if (!stateDeletesByteCount) {
+            return stateDeletesByteCount.error();
         }
-        uint32_t ftBalancesByteCount = StateValidation::performValidateStateRestrictionsTokenFtBalances(ftState);
-        if (ftBalancesByteCount > MAX_BALANCES_BYTES) {
-            throw new StateValidationTokenFtBalanceSizeLimitError();
+        if (*stateDeletesByteCount > MAX_STATE_UPDATE_BYTES) {
+            return StateError::STATE_DELETES_SIZE;
         }
-        uint32_t ftBalancesUpdatesByteCount =
-            StateValidation::performValidateStateRestrictionsTokenFtBalances(ftStateUpdates, true);
-        if (ftBalancesUpdatesByteCount > MAX_BALANCES_UPDATE_BYTES) {
-            throw new StateValidationTokenFtBalanceUpdateSizeLimitError();
+        const StateResult<uint32_t> ftBalancesByteCount = performValidateStateRestrictionsTokenFtBalances(ftState);
+        if (!ftBalancesByteCount) {
+            return ftBalancesByteCount.error();
+        }
+        if (*ftBalancesByteCount > MAX_BALANCES_BYTES) {
+            return StateError::FT_BALANCES_SIZE;
+        }
+        const StateResult<uint32_t> ftBalancesUpdatesByteCount =
+            performValidateStateRestrictionsTokenFtBalances(ftStateUpdates, true);
+        if (!ftBalancesUpdatesByteCount) {
+            return ftBalancesUpdatesByteCount.error();
+        }
+        if (*ftBalancesUpdatesByteCount > MAX_BALANCES_UPDATE_BYTES) {
+            return StateError::FT_BALANCES_UPDATES_SIZE;
         }
         // No bytes size validation on the incoming ft balances
-        StateValidation::performValidateStateRestrictionsTokenFtBalances(ftStateIncoming);
-
-        uint32_t nftBalancesByteCount = StateValidation::performValidateStateRestrictionsTokenNftBalances(nftState);
-        if (nftBalancesByteCount > MAX_BALANCES_BYTES) {
-            throw new StateValidationTokenNftBalanceSizeLimitError();
+        if (const auto incoming = performValidateStateRestrictionsTokenFtBalances(ftStateIncoming); !incoming) {
+            return incoming.error();
         }
 
-        uint32_t nftBalancesUpdatesByteCount =
-            StateValidation::performValidateStateRestrictionsTokenNftBalances(nftStateUpdates, true);
-        if (nftBalancesUpdatesByteCount > MAX_BALANCES_UPDATE_BYTES) {
-            throw new StateValidationTokenNftBalanceUpdateSizeLimitError();
+        const StateResult<uint32_t> nftBalancesByteCount = performValidateStateRestrictionsTokenNftBalances(nftState);
+        if (!nftBalancesByteCount) {
+            return nftBalancesByteCount.error();
+        }
+        if (*nftBalancesByteCount > MAX_BALANCES_BYTES) {
+            return StateError::NFT_BALANCES_SIZE;
+        }
+        const StateResult<uint32_t> nftBalancesUpdatesByteCount =
+            performValidateStateRestrictionsTokenNftBalances(nftStateUpdates, true);
+        if (!nftBalancesUpdatesByteCount) {
+            return nftBalancesUpdatesByteCount.error();
+        }
+        if (*nftBalancesUpdatesByteCount > MAX_BALANCES_UPDATE_BYTES) {
+            return StateError::NFT_BALANCES_UPDATES_SIZE;
         }
         // No bytes size validation validation on incoming nft balances
-        StateValidation::performValidateStateRestrictionsTokenNftBalances(nftStateIncoming);
+        if (const auto incoming = performValidateStateRestrictionsTokenNftBalances(nftStateIncoming); !incoming) {
+            return incoming.error();
+        }
+        return StateError::OK;
     }
 
-    static uint32_t performValidateStateRestrictionsState(const json &obj) {
+    static StateResult<uint32_t> performValidateStateRestrictionsState(const json &obj) {
         uint32_t byteCount = 0;
         for (auto &[key, value] : obj.items()) {
             // Ensure key is a valid hex string
             if (!isHexStr(key)) {
-                throw new StateValidationStateFormatError();
+                return StateError::STATE_FORMAT;
             }
             byteCount += key.length() / 2;
             // Ensure value is an object
             if (!value.is_object()) {
-                throw new StateValidationStateFormatError();
+                return StateError::STATE_FORMAT;
             }
             // Ensure object is not empty
             if (value.empty()) {
-                throw new StateValidationStateFormatError();
+                return StateError::STATE_FORMAT;
             }
             // Ensure second level keys are valid hex
             for (auto &[secondKey, secondValue] : value.items()) {
                 if (!isHexStr(secondKey)) {
-                    throw new StateValidationStateFormatError();
+                    return StateError::STATE_FORMAT;
                 }
                 byteCount += secondKey.length() / 2;
                 // Ensure second level values are valid hex strings
                 if (!secondValue.is_string()) {
-                    throw new StateValidationStateFormatError();
+                    return StateError::STATE_FORMAT;
                 }
-                std::string secondValueStr = secondValue.template get<std::string>();
+                const std::string &secondValueStr = secondValue.template get_ref<const std::string &>();
                 if (!isHexStr(secondValueStr)) {
-                    throw new StateValidationStateFormatError();
+                    return StateError::STATE_FORMAT;
                 }
                 byteCount += secondValueStr.length() / 2;
             }
@@ -139,82 +146,79 @@ public:
         return byteCount;
     }
 
-    static uint32_t performValidateStateRestrictionsStateDeletes(const json &obj) {
+    static StateResult<uint32_t> performValidateStateRestrictionsStateDeletes(const json &obj) {
         uint32_t byteCount = 0;
         for (auto &[key, value] : obj.items()) {
             // Ensure key is a valid hex string
             if (!isHexStr(key)) {
-                throw new StateValidationStateDeleteFormatError();
+                return StateError::STATE_DELETES_FORMAT;
             }
             byteCount += key.length() / 2;
             // Ensure value is an object
             if (!value.is_object()) {
-                throw new StateValidationStateDeleteFormatError();
+                return StateError::STATE_DELETES_FORMAT;
             }
             // Ensure object is not empty
             if (value.empty()) {
-                throw new StateValidationStateDeleteFormatError();
+                return StateError::STATE_DELETES_FORMAT;
             }
             // Ensure second level keys are valid hex
             for (auto &[secondKey, secondValue] : value.items()) {
                 if (!isHexStr(secondKey)) {
-                    throw new StateValidationStateDeleteFormatError();
+                    return StateError::STATE_DELETES_FORMAT;
                 }
                 byteCount += secondKey.length() / 2;
                 // Ensure second level values are boolean.
                 // Note: they do not count towards the byte count
                 // Must always be boolean true
-                if (!secondValue.is_boolean()) {
-                    throw new StateValidationStateDeleteFormatError();
-                }
-                bool secondValueBool = secondValue.template get<bool>();
-                if (!secondValueBool) {
-                    throw new StateValidationStateFormatError();
+                if (!secondValue.is_boolean() || !secondValue.template get<bool>()) {
+                    return StateError::STATE_DELETES_FORMAT;
                 }
             }
         }
         return byteCount;
     }
 
-    static uint32_t performValidateStateRestrictionsTokenFtBalances(const json &obj, bool isAllowZeroBalance = false) {
+    static StateResult<uint32_t> performValidateStateRestrictionsTokenFtBalances(const json &obj,
+                                                                                 bool isAllowZeroBalance = false) {
         uint32_t byteCount = 0;
         for (auto &[key, value] : obj.items()) {
             // Ensure key is a valid hex string
             if (!isHexStr(key)) {
-                throw new StateValidationTokenFtBalanceFormatError();
+                return StateError::FT_BALANCES_FORMAT;
             }
             byteCount += key.length() / 2;
             // Ensure value is a number
             if (!value.is_number_unsigned()) {
-                throw new StateValidationTokenFtBalanceFormatError();
+                return StateError::FT_BALANCES_FORMAT;
             }
             // Allow zero balance if set
             uint64_t valueInt = value.template get<uint64_t>();
             if (!isAllowZeroBalance && valueInt == 0) {
-                throw new StateValidationTokenFtBalanceZeroFormatError();
+                return StateError::FT_BALANCES_FORMAT;
             }
-            assert(sizeof(unsigned long) == 8);
             byteCount += 8;
         }
         return byteCount;
     }
 
-    static uint32_t performValidateStateRestrictionsTokenNftBalances(const json &obj, bool isAllowFalse = false) {
+    static StateResult<uint32_t> performValidateStateRestrictionsTokenNftBalances(const json &obj,
+                                                                                  bool isAllowFalse = false) {
         uint32_t byteCount = 0;
         for (auto &[key, value] : obj.items()) {
             // Ensure key is a valid hex string
             if (!isHexStr(key)) {
-                throw new StateValidationTokenNftBalanceFormatError();
+                return StateError::NFT_BALANCES_FORMAT;
             }
             byteCount += key.length() / 2;
             // Ensure value is a bool
             if (!value.is_boolean()) {
-                throw new StateValidationTokenNftBalanceFormatError();
+                return StateError::NFT_BALANCES_FORMAT;
             }
             // Allow false if set
             bool valueBool = value.template get<bool>();
             if (!isAllowFalse && !valueBool) {
-                throw new StateValidationTokenNftBalanceFormatError();
+                return StateError::NFT_BALANCES_FORMAT;
             }
             // Do not count bytes for the value
         }
@@ -222,188 +226,298 @@ public:
     }
 };
 
-// Given a json object, serialize all of the keys and values recursively as a std::vector<uint8_t>
-static uint32_t GetStateDataVectorOnlyStrings(const json &stateData, std::vector<uint8_t> &resultDataVec) {
-    for (auto &[key, value] : stateData.items()) {
-        std::vector<uint8_t> keyBytes = ParseHex(key);
-        AppendVector(resultDataVec, keyBytes);
-        if (value.is_string()) {
-            std::vector<uint8_t> valueBytes = ParseHex(value);
-            AppendVector(resultDataVec, valueBytes);
-        } else if (value.is_object()) {
-            GetStateDataVectorOnlyStrings(value, resultDataVec);
-        } else {
-            throw new UnexpectedStateKeyTypeError();
-        }
-    }
-    return resultDataVec.size();
-}
+// Streams the preimage of one state hash component, serializing the json as SHA256 asks for more bytes: the
+// preimage is never built in memory, so the components can be hashed side by side with SHA256Multi
+class StatePreimageReader final : public SHA256MultiSource {
+public:
+    enum class Layout {
+        // Keys and string values, recursively
+        State,
+        // Two levels of keys with boolean values
+        Deletes,
+        // Keys with boolean values
+        NftBalances,
+        // Keys with non-negative integer values
+        FtBalances,
+        // Keys, then the non-negative integer value as 4 bytes
+        NftWithdraws,
+        // Keys, then for each second level pair the key as an integer and the value, 8 bytes each
+        FtWithdraws,
+    };
 
-static void SerializeUint64_t(uint64_t val, std::vector<uint8_t> &resultData) {
-    uint8_t result[8];
-    std::memcpy(result, &val, sizeof val);
-    std::vector<uint8_t> serializedInt(&result[0], &result[0] + 8);
-    resultData = serializedInt;
-}
-static void SerializeUint32_t(uint32_t val, std::vector<uint8_t> &resultData) {
-    uint8_t result[4];
-    std::memcpy(result, &val, sizeof val);
-    std::vector<uint8_t> serializedInt(&result[0], &result[0] + 4);
-    resultData = serializedInt;
-}
-static uint32_t GetStateDataVectorStringKeyBooleanValue(const json &stateData, std::vector<uint8_t> &resultDataVec) {
-    for (auto &[key, value] : stateData.items()) {
-        std::vector<uint8_t> keyBytes = ParseHex(key);
-        AppendVector(resultDataVec, keyBytes);
-        if (!value.is_boolean()) {
-            throw new UnexpectedStateKeyTypeError();
-        }
-        // Do nothing with value because we only use the keys
+    StatePreimageReader(const json &data, Layout layout) : _layout(layout) {
+        _frames.emplace_back(data);
     }
-    return resultDataVec.size();
-}
 
-static uint32_t GetStateDataVectorStringKeyIntValue(const json &stateData, std::vector<uint8_t> &resultDataVec) {
-    for (auto &[key, value] : stateData.items()) {
-        std::vector<uint8_t> keyBytes = ParseHex(key);
-        AppendVector(resultDataVec, keyBytes);
-        if (!value.is_number_integer() || value < 0) {
-            throw new UnexpectedStateKeyTypeError();
+    // Set once a value of the wrong type was met, the data read up to there is not a valid preimage
+    StateError error() const { return _error; }
+
+    size_t Read(uint8_t *buf, size_t len) override {
+        size_t n = 0;
+        while (n < len) {
+            if (_pieceIndex == _pieceCount) {
+                if (!Next()) {
+                    break;
+                }
+                continue;
+            }
+            Piece &piece = _pieces[_pieceIndex];
+            if (!piece.hex) {
+                size_t count = std::min(len - n, piece.rawLen - piece.rawPos);
+                std::memcpy(buf + n, piece.raw + piece.rawPos, count);
+                n += count;
+                piece.rawPos += count;
+                if (piece.rawPos == piece.rawLen) {
+                    _pieceIndex++;
+                }
+                continue;
+            }
+            if (piece.hexEnd) {
+                // Only hex digits, decoded in bulk
+                size_t count = std::min<size_t>(len - n, (piece.hexEnd - piece.hex) / 2);
+                HexDecode(Span<const char>(piece.hex, 2 * count), buf + n);
+                n += count;
+                piece.hex += 2 * count;
+                if (piece.hex == piece.hexEnd) {
+                    _pieceIndex++;
+                }
+                continue;
+            }
+            // Decodes hex the way ParseHex does
+            const char *psz = piece.hex;
+            while (n < len) {
+                while (IsSpace(*psz)) {
+                    psz++;
+                }
+                signed char c = HexDigit(*psz++);
+                if (c == (signed char)-1) {
+                    _pieceIndex++;
+                    break;
+                }
+                uint8_t high = (c << 4);
+                c = HexDigit(*psz++);
+                if (c == (signed char)-1) {
+                    _pieceIndex++;
+                    break;
+                }
+                buf[n++] = high | c;
+            }
+            piece.hex = psz;
         }
-        // Do nothing with value because we only use the keys
+        return n;
     }
-    return resultDataVec.size();
-}
 
-// Get the hash of the state data serialized for keys and values
-static std::vector<uint8_t> GetStateDataHashState(const json &data) {
-    std::vector<uint8_t> vchPreimage;
-    GetStateDataVectorOnlyStrings(data, vchPreimage);
-    std::vector<uint8_t> vchHash(32);
-    CSHA256().Write(vchPreimage.data(), vchPreimage.size()).Finalize(vchHash.data());
-    return vchHash;
-}
+private:
+    using Iterator = decltype(std::declval<const json &>().items().begin());
 
-static std::vector<uint8_t> GetStateDataHashNftBalanceHash(const json &data) {
-    std::vector<uint8_t> vchPreimage;
-    GetStateDataVectorStringKeyBooleanValue(data, vchPreimage);
-    std::vector<uint8_t> vchHash(32);
-    CSHA256().Write(vchPreimage.data(), vchPreimage.size()).Finalize(vchHash.data());
-    return vchHash;
-}
+    // Iterates the items of one json value. The current item is only stepped past when the next one is needed, as
+    // the pieces queued for it may point into the iterator
+    struct Frame {
+        Iterator it;
+        Iterator end;
+        bool started = false;
+        explicit Frame(const json &value) : it(value.items().begin()), end(value.items().end()) {}
+    };
 
-static std::vector<uint8_t> GetStateDataHashFtBalanceHash(const json &data) {
-    std::vector<uint8_t> vchPreimage;
-    GetStateDataVectorStringKeyIntValue(data, vchPreimage);
-    std::vector<uint8_t> vchHash(32);
-    CSHA256().Write(vchPreimage.data(), vchPreimage.size()).Finalize(vchHash.data());
-    return vchHash;
-}
+    // Bytes waiting to be read: either a hex string to decode or up to 8 raw bytes. A hex string of hex digits
+    // only has the end of its last pair of digits in hexEnd, others are decoded the way ParseHex does
+    struct Piece {
+        const char *hex;
+        const char *hexEnd;
+        uint8_t raw[8];
+        size_t rawLen;
+        size_t rawPos;
+    };
 
-static std::vector<uint8_t> GetStateDataHashNftWithdraws(const json &data) {
-    std::vector<uint8_t> vchPreimage;
-    for (auto &[key, value] : data.items()) {
-        std::vector<uint8_t> keyBytes = ParseHex(key);
-        AppendVector(vchPreimage, keyBytes);
-        if (!value.is_number_integer() || value < 0) {
-            throw new UnexpectedStateKeyTypeError();
-        }
-        // Serialize the integer
-        std::vector<uint8_t> serializedIntValue;
-        SerializeUint32_t(value, serializedIntValue);
-        AppendVector(vchPreimage, serializedIntValue);
+    Layout _layout;
+    StateError _error = StateError::OK;
+    // A deque keeps the frames in place as children are pushed
+    std::deque<Frame> _frames;
+    Piece _pieces[2];
+    size_t _pieceIndex = 0;
+    size_t _pieceCount = 0;
+
+    void QueueHex(const std::string &hex) {
+        const char *hexEnd = IsHexDigits(hex) ? hex.c_str() + (hex.size() & ~size_t(1)) : nullptr;
+        _pieces[_pieceCount++] = Piece{hex.c_str(), hexEnd, {}, 0, 0};
+    }
+
+    void QueueUint64_t(uint64_t val) {
+        Piece &piece = _pieces[_pieceCount++];
+        piece = Piece{nullptr, nullptr, {}, sizeof val, 0};
+        std::memcpy(piece.raw, &val, sizeof val);
     }
-    std::vector<uint8_t> vchHash(32);
-    CSHA256().Write(vchPreimage.data(), vchPreimage.size()).Finalize(vchHash.data());
-    return vchHash;
-}
 
-static std::vector<uint8_t> GetStateDataHashFtWithdraws(const json &data) {
-    std::vector<uint8_t> vchPreimage;
-    for (auto &[key, value] : data.items()) {
-        std::vector<uint8_t> keyBytes = ParseHex(key);
-        AppendVector(vchPreimage, keyBytes);
-        for (auto &[secondKey, secondValue] : value.items()) {
-            uint64_t secondKeyInt = atoi(secondKey);
-            std::vector<uint8_t> serializedSecondKeyIntBytes;
-            SerializeUint64_t(secondKeyInt, serializedSecondKeyIntBytes);
-            AppendVector(vchPreimage, serializedSecondKeyIntBytes);
-            if (!secondValue.is_number_integer()) {
-                throw new UnexpectedStateKeyTypeError();
+    void QueueUint32_t(uint32_t val) {
+        Piece &piece = _pieces[_pieceCount++];
+        piece = Piece{nullptr, nullptr, {}, sizeof val, 0};
+        std::memcpy(piece.raw, &val, sizeof val);
+    }
+
+    // Queue the pieces of the next item, returns false at the end of the data
+    bool Next() {
+        _pieceIndex = 0;
+        _pieceCount = 0;
+        while (!_frames.empty()) {
+            Frame &frame = _frames.back();
+            if (frame.started) {
+                ++frame.it;
+            }
+            frame.started = true;
+            if (frame.it == frame.end) {
+                _frames.pop_back();
+                continue;
             }
-            // Serialize the integer value
-            std::vector<uint8_t> serializedSEcondValueInt;
-            SerializeUint64_t(secondValue, serializedSEcondValueInt);
-            AppendVector(vchPreimage, serializedSEcondValueInt);
+            if (!Visit(frame.it.key(), frame.it.value(), _frames.size() - 1)) {
+                // Nothing more is read past a value of the wrong type
+                _frames.clear();
+                _pieceCount = 0;
+                return false;
+            }
+            return true;
         }
+        return false;
     }
-    std::vector<uint8_t> vchHash(32);
-    CSHA256().Write(vchPreimage.data(), vchPreimage.size()).Finalize(vchHash.data());
-    return vchHash;
-}
 
-static uint32_t GetStateDataVectorOnly2LevelStringKeysBooleanValue(const json &stateData,
-                                                                   std::vector<uint8_t> &resultDataVec) {
-    for (auto &[key, value] : stateData.items()) {
-        if (!value.is_object()) {
-            throw new UnexpectedStateKeyTypeError();
+    // The error for a value of the wrong type in the layout being read
+    StateError LayoutError() const {
+        switch (_layout) {
+        case Layout::State:
+            return StateError::STATE_FORMAT;
+        case Layout::Deletes:
+            return StateError::STATE_DELETES_FORMAT;
+        case Layout::NftBalances:
+        case Layout::NftWithdraws:
+            return StateError::NFT_BALANCES_FORMAT;
+        case Layout::FtBalances:
+        case Layout::FtWithdraws:
+            return StateError::FT_BALANCES_FORMAT;
         }
-        std::vector<uint8_t> keyBytes = ParseHex(key);
-        AppendVector(resultDataVec, keyBytes);
-        for (auto &[secondKey, secondValue] : value.items()) {
-            std::vector<uint8_t> secondKeyBytes = ParseHex(secondKey);
-            AppendVector(resultDataVec, secondKeyBytes);
-            if (!secondValue.is_boolean()) {
-                throw new UnexpectedStateKeyTypeError();
+        return StateError::STATE_FORMAT;
+    }
+
+    // Queue the pieces of an item, returns false and records the error if a value has the wrong type
+    bool Visit(const std::string &key, const json &value, size_t depth) {
+        switch (_layout) {
+        case Layout::State:
+            QueueHex(key);
+            if (value.is_string()) {
+                QueueHex(value.template get_ref<const std::string &>());
+            } else if (value.is_object()) {
+                _frames.emplace_back(value);
+            } else {
+                _error = LayoutError();
+                return false;
+            }
+            break;
+        case Layout::Deletes:
+            if (depth == 0) {
+                if (!value.is_object()) {
+                    _error = LayoutError();
+                    return false;
+                }
+                QueueHex(key);
+                _frames.emplace_back(value);
+            } else {
+                QueueHex(key);
+                if (!value.is_boolean()) {
+                    _error = LayoutError();
+                    return false;
+                }
+                // Do nothing with value because we only use the keys
+            }
+            break;
+        case Layout::NftBalances:
+            QueueHex(key);
+            if (!value.is_boolean()) {
+                _error = LayoutError();
+                return false;
+            }
+            // Do nothing with value because we only use the keys
+            break;
+        case Layout::FtBalances:
+            QueueHex(key);
+            if (!value.is_number_integer() || value < 0) {
+                _error = LayoutError();
+                return false;
             }
             // Do nothing with value because we only use the keys
+            break;
+        case Layout::NftWithdraws:
+            QueueHex(key);
+            if (!value.is_number_integer() || value < 0) {
+                _error = LayoutError();
+                return false;
+            }
+            // Serialize the integer
+            QueueUint32_t(value);
+            break;
+        case Layout::FtWithdraws:
+            if (depth == 0) {
+                QueueHex(key);
+                _frames.emplace_back(value);
+            } else {
+                uint64_t keyInt = atoi(key);
+                QueueUint64_t(keyInt);
+                if (!value.is_number_integer()) {
+                    _error = LayoutError();
+                    return false;
+                }
+                // Serialize the integer value
+                QueueUint64_t(value);
+            }
+            break;
         }
+        return true;
     }
-    return resultDataVec.size();
-}
-
-// Get the hash of the state data deletes serialized for keys and values
-static std::vector<uint8_t> GetStateDataHashDeletes(const json &data) {
-    std::vector<uint8_t> vchPreimage;
-    GetStateDataVectorOnly2LevelStringKeysBooleanValue(data, vchPreimage);
-    std::vector<uint8_t> vchHash(32);
-    CSHA256().Write(vchPreimage.data(), vchPreimage.size()).Finalize(vchHash.data());
-    return vchHash;
-}
-
-static std::vector<uint8_t> CalculateStateHash(const std::vector<uint8_t> &prevHash, const json &stateFinal,
-                                               const json &stateUpdates, const json &stateDeletes,
-                                               const json &ftIncoming, const json &nftIncoming, const json &ftBalances,
-                                               const json &ftBalancesUpdates, const json &nftBalances,
-                                               const json &nftBalancesUpdates, const json &ftWithdraws,
-                                               const json &nftWithdraws) {
-    std::vector<uint8_t> concatData(prevHash);
-    std::vector<uint8_t> stateFinalHash = GetStateDataHashState(stateFinal);
-    std::vector<uint8_t> stateUpdatesHash = GetStateDataHashState(stateUpdates);
-    std::vector<uint8_t> stateDeletesHash = GetStateDataHashDeletes(stateDeletes);
-    std::vector<uint8_t> nftIncomingHash = GetStateDataHashNftBalanceHash(nftIncoming);
-    std::vector<uint8_t> ftIncomingHash = GetStateDataHashFtBalanceHash(ftIncoming);
-    std::vector<uint8_t> nftBalancesHash = GetStateDataHashNftBalanceHash(nftBalances);
-    std::vector<uint8_t> ftBalancesHash = GetStateDataHashFtBalanceHash(ftBalances);
-    std::vector<uint8_t> nftBalancesUpdatesHash = GetStateDataHashNftBalanceHash(nftBalancesUpdates);
-    std::vector<uint8_t> ftBalancesUpdatesHash = GetStateDataHashFtBalanceHash(ftBalancesUpdates);
-    std::vector<uint8_t> nftWithdrawHash = GetStateDataHashNftWithdraws(nftWithdraws);
-    std::vector<uint8_t> ftWithdrawHash = GetStateDataHashFtWithdraws(ftWithdraws);
+};
 
-    AppendVector(concatData, nftIncomingHash);
-    AppendVector(concatData, ftIncomingHash);
-    AppendVector(concatData, stateFinalHash);
-    AppendVector(concatData, stateUpdatesHash);
-    AppendVector(concatData, stateDeletesHash);
-    AppendVector(concatData, nftBalancesHash);
-    AppendVector(concatData, ftBalancesHash);
-    AppendVector(concatData, nftBalancesUpdatesHash);
-    AppendVector(concatData, ftBalancesUpdatesHash);
-    AppendVector(concatData, nftWithdrawHash);
-    AppendVector(concatData, ftWithdrawHash);
+static inline StateResult<std::vector<uint8_t>>
+CalculateStateHash(const std::vector<uint8_t> &prevHash, const json &stateFinal, const json &stateUpdates,
+                   const json &stateDeletes, const json &ftIncoming, const json &nftIncoming, const json &ftBalances,
+                   const json &ftBalancesUpdates, const json &nftBalances, const json &nftBalancesUpdates,
+                   const json &ftWithdraws, const json &nftWithdraws) {
+    using Layout = StatePreimageReader::Layout;
+    // The components are hashed together, in the order their hashes are committed to
+    StatePreimageReader readers[] = {
+        {nftIncoming, Layout::NftBalances},
+        {ftIncoming, Layout::FtBalances},
+        {stateFinal, Layout::State},
+        {stateUpdates, Layout::State},
+        {stateDeletes, Layout::Deletes},
+        {nftBalances, Layout::NftBalances},
+        {ftBalances, Layout::FtBalances},
+        {nftBalancesUpdates, Layout::NftBalances},
+        {ftBalancesUpdates, Layout::FtBalances},
+        {nftWithdraws, Layout::NftWithdraws},
+        {ftWithdraws, Layout::FtWithdraws},
+    };
+    constexpr size_t count = sizeof(readers) / sizeof(readers[0]);
+    SHA256MultiSource *sources[count];
+    for (size_t i = 0; i < count; i++) {
+        sources[i] = &readers[i];
+    }
+    uint8_t componentHashes[count * CSHA256::OUTPUT_SIZE];
+    SHA256Multi(sources, componentHashes, count);
+    for (const StatePreimageReader &reader : readers) {
+        if (reader.error() != StateError::OK) {
+            return reader.error();
+        }
+    }
 
     // Store the updated state hash
     std::vector<uint8_t> vchHash(32);
-    CSHA256().Write(concatData.data(), concatData.size()).Finalize(vchHash.data());
+    CSHA256()
+        .Write(prevHash.data(), prevHash.size())
+        .Write(componentHashes, sizeof(componentHashes))
+        .Finalize(vchHash.data());
     return vchHash;
 }
+
+// Same commitment as CalculateStateHash, with the final state and balances committed to by their running multiset
+// digests in place of hashes over every entry: the cost no longer depends on the size of the state
+StateResult<std::vector<uint8_t>>
+CalculateStateHashV2(const std::vector<uint8_t> &prevHash, const ContractStateDigests &digests,
+                     const json &stateUpdates, const json &stateDeletes, const json &ftIncoming,
+                     const json &nftIncoming, const json &ftBalancesUpdates, const json &nftBalancesUpdates,
+                     const json &ftWithdraws, const json &nftWithdraws);
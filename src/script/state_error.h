@@ -0,0 +1,61 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#pragma once
+
+#include <cassert>
+#include <optional>
+#include <utility>
+
+/** Why the state of a call, or the external state it reads, was rejected. */
+enum class StateError {
+    OK = 0,
+
+    // The contract state, balances or change sets are not in the expected form
+    STATE_FORMAT,
+    STATE_DELETES_FORMAT,
+    FT_BALANCES_FORMAT,
+    NFT_BALANCES_FORMAT,
+
+    // Size limits
+    STATE_SIZE,
+    STATE_UPDATES_SIZE,
+    STATE_DELETES_SIZE,
+    FT_BALANCES_SIZE,
+    FT_BALANCES_UPDATES_SIZE,
+    NFT_BALANCES_SIZE,
+    NFT_BALANCES_UPDATES_SIZE,
+
+    // External state
+    HEIGHT_NOT_FOUND,
+    HEIGHT_INVALID,
+    HEADER_DECODE,
+    HEADERS_INVALID,
+
+    // There is no header for the call at the block info height
+    BLOCK_INFO_HEIGHT,
+};
+
+/**
+ * A value, or the StateError that prevented computing it. Checked inline by
+ * the caller, so that failures on the state paths do not unwind.
+ */
+template <typename T>
+class StateResult {
+public:
+    StateResult(T value) : _value(std::move(value)) {}
+    StateResult(StateError error) : _error(error) { assert(error != StateError::OK); }
+
+    explicit operator bool() const { return _error == StateError::OK; }
+    StateError error() const { return _error; }
+
+    const T &operator*() const { return *_value; }
+    T &operator*() { return *_value; }
+    const T *operator->() const { return &*_value; }
+    T *operator->() { return &*_value; }
+
+private:
+    std::optional<T> _value;
+    StateError _error = StateError::OK;
+};
@@ -102,6 +102,43 @@ SECP256K1_API int secp256k1_multiset_finalize(
 ) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3);
 
 
+/** Serializes a multiset to its canonical encoding, so that it can be
+ *  stored and later updated with more elements.
+ *
+ *  The encoding is the group element as a 33 byte compressed public key,
+ *  or 33 zero bytes for the multiset of no data elements. Unlike the
+ *  opaque secp256k1_multiset, it is the same for every representation of
+ *  the same multiset.
+ *
+ *  Returns: 1: success
+ *           0: invalid parameter
+ *  Args:    ctx:      pointer to a context object (cannot be NULL)
+ *  Out:     output33: pointer to a 33 byte buffer
+ *  In:      multiset: the multiset to serialize
+ */
+SECP256K1_API int secp256k1_multiset_serialize(
+  const secp256k1_context* ctx,
+  unsigned char *output33,
+  const secp256k1_multiset *multiset
+) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3);
+
+
+/** Parses a multiset serialized by secp256k1_multiset_serialize
+ *
+ *  Returns: 1: success
+ *           0: the input is not the encoding of a multiset: neither 33
+ *              zero bytes nor a valid compressed point
+ *  Args:    ctx:      pointer to a context object (cannot be NULL)
+ *  Out:     multiset: the parsed multiset, unchanged on failure
+ *  In:      input33:  pointer to a 33 byte serialized multiset
+ */
+SECP256K1_API SECP256K1_WARN_UNUSED_RESULT int secp256k1_multiset_parse(
+  const secp256k1_context* ctx,
+  secp256k1_multiset *multiset,
+  const unsigned char *input33
+) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3);
+
+
 
 # ifdef __cplusplus
 }
@@ -194,6 +194,53 @@ int secp256k1_multiset_finalize(const secp256k1_context* ctx, unsigned char *res
     return 1;
 }
 
+/** Serialize the multiset as a compressed point, zeros for the empty set */
+int secp256k1_multiset_serialize(const secp256k1_context* ctx, unsigned char *output33, const secp256k1_multiset *multiset) {
+    secp256k1_gej gej;
+    secp256k1_ge ge;
+    size_t size;
+
+    VERIFY_CHECK(ctx != NULL);
+    ARG_CHECK(output33 != NULL);
+    ARG_CHECK(multiset != NULL);
+
+    gej_from_multiset_var(&gej, multiset);
+
+    if (gej.infinity) {
+        memset(output33, 0x00, 33);
+        return 1;
+    }
+
+    secp256k1_ge_set_gej(&ge, &gej);
+    return secp256k1_eckey_pubkey_serialize(&ge, output33, &size, 1);
+}
+
+/** Parse a multiset serialized by secp256k1_multiset_serialize */
+int secp256k1_multiset_parse(const secp256k1_context* ctx, secp256k1_multiset *multiset, const unsigned char *input33) {
+    static const unsigned char zeros[33] = { 0 };
+    secp256k1_ge ge;
+    secp256k1_gej gej;
+
+    VERIFY_CHECK(ctx != NULL);
+    ARG_CHECK(multiset != NULL);
+    ARG_CHECK(input33 != NULL);
+
+    if (memcmp(input33, zeros, sizeof(zeros)) == 0) {
+        return secp256k1_multiset_init(ctx, multiset);
+    }
+    if (!secp256k1_eckey_pubkey_parse(&ge, input33, 33)) {
+        return 0;
+    }
+
+    secp256k1_gej_set_ge(&gej, &ge);
+    secp256k1_fe_normalize(&gej.x);
+    secp256k1_fe_normalize(&gej.y);
+    secp256k1_fe_normalize(&gej.z);
+    multiset_from_gej_var(multiset, &gej);
+
+    return 1;
+}
+
 /** Inits the multiset with the constant for empty data,
  *  represented by the Jacobian GE infinite
  */
@@ -273,6 +273,50 @@ void test_empty(void) {
     CHECK_EQUAL(&empty, &r1); /* M()+M()==M() */
 }
 
+void test_serialize(void) {
+
+    /* Test that the encoding is canonical and parses back */
+
+    secp256k1_multiset empty, r1, r2, parsed;
+    unsigned char s1[33], s2[33], zeros[33] = { 0 }, bad[33];
+    int n;
+
+    secp256k1_multiset_init(ctx, &empty);
+    CHECK(secp256k1_multiset_serialize(ctx, s1, &empty));
+    CHECK(memcmp(s1, zeros, 33) == 0);
+    CHECK(secp256k1_multiset_parse(ctx, &parsed, s1));
+    CHECK_EQUAL(&empty, &parsed);
+
+    /* M(0,1,2) built in two orders has two representations, one encoding */
+    secp256k1_multiset_init(ctx, &r1);
+    secp256k1_multiset_init(ctx, &r2);
+    for (n = 0; n < 3; n++) {
+        secp256k1_multiset_add(ctx, &r1, elements[n], DATALEN);
+        secp256k1_multiset_add(ctx, &r2, elements[2 - n], DATALEN);
+    }
+    CHECK(secp256k1_multiset_serialize(ctx, s1, &r1));
+    CHECK(secp256k1_multiset_serialize(ctx, s2, &r2));
+    CHECK(memcmp(s1, s2, 33) == 0);
+
+    /* Parsed multisets keep accumulating like the original */
+    CHECK(secp256k1_multiset_parse(ctx, &parsed, s1));
+    CHECK_EQUAL(&r1, &parsed);
+    secp256k1_multiset_add(ctx, &r1, elements[3], DATALEN);
+    secp256k1_multiset_add(ctx, &parsed, elements[3], DATALEN);
+    CHECK_EQUAL(&r1, &parsed);
+
+    /* Invalid tags and x coordinates off the curve are rejected */
+    memcpy(bad, s1, 33);
+    bad[0] = 0x04;
+    CHECK(secp256k1_multiset_parse(ctx, &parsed, bad) == 0);
+    memset(bad, 0xff, 33);
+    bad[0] = 0x02;
+    CHECK(secp256k1_multiset_parse(ctx, &parsed, bad) == 0);
+    memset(bad, 0x00, 33);
+    bad[32] = 0x01;
+    CHECK(secp256k1_multiset_parse(ctx, &parsed, bad) == 0);
+}
+
 void test_testvector(void) {
     /* Tests known values from the specification */
 
@@ -341,6 +385,7 @@ void run_multiset_tests(void) {
     test_remove();
     test_empty();
     test_duplicate();
+    test_serialize();
     test_testvector();
 }
 
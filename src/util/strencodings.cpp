@@ -7,6 +7,7 @@
 #include <util/strencodings.h>
 #include <util/string.h>
 
+#include <compat/cpuid.h>
 #include <tinyformat.h>
 
 #include <algorithm>
@@ -74,12 +75,7 @@ signed char HexDigit(char c) noexcept {
 }
 
 bool IsHex(const std::string &str) noexcept {
-    for (std::string::const_iterator it(str.begin()); it != str.end(); ++it) {
-        if (HexDigit(*it) < 0) {
-            return false;
-        }
-    }
-    return (str.size() > 0) && (str.size() % 2 == 0);
+    return (str.size() > 0) && (str.size() % 2 == 0) && IsHexDigits(str);
 }
 
 bool IsHexNumber(const std::string &str) {
@@ -97,6 +93,15 @@ bool IsHexNumber(const std::string &str) {
 }
 
 std::vector<uint8_t> ParseHex(const char *psz) {
+    // Strings of hex digits only, the usual case, are decoded in one go. An
+    // odd final digit is dropped, as the loop below does.
+    const Span<const char> str(psz, strlen(psz));
+    if (IsHexDigits(str)) {
+        std::vector<uint8_t> vch(str.size() / 2);
+        HexDecode(str.first(vch.size() * 2), vch.data());
+        return vch;
+    }
+
     // convert hex dump to vector
     std::vector<uint8_t> vch;
     while (true) {
@@ -122,6 +127,204 @@ std::vector<uint8_t> ParseHex(const std::string &str) {
     return ParseHex(str.c_str());
 }
 
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#if defined(ENABLE_SSSE3)
+namespace hex_ssse3 {
+size_t Encode(const uint8_t *in, size_t n, char *out);
+size_t Decode(const char *in, size_t n, uint8_t *out);
+size_t ValidateDigits(const char *in, size_t n);
+size_t ValidateLowerDigits(const char *in, size_t n);
+} // namespace hex_ssse3
+#endif
+#if defined(ENABLE_AVX2)
+namespace hex_avx2 {
+size_t Encode(const uint8_t *in, size_t n, char *out);
+size_t Decode(const char *in, size_t n, uint8_t *out);
+size_t ValidateDigits(const char *in, size_t n);
+size_t ValidateLowerDigits(const char *in, size_t n);
+} // namespace hex_avx2
+#endif
+#endif
+
+namespace {
+
+// The vector kernels handle whole registers from the start of their input
+// and return how far they got: bytes for Encode and Decode, characters for
+// the validation. Decode and the validation stop at the first register
+// holding a character that is not a hex digit. What is left is done here a
+// byte at a time.
+using EncodeFn = size_t (*)(const uint8_t *in, size_t n, char *out);
+using DecodeFn = size_t (*)(const char *in, size_t n, uint8_t *out);
+using ValidateFn = size_t (*)(const char *in, size_t n);
+
+size_t EncodeNone(const uint8_t *, size_t, char *) {
+    return 0;
+}
+size_t DecodeNone(const char *, size_t, uint8_t *) {
+    return 0;
+}
+size_t ValidateNone(const char *, size_t) {
+    return 0;
+}
+
+EncodeFn EncodeBlocks = EncodeNone;
+DecodeFn DecodeBlocks = DecodeNone;
+ValidateFn ValidateDigitBlocks = ValidateNone;
+ValidateFn ValidateLowerDigitBlocks = ValidateNone;
+
+bool IsLowerHexDigit(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+}
+
+/** Check the selected kernels against the byte at a time code. */
+bool SelfTest() {
+    uint8_t bytes[100], decoded[100];
+    char hex[200], encoded[200];
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = uint8_t(i * 151 + 17);
+        hex[2 * i] = strencodings::hexmap[bytes[i] * 2];
+        hex[2 * i + 1] = strencodings::hexmap[bytes[i] * 2 + 1];
+    }
+    for (size_t n = 0; n <= sizeof(bytes); n++) {
+        HexEncode(Span<const uint8_t>(bytes, n), encoded);
+        if (memcmp(encoded, hex, 2 * n) || !IsLowerHexDigits({hex, 2 * n}) ||
+            !HexDecode({hex, 2 * n}, decoded) || memcmp(decoded, bytes, n)) {
+            return false;
+        }
+    }
+
+    // Upper-case digits are only lower-case ones for IsLowerHexDigits, and
+    // a character that is not a digit fails anywhere in the string.
+    for (size_t i = 0; i < sizeof(hex); i++) {
+        const char c = hex[i];
+        if (c >= 'a') {
+            hex[i] = c - 'a' + 'A';
+            if (!IsHexDigits(hex) || IsLowerHexDigits(hex) ||
+                !HexDecode(hex, decoded) || memcmp(decoded, bytes, 100)) {
+                return false;
+            }
+        }
+        for (const char bad : {'g', 'G', '/', ':', '\0', char(0xb0)}) {
+            hex[i] = bad;
+            if (IsHexDigits(hex) || IsLowerHexDigits(hex) ||
+                HexDecode(hex, decoded)) {
+                return false;
+            }
+        }
+        hex[i] = c;
+    }
+    return true;
+}
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+/** Check whether the OS has enabled AVX registers. */
+bool AVXEnabled() {
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+} // namespace
+
+void HexEncode(Span<const uint8_t> input, char *out) {
+    for (size_t i = EncodeBlocks(input.data(), input.size(), out);
+         i < input.size(); i++) {
+        const char *hex = &strencodings::hexmap[input[i] * 2];
+        out[2 * i] = hex[0];
+        out[2 * i + 1] = hex[1];
+    }
+}
+
+bool HexDecode(Span<const char> str, uint8_t *out) {
+    if (str.size() % 2) {
+        return false;
+    }
+    const size_t n = str.size() / 2;
+    for (size_t i = DecodeBlocks(str.data(), n, out); i < n; i++) {
+        const signed char high = HexDigit(str[2 * i]);
+        const signed char low = HexDigit(str[2 * i + 1]);
+        if (high < 0 || low < 0) {
+            return false;
+        }
+        out[i] = (high << 4) | low;
+    }
+    return true;
+}
+
+bool IsHexDigits(Span<const char> str) {
+    for (size_t i = ValidateDigitBlocks(str.data(), str.size()); i < str.size();
+         i++) {
+        if (HexDigit(str[i]) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IsLowerHexDigits(Span<const char> str) {
+    for (size_t i = ValidateLowerDigitBlocks(str.data(), str.size());
+         i < str.size(); i++) {
+        if (!IsLowerHexDigit(str[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string HexAutoDetect() {
+    std::string ret = "standard";
+#if defined(HAVE_GETCPUID)
+    bool have_ssse3 = false;
+    bool have_xsave = false;
+    bool have_avx = false;
+    bool have_avx2 = false;
+    bool enabled_avx = false;
+
+    (void)have_ssse3;
+    (void)have_avx;
+    (void)have_avx2;
+    (void)enabled_avx;
+
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(0, 0, eax, ebx, ecx, edx);
+    const uint32_t max_leaf = eax;
+    GetCPUID(1, 0, eax, ebx, ecx, edx);
+    have_ssse3 = (ecx >> 9) & 1;
+    have_xsave = (ecx >> 27) & 1;
+    have_avx = (ecx >> 28) & 1;
+    if (have_xsave && have_avx) {
+        enabled_avx = AVXEnabled();
+    }
+    if (max_leaf >= 7) {
+        GetCPUID(7, 0, eax, ebx, ecx, edx);
+        have_avx2 = (ebx >> 5) & 1;
+    }
+
+#if defined(ENABLE_SSSE3)
+    if (have_ssse3) {
+        EncodeBlocks = hex_ssse3::Encode;
+        DecodeBlocks = hex_ssse3::Decode;
+        ValidateDigitBlocks = hex_ssse3::ValidateDigits;
+        ValidateLowerDigitBlocks = hex_ssse3::ValidateLowerDigits;
+        ret = "ssse3";
+    }
+#endif
+
+#if defined(ENABLE_AVX2)
+    if (have_avx2 && have_avx && enabled_avx) {
+        EncodeBlocks = hex_avx2::Encode;
+        DecodeBlocks = hex_avx2::Decode;
+        ValidateDigitBlocks = hex_avx2::ValidateDigits;
+        ValidateLowerDigitBlocks = hex_avx2::ValidateLowerDigits;
+        ret = "avx2";
+    }
+#endif
+#endif
+
+    assert(SelfTest());
+    return ret;
+}
+
 void SplitHostPort(std::string in, int &portOut, std::string &hostOut) {
     size_t colon = in.find_last_of(':');
     // if a : is found, and it either follows a [...], or no other : is in the
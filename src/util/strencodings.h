@@ -51,6 +51,29 @@ bool IsHex(const std::string &str) noexcept;
  * Return true if the string is a hex number, optionally prefixed with "0x"
  */
 bool IsHexNumber(const std::string &str);
+
+/**
+ * Allocation-free hex routines over spans, writing into caller buffers. They
+ * run on SSSE3 or AVX2 once HexAutoDetect() has selected them, and a byte at
+ * a time otherwise.
+ */
+/** Write the 2 * input.size() lower-case hex digits of input to out. */
+void HexEncode(Span<const uint8_t> input, char *out);
+/**
+ * Decode the hex digits of str, of either case, into the str.size() / 2
+ * bytes at out. Returns false if str has an odd length or a character that
+ * is not a hex digit, in which case out holds an unspecified prefix.
+ */
+bool HexDecode(Span<const char> str, uint8_t *out);
+/** Returns true if each character in str is a hex digit, of either case. */
+bool IsHexDigits(Span<const char> str);
+/** Returns true if each character in str is a lower-case hex digit. */
+bool IsLowerHexDigits(Span<const char> str);
+/**
+ * Autodetect the best available implementation of the hex routines.
+ * Returns the name of the implementation.
+ */
+std::string HexAutoDetect();
 std::vector<uint8_t> DecodeBase64(const char *p, bool *pfInvalid = nullptr);
 std::string DecodeBase64(const std::string &str);
 std::string EncodeBase64(Span<const uint8_t> input);
@@ -201,7 +224,12 @@ std::string HexStr(const T itbegin, const T itend, bool fSpaces = false) {
  * Convert a span of bytes to a lower-case hexadecimal string.
  */
 inline std::string HexStr(const Span<const uint8_t> input, bool fSpaces = false) {
-    return HexStr(input.begin(), input.end(), fSpaces);
+    if (fSpaces) {
+        return HexStr(input.begin(), input.end(), fSpaces);
+    }
+    std::string rv(input.size() * 2, '\0');
+    HexEncode(input, rv.data());
+    return rv;
 }
 
 inline std::string HexStr(const Span<const char> input, bool fSpaces = false) {
@@ -0,0 +1,106 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+
+namespace hex_avx2 {
+namespace {
+
+    __m256i inline K(char x) { return _mm256_set1_epi8(x); }
+
+    /** Whether each of 32 characters is in [lo, hi], as a byte mask. */
+    __m256i inline InRange(__m256i c, char lo, char hi) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(c, K(lo - 1)),
+                                _mm256_cmpgt_epi8(K(hi + 1), c));
+    }
+
+    /** As in strencodings_ssse3.cpp, for 32 characters. */
+    __m256i inline Digits(__m256i c, bool upper, __m256i &valid) {
+        const __m256i lc = upper ? _mm256_or_si256(c, K(0x20)) : c;
+        const __m256i decimal = InRange(c, '0', '9');
+        valid = _mm256_or_si256(decimal, InRange(lc, 'a', 'f'));
+        return _mm256_or_si256(
+            _mm256_and_si256(decimal, _mm256_sub_epi8(c, K('0'))),
+            _mm256_andnot_si256(decimal, _mm256_sub_epi8(lc, K('a' - 10))));
+    }
+
+    size_t Validate(const char *in, size_t n, bool upper) {
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i valid;
+            Digits(_mm256_loadu_si256((const __m256i *)(in + i)), upper, valid);
+            if (_mm256_movemask_epi8(valid) != -1) {
+                break;
+            }
+        }
+        return i;
+    }
+
+} // namespace
+
+size_t Encode(const uint8_t *in, size_t n, char *out) {
+    const __m256i lut = _mm256_setr_epi8(
+        '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd',
+        'e', 'f', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b',
+        'c', 'd', 'e', 'f');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        const __m256i hi = _mm256_shuffle_epi8(
+            lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), K(0x0f)));
+        const __m256i lo =
+            _mm256_shuffle_epi8(lut, _mm256_and_si256(v, K(0x0f)));
+        // The unpacks interleave within each 128-bit lane: bytes 0-7 and
+        // 16-23, then 8-15 and 24-31.
+        const __m256i first = _mm256_unpacklo_epi8(hi, lo);
+        const __m256i second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(out + 2 * i),
+                            _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 2 * i + 32),
+                            _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    return i;
+}
+
+size_t Decode(const char *in, size_t n, uint8_t *out) {
+    // Each pair of digit values is combined as high * 16 + low.
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i valid0, valid1;
+        const __m256i v0 = Digits(
+            _mm256_loadu_si256((const __m256i *)(in + 2 * i)), true, valid0);
+        const __m256i v1 = Digits(
+            _mm256_loadu_si256((const __m256i *)(in + 2 * i + 32)), true,
+            valid1);
+        if (_mm256_movemask_epi8(_mm256_and_si256(valid0, valid1)) != -1) {
+            break;
+        }
+        // The pack works within each 128-bit lane, leaving the 8-byte groups
+        // in the order 0, 2, 1, 3.
+        const __m256i packed =
+            _mm256_packus_epi16(_mm256_maddubs_epi16(v0, weights),
+                                _mm256_maddubs_epi16(v1, weights));
+        _mm256_storeu_si256(
+            (__m256i *)(out + i),
+            _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    return i;
+}
+
+size_t ValidateDigits(const char *in, size_t n) {
+    return Validate(in, n, true);
+}
+
+size_t ValidateLowerDigits(const char *in, size_t n) {
+    return Validate(in, n, false);
+}
+
+} // namespace hex_avx2
+
+#endif
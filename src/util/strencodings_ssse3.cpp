@@ -0,0 +1,96 @@
+// Copyright (c) 2024 The Atomicals Developers and Supporters
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_SSSE3
+
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+
+namespace hex_ssse3 {
+namespace {
+
+    __m128i inline K(char x) { return _mm_set1_epi8(x); }
+
+    /** Whether each of 16 characters is in [lo, hi], as a byte mask. */
+    __m128i inline InRange(__m128i c, char lo, char hi) {
+        return _mm_and_si128(_mm_cmpgt_epi8(c, K(lo - 1)),
+                             _mm_cmplt_epi8(c, K(hi + 1)));
+    }
+
+    /**
+     * The values of 16 hex digits, with a byte mask of the characters that
+     * are digits. Upper-case digits are only accepted if upper is set.
+     * Characters of 0x80 and above compare as negative and are rejected.
+     */
+    __m128i inline Digits(__m128i c, bool upper, __m128i &valid) {
+        const __m128i lc = upper ? _mm_or_si128(c, K(0x20)) : c;
+        const __m128i decimal = InRange(c, '0', '9');
+        valid = _mm_or_si128(decimal, InRange(lc, 'a', 'f'));
+        return _mm_or_si128(
+            _mm_and_si128(decimal, _mm_sub_epi8(c, K('0'))),
+            _mm_andnot_si128(decimal, _mm_sub_epi8(lc, K('a' - 10))));
+    }
+
+    size_t Validate(const char *in, size_t n, bool upper) {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i valid;
+            Digits(_mm_loadu_si128((const __m128i *)(in + i)), upper, valid);
+            if (_mm_movemask_epi8(valid) != 0xFFFF) {
+                break;
+            }
+        }
+        return i;
+    }
+
+} // namespace
+
+size_t Encode(const uint8_t *in, size_t n, char *out) {
+    const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                      '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        const __m128i hi = _mm_shuffle_epi8(
+            lut, _mm_and_si128(_mm_srli_epi16(v, 4), K(0x0f)));
+        const __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, K(0x0f)));
+        _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(out + 2 * i + 16),
+                         _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+size_t Decode(const char *in, size_t n, uint8_t *out) {
+    // Each pair of digit values is combined as high * 16 + low.
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i valid0, valid1;
+        const __m128i v0 = Digits(
+            _mm_loadu_si128((const __m128i *)(in + 2 * i)), true, valid0);
+        const __m128i v1 = Digits(
+            _mm_loadu_si128((const __m128i *)(in + 2 * i + 16)), true, valid1);
+        if (_mm_movemask_epi8(_mm_and_si128(valid0, valid1)) != 0xFFFF) {
+            break;
+        }
+        _mm_storeu_si128((__m128i *)(out + i),
+                         _mm_packus_epi16(_mm_maddubs_epi16(v0, weights),
+                                          _mm_maddubs_epi16(v1, weights)));
+    }
+    return i;
+}
+
+size_t ValidateDigits(const char *in, size_t n) {
+    return Validate(in, n, true);
+}
+
+size_t ValidateLowerDigits(const char *in, size_t n) {
+    return Validate(in, n, false);
+}
+
+} // namespace hex_ssse3
+
+#endif